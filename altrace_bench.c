@@ -0,0 +1,195 @@
+/**
+ * alTrace; a debugging tool for OpenAL.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by Ryan C. Gordon.
+ */
+
+// Times the HASH_MAP from altrace_common.h against the fixed 256-bucket
+//  chained map it replaced, with the kinds of keys the tools actually use:
+//  AL names counting up from 1, AL names scattered over 32 bits, and heap
+//  pointers (stack frames, devices, contexts). Run it with the largest map
+//  size to try; it works up to that by powers of ten.
+
+#include "altrace_common.h"
+
+const char *GAppName = "altrace_bench";
+
+void out_of_memory(void)
+{
+    fputs(GAppName, stderr);
+    fputs(": Out of memory!\n", stderr);
+    _exit(42);
+}
+
+static uint64 bench_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64) ts.tv_sec) * 1000000000ull) + ((uint64) ts.tv_nsec);
+}
+
+// this is what HASH_MAP was before it could grow, for comparison.
+#define OLD_HASH_MAP(maptype, fromctype, toctype) \
+    typedef struct OldHashMap_##maptype { \
+        fromctype from; \
+        toctype to; \
+        struct OldHashMap_##maptype *next; \
+    } OldHashMap_##maptype; \
+    static OldHashMap_##maptype *oldhashmap_##maptype[256]; \
+    static OldHashMap_##maptype *old_get_hashitem_##maptype(fromctype from, uint8 *_hash) { \
+        const uint8 hash = old_hash_##maptype(from); \
+        OldHashMap_##maptype *prev = NULL; \
+        OldHashMap_##maptype *item = oldhashmap_##maptype[hash]; \
+        if (_hash) { *_hash = hash; } \
+        while (item) { \
+            if (item->from == from) { \
+                if (prev) { \
+                    prev->next = item->next; \
+                    item->next = oldhashmap_##maptype[hash]; \
+                    oldhashmap_##maptype[hash] = item; \
+                } \
+                return item; \
+            } \
+            prev = item; \
+            item = item->next; \
+        } \
+        return NULL; \
+    } \
+    static void old_add_##maptype##_to_map(fromctype from, toctype to) { \
+        uint8 hash; OldHashMap_##maptype *item = old_get_hashitem_##maptype(from, &hash); \
+        if (item) { \
+            item->to = to; \
+        } else { \
+            item = (OldHashMap_##maptype *) calloc(1, sizeof (OldHashMap_##maptype)); \
+            if (!item) { \
+                out_of_memory(); \
+            } \
+            item->from = from; \
+            item->to = to; \
+            item->next = oldhashmap_##maptype[hash]; \
+            oldhashmap_##maptype[hash] = item; \
+        } \
+    } \
+    static toctype old_get_mapped_##maptype(fromctype from) { \
+        OldHashMap_##maptype *item = old_get_hashitem_##maptype(from, NULL); \
+        return item ? item->to : (toctype) 0; \
+    } \
+    static void old_remove_##maptype##_from_map(fromctype from) { \
+        const uint8 hash = old_hash_##maptype(from); \
+        OldHashMap_##maptype **prev = &oldhashmap_##maptype[hash]; \
+        OldHashMap_##maptype *item; \
+        for (item = *prev; item; prev = &item->next, item = item->next) { \
+            if (item->from == from) { \
+                *prev = item->next; \
+                free(item); \
+                return; \
+            } \
+        } \
+    }
+
+static void free_hash_item_name(uint32 from, uint32 to) { /* no-op */ }
+static uint32 hash_name(const uint32 name) { return hash_uint64((uint64) name); }
+static uint8 old_hash_name(const uint32 name) { return (uint8) (name & 0xFF); }
+HASH_MAP(name, uint32, uint32)
+OLD_HASH_MAP(name, uint32, uint32)
+
+static void free_hash_item_ptr(void *from, uint32 to) { /* no-op */ }
+#define hash_ptr hash_pointer
+static uint8 old_hash_ptr(void *from) { return (uint8) ((((size_t) from) / (sizeof (void *))) & 0xFF); }
+HASH_MAP(ptr, void *, uint32)
+OLD_HASH_MAP(ptr, void *, uint32)
+
+typedef enum { KEYS_DENSE, KEYS_SPARSE, KEYS_POINTER } KeyType;
+
+static uint64 *make_keys(const KeyType type, const uint32 count)
+{
+    uint64 *keys = (uint64 *) malloc(sizeof (uint64) * count);
+    uint64 x = 0x9E3779B97F4A7C15ull;
+    uint32 i;
+
+    if (!keys) {
+        out_of_memory();
+    }
+
+    for (i = 0; i < count; i++) {
+        switch (type) {
+            case KEYS_DENSE: keys[i] = i + 1; break;
+            case KEYS_SPARSE:  // xorshift, so they're all over the place but repeatable.
+                x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+                keys[i] = (uint32) (x | 1);
+                break;
+            case KEYS_POINTER: keys[i] = 0x7f0000100000ull + (((uint64) i) * 48); break;
+        }
+    }
+    return keys;
+}
+
+// insert everything, look everything up (hits and misses), remove everything.
+#define BENCH_MAP(prefix, maptype, keyctype, keys, count, lookups) do { \
+    uint64 start, i; \
+    uint32 r; \
+    start = bench_ns(); \
+    for (i = 0; i < count; i++) { prefix##add_##maptype##_to_map((keyctype) (size_t) keys[i], (uint32) i + 1); } \
+    insert_ns = bench_ns() - start; \
+    start = bench_ns(); \
+    for (r = 0; r < lookups; r++) { \
+        for (i = 0; i < count; i++) { \
+            if (prefix##get_mapped_##maptype((keyctype) (size_t) keys[i]) != ((uint32) i + 1)) { \
+                fprintf(stderr, "%s: lookup failed!\n", GAppName); \
+                exit(1); \
+            } \
+        } \
+    } \
+    lookup_ns = (bench_ns() - start) / lookups; \
+    start = bench_ns(); \
+    for (i = 0; i < count; i++) { prefix##get_mapped_##maptype((keyctype) (size_t) (keys[i] + 0x80000000ull)); } \
+    miss_ns = bench_ns() - start; \
+    start = bench_ns(); \
+    for (i = 0; i < count; i++) { prefix##remove_##maptype##_from_map((keyctype) (size_t) keys[i]); } \
+    remove_ns = bench_ns() - start; \
+} while (0)
+
+static void report(const char *mapname, const char *keyname, const uint32 count, const uint64 insert_ns, const uint64 lookup_ns, const uint64 miss_ns, const uint64 remove_ns)
+{
+    const double n = (double) count;
+    printf("%-8s %-8s %9u %10.1f %10.1f %10.1f %10.1f\n", mapname, keyname, (uint) count,
+           insert_ns / n, lookup_ns / n, miss_ns / n, remove_ns / n);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *keynames[] = { "dense", "sparse", "pointer" };
+    const uint32 maxcount = (argc > 1) ? (uint32) strtoul(argv[1], NULL, 10) : 100000;
+    const uint32 lookups = 4;
+    uint64 insert_ns, lookup_ns, miss_ns, remove_ns;
+    uint32 count;
+    int type;
+
+    printf("%-8s %-8s %9s %10s %10s %10s %10s\n", "map", "keys", "count", "insert ns", "lookup ns", "miss ns", "remove ns");
+    for (count = 1000; count <= maxcount; count *= 10) {
+        for (type = KEYS_DENSE; type <= KEYS_POINTER; type++) {
+            uint64 *keys = make_keys((KeyType) type, count);
+            if (type == KEYS_POINTER) {
+                BENCH_MAP(, ptr, void *, keys, count, lookups);
+                report("new", keynames[type], count, insert_ns, lookup_ns, miss_ns, remove_ns);
+                BENCH_MAP(old_, ptr, void *, keys, count, lookups);
+                report("old", keynames[type], count, insert_ns, lookup_ns, miss_ns, remove_ns);
+                free_ptr_map();
+            } else {
+                BENCH_MAP(, name, uint32, keys, count, lookups);
+                report("new", keynames[type], count, insert_ns, lookup_ns, miss_ns, remove_ns);
+                BENCH_MAP(old_, name, uint32, keys, count, lookups);
+                report("old", keynames[type], count, insert_ns, lookup_ns, miss_ns, remove_ns);
+                free_name_map();
+            }
+            free(keys);
+        }
+    }
+
+    return 0;
+}
+
+// end of altrace_bench.c ...
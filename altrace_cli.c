@@ -14,8 +14,13 @@ static int dump_calls = 1;
 static int dump_callers = 0;
 static int dump_state_changes = 0;
 static int dump_errors = 0;
+static int dump_durations = 0;
+static int dump_overhead = 1;
+static int dump_latency = 1;
+static int dump_contention = 1;
 static int dumping = 1;
 static int run_calls = 0;
+static uint32 skipped_ticks = 0;  // time capture was off, which --run doesn't wait through.
 
 void out_of_memory(void)
 {
@@ -28,7 +33,7 @@ void out_of_memory(void)
 
 static void wait_until(const uint32 ticks)
 {
-    while (now() < ticks) {
+    while ((now() + skipped_ticks) < ticks) {
         usleep(1000);  /* keep the pace of the original run */
     }
 }
@@ -139,6 +144,254 @@ void visit_buffer_state_changed_int(void *userdata, const ALuint name, const ALe
     }
 }
 
+void visit_state_poll(void *userdata, ALCcontext *ctx, const uint32 ticks)
+{
+    if (run_calls) {
+        wait_until(ticks);
+    }
+
+    if (dump_state_changes) {
+        printf("<<< STATE POLL: ctx=%s ticks=%u >>>\n", ctxString(ctx), (uint) ticks);
+    }
+}
+
+void visit_capture_started(void *userdata, const uint32 ticks, const char *reason)
+{
+    if (run_calls) {
+        const uint32 current = now() + skipped_ticks;
+        if (ticks > current) {
+            skipped_ticks += ticks - current;
+        }
+    }
+
+    if (dumping) {
+        printf("<<< CAPTURE STARTED (%s) ticks=%u >>>\n", reason, (uint) ticks);
+    }
+}
+
+void visit_capture_stopped(void *userdata, const uint32 ticks, const char *reason)
+{
+    if (run_calls) {
+        wait_until(ticks);
+    }
+
+    if (dumping) {
+        printf("<<< CAPTURE STOPPED (%s) ticks=%u >>>\n", reason, (uint) ticks);
+    }
+}
+
+static const char *entryName(const EventEnum entryid)
+{
+    switch (entryid) {
+        #define ENTRYPOINT(ret,name,params,args,numargs,visitparams,visitargs) case ALEE_##name: return #name;
+        #include "altrace_entrypoints.h"
+        case ALEE_STATE_POLL: return "(poller thread)";
+        default: break;
+    }
+    return "(unknown)";
+}
+
+static uint64 tracer_ns(const OverheadSummary *entry)
+{
+    const uint64 total = entry->ns[ALTRACE_OVERHEAD_TOTAL];
+    const uint64 real = entry->ns[ALTRACE_OVERHEAD_REAL_CALL];
+    return (total > real) ? (total - real) : 0;
+}
+
+static int cmp_overhead(const void *_a, const void *_b)
+{
+    const uint64 a = tracer_ns((const OverheadSummary *) _a);
+    const uint64 b = tracer_ns((const OverheadSummary *) _b);
+    return (a > b) ? -1 : ((a < b) ? 1 : 0);
+}
+
+static void dump_overhead_line(const char *name, const OverheadSummary *entry, const int percentiles)
+{
+    const uint64 tracer = tracer_ns(entry);
+    uint64 accounted = 0;
+    int i;
+
+    for (i = ALTRACE_OVERHEAD_LOCK_WAIT; i < ALTRACE_OVERHEAD_MAX; i++) {
+        accounted += entry->ns[i];
+    }
+
+    printf("%-28s %9llu %10s %10s %10s", name, (unsigned long long) entry->calls,
+           durationString(entry->ns[ALTRACE_OVERHEAD_TOTAL]),
+           durationString(entry->ns[ALTRACE_OVERHEAD_REAL_CALL]),
+           durationString(tracer));
+    for (i = ALTRACE_OVERHEAD_LOCK_WAIT; i < ALTRACE_OVERHEAD_MAX; i++) {
+        printf(" %10s", durationString(entry->ns[i]));
+    }
+    printf(" %10s", durationString((tracer > accounted) ? (tracer - accounted) : 0));
+    if (percentiles) {
+        printf(" %10s %10s %10s %10s",
+               durationString(histogram_percentile(entry->histogram, 50.0)),
+               durationString(histogram_percentile(entry->histogram, 90.0)),
+               durationString(histogram_percentile(entry->histogram, 99.0)),
+               durationString(histogram_percentile(entry->histogram, 100.0)));
+    }
+    printf("\n");
+}
+
+// "tracer" is everything but the real call, and "other" is the part of
+//  that we don't have a category for (encoding the call, error checks...).
+//  The percentiles are of each call's tracer time.
+void visit_overhead_summary(void *userdata, const uint32 numentries, const OverheadSummary *entries)
+{
+    OverheadSummary *sorted;
+    OverheadSummary total;
+    uint32 i;
+    int j;
+
+    if (!dump_overhead) {
+        return;
+    }
+
+    sorted = (OverheadSummary *) malloc((numentries ? numentries : 1) * sizeof (OverheadSummary));
+    if (!sorted) {
+        out_of_memory();
+    }
+    memcpy(sorted, entries, numentries * sizeof (OverheadSummary));
+    qsort(sorted, numentries, sizeof (OverheadSummary), cmp_overhead);
+
+    memset(&total, '\0', sizeof (total));
+    for (i = 0; i < numentries; i++) {
+        if (sorted[i].entryid == ALEE_STATE_POLL) {
+            continue;  // not time the app spent waiting on us.
+        }
+        total.calls += sorted[i].calls;
+        for (j = 0; j < ALTRACE_OVERHEAD_MAX; j++) {
+            total.ns[j] += sorted[i].ns[j];
+        }
+    }
+
+    printf("\n<<< RECORDER OVERHEAD >>>\n");
+    printf("%-28s %9s %10s %10s %10s %10s %10s %10s %10s %10s %10s %10s %10s %10s %10s\n",
+           "entry point", "calls", "total", "real call", "tracer", "lock wait", "unwind",
+           "symbolize", "poll", "io", "other", "p50", "p90", "p99", "max");
+    for (i = 0; i < numentries; i++) {
+        dump_overhead_line(entryName(sorted[i].entryid), &sorted[i], 1);
+    }
+    dump_overhead_line("(all calls)", &total, 0);
+    if (total.ns[ALTRACE_OVERHEAD_TOTAL]) {
+        printf("recorder overhead: %.2f%% of the time spent in OpenAL calls\n",
+               (((double) tracer_ns(&total)) * 100.0) / ((double) total.ns[ALTRACE_OVERHEAD_TOTAL]));
+    }
+
+    free(sorted);
+    fflush(stdout);
+}
+
+static int cmp_latency(const void *_a, const void *_b)
+{
+    const uint64 a = ((const LatencyHistogram *) _a)->calls;
+    const uint64 b = ((const LatencyHistogram *) _b)->calls;
+    return (a > b) ? -1 : ((a < b) ? 1 : 0);
+}
+
+void visit_latency_histograms(void *userdata, const uint32 numentries, const LatencyHistogram *entries)
+{
+    LatencyHistogram *sorted;
+    uint32 i;
+
+    if (!dump_latency) {
+        return;
+    }
+
+    sorted = (LatencyHistogram *) malloc((numentries ? numentries : 1) * sizeof (LatencyHistogram));
+    if (!sorted) {
+        out_of_memory();
+    }
+    memcpy(sorted, entries, numentries * sizeof (LatencyHistogram));
+    qsort(sorted, numentries, sizeof (LatencyHistogram), cmp_latency);
+
+    printf("\n<<< OPENAL CALL LATENCY >>>\n");
+    printf("%-28s %9s %10s %10s %10s %10s %10s\n", "entry point", "calls", "p50", "p90", "p99", "p99.9", "max");
+    for (i = 0; i < numentries; i++) {
+        const uint64 *histogram = sorted[i].histogram;
+        printf("%-28s %9llu %10s %10s %10s %10s %10s\n", entryName(sorted[i].entryid),
+               (unsigned long long) sorted[i].calls,
+               durationString(histogram_percentile(histogram, 50.0)),
+               durationString(histogram_percentile(histogram, 90.0)),
+               durationString(histogram_percentile(histogram, 99.0)),
+               durationString(histogram_percentile(histogram, 99.9)),
+               durationString(histogram_percentile(histogram, 100.0)));
+    }
+
+    free(sorted);
+    fflush(stdout);
+}
+
+static int cmp_contention_callsite(const void *_a, const void *_b)
+{
+    const uint64 a = ((const ContentionCallsite *) _a)->wait_ns;
+    const uint64 b = ((const ContentionCallsite *) _b)->wait_ns;
+    return (a > b) ? -1 : ((a < b) ? 1 : 0);
+}
+
+void visit_contention_summary(void *userdata, const ContentionSummary *summary)
+{
+    ContentionCallsite *sorted;
+    uint32 i, j;
+
+    if (!dump_contention) {
+        return;
+    }
+
+    printf("\n<<< CROSS-THREAD OPENAL USE >>>\n");
+    printf("%-10s %9s %10s %10s %8s %8s  %s\n", "threadid", "calls", "lock wait", "max wait", "sources", "buffers", "contexts (calls)");
+    for (i = 0; i < summary->num_threads; i++) {
+        const ContentionThread *thr = &summary->threads[i];
+        printf("%-10u %9llu %10s %10s %8u %8u ", (uint) thr->threadid,
+               (unsigned long long) thr->calls, durationString(thr->wait_ns),
+               durationString(thr->max_wait_ns), (uint) thr->sources, (uint) thr->buffers);
+        for (j = 0; j < thr->num_contexts; j++) {
+            printf(" %s (%llu)", ctxString(thr->contexts[j].ctx), (unsigned long long) thr->contexts[j].calls);
+        }
+        printf("\n");
+    }
+
+    // a handoff is a call from a different thread than the one before it.
+    printf("\n%-28s %9s %10s %10s   (handoffs within %s)\n", "context", "calls", "handoffs", "overlaps", durationString(summary->window_ns));
+    for (i = 0; i < summary->num_contexts; i++) {
+        const ContentionContext *cc = &summary->contexts[i];
+        printf("%-28s %9llu %10llu %10llu\n", ctxString(cc->ctx), (unsigned long long) cc->calls,
+               (unsigned long long) cc->handoffs, (unsigned long long) cc->overlaps);
+    }
+
+    sorted = (ContentionCallsite *) malloc((summary->num_callsites ? summary->num_callsites : 1) * sizeof (ContentionCallsite));
+    if (!sorted) {
+        out_of_memory();
+    }
+    memcpy(sorted, summary->callsites, summary->num_callsites * sizeof (ContentionCallsite));
+    qsort(sorted, summary->num_callsites, sizeof (ContentionCallsite), cmp_contention_callsite);
+
+    printf("\n%-28s %9s %10s %10s  %s\n", "entry point", "calls", "lock wait", "max wait", "called from");
+    for (i = 0; i < summary->num_callsites; i++) {
+        const ContentionCallsite *site = &sorted[i];
+        printf("%-28s %9llu %10s %10s  %s\n", entryName(site->entryid), (unsigned long long) site->calls,
+               durationString(site->wait_ns), durationString(site->max_wait_ns),
+               site->symbol ? site->symbol : ptrString(site->callsite));
+    }
+    free(sorted);
+
+    if (summary->num_shared) {
+        printf("\nused from more than one thread:\n");
+        for (i = 0; i < summary->num_shared; i++) {
+            const ContentionShared *obj = &summary->shared[i];
+            printf("%s %s calls=%llu threads=", obj->is_buffer ? "buffer" : "source",
+                   obj->is_buffer ? bufferString(obj->name) : sourceString(obj->name),
+                   (unsigned long long) obj->calls);
+            for (j = 0; j < obj->num_threads; j++) {
+                printf("%s%u", j ? "," : "", (uint) obj->threadids[j]);
+            }
+            printf("\n");
+        }
+    }
+
+    fflush(stdout);
+}
+
 void visit_eos(void *userdata, const ALboolean okay, const uint32 ticks)
 {
     if (run_calls) {
@@ -285,9 +538,19 @@ static void dump_alcCaptureStop(CallerInfo *callerinfo, ALCdevice *device)
     printf("(%s)\n", deviceString(device));
 }
 
+// note audio payloads that the recorder didn't store in full, since
+//  replaying those calls won't sound like the original session.
+static void dump_payload_policy(CallerInfo *callerinfo)
+{
+    if (callerinfo->payload_policy != ALTRACE_PAYLOAD_FULL) {
+        printf("    (data %s)\n", payloadString(callerinfo->payload_policy, callerinfo->payload_len, callerinfo->payload_stored_len, callerinfo->payload_hash, callerinfo->payload_downsample));
+    }
+}
+
 static void dump_alcCaptureSamples(CallerInfo *callerinfo, ALCdevice *device, ALCvoid *origbuffer, ALCvoid *buffer, ALCsizei bufferlen, ALCsizei samples)
 {
     printf("(%s, %s, %u)\n", deviceString(device), ptrString(origbuffer), (uint) samples);
+    dump_payload_policy(callerinfo);
 }
 
 static void dump_alDopplerFactor(CallerInfo *callerinfo, ALfloat value)
@@ -517,7 +780,6 @@ static void dump_alGenSources(CallerInfo *callerinfo, ALsizei n, ALuint *orignam
     if (orignames) {
         printf(" => {");
         for (i = 0; i < n; i++) {
-#pragma warning can overflow ioblob array
             printf("%s %s", i > 0 ? "," : "", sourceString(names[i]));
         }
         printf("%s}", n > 0 ? " " : "");
@@ -532,7 +794,6 @@ static void dump_alDeleteSources(CallerInfo *callerinfo, ALsizei n, const ALuint
     if (orignames) {
         printf(" {");
         for (i = 0; i < n; i++) {
-#pragma warning can overflow ioblob array
             printf("%s %s", i > 0 ? "," : "", sourceString(names[i]));
         }
         printf("%s}", n > 0 ? " " : "");
@@ -673,7 +934,6 @@ static void dump_alSourcePlayv(CallerInfo *callerinfo, ALsizei n, const ALuint *
     if (orignames) {
         printf(" {");
         for (i = 0; i < n; i++) {
-#pragma warning can overflow ioblob array
             printf("%s %s", i > 0 ? "," : "", sourceString(names[i]));
         }
         printf("%s}", n > 0 ? " " : "");
@@ -693,7 +953,6 @@ static void dump_alSourcePausev(CallerInfo *callerinfo, ALsizei n, const ALuint
     if (orignames) {
         printf(" {");
         for (i = 0; i < n; i++) {
-#pragma warning can overflow ioblob array
             printf("%s %s", i > 0 ? "," : "", sourceString(names[i]));
         }
         printf("%s}", n > 0 ? " " : "");
@@ -713,7 +972,6 @@ static void dump_alSourceRewindv(CallerInfo *callerinfo, ALsizei n, const ALuint
     if (orignames) {
         printf(" {");
         for (i = 0; i < n; i++) {
-#pragma warning can overflow ioblob array
             printf("%s %s", i > 0 ? "," : "", sourceString(names[i]));
         }
         printf("%s}", n > 0 ? " " : "");
@@ -733,7 +991,6 @@ static void dump_alSourceStopv(CallerInfo *callerinfo, ALsizei n, const ALuint *
     if (orignames) {
         printf(" {");
         for (i = 0; i < n; i++) {
-#pragma warning can overflow ioblob array
             printf("%s %s", i > 0 ? "," : "", sourceString(names[i]));
         }
         printf("%s}", n > 0 ? " " : "");
@@ -748,7 +1005,6 @@ static void dump_alSourceQueueBuffers(CallerInfo *callerinfo, ALuint name, ALsiz
     if (origbufnames) {
         printf(" {");
         for (i = 0; i < nb; i++) {
-#pragma warning can overflow ioblob array
             printf("%s %s", i > 0 ? "," : "", bufferString(bufnames[i]));
         }
         printf("%s}", nb > 0 ? " " : "");
@@ -763,7 +1019,6 @@ static void dump_alSourceUnqueueBuffers(CallerInfo *callerinfo, ALuint name, ALs
     if (origbufnames) {
         printf(" {");
         for (i = 0; i < nb; i++) {
-#pragma warning can overflow ioblob array
             printf("%s %s", i > 0 ? "," : "", bufferString(bufnames[i]));
         }
         printf("%s}", nb > 0 ? " " : "");
@@ -778,7 +1033,6 @@ static void dump_alGenBuffers(CallerInfo *callerinfo, ALsizei n, ALuint *orignam
     if (orignames) {
         printf(" => {");
         for (i = 0; i < n; i++) {
-#pragma warning can overflow ioblob array
             printf("%s %s", i > 0 ? "," : "", bufferString(names[i]));
         }
         printf("%s}", n > 0 ? " " : "");
@@ -793,7 +1047,6 @@ static void dump_alDeleteBuffers(CallerInfo *callerinfo, ALsizei n, const ALuint
     if (orignames) {
         printf(" {");
         for (i = 0; i < n; i++) {
-#pragma warning can overflow ioblob array
             printf("%s %s", i > 0 ? "," : "", bufferString(names[i]));
         }
         printf("%s}", n > 0 ? " " : "");
@@ -809,6 +1062,7 @@ static void dump_alIsBuffer(CallerInfo *callerinfo, ALboolean retval, ALuint nam
 static void dump_alBufferData(CallerInfo *callerinfo, ALuint name, ALenum alfmt, const ALvoid *origdata, const ALvoid *data, ALsizei size, ALsizei freq)
 {
     printf("(%s, %s, %s, %u, %u)\n", bufferString(name), alenumString(alfmt), ptrString(origdata), (uint) size, (uint) freq);
+    dump_payload_policy(callerinfo);
 }
 
 static void dump_alBufferfv(CallerInfo *callerinfo, ALuint name, ALenum param, const ALfloat *origvalues, uint32 numvals, const ALfloat *values)
@@ -997,7 +1251,9 @@ static void run_alcCaptureOpenDevice(CallerInfo *callerinfo, ALCdevice *retval,
 
 static void run_alcCaptureCloseDevice(CallerInfo *callerinfo, ALCboolean retval, ALCdevice *device)
 {
-    REAL_alcCaptureCloseDevice(get_mapped_device(device));
+    if (REAL_alcCaptureCloseDevice(get_mapped_device(device))) {
+        remove_device_from_map(device);
+    }
 }
 
 static void run_alcOpenDevice(CallerInfo *callerinfo, ALCdevice *retval, const ALCchar *devicename, ALint major_version, ALint minor_version, const ALCchar *devspec, const ALCchar *extensions)
@@ -1022,7 +1278,9 @@ static void run_alcOpenDevice(CallerInfo *callerinfo, ALCdevice *retval, const A
 
 static void run_alcCloseDevice(CallerInfo *callerinfo, ALCboolean retval, ALCdevice *device)
 {
-    REAL_alcCloseDevice(get_mapped_device(device));
+    if (REAL_alcCloseDevice(get_mapped_device(device))) {
+        remove_device_from_map(device);
+    }
 }
 
 static void run_alcCreateContext(CallerInfo *callerinfo, ALCcontext *retval, ALCdevice *device, const ALCint *origattrlist, uint32 attrcount, const ALCint *attrlist)
@@ -1274,6 +1532,9 @@ static void run_alDeleteSources(CallerInfo *callerinfo, ALsizei n, const ALuint
         realnames[i] = get_mapped_source(names[i]);
     }
     REAL_alDeleteSources(n, realnames);
+    for (i = 0; i < n; i++) {
+        remove_source_from_map(names[i]);
+    }
 }
 
 static void run_alIsSource(CallerInfo *callerinfo, ALboolean retval, ALuint name)
@@ -1467,9 +1728,12 @@ static void run_alDeleteBuffers(CallerInfo *callerinfo, ALsizei n, const ALuint
     ALsizei i;
     ALuint *realnames = (ALuint *) get_ioblob(sizeof (ALuint) * n);
     for (i = 0; i < n; i++) {
-        realnames[i] = get_mapped_source(names[i]);
+        realnames[i] = get_mapped_buffer(names[i]);
     }
     REAL_alDeleteBuffers(n, realnames);
+    for (i = 0; i < n; i++) {
+        remove_buffer_from_map(names[i]);
+    }
 }
 
 static void run_alIsBuffer(CallerInfo *callerinfo, ALboolean retval, ALuint name)
@@ -1611,6 +1875,13 @@ static void dump_callerinfo(const CallerInfo *callerinfo, const char *fn)
         for (i = 0; i < callerinfo->trace_scope; i++) {
             printf("    ");
         }
+        if (dump_durations) {
+            printf("[time=%.6fs duration=%s", ((double) callerinfo->timestamp) / 1000000000.0, durationString(callerinfo->duration));
+            if (callerinfo->have_cputime) {
+                printf(" cpu=%s", durationString(callerinfo->cputime));
+            }
+            printf("] ");
+        }
         printf("%s", fn);
     }
 }
@@ -1654,10 +1925,26 @@ int main(int argc, char **argv)
             dump_state_changes = 1;
         } else if (strcmp(arg, "--no-dump-state-changes") == 0) {
             dump_state_changes = 0;
+        } else if (strcmp(arg, "--dump-durations") == 0) {
+            dump_durations = 1;
+        } else if (strcmp(arg, "--no-dump-durations") == 0) {
+            dump_durations = 0;
+        } else if (strcmp(arg, "--dump-overhead") == 0) {
+            dump_overhead = 1;
+        } else if (strcmp(arg, "--no-dump-overhead") == 0) {
+            dump_overhead = 0;
+        } else if (strcmp(arg, "--dump-latency") == 0) {
+            dump_latency = 1;
+        } else if (strcmp(arg, "--no-dump-latency") == 0) {
+            dump_latency = 0;
+        } else if (strcmp(arg, "--dump-contention") == 0) {
+            dump_contention = 1;
+        } else if (strcmp(arg, "--no-dump-contention") == 0) {
+            dump_contention = 0;
         } else if (strcmp(arg, "--dump-all") == 0) {
-            dump_calls = dump_callers = dump_errors = dump_state_changes = 1;
+            dump_calls = dump_callers = dump_errors = dump_state_changes = dump_durations = dump_overhead = dump_latency = dump_contention = 1;
         } else if (strcmp(arg, "--no-dump-all") == 0) {
-            dump_calls = dump_callers = dump_errors = dump_state_changes = 0;
+            dump_calls = dump_callers = dump_errors = dump_state_changes = dump_durations = dump_overhead = dump_latency = dump_contention = 0;
         } else if (strcmp(arg, "--run") == 0) {
             run_calls = 1;
         } else if (strcmp(arg, "--no-run") == 0) {
@@ -1682,6 +1969,10 @@ int main(int argc, char **argv)
         fprintf(stderr, "   --[no-]dump-callers\n");
         fprintf(stderr, "   --[no-]dump-errors\n");
         fprintf(stderr, "   --[no-]dump-state-changes\n");
+        fprintf(stderr, "   --[no-]dump-durations\n");
+        fprintf(stderr, "   --[no-]dump-overhead\n");
+        fprintf(stderr, "   --[no-]dump-latency\n");
+        fprintf(stderr, "   --[no-]dump-contention\n");
         fprintf(stderr, "   --[no-]dump-all\n");
         fprintf(stderr, "   --[no-]run\n");
         fprintf(stderr, "\n");
@@ -12,49 +12,157 @@
 #include "altrace_entrypoints.h"
 
 
-#define MAX_IOBLOBS 256
-static uint8 *ioblobs[MAX_IOBLOBS];
-static size_t ioblobs_len[MAX_IOBLOBS];
-static int next_ioblob = 0;
+// Scratch memory for decoding tracefiles: get_ioblob() bump-allocates out
+//  of big blocks, and reset_ioblobs() makes all of it available again at
+//  once. Playback resets after every event, so anything from get_ioblob()
+//  (or sprintf_alloc(), litString(), etc) is only good until the visitor
+//  returns; retain_ioblob() copies something somewhere that lasts until
+//  free_ioblobs(). A reset keeps a few empty blocks around for the next
+//  event and frees the rest, so one huge event doesn't pin its memory.
+#define IOBLOB_BLOCK_SIZE (64 * 1024)
+#define IOBLOB_MAX_SPARE_BLOCKS 16
+#define IOBLOB_ALIGN(x) (((x) + 15) & ~((size_t) 15))
+
+typedef struct IoBlobBlock
+{
+    struct IoBlobBlock *next;
+    size_t used;
+    size_t size;
+} IoBlobBlock;
 
-void *get_ioblob(const size_t len)
+#define IOBLOB_BLOCK_DATA(block) (((uint8 *) (block)) + IOBLOB_ALIGN(sizeof (IoBlobBlock)))
+
+typedef struct IoBlobArena
+{
+    IoBlobBlock *blocks;
+    IoBlobBlock *current;  // blocks after this one are empty.
+} IoBlobArena;
+
+static IoBlobArena ioblob_scratch = { NULL, NULL };
+static IoBlobArena ioblob_retained = { NULL, NULL };
+
+static void *ioblob_arena_alloc(IoBlobArena *arena, const size_t len)
 {
-    void *ptr = ioblobs[next_ioblob];
-    if (len > ioblobs_len[next_ioblob]) {
-        //printf("allocating ioblob of %llu bytes...\n", (unsigned long long) len);
-        ptr = realloc(ptr, len);
-        if (!ptr) {
+    const size_t alen = IOBLOB_ALIGN(len ? len : 1);
+    IoBlobBlock *block = arena->current;
+    void *retval;
+
+    while (block && ((block->size - block->used) < alen)) {
+        block = block->next;
+    }
+
+    if (!block) {
+        const size_t size = (alen > IOBLOB_BLOCK_SIZE) ? alen : IOBLOB_BLOCK_SIZE;
+        block = (IoBlobBlock *) malloc(IOBLOB_ALIGN(sizeof (IoBlobBlock)) + size);
+        if (!block) {
             out_of_memory();
         }
-        ioblobs[next_ioblob] = (uint8 *) ptr;
-        ioblobs_len[next_ioblob] = len;
+        block->used = 0;
+        block->size = size;
+        if (arena->current) {
+            block->next = arena->current->next;
+            arena->current->next = block;
+        } else {
+            block->next = arena->blocks;
+            arena->blocks = block;
+        }
     }
-    next_ioblob++;
-    if (next_ioblob >= ((sizeof (ioblobs) / sizeof (ioblobs[0])))) {
-        next_ioblob = 0;
+
+    arena->current = block;
+    retval = IOBLOB_BLOCK_DATA(block) + block->used;
+    block->used += alen;
+    return retval;
+}
+
+static void ioblob_arena_free(IoBlobArena *arena)
+{
+    IoBlobBlock *block = arena->blocks;
+    while (block) {
+        IoBlobBlock *next = block->next;
+        free(block);
+        block = next;
     }
-    return ptr;
+    arena->blocks = arena->current = NULL;
 }
 
-void free_ioblobs(void)
+void *get_ioblob(const size_t len)
+{
+    return ioblob_arena_alloc(&ioblob_scratch, len);
+}
+
+void reset_ioblobs(void)
+{
+    IoBlobBlock **prev = &ioblob_scratch.blocks;
+    IoBlobBlock *block = ioblob_scratch.blocks;
+    int kept = 0;
+
+    while (block) {
+        IoBlobBlock *next = block->next;
+        if ((block->size > IOBLOB_BLOCK_SIZE) || (kept >= IOBLOB_MAX_SPARE_BLOCKS)) {
+            *prev = next;
+            free(block);
+        } else {
+            block->used = 0;
+            prev = &block->next;
+            kept++;
+        }
+        block = next;
+    }
+    ioblob_scratch.current = ioblob_scratch.blocks;
+}
+
+void *retain_ioblob(const void *ptr, const size_t len)
 {
-    size_t i;
-    for (i = 0; i < (sizeof (ioblobs) / sizeof (ioblobs[0])); i++) {
-        free(ioblobs[i]);
-        ioblobs[i] = NULL;
-        ioblobs_len[i] = 0;
+    void *retval = NULL;
+    if (ptr) {
+        retval = ioblob_arena_alloc(&ioblob_retained, len);
+        memcpy(retval, ptr, len);
     }
-    next_ioblob = 0;
+    return retval;
+}
+
+const char *retain_iostring(const char *str)
+{
+    return str ? (const char *) retain_ioblob(str, strlen(str) + 1) : NULL;
+}
+
+void free_ioblobs(void)
+{
+    ioblob_arena_free(&ioblob_scratch);
+    ioblob_arena_free(&ioblob_retained);
 }
 
 char *sprintf_alloc(const char *fmt, ...)
 {
+    IoBlobBlock *block = ioblob_scratch.current;
+    char *retval = NULL;
+    size_t avail = 0;
+    size_t len;
+    int rc;
     va_list ap;
+
+    // try to print straight into what's left of the current block, so the
+    //  usual short string only costs one vsnprintf and no allocation.
+    if (block) {
+        retval = (char *) (IOBLOB_BLOCK_DATA(block) + block->used);
+        avail = block->size - block->used;
+    }
+
     va_start(ap, fmt);
-    const size_t len = vsnprintf(NULL, 0, fmt, ap);
+    rc = vsnprintf(retval, avail, fmt, ap);
     va_end(ap);
 
-    char *retval = (char *) get_ioblob(len + 1);
+    if (rc < 0) {
+        return NULL;
+    }
+
+    len = (size_t) rc;
+    if (len < avail) {
+        block->used += IOBLOB_ALIGN(len + 1);
+        return retval;
+    }
+
+    retval = (char *) get_ioblob(len + 1);
     va_start(ap, fmt);
     if (vsnprintf(retval, len + 1, fmt, ap) != len) {
         retval = NULL;
@@ -65,9 +173,9 @@ char *sprintf_alloc(const char *fmt, ...)
 }
 
 
-static uint64 starttime = 0;
+static uint64 starttime = 0;  // in nanoseconds.
 
-uint32 now(void)
+uint64 now_ns(void)
 {
 #ifdef __APPLE__
     if (clock_gettime == NULL) {  // not available until 10.12, use gettimeofday if necessary.
@@ -76,7 +184,7 @@ uint32 now(void)
             fprintf(stderr, "%s: Failed to get current clock time: %s\n", GAppName, strerror(errno));
             return 0;
         }
-        return (uint32) ( ( (((uint64) tv.tv_sec) * 1000) + (((uint64) tv.tv_usec) / 1000) ) - starttime );
+        return ( (((uint64) tv.tv_sec) * 1000000000) + (((uint64) tv.tv_usec) * 1000) ) - starttime;
     }
 #endif
 
@@ -86,7 +194,29 @@ uint32 now(void)
         return 0;
     }
 
-    return (uint32) ( ( (((uint64) ts.tv_sec) * 1000) + (((uint64) ts.tv_nsec) / 1000000) ) - starttime );
+    return ( (((uint64) ts.tv_sec) * 1000000000) + ((uint64) ts.tv_nsec) ) - starttime;
+}
+
+uint32 now(void)
+{
+    return (uint32) (now_ns() / 1000000);
+}
+
+// CPU time the calling thread has used, in nanoseconds, or 0 if we can't tell.
+uint64 thread_cpu_ns(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+#ifdef __APPLE__
+    if (clock_gettime == NULL) {
+        return 0;
+    }
+#endif
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return (((uint64) ts.tv_sec) * 1000000000) + ((uint64) ts.tv_nsec);
+    }
+#endif
+    return 0;
 }
 
 int init_clock(void)
@@ -99,7 +229,7 @@ int init_clock(void)
             return 0;
         }
         usleep(1000);  // just so now() is (hopefully) never 0
-        starttime = (((uint64) tv.tv_sec) * 1000) + (((uint64) tv.tv_usec) / 1000);
+        starttime = (((uint64) tv.tv_sec) * 1000000000) + (((uint64) tv.tv_usec) * 1000);
         return 1;
     }
 #endif
@@ -111,7 +241,7 @@ int init_clock(void)
     }
     usleep(1000);  // just so now() is (hopefully) never 0
 
-    starttime = (((uint64) ts.tv_sec) * 1000) + (((uint64) ts.tv_nsec) / 1000000);
+    starttime = (((uint64) ts.tv_sec) * 1000000000) + ((uint64) ts.tv_nsec);
 
     return 1;
 }
@@ -196,17 +326,34 @@ void close_real_openal(void)
 
 // stole this from MojoShader: https://icculus.org/mojoshader
 //  (I wrote this code, and it's zlib-licensed even if I didn't.  --ryan.)
-typedef struct StringBucket
+//  It's since grown a bit: the table is open addressing with linear probing
+//  and doubles when it's 3/4 full, since the GUI can push millions of
+//  strings through here, and the strings themselves are packed into big
+//  arena pages instead of each getting its own malloc. Nothing is ever
+//  removed until the whole cache is destroyed, so there's no deletion.
+#define STRINGCACHE_PAGE_SIZE (64 * 1024)
+
+typedef struct StringCacheItem
 {
-    char *string;
-    struct StringBucket *next;
-} StringBucket;
+    const char *string;  // NULL if this slot is empty.
+    uint32 hash;
+    uint32 len;
+} StringCacheItem;
+
+typedef struct StringCachePage
+{
+    struct StringCachePage *next;
+    size_t used;
+    size_t size;
+    // string data follows.
+} StringCachePage;
 
 struct StringCache
 {
-    StringBucket **hashtable;
-    uint32 table_size;
-    void *d;
+    StringCacheItem *hashtable;
+    uint32 table_size;  // always a power of two.
+    uint32 count;
+    StringCachePage *pages;  // the one we're filling is first.
 };
 
 static inline uint32 hash_string(const char *str, size_t len)
@@ -217,54 +364,124 @@ static inline uint32 hash_string(const char *str, size_t len)
     return hash;
 } // hash_string
 
+static char *stringcache_alloc(StringCache *cache, const size_t len)
+{
+    StringCachePage *page = cache->pages;
+    char *retval;
+
+    if ((page == NULL) || ((page->size - page->used) < len))
+    {
+        // big strings get a page to themselves, behind the current one, so
+        //  we don't waste what's left of the page we're filling.
+        const size_t size = (len > (STRINGCACHE_PAGE_SIZE / 4)) ? len : STRINGCACHE_PAGE_SIZE;
+        StringCachePage *newpage = (StringCachePage *) malloc(sizeof (StringCachePage) + size);
+        if (newpage == NULL)
+            return NULL;
+        newpage->used = 0;
+        newpage->size = size;
+        if ((size != STRINGCACHE_PAGE_SIZE) && (page != NULL))
+        {
+            newpage->next = page->next;
+            page->next = newpage;
+        } // if
+        else
+        {
+            newpage->next = page;
+            cache->pages = newpage;
+        } // else
+        page = newpage;
+    } // if
+
+    retval = ((char *) (page + 1)) + page->used;
+    page->used += len;
+    return retval;
+} // stringcache_alloc
+
+static int stringcache_grow(StringCache *cache)
+{
+    const uint32 oldsize = cache->table_size;
+    const uint32 newsize = oldsize * 2;
+    const uint32 mask = newsize - 1;
+    StringCacheItem *oldtable = cache->hashtable;
+    StringCacheItem *newtable = (StringCacheItem *) calloc(newsize, sizeof (StringCacheItem));
+    uint32 i;
+
+    if (newtable == NULL)
+        return 0;
+
+    for (i = 0; i < oldsize; i++)
+    {
+        if (oldtable[i].string != NULL)
+        {
+            uint32 slot = oldtable[i].hash & mask;
+            while (newtable[slot].string != NULL)
+                slot = (slot + 1) & mask;
+            newtable[slot] = oldtable[i];
+        } // if
+    } // for
+
+    free(oldtable);
+    cache->hashtable = newtable;
+    cache->table_size = newsize;
+    return 1;
+} // stringcache_grow
+
 static const char *stringcache_len_internal(StringCache *cache,
                                             const char *str,
                                             const unsigned int len,
                                             const int addmissing)
 {
-    const uint8 hash = hash_string(str, len) & (cache->table_size-1);
-    StringBucket *bucket = cache->hashtable[hash];
-    StringBucket *prev = NULL;
-    while (bucket)
+    const uint32 hash = hash_string(str, len);
+    uint32 mask = cache->table_size - 1;
+    uint32 slot = hash & mask;
+    StringCacheItem *item;
+    char *string;
+
+    while ((item = &cache->hashtable[slot])->string != NULL)
     {
-        const char *bstr = bucket->string;
-        if ((strncmp(bstr, str, len) == 0) && (bstr[len] == 0))
-        {
-            // Matched! Move this to the front of the list.
-            if (prev != NULL)
-            {
-                assert(prev->next == bucket);
-                prev->next = bucket->next;
-                bucket->next = cache->hashtable[hash];
-                cache->hashtable[hash] = bucket;
-            } // if
-            return bstr; // already cached
-        } // if
-        prev = bucket;
-        bucket = bucket->next;
+        if ((item->hash == hash) && (item->len == len) && (memcmp(item->string, str, len) == 0))
+            return item->string; // already cached
+        slot = (slot + 1) & mask;
     } // while
 
     // no match!
     if (!addmissing)
         return NULL;
 
+    if (((cache->count + 1) * 4) > (cache->table_size * 3))
+    {
+        if (!stringcache_grow(cache))
+            return NULL;
+        mask = cache->table_size - 1;
+        slot = hash & mask;
+        while (cache->hashtable[slot].string != NULL)
+            slot = (slot + 1) & mask;
+        item = &cache->hashtable[slot];
+    } // if
+
     // add to the table.
-    bucket = (StringBucket *) malloc(sizeof (StringBucket) + len + 1);
-    if (bucket == NULL)
+    string = stringcache_alloc(cache, len + 1);
+    if (string == NULL)
         return NULL;
-    bucket->string = (char *)(bucket + 1);
-    memcpy(bucket->string, str, len);
-    bucket->string[len] = '\0';
-    bucket->next = cache->hashtable[hash];
-    cache->hashtable[hash] = bucket;
-    return bucket->string;
+    memcpy(string, str, len);
+    string[len] = '\0';
+    item->string = string;
+    item->hash = hash;
+    item->len = len;
+    cache->count++;
+    return string;
 } // stringcache_len_internal
 
-static const char *stringcache_len(StringCache *cache, const char *str, const unsigned int len)
+const char *stringcache_len(StringCache *cache, const char *str, const unsigned int len)
 {
     return stringcache_len_internal(cache, str, len, 1);
 } // stringcache_len
 
+const char *stringcache_find_len(StringCache *cache, const char *str, const unsigned int len)
+{
+    return stringcache_len_internal(cache, str, len, 0);
+} // stringcache_find_len
+
 const char *stringcache(StringCache *cache, const char *str)
 {
     return stringcache_len(cache, str, strlen(str));
@@ -273,20 +490,18 @@ const char *stringcache(StringCache *cache, const char *str)
 StringCache *stringcache_create(void)
 {
     const uint32 initial_table_size = 256;
-    const size_t tablelen = sizeof (StringBucket *) * initial_table_size;
     StringCache *cache = (StringCache *) malloc(sizeof (StringCache));
     if (!cache) {
         return NULL;
     }
     memset(cache, '\0', sizeof (StringCache));
 
-    cache->hashtable = (StringBucket **) malloc(tablelen);
+    cache->hashtable = (StringCacheItem *) calloc(initial_table_size, sizeof (StringCacheItem));
     if (!cache->hashtable)
     {
         free(cache);
         return NULL;
     }
-    memset(cache->hashtable, '\0', tablelen);
 
     cache->table_size = initial_table_size;
     return cache;
@@ -294,26 +509,273 @@ StringCache *stringcache_create(void)
 
 void stringcache_destroy(StringCache *cache)
 {
-    size_t i;
+    StringCachePage *page;
 
     if (cache == NULL)
         return;
 
-    for (i = 0; i < cache->table_size; i++)
+    page = cache->pages;
+    while (page)
     {
-        StringBucket *bucket = cache->hashtable[i];
-        cache->hashtable[i] = NULL;
-        while (bucket)
-        {
-            StringBucket *next = bucket->next;
-            free(bucket);
-            bucket = next;
-        } // while
-    } // for
+        StringCachePage *next = page->next;
+        free(page);
+        page = next;
+    } // while
 
     free(cache->hashtable);
     free(cache);
 } // stringcache_destroy
 
+// A small compressor for the LZ4 block format, used for compressed
+//  tracefiles (see ALTRACE_COMPRESSED_MAGIC). It's the simple greedy
+//  version: one hash table probe per position, no match search, which is
+//  plenty for event streams full of repeated handles and enums.
+#define LZ4_MINMATCH 4
+#define LZ4_HASHLOG 12
+#define LZ4_LASTLITERALS 5
+#define LZ4_MFLIMIT 12
+#define LZ4_MAXDISTANCE 65535
+
+static uint32 lz4_read32(const uint8 *ptr)
+{
+    uint32 val;
+    memcpy(&val, ptr, sizeof (val));
+    return val;
+}
+
+static uint32 lz4_hash(const uint32 val)
+{
+    return (val * 2654435761u) >> (32 - LZ4_HASHLOG);
+}
+
+static uint8 *lz4_write_length(uint8 *op, size_t len)
+{
+    while (len >= 255) {
+        *(op++) = 255;
+        len -= 255;
+    }
+    *(op++) = (uint8) len;
+    return op;
+}
+
+static uint8 *lz4_write_literals(uint8 *op, uint8 **token, const uint8 *literals, const size_t len)
+{
+    *token = op++;
+    if (len >= 15) {
+        **token = 15 << 4;
+        op = lz4_write_length(op, len - 15);
+    } else {
+        **token = (uint8) (len << 4);
+    }
+    memcpy(op, literals, len);
+    return op + len;
+}
+
+size_t lz4_compress_bound(const size_t len)
+{
+    return len + (len / 255) + 16;
+}
+
+size_t lz4_compress(const uint8 *src, const size_t srclen, uint8 *dst, const size_t dstlen)
+{
+    uint32 table[1 << LZ4_HASHLOG];
+    const uint8 *iend = src + srclen;
+    const uint8 *mflimit = iend - LZ4_MFLIMIT;
+    const uint8 *matchlimit = iend - LZ4_LASTLITERALS;
+    const uint8 *anchor = src;
+    const uint8 *ip = src + 1;  // the first byte can't match anything.
+    uint8 *op = dst;
+    uint8 *token = NULL;
+
+    if (dstlen < lz4_compress_bound(srclen)) {
+        return 0;  // we don't bounds-check output as we go.
+    }
+
+    memset(table, '\0', sizeof (table));
+
+    if (srclen > LZ4_MFLIMIT) {
+        while (ip < mflimit) {
+            const uint32 seq = lz4_read32(ip);
+            const uint32 hash = lz4_hash(seq);
+            const uint8 *match = src + table[hash];
+            const uint8 *start;
+            size_t len;
+
+            table[hash] = (uint32) (ip - src);
+            if ((match >= ip) || ((ip - match) > LZ4_MAXDISTANCE) || (lz4_read32(match) != seq)) {
+                ip++;
+                continue;
+            }
+
+            while ((ip > anchor) && (match > src) && (ip[-1] == match[-1])) {
+                ip--;
+                match--;
+            }
+
+            op = lz4_write_literals(op, &token, anchor, (size_t) (ip - anchor));
+            *(op++) = (uint8) ((ip - match) & 0xFF);
+            *(op++) = (uint8) ((ip - match) >> 8);
+
+            start = ip;
+            ip += LZ4_MINMATCH;
+            match += LZ4_MINMATCH;
+            while ((ip < matchlimit) && (*ip == *match)) {
+                ip++;
+                match++;
+            }
+
+            len = (size_t) (ip - start) - LZ4_MINMATCH;
+            if (len >= 15) {
+                *token |= 15;
+                op = lz4_write_length(op, len - 15);
+            } else {
+                *token |= (uint8) len;
+            }
+
+            anchor = ip;
+            if (ip < mflimit) {  // give the bytes we skipped a chance, too.
+                table[lz4_hash(lz4_read32(ip - 2))] = (uint32) ((ip - 2) - src);
+            }
+        }
+    }
+
+    // the last sequence is only literals.
+    op = lz4_write_literals(op, &token, anchor, (size_t) (iend - anchor));
+    return (size_t) (op - dst);
+}
+
+int lz4_decompress(const uint8 *src, const size_t srclen, uint8 *dst, const size_t dstlen)
+{
+    const uint8 *ip = src;
+    const uint8 *iend = src + srclen;
+    uint8 *op = dst;
+    uint8 *oend = dst + dstlen;
+
+    while (ip < iend) {
+        const uint8 token = *(ip++);
+        size_t len = token >> 4;
+        const uint8 *match;
+        size_t offset;
+
+        if (len == 15) {
+            uint8 val;
+            do {
+                if (ip >= iend) {
+                    return 0;
+                }
+                val = *(ip++);
+                len += val;
+            } while (val == 255);
+        }
+
+        if ((len > (size_t) (iend - ip)) || (len > (size_t) (oend - op))) {
+            return 0;
+        }
+        memcpy(op, ip, len);
+        op += len;
+        ip += len;
+
+        if (ip == iend) {
+            break;  // that was the last sequence.
+        } else if ((iend - ip) < 2) {
+            return 0;
+        }
+
+        offset = ((size_t) ip[0]) | (((size_t) ip[1]) << 8);
+        ip += 2;
+        if ((offset == 0) || (offset > (size_t) (op - dst))) {
+            return 0;
+        }
+
+        len = token & 15;
+        if (len == 15) {
+            uint8 val;
+            do {
+                if (ip >= iend) {
+                    return 0;
+                }
+                val = *(ip++);
+                len += val;
+            } while (val == 255);
+        }
+        len += LZ4_MINMATCH;
+
+        if (len > (size_t) (oend - op)) {
+            return 0;
+        }
+
+        match = op - offset;
+        if (offset >= len) {
+            memcpy(op, match, len);
+            op += len;
+        } else {  // overlapping copy, this repeats the last (offset) bytes.
+            while (len--) {
+                *(op++) = *(match++);
+            }
+        }
+    }
+
+    return (op == oend);
+}
+
+uint32 histogram_bucket(const uint64 val)
+{
+    const uint32 subbuckets = 1 << ALTRACE_HISTOGRAM_SUB_BITS;
+    uint32 shift;
+    if (val < subbuckets) {
+        return (uint32) val;
+    }
+    shift = (uint32) (63 - __builtin_clzll(val)) - ALTRACE_HISTOGRAM_SUB_BITS;
+    return ((shift + 1) << ALTRACE_HISTOGRAM_SUB_BITS) | ((uint32) (val >> shift) & (subbuckets - 1));
+}
+
+// the smallest value that lands in this bucket.
+uint64 histogram_bucket_min(const uint32 bucket)
+{
+    const uint32 subbuckets = 1 << ALTRACE_HISTOGRAM_SUB_BITS;
+    uint32 shift;
+    if (bucket < subbuckets) {
+        return bucket;
+    }
+    shift = (bucket >> ALTRACE_HISTOGRAM_SUB_BITS) - 1;
+    return ((uint64) (subbuckets | (bucket & (subbuckets - 1)))) << shift;
+}
+
+// the middle of the bucket's range.
+uint64 histogram_bucket_value(const uint32 bucket)
+{
+    const uint32 shift = (bucket < (1 << ALTRACE_HISTOGRAM_SUB_BITS)) ? 0 : ((bucket >> ALTRACE_HISTOGRAM_SUB_BITS) - 1);
+    return histogram_bucket_min(bucket) + ((((uint64) 1) << shift) >> 1);
+}
+
+// (pct) is 0.0 to 100.0. Returns 0 for an empty histogram.
+uint64 histogram_percentile(const uint64 *buckets, const double pct)
+{
+    uint64 total = 0;
+    uint64 seen = 0;
+    uint64 wanted;
+    uint32 i;
+
+    for (i = 0; i < ALTRACE_HISTOGRAM_BUCKETS; i++) {
+        total += buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    wanted = (uint64) ((((double) total) * pct) / 100.0);
+    if (wanted >= total) {
+        wanted = total - 1;
+    }
+
+    for (i = 0; i < ALTRACE_HISTOGRAM_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen > wanted) {
+            break;
+        }
+    }
+    return histogram_bucket_value(i);
+}
+
 // end of altrace_common.c ...
 
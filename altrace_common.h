@@ -31,7 +31,78 @@
 #define ALTRACE_VERSION "0.0.1"
 
 #define ALTRACE_LOG_FILE_MAGIC  0x0104E5A1
-#define ALTRACE_LOG_FILE_FORMAT 1
+#define ALTRACE_LOG_FILE_FORMAT 3
+
+// Format 1 wrote every integer (enums, booleans, sizes, pointers...) as a
+//  little endian 32 or 64-bit value, and each call's entry info as the event
+//  enum, a uint32 timestamp, the uint64 thread id, and the frame field.
+// Format 2 writes integers as LEB128 varints and event enums as one byte
+//  (floats and doubles are still raw little endian). Entry info is the
+//  thread's index from its ALEE_NEW_THREAD event, the milliseconds since
+//  that thread's previous call in the tracefile, and the frame field, which
+//  is zero or a callstack id plus one.
+// Format 3 is format 2 with 64-bit nanosecond times everywhere (call
+//  timestamp deltas, ALEE_STATE_POLL and ALEE_EOS), and the entry info ends
+//  with how long the real OpenAL call took: nanoseconds shifted left one
+//  bit, and if the low bit is set, that thread's CPU time for the call.
+#define ALTRACE_LOG_FILE_FORMAT_V1 1
+#define ALTRACE_LOG_FILE_FORMAT_V2 2
+
+// Tracefiles recorded with ALTRACE_OUTPUT=mmap hold the usual event stream
+//  split across fixed-size segments. Each segment starts with a header:
+//  uint32 magic, uint32 segment index, uint64 segment size (header
+//  included), uint64 bytes of event stream committed in this segment, and
+//  8 reserved bytes. Commits only happen between events, so a reader can
+//  trust everything up to the first segment that isn't completely full,
+//  even if the recording process died without writing ALEE_EOS.
+#define ALTRACE_SEGMENT_MAGIC 0x0104E5A2
+#define ALTRACE_SEGMENT_HEADER_SIZE 32
+
+// Tracefiles recorded with ALTRACE_COMPRESS hold the event stream in
+//  independently compressed blocks. There's a 16 byte header (uint32 magic,
+//  uint32 version, uint32 block size, uint32 reserved), then each block is
+//  a uint32 raw length and a uint32 stored length, followed by the stored
+//  bytes: LZ4 block format, or the raw bytes if ALTRACE_BLOCK_STORED_RAW is
+//  set in the stored length. A block with a raw length of zero ends the
+//  stream and its stored length is the number of blocks; the block index
+//  follows (a uint64 container offset and a uint64 event stream offset per
+//  block, plus one more entry for the end block and the stream's total
+//  length) and then a 16 byte footer: uint64 offset of the end block, uint32
+//  ALTRACE_COMPRESSED_INDEX_MAGIC, uint32 reserved. A recording that died
+//  before writing the index can still be read by walking the block headers.
+//  This container sits inside the segments if ALTRACE_OUTPUT=mmap, too.
+#define ALTRACE_COMPRESSED_MAGIC 0x0104E5A3
+#define ALTRACE_COMPRESSED_INDEX_MAGIC 0x0104E5A4
+#define ALTRACE_COMPRESSED_FORMAT 1
+#define ALTRACE_COMPRESSED_HEADER_SIZE 16
+#define ALTRACE_BLOCK_HEADER_SIZE 8
+#define ALTRACE_BLOCK_STORED_RAW 0x80000000
+
+// Blobs (buffer data, captured samples, etc) start with a uint64 length,
+//  but a few lengths mean something else. Big blobs are written once with
+//  ALTRACE_BLOB_DEFINE (then uint64 blob id, uint64 length, and the bytes),
+//  and repeats of the same bytes are just ALTRACE_BLOB_REF and the blob id.
+#define ALTRACE_BLOB_NULL 0xFFFFFFFFFFFFFFFFull
+#define ALTRACE_BLOB_REF 0xFFFFFFFFFFFFFFFEull
+#define ALTRACE_BLOB_DEFINE 0xFFFFFFFFFFFFFFFDull
+
+// Audio payloads (alBufferData, alcCaptureSamples) recorded under a policy
+//  other than full (ALTRACE_BUFFER_DATA, ALTRACE_CAPTURE_DATA) have this as
+//  their blob length, then the varint policy and the payload's real length.
+//  ALTRACE_PAYLOAD_HASH adds a varint 64-bit hash of the bytes,
+//  ALTRACE_PAYLOAD_PREVIEW adds a blob with the first bytes, and
+//  ALTRACE_PAYLOAD_DOWNSAMPLE adds varints for how many sample frames
+//  became one and the frame size in bytes, then a blob of the frames kept.
+#define ALTRACE_BLOB_POLICY 0xFFFFFFFFFFFFFFFCull
+
+typedef enum
+{
+    ALTRACE_PAYLOAD_FULL,
+    ALTRACE_PAYLOAD_NONE,
+    ALTRACE_PAYLOAD_HASH,
+    ALTRACE_PAYLOAD_PREVIEW,
+    ALTRACE_PAYLOAD_DOWNSAMPLE
+} PayloadPolicy;
 
 /* AL_EXT_FLOAT32 support... */
 #ifndef AL_FORMAT_MONO_FLOAT32
@@ -104,6 +175,11 @@ static uint64 swap64(uint64 x)
 
 #define MAX_CALLSTACKS 32
 
+// If this bit is set in a call's callstack frame count, the rest of the
+//  value is the ID of a callstack previously defined by ALEE_NEW_CALLSTACK,
+//  and no frames follow.
+#define ALTRACE_CALLSTACK_ID_FLAG 0x80000000
+
 typedef enum
 {
     ALEE_EOS,
@@ -125,141 +201,268 @@ typedef enum
     ALEE_BUFFER_STATE_CHANGED_INT,
     #define ENTRYPOINT(ret,name,params,args,numargs,visitparams,visitargs) ALEE_##name,
     #include "altrace_entrypoints.h"
+    // new event types go down here, so existing tracefiles keep their numbering.
+    //  Format 2 writes these as one byte, so there's room for 256 of them.
+    ALEE_MODULE_MAP,
+    ALEE_NEW_CALLSTACK,
+    ALEE_STATE_POLL,
+    ALEE_NEW_THREAD,
+    ALEE_OVERHEAD_SUMMARY,
+    ALEE_LATENCY_HISTOGRAMS,
+    ALEE_CAPTURE_STARTED,
+    ALEE_CAPTURE_STOPPED,
+    ALEE_CONTENTION_SUMMARY,
     ALEE_MAX
 } EventEnum;
 
+// With ALTRACE_OVERHEAD=1, the recorder keeps track of where the time goes
+//  in each entry point and writes it out as ALEE_OVERHEAD_SUMMARY at
+//  shutdown: a varint count of categories and of entry points, then for
+//  each entry point its one-byte EventEnum, a varint call count, each
+//  category's total nanoseconds, and a histogram of each call's overhead
+//  (total minus the real call) as a count of used buckets followed by
+//  bucket index/count pairs. The poller thread's work is listed under
+//  ALEE_STATE_POLL. New categories go on the end, so readers can skip the
+//  ones they don't know.
+typedef enum
+{
+    ALTRACE_OVERHEAD_TOTAL,  // everything from entering our entry point to leaving it.
+    ALTRACE_OVERHEAD_REAL_CALL,
+    ALTRACE_OVERHEAD_LOCK_WAIT,
+    ALTRACE_OVERHEAD_UNWIND,
+    ALTRACE_OVERHEAD_SYMBOLIZE,
+    ALTRACE_OVERHEAD_POLL,
+    ALTRACE_OVERHEAD_IO,
+    ALTRACE_OVERHEAD_MAX
+} OverheadCategory;
+
+// Log-bucketed histograms: values under 8 get their own bucket, and each
+//  power of two after that is split into 8 buckets, so a bucket's value is
+//  never more than 12.5% off.
+#define ALTRACE_HISTOGRAM_SUB_BITS 3
+#define ALTRACE_HISTOGRAM_BUCKETS ((64 - ALTRACE_HISTOGRAM_SUB_BITS + 1) << ALTRACE_HISTOGRAM_SUB_BITS)
+
+// With ALTRACE_HISTOGRAMS=1, ALEE_LATENCY_HISTOGRAMS at shutdown has a
+//  histogram of real call durations (nanoseconds) for each entry point that
+//  was called: a varint ALTRACE_HISTOGRAM_SUB_BITS, a varint count of entry
+//  points, then for each one its one-byte EventEnum, a varint count of used
+//  buckets, and bucket index/count pairs.
+
+// The recorder can leave capture off and turn it on later (ALTRACE_CAPTURE,
+//  etc). ALEE_CAPTURE_STARTED and ALEE_CAPTURE_STOPPED are a varint
+//  timestamp in nanoseconds and a string saying what did it. After a start,
+//  a trace scope follows with ordinary calls (no callstacks, no durations)
+//  and state changes that recreate every object that was alive at the time.
+
+// With ALTRACE_CONTENTION=1, ALEE_CONTENTION_SUMMARY at shutdown says how
+//  threads shared OpenAL: a varint handoff window in nanoseconds, then four
+//  lists, each a varint count followed by its items. Threads: a varint
+//  thread ID (the same one ALEE_NEW_THREAD uses), varint calls, total and
+//  longest API lock wait in nanoseconds, the number of sources and buffers
+//  it used, and a count of context pointer/call count pairs. Contexts:
+//  pointer, calls, handoffs (calls from a different thread than the one
+//  before, within the window) and overlaps (handoffs while that thread was
+//  still in its real call). Call sites: one-byte EventEnum, return address,
+//  calls, total and longest lock wait. Sources and buffers more than one
+//  thread used: a varint that's 1 for buffers, the name, calls, and a count
+//  of thread IDs followed by the IDs.
 
 #define ENTRYPOINT(ret,name,params,args,numargs,visitparams,visitargs) extern ret (*REAL_##name) params;
 #include "altrace_entrypoints.h"
 
 void *get_ioblob(const size_t len);
+void reset_ioblobs(void);
+void *retain_ioblob(const void *ptr, const size_t len);
+const char *retain_iostring(const char *str);
 void free_ioblobs(void);
 __attribute__((noreturn)) void out_of_memory(void);
 char *sprintf_alloc(const char *fmt, ...);
 uint32 now(void);
+uint64 now_ns(void);
+uint64 thread_cpu_ns(void);
 int init_clock(void);
 int load_real_openal(void);
 void close_real_openal(void);
 
 typedef struct StringCache StringCache;
 const char *stringcache(StringCache *cache, const char *str);
+const char *stringcache_len(StringCache *cache, const char *str, const unsigned int len);
+const char *stringcache_find_len(StringCache *cache, const char *str, const unsigned int len);  // NULL if not cached.
 StringCache *stringcache_create(void);
 void stringcache_destroy(StringCache *cache);
 
+size_t lz4_compress_bound(const size_t len);
+size_t lz4_compress(const uint8 *src, const size_t srclen, uint8 *dst, const size_t dstlen);
+int lz4_decompress(const uint8 *src, const size_t srclen, uint8 *dst, const size_t dstlen);
+
+uint32 histogram_bucket(const uint64 val);
+uint64 histogram_bucket_min(const uint32 bucket);
+uint64 histogram_bucket_value(const uint32 bucket);
+uint64 histogram_percentile(const uint64 *buckets, const double pct);
+
 #ifdef __cplusplus
 }
 #endif
 
+// Scramble all the bits of a key into the hash, so keys that only differ
+//  in a few low bits (AL names counting up from 1, aligned pointers) end up
+//  all over the table. This is the finalizer from MurmurHash3.
+static inline uint32 hash_uint64(uint64 x)
+{
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return (uint32) x;
+}
+
+static inline uint32 hash_pointer(const void *ptr)
+{
+    return hash_uint64((uint64) (size_t) ptr);
+}
+
 #define MAP_DECL(maptype, fromctype, toctype) \
     void add_##maptype##_to_map(fromctype from, toctype to); \
     toctype get_mapped_##maptype(fromctype from); \
+    void remove_##maptype##_from_map(fromctype from); \
     void free_##maptype##_map(void)
 
-#define SIMPLE_MAP(maptype, fromctype, toctype) \
-    typedef struct SimpleMap_##maptype { \
+// An open addressing hash table with Robin Hood probing: an item being
+//  inserted takes the slot of any item that's closer to its home slot than
+//  the new one is to its own, so probe lengths stay short and even, and a
+//  lookup can stop as soon as it passes where its key would have been.
+//  Removal shifts the items after it back a slot instead of leaving a
+//  tombstone. The table doubles when it's 3/4 full. Each map needs
+//  hash_MAPTYPE() to return a uint32 for a key, and free_hash_item_MAPTYPE()
+//  to clean up an item that's replaced or removed.
+#define HASH_MAP(maptype, fromctype, toctype) \
+    typedef struct HashMap_##maptype { \
         fromctype from; \
         toctype to; \
-    } SimpleMap_##maptype; \
-    static SimpleMap_##maptype *simplemap_##maptype = NULL; \
-    static uint32 simplemap_##maptype##_map_size = 0; \
-    void add_##maptype##_to_map(fromctype from, toctype to) { \
-        void *ptr; uint32 i; \
-        for (i = 0; i < simplemap_##maptype##_map_size; i++) { \
-            if (simplemap_##maptype[i].from == from) { \
-                free_hash_item_##maptype(simplemap_##maptype[i].from, simplemap_##maptype[i].to); \
-                simplemap_##maptype[i].from = from; \
-                simplemap_##maptype[i].to = to; \
-                return; \
-            } \
+        uint32 hash;  /* zero if this slot is empty. */ \
+    } HashMap_##maptype; \
+    static HashMap_##maptype *hashmap_##maptype = NULL; \
+    static uint32 hashmap_##maptype##_capacity = 0;  /* always a power of two. */ \
+    static uint32 hashmap_##maptype##_count = 0; \
+    static uint32 hashkey_##maptype(fromctype from) { \
+        return hash_##maptype(from) | 0x80000000;  /* never zero. */ \
+    } \
+    static uint32 hashdist_##maptype(const uint32 hash, const uint32 slot) { \
+        return (slot - hash) & (hashmap_##maptype##_capacity - 1); \
+    } \
+    static HashMap_##maptype *get_hashitem_##maptype(fromctype from) { \
+        const uint32 hash = hashkey_##maptype(from); \
+        const uint32 mask = hashmap_##maptype##_capacity - 1; \
+        uint32 slot = hash & mask; \
+        uint32 dist = 0; \
+        if (!hashmap_##maptype##_capacity) { \
+            return NULL; \
         } \
-        ptr = realloc(simplemap_##maptype, (simplemap_##maptype##_map_size + 1) * sizeof (SimpleMap_##maptype)); \
-        if (!ptr) { \
-            out_of_memory(); \
+        while (1) { \
+            HashMap_##maptype *item = &hashmap_##maptype[slot]; \
+            if (!item->hash || (dist > hashdist_##maptype(item->hash, slot))) { \
+                return NULL; \
+            } else if ((item->hash == hash) && (item->from == from)) { \
+                return item; \
+            } \
+            slot = (slot + 1) & mask; \
+            dist++; \
         } \
-        simplemap_##maptype = (SimpleMap_##maptype *) ptr; \
-        simplemap_##maptype[simplemap_##maptype##_map_size].from = from; \
-        simplemap_##maptype[simplemap_##maptype##_map_size].to = to; \
-        simplemap_##maptype##_map_size++; \
     } \
-    toctype get_mapped_##maptype(fromctype from) { \
-        uint32 i; \
-        for (i = 0; i < simplemap_##maptype##_map_size; i++) { \
-            if (simplemap_##maptype[i].from == from) { \
-                return simplemap_##maptype[i].to; \
+    static void insert_hashitem_##maptype(HashMap_##maptype newitem) { \
+        const uint32 mask = hashmap_##maptype##_capacity - 1; \
+        uint32 slot = newitem.hash & mask; \
+        uint32 dist = 0; \
+        while (1) { \
+            HashMap_##maptype *item = &hashmap_##maptype[slot]; \
+            uint32 itemdist; \
+            if (!item->hash) { \
+                *item = newitem; \
+                hashmap_##maptype##_count++; \
+                return; \
+            } \
+            itemdist = hashdist_##maptype(item->hash, slot); \
+            if (itemdist < dist) { /* take from the rich, carry on with the displaced item. */ \
+                const HashMap_##maptype tmp = *item; \
+                *item = newitem; \
+                newitem = tmp; \
+                dist = itemdist; \
             } \
+            slot = (slot + 1) & mask; \
+            dist++; \
         } \
-        return (toctype) 0; \
     } \
-    void free_##maptype##_map(void) { \
+    static void grow_hashmap_##maptype(void) { \
+        HashMap_##maptype *oldmap = hashmap_##maptype; \
+        const uint32 oldcapacity = hashmap_##maptype##_capacity; \
+        const uint32 newcapacity = oldcapacity ? (oldcapacity * 2) : 64; \
         uint32 i; \
-        for (i = 0; i < simplemap_##maptype##_map_size; i++) { \
-            SimpleMap_##maptype *item = &simplemap_##maptype[i]; \
-            free_hash_item_##maptype(item->from, item->to); \
+        hashmap_##maptype = (HashMap_##maptype *) calloc(newcapacity, sizeof (HashMap_##maptype)); \
+        if (!hashmap_##maptype) { \
+            out_of_memory(); \
         } \
-        free(simplemap_##maptype); \
-        simplemap_##maptype = NULL; \
-        simplemap_##maptype##_map_size = 0; \
-    }
-
-
-#define HASH_MAP(maptype, fromctype, toctype) \
-    typedef struct HashMap_##maptype { \
-        fromctype from; \
-        toctype to; \
-        struct HashMap_##maptype *next; \
-    } HashMap_##maptype; \
-    static HashMap_##maptype *hashmap_##maptype[256]; \
-    static HashMap_##maptype *get_hashitem_##maptype(fromctype from, uint8 *_hash) { \
-        const uint8 hash = hash_##maptype(from); \
-        HashMap_##maptype *prev = NULL; \
-        HashMap_##maptype *item = hashmap_##maptype[hash]; \
-        if (_hash) { *_hash = hash; } \
-        while (item) { \
-            if (item->from == from) { \
-                if (prev) { /* move to front of list */ \
-                    prev->next = item->next; \
-                    item->next = hashmap_##maptype[hash]; \
-                    hashmap_##maptype[hash] = item; \
-                } \
-                return item; \
+        hashmap_##maptype##_capacity = newcapacity; \
+        hashmap_##maptype##_count = 0; \
+        for (i = 0; i < oldcapacity; i++) { \
+            if (oldmap[i].hash) { \
+                insert_hashitem_##maptype(oldmap[i]); \
             } \
-            prev = item; \
-            item = item->next; \
         } \
-        return NULL; \
+        free(oldmap); \
     } \
     void add_##maptype##_to_map(fromctype from, toctype to) { \
-        uint8 hash; HashMap_##maptype *item = get_hashitem_##maptype(from, &hash); \
+        HashMap_##maptype *item = get_hashitem_##maptype(from); \
         if (item) { \
             free_hash_item_##maptype(item->from, item->to); \
             item->from = from; \
             item->to = to; \
         } else { \
-            item = (HashMap_##maptype *) calloc(1, sizeof (HashMap_##maptype)); \
-            if (!item) { \
-                out_of_memory(); \
+            HashMap_##maptype newitem; \
+            if (((hashmap_##maptype##_count + 1) * 4) > (hashmap_##maptype##_capacity * 3)) { \
+                grow_hashmap_##maptype(); \
             } \
-            item->from = from; \
-            item->to = to; \
-            item->next = hashmap_##maptype[hash]; \
-            hashmap_##maptype[hash] = item; \
+            newitem.from = from; \
+            newitem.to = to; \
+            newitem.hash = hashkey_##maptype(from); \
+            insert_hashitem_##maptype(newitem); \
         } \
     } \
     toctype get_mapped_##maptype(fromctype from) { \
-        HashMap_##maptype *item = get_hashitem_##maptype(from, NULL); \
+        HashMap_##maptype *item = get_hashitem_##maptype(from); \
         return item ? item->to : (toctype) 0; \
     } \
+    void remove_##maptype##_from_map(fromctype from) { \
+        HashMap_##maptype *item = get_hashitem_##maptype(from); \
+        if (item) { \
+            const uint32 mask = hashmap_##maptype##_capacity - 1; \
+            uint32 slot = (uint32) (item - hashmap_##maptype); \
+            free_hash_item_##maptype(item->from, item->to); \
+            while (1) { \
+                const uint32 next = (slot + 1) & mask; \
+                HashMap_##maptype *nextitem = &hashmap_##maptype[next]; \
+                if (!nextitem->hash || !hashdist_##maptype(nextitem->hash, next)) { \
+                    break; \
+                } \
+                hashmap_##maptype[slot] = *nextitem; \
+                slot = next; \
+            } \
+            hashmap_##maptype[slot].hash = 0; \
+            hashmap_##maptype##_count--; \
+        } \
+    } \
     void free_##maptype##_map(void) { \
-        int i; \
-        for (i = 0; i < 256; i++) { \
-            HashMap_##maptype *item; HashMap_##maptype *next; \
-            for (item = hashmap_##maptype[i]; item; item = next) { \
+        uint32 i; \
+        for (i = 0; i < hashmap_##maptype##_capacity; i++) { \
+            HashMap_##maptype *item = &hashmap_##maptype[i]; \
+            if (item->hash) { \
                 free_hash_item_##maptype(item->from, item->to); \
-                next = item->next; \
-                free(item); \
             } \
-            hashmap_##maptype[i] = NULL; \
         } \
+        free(hashmap_##maptype); \
+        hashmap_##maptype = NULL; \
+        hashmap_##maptype##_capacity = 0; \
+        hashmap_##maptype##_count = 0; \
     }
 
 #endif
@@ -6,33 +6,72 @@
  *  This file written by Ryan C. Gordon.
  */
 
+#include <sys/mman.h>
+
 #include "altrace_playback.h"
 
-static int logfd = -1;
+// The event stream is either the whole tracefile, or spread across the
+//  segments of a tracefile recorded with ALTRACE_OUTPUT=mmap (see
+//  ALTRACE_SEGMENT_MAGIC), and either of those might hold compressed blocks
+//  instead (see ALTRACE_COMPRESSED_MAGIC). Everything above this only sees
+//  the event stream, and offsets we hand out (CallerInfo::fdoffset, etc) are
+//  positions in the event stream, not the file. When we can, the whole file
+//  is mmap'd and read straight out of memory; pread() is the fallback for
+//  things we can't map.
+typedef struct TraceBlock
+{
+    uint64 offset;  // where the block header is in the container.
+    uint64 pos;  // where the block's bytes start in the event stream.
+} TraceBlock;
+
+typedef struct TraceInput
+{
+    int fd;
+    const uint8 *map;  // the whole file, or NULL if we use pread() instead.
+    size_t map_len;
+    int segmented;
+    uint64 segment_size;
+    uint64 container_size;  // bytes of (maybe compressed) container we can trust.
+    int compressed;
+    TraceBlock *blocks;  // (num_blocks + 1) entries, the last one marks the end.
+    uint32 num_blocks;
+    uint32 cached_block;
+    uint8 *block_data;
+    size_t block_data_len;
+    uint8 *stored_data;
+    size_t stored_data_len;
+    uint64 size;  // bytes of event stream we can trust.
+    uint64 pos;
+} TraceInput;
+
+static TraceInput input = { -1, NULL, 0 };
+static uint32 trace_format = 0;
 static uint32 trace_scope = 0;
+static uint32 last_wait_until = 0;
+static CallerInfo *current_callerinfo = NULL;
 static void *guserdata = NULL;
 
 static void quit_altrace_playback(void);
 
-// don't bother doing a full hash map for devices and contexts, since you'll
-//  usually never have more than one or two and they live basically the entire
-//  lifetime of your app.
 static void free_hash_item_device(ALCdevice *from, ALCdevice *to) { /* no-op */ }
-SIMPLE_MAP(device, ALCdevice *, ALCdevice *)
+#define hash_device hash_pointer
+HASH_MAP(device, ALCdevice *, ALCdevice *)
 
 static void free_hash_item_context(ALCcontext *from, ALCcontext *to) { /* no-op */ }
-SIMPLE_MAP(context, ALCcontext *, ALCcontext *)
+#define hash_context hash_pointer
+HASH_MAP(context, ALCcontext *, ALCcontext *)
 
 static void free_hash_item_devicelabel(ALCdevice *from, char *to) { free(to); }
-SIMPLE_MAP(devicelabel, ALCdevice *, char *)
+#define hash_devicelabel hash_pointer
+HASH_MAP(devicelabel, ALCdevice *, char *)
 
 static void free_hash_item_contextlabel(ALCcontext *from, char *to) { free(to); }
-SIMPLE_MAP(contextlabel, ALCcontext *, char *)
+#define hash_contextlabel hash_pointer
+HASH_MAP(contextlabel, ALCcontext *, char *)
 
 static void free_hash_item_alname(ALuint from, ALuint to) { /* no-op */ }
-static uint8 hash_alname(const ALuint name) {
-    /* since these are usually small numbers that increment from 0, they distribute pretty well on their own. */
-    return (uint8) (name & 0xFF);
+static uint32 hash_alname(const ALuint name) {
+    return hash_uint64((uint64) name);
 }
 
 #define free_hash_item_source free_hash_item_alname
@@ -55,16 +94,484 @@ HASH_MAP(bufferlabel, ALuint, char *)
 
 
 static void free_hash_item_stackframe(void *from, char *to) { free(to); }
-static uint8 hash_stackframe(void *from) {
-    // everything is going to end in a multiple of pointer size, so flatten down.
-    const size_t val = ((size_t) from) / (sizeof (void *));
-    return (uint8) (val & 0xFF);  // good enough, I guess.
-}
+#define hash_stackframe hash_pointer
 HASH_MAP(stackframe, void *, char *)
 
+// Tracefiles from the default recorder setup don't have symbol names in
+//  them, just where each ELF object was loaded (ALEE_MODULE_MAP), so we
+//  look up symbols from the files on disk here instead. This needs to run
+//  on the machine that made the recording (or one with the same files).
+//  We don't use <elf.h> so this builds on platforms that don't have it.
+typedef struct ElfFileHeader64
+{
+    uint8 e_ident[16];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32 e_version;
+    uint64 e_entry;
+    uint64 e_phoff;
+    uint64 e_shoff;
+    uint32 e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+} ElfFileHeader64;
+
+typedef struct ElfSectionHeader64
+{
+    uint32 sh_name;
+    uint32 sh_type;
+    uint64 sh_flags;
+    uint64 sh_addr;
+    uint64 sh_offset;
+    uint64 sh_size;
+    uint32 sh_link;
+    uint32 sh_info;
+    uint64 sh_addralign;
+    uint64 sh_entsize;
+} ElfSectionHeader64;
+
+typedef struct ElfSymbol64
+{
+    uint32 st_name;
+    uint8 st_info;
+    uint8 st_other;
+    uint16_t st_shndx;
+    uint64 st_value;
+    uint64 st_size;
+} ElfSymbol64;
+
+// 32-bit objects get widened to the structs above as they're read.
+typedef struct ElfFileHeader32
+{
+    uint8 e_ident[16];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32 e_version;
+    uint32 e_entry;
+    uint32 e_phoff;
+    uint32 e_shoff;
+    uint32 e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+} ElfFileHeader32;
+
+typedef struct ElfSectionHeader32
+{
+    uint32 sh_name;
+    uint32 sh_type;
+    uint32 sh_flags;
+    uint32 sh_addr;
+    uint32 sh_offset;
+    uint32 sh_size;
+    uint32 sh_link;
+    uint32 sh_info;
+    uint32 sh_addralign;
+    uint32 sh_entsize;
+} ElfSectionHeader32;
+
+typedef struct ElfSymbol32
+{
+    uint32 st_name;
+    uint32 st_value;
+    uint32 st_size;
+    uint8 st_info;
+    uint8 st_other;
+    uint16_t st_shndx;
+} ElfSymbol32;
+
+typedef struct ModuleSymbol
+{
+    uint64 addr;
+    uint64 size;
+    const char *name;
+} ModuleSymbol;
+
+typedef struct ModuleSymbols
+{
+    char *path;
+    char *strtab;
+    ModuleSymbol *syms;
+    uint32 num_syms;
+    struct ModuleSymbols *next;
+} ModuleSymbols;
+
+typedef struct TraceModule
+{
+    void *bias;
+    void *start;
+    uint64 len;
+    char *path;
+    ModuleSymbols *symbols;  // loaded the first time we need them.
+} TraceModule;
+
+static TraceModule *trace_modules = NULL;
+static uint32 num_trace_modules = 0;
+static ModuleSymbols *module_symbols = NULL;
+
+// frames we symbolized ourselves; separate from the stackframe map,
+//  because addresses can be reused by a different module after dlclose().
+#define free_hash_item_resolvedframe free_hash_item_stackframe
+#define hash_resolvedframe hash_stackframe
+HASH_MAP(resolvedframe, void *, char *)
+
+static int cmp_module_symbols(const void *_a, const void *_b)
+{
+    const ModuleSymbol *a = (const ModuleSymbol *) _a;
+    const ModuleSymbol *b = (const ModuleSymbol *) _b;
+    return (a->addr < b->addr) ? -1 : (a->addr > b->addr) ? 1 : 0;
+}
+
+static int pread_fully(const int fd, void *buf, const size_t len, const off_t offset)
+{
+    return (pread(fd, buf, len, offset) == (ssize_t) len);
+}
+
+static int read_elf_file_header(const int fd, const int is64, ElfFileHeader64 *ehdr)
+{
+    ElfFileHeader32 ehdr32;
+
+    if (is64) {
+        return pread_fully(fd, ehdr, sizeof (*ehdr), 0);
+    } else if (!pread_fully(fd, &ehdr32, sizeof (ehdr32), 0)) {
+        return 0;
+    }
+
+    memcpy(ehdr->e_ident, ehdr32.e_ident, sizeof (ehdr->e_ident));
+    ehdr->e_type = ehdr32.e_type;
+    ehdr->e_machine = ehdr32.e_machine;
+    ehdr->e_version = ehdr32.e_version;
+    ehdr->e_entry = ehdr32.e_entry;
+    ehdr->e_phoff = ehdr32.e_phoff;
+    ehdr->e_shoff = ehdr32.e_shoff;
+    ehdr->e_flags = ehdr32.e_flags;
+    ehdr->e_ehsize = ehdr32.e_ehsize;
+    ehdr->e_phentsize = ehdr32.e_phentsize;
+    ehdr->e_phnum = ehdr32.e_phnum;
+    ehdr->e_shentsize = ehdr32.e_shentsize;
+    ehdr->e_shnum = ehdr32.e_shnum;
+    ehdr->e_shstrndx = ehdr32.e_shstrndx;
+    return 1;
+}
+
+static int read_elf_section_headers(const int fd, const int is64, const ElfFileHeader64 *ehdr, ElfSectionHeader64 *shdrs)
+{
+    ElfSectionHeader32 *shdrs32;
+    uint32 i;
+    int retval;
+
+    if (is64) {
+        return pread_fully(fd, shdrs, ehdr->e_shnum * sizeof (ElfSectionHeader64), (off_t) ehdr->e_shoff);
+    }
+
+    shdrs32 = (ElfSectionHeader32 *) malloc(ehdr->e_shnum * sizeof (ElfSectionHeader32));
+    if (!shdrs32) {
+        out_of_memory();
+    }
+
+    retval = pread_fully(fd, shdrs32, ehdr->e_shnum * sizeof (ElfSectionHeader32), (off_t) ehdr->e_shoff);
+    for (i = 0; retval && (i < ehdr->e_shnum); i++) {
+        ElfSectionHeader64 *shdr = &shdrs[i];
+        shdr->sh_name = shdrs32[i].sh_name;
+        shdr->sh_type = shdrs32[i].sh_type;
+        shdr->sh_flags = shdrs32[i].sh_flags;
+        shdr->sh_addr = shdrs32[i].sh_addr;
+        shdr->sh_offset = shdrs32[i].sh_offset;
+        shdr->sh_size = shdrs32[i].sh_size;
+        shdr->sh_link = shdrs32[i].sh_link;
+        shdr->sh_info = shdrs32[i].sh_info;
+        shdr->sh_addralign = shdrs32[i].sh_addralign;
+        shdr->sh_entsize = shdrs32[i].sh_entsize;
+    }
+
+    free(shdrs32);
+    return retval;
+}
+
+static void get_elf_symbol(const uint8 *elfsyms, const int is64, const uint64 idx, ElfSymbol64 *sym)
+{
+    if (is64) {
+        memcpy(sym, elfsyms + (idx * sizeof (ElfSymbol64)), sizeof (*sym));
+    } else {
+        ElfSymbol32 sym32;
+        memcpy(&sym32, elfsyms + (idx * sizeof (ElfSymbol32)), sizeof (sym32));
+        sym->st_name = sym32.st_name;
+        sym->st_info = sym32.st_info;
+        sym->st_other = sym32.st_other;
+        sym->st_shndx = sym32.st_shndx;
+        sym->st_value = sym32.st_value;
+        sym->st_size = sym32.st_size;
+    }
+}
+
+static void load_elf_symbols(ModuleSymbols *modsyms)
+{
+    uint8 ident[16];
+    ElfFileHeader64 ehdr;
+    ElfSectionHeader64 *shdrs = NULL;
+    ElfSectionHeader64 *symtab = NULL;
+    ElfSectionHeader64 *strtab = NULL;
+    uint8 *elfsyms = NULL;
+    uint64 num_elfsyms = 0;
+    size_t symsize = 0;
+    int is64 = 0;
+    uint64 i;
+    const int fd = open(modsyms->path, O_RDONLY);
+
+    if (fd == -1) {
+        return;
+    }
+
+    if (!pread_fully(fd, ident, sizeof (ident), 0)) {
+        goto done;
+    } else if (memcmp(ident, "\x7F" "ELF", 4) != 0) {
+        goto done;
+    } else if ((ident[4] != 1) && (ident[4] != 2)) {  // ELFCLASS32, ELFCLASS64
+        goto done;
+    #ifdef BIGENDIAN
+    } else if (ident[5] != 2) {  // ELFDATA2MSB
+    #else
+    } else if (ident[5] != 1) {  // ELFDATA2LSB
+    #endif
+        goto done;
+    }
+
+    is64 = (ident[4] == 2);
+    symsize = is64 ? sizeof (ElfSymbol64) : sizeof (ElfSymbol32);
+
+    if (!read_elf_file_header(fd, is64, &ehdr)) {
+        goto done;
+    } else if ((ehdr.e_shnum == 0) || (ehdr.e_shentsize != (is64 ? sizeof (ElfSectionHeader64) : sizeof (ElfSectionHeader32)))) {
+        goto done;
+    }
+
+    shdrs = (ElfSectionHeader64 *) malloc(ehdr.e_shnum * sizeof (ElfSectionHeader64));
+    if (!shdrs) {
+        out_of_memory();
+    } else if (!read_elf_section_headers(fd, is64, &ehdr, shdrs)) {
+        goto done;
+    }
+
+    // prefer the full symbol table, but stripped binaries only have .dynsym.
+    // !!! FIXME: look for separate debug info (.gnu_debuglink, build-id).
+    for (i = 0; i < ehdr.e_shnum; i++) {
+        if (shdrs[i].sh_type == 2) {  // SHT_SYMTAB
+            symtab = &shdrs[i];
+            break;
+        } else if ((shdrs[i].sh_type == 11) && !symtab) {  // SHT_DYNSYM
+            symtab = &shdrs[i];
+        }
+    }
+
+    if (!symtab || (symtab->sh_link >= ehdr.e_shnum) || (symtab->sh_entsize != symsize)) {
+        goto done;
+    }
+
+    strtab = &shdrs[symtab->sh_link];
+    modsyms->strtab = (char *) malloc(strtab->sh_size + 1);
+    if (!modsyms->strtab) {
+        out_of_memory();
+    } else if (!pread_fully(fd, modsyms->strtab, strtab->sh_size, (off_t) strtab->sh_offset)) {
+        goto done;
+    }
+    modsyms->strtab[strtab->sh_size] = '\0';
+
+    num_elfsyms = symtab->sh_size / symsize;
+    elfsyms = (uint8 *) malloc(num_elfsyms * symsize);
+    if (!elfsyms) {
+        out_of_memory();
+    } else if (!pread_fully(fd, elfsyms, num_elfsyms * symsize, (off_t) symtab->sh_offset)) {
+        goto done;
+    }
+
+    modsyms->syms = (ModuleSymbol *) malloc(num_elfsyms * sizeof (ModuleSymbol));
+    if (!modsyms->syms) {
+        out_of_memory();
+    }
+
+    for (i = 0; i < num_elfsyms; i++) {
+        ElfSymbol64 elfsym;
+        get_elf_symbol(elfsyms, is64, i, &elfsym);
+        if ((elfsym.st_info & 0xF) != 2) {  // STT_FUNC
+            continue;
+        } else if ((elfsym.st_shndx == 0) || (elfsym.st_value == 0)) {  // undefined
+            continue;
+        } else if (elfsym.st_name >= strtab->sh_size) {
+            continue;
+        } else {
+            ModuleSymbol *sym = &modsyms->syms[modsyms->num_syms++];
+            sym->addr = elfsym.st_value;
+            sym->size = elfsym.st_size;
+            sym->name = modsyms->strtab + elfsym.st_name;
+        }
+    }
+
+    qsort(modsyms->syms, modsyms->num_syms, sizeof (ModuleSymbol), cmp_module_symbols);
+
+done:
+    free(elfsyms);
+    free(shdrs);
+    close(fd);
+}
+
+static ModuleSymbols *get_module_symbols(const char *path)
+{
+    ModuleSymbols *modsyms;
+    for (modsyms = module_symbols; modsyms; modsyms = modsyms->next) {
+        if (strcmp(modsyms->path, path) == 0) {
+            return modsyms;
+        }
+    }
+
+    // we keep failed loads around too, so we don't retry them every frame.
+    modsyms = (ModuleSymbols *) calloc(1, sizeof (ModuleSymbols));
+    if (!modsyms) {
+        out_of_memory();
+    }
+    modsyms->path = strdup(path);
+    if (!modsyms->path) {
+        out_of_memory();
+    }
+    load_elf_symbols(modsyms);
+    modsyms->next = module_symbols;
+    module_symbols = modsyms;
+    return modsyms;
+}
+
+static const ModuleSymbol *find_module_symbol(const ModuleSymbols *modsyms, const uint64 addr)
+{
+    const ModuleSymbol *sym;
+    uint32 lo = 0;
+    uint32 hi = modsyms->num_syms;
+
+    while (lo < hi) {  // find the first symbol past (addr).
+        const uint32 mid = lo + ((hi - lo) / 2);
+        if (modsyms->syms[mid].addr <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0) {
+        return NULL;
+    }
+
+    sym = &modsyms->syms[lo - 1];
+    if (sym->size && (addr >= (sym->addr + sym->size))) {
+        return NULL;  // in a gap between functions.
+    }
+    return sym;
+}
+
+// this produces the same thing backtrace_symbols() would have, so tools
+//  treat both kinds of tracefile the same.
+static const char *symbolize_frame(void *frame)
+{
+    const uint64 addr = (uint64) (size_t) frame;
+    char *retval = get_mapped_resolvedframe(frame);
+    TraceModule *mod = NULL;
+    uint32 i;
+
+    if (retval) {
+        return retval;
+    }
+
+    for (i = 0; i < num_trace_modules; i++) {
+        const uint64 start = (uint64) (size_t) trace_modules[i].start;
+        if ((addr >= start) && (addr < (start + trace_modules[i].len))) {
+            mod = &trace_modules[i];
+            break;
+        }
+    }
+
+    if (!mod) {
+        return NULL;
+    } else {
+        const uint64 vaddr = addr - (uint64) (size_t) mod->bias;
+        const ModuleSymbol *sym;
+        const char *str;
+
+        if (!mod->symbols) {
+            mod->symbols = get_module_symbols(mod->path);
+        }
+
+        // these are return addresses, so back up into the call instruction,
+        //  in case the call was the last thing in the function.
+        sym = find_module_symbol(mod->symbols, vaddr ? vaddr - 1 : 0);
+        if (sym) {
+            str = sprintf_alloc("%s(%s+0x%llx) [%p]", mod->path, sym->name, (unsigned long long) (vaddr - sym->addr), frame);
+        } else {
+            str = sprintf_alloc("%s(+0x%llx) [%p]", mod->path, (unsigned long long) vaddr, frame);
+        }
+        retval = str ? strdup(str) : NULL;  // sprintf_alloc() only gives us scratch memory.
+    }
+
+    if (!retval) {
+        out_of_memory();
+    }
+    add_resolvedframe_to_map(frame, retval);
+    return retval;
+}
+
+static void free_trace_modules(void)
+{
+    uint32 i;
+    for (i = 0; i < num_trace_modules; i++) {
+        free(trace_modules[i].path);
+    }
+    free(trace_modules);
+    trace_modules = NULL;
+    num_trace_modules = 0;
+    free_resolvedframe_map();
+}
+
+static void free_module_symbols(void)
+{
+    ModuleSymbols *modsyms = module_symbols;
+    while (modsyms) {
+        ModuleSymbols *next = modsyms->next;
+        free(modsyms->path);
+        free(modsyms->strtab);
+        free(modsyms->syms);
+        free(modsyms);
+        modsyms = next;
+    }
+    module_symbols = NULL;
+}
+
+// callstacks defined by ALEE_NEW_CALLSTACK, indexed by ID.
+typedef struct TraceCallstack
+{
+    uint32 frames;
+    void **callstack;
+} TraceCallstack;
+
+static TraceCallstack *trace_callstacks = NULL;
+static uint32 num_trace_callstacks = 0;
+
+static void free_trace_callstacks(void)
+{
+    uint32 i;
+    for (i = 0; i < num_trace_callstacks; i++) {
+        free(trace_callstacks[i].callstack);
+    }
+    free(trace_callstacks);
+    trace_callstacks = NULL;
+    num_trace_callstacks = 0;
+}
+
 static void free_hash_item_threadid(uint64 from, uint32 to) { /* no-op */ }
 static uint32 next_mapped_threadid = 0;
-SIMPLE_MAP(threadid, uint64, uint32);
+#define hash_threadid hash_uint64
+HASH_MAP(threadid, uint64, uint32)
 
 static int io_failure = 0;
 static void IO_READ_FAIL(const int eof)
@@ -75,45 +582,527 @@ static void IO_READ_FAIL(const int eof)
     }
 }
 
-static uint32 readle32(void)
+static int read_segment_header(const int fd, const uint32 idx, const uint64 segment_size, uint64 *_segsize, uint64 *_committed)
 {
-    uint32 retval = 0;
-    if (!io_failure) {
-        const ssize_t br = read(logfd, &retval, sizeof (retval));
-        if (br != ((ssize_t) sizeof (retval))) {
-            IO_READ_FAIL(br >= 0);
+    uint8 hdr[ALTRACE_SEGMENT_HEADER_SIZE];
+    uint32 magic, sidx;
+    uint64 segsize, committed;
+
+    if (pread(fd, hdr, sizeof (hdr), (off_t) (idx * segment_size)) != sizeof (hdr)) {
+        return 0;
+    }
+
+    memcpy(&magic, hdr, 4);
+    memcpy(&sidx, hdr + 4, 4);
+    memcpy(&segsize, hdr + 8, 8);
+    memcpy(&committed, hdr + 16, 8);
+    segsize = swap64(segsize);
+    committed = swap64(committed);
+    if ((swap32(magic) != ALTRACE_SEGMENT_MAGIC) || (swap32(sidx) != idx) || (segsize <= ALTRACE_SEGMENT_HEADER_SIZE)) {
+        return 0;
+    } else if (committed > (segsize - ALTRACE_SEGMENT_HEADER_SIZE)) {
+        return 0;
+    }
+
+    *_segsize = segsize;
+    *_committed = committed;
+    return 1;
+}
+
+// works like pread(), but on the container inside the file.
+static ssize_t read_trace_container(TraceInput *in, void *_buf, size_t len, uint64 pos)
+{
+    uint8 *buf = (uint8 *) _buf;
+    ssize_t retval = 0;
+
+    if (pos >= in->container_size) {
+        return 0;
+    } else if (len > (in->container_size - pos)) {
+        len = (size_t) (in->container_size - pos);
+    }
+
+    while (len > 0) {
+        off_t offset = (off_t) pos;
+        size_t cpy = len;
+        ssize_t br;
+
+        if (in->segmented) {
+            const uint64 capacity = in->segment_size - ALTRACE_SEGMENT_HEADER_SIZE;
+            const uint64 idx = pos / capacity;
+            const uint64 segpos = pos % capacity;
+            offset = (off_t) ((idx * in->segment_size) + ALTRACE_SEGMENT_HEADER_SIZE + segpos);
+            if (cpy > (capacity - segpos)) {
+                cpy = (size_t) (capacity - segpos);
+            }
+        }
+
+        if (in->map) {
+            if (((uint64) offset) >= in->map_len) {
+                break;
+            } else if (cpy > (in->map_len - (size_t) offset)) {
+                cpy = in->map_len - (size_t) offset;
+            }
+            memcpy(buf, in->map + offset, cpy);
+            br = (ssize_t) cpy;
+        } else {
+            br = pread(in->fd, buf, cpy, offset);
+        }
+
+        if (br < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        } else if (br == 0) {
+            break;
         }
+
+        pos += (uint64) br;
+        buf += br;
+        len -= (size_t) br;
+        retval += br;
     }
+
+    return retval;
+}
+
+static int read_trace_container_uint64(TraceInput *in, const uint64 pos, uint64 *_val)
+{
+    uint64 val;
+    if (read_trace_container(in, &val, sizeof (val), pos) != sizeof (val)) {
+        return 0;
+    }
+    *_val = swap64(val);
+    return 1;
+}
+
+static int read_block_header(TraceInput *in, const uint64 pos, uint32 *_rawlen, uint32 *_storedlen)
+{
+    uint32 hdr[2];
+    if (read_trace_container(in, hdr, sizeof (hdr), pos) != sizeof (hdr)) {
+        return 0;
+    }
+    *_rawlen = swap32(hdr[0]);
+    *_storedlen = swap32(hdr[1]);
+    return 1;
+}
+
+static void add_trace_input_block(TraceInput *in, const uint32 idx, const uint64 offset, const uint64 pos)
+{
+    if ((idx % 256) == 0) {
+        void *ptr = realloc(in->blocks, (idx + 256) * sizeof (TraceBlock));
+        if (!ptr) {
+            out_of_memory();
+        }
+        in->blocks = (TraceBlock *) ptr;
+    }
+    in->blocks[idx].offset = offset;
+    in->blocks[idx].pos = pos;
+}
+
+// use the block index at the end of the container, if it got written.
+static int load_block_index(TraceInput *in)
+{
+    uint64 endblock = 0;
+    uint64 footer[2];
+    uint32 rawlen, count, i;
+    uint64 indexlen;
+
+    if (in->container_size < (ALTRACE_COMPRESSED_HEADER_SIZE + ALTRACE_BLOCK_HEADER_SIZE + sizeof (footer))) {
+        return 0;
+    } else if (read_trace_container(in, footer, sizeof (footer), in->container_size - sizeof (footer)) != sizeof (footer)) {
+        return 0;
+    } else if (swap32(((uint32 *) footer)[2]) != ALTRACE_COMPRESSED_INDEX_MAGIC) {
+        return 0;
+    }
+
+    endblock = swap64(footer[0]);
+    if (!read_block_header(in, endblock, &rawlen, &count) || (rawlen != 0)) {
+        return 0;
+    }
+
+    indexlen = ((uint64) count + 1) * 16;
+    if ((endblock + ALTRACE_BLOCK_HEADER_SIZE + indexlen + sizeof (footer)) != in->container_size) {
+        return 0;
+    }
+
+    for (i = 0; i <= count; i++) {
+        const uint64 pos = endblock + ALTRACE_BLOCK_HEADER_SIZE + (((uint64) i) * 16);
+        uint64 offset, streampos;
+        if (!read_trace_container_uint64(in, pos, &offset) || !read_trace_container_uint64(in, pos + 8, &streampos)) {
+            return 0;
+        } else if ((i > 0) && ((offset <= in->blocks[i-1].offset) || (streampos < in->blocks[i-1].pos))) {
+            return 0;
+        }
+        add_trace_input_block(in, i, offset, streampos);
+    }
+
+    if ((in->blocks[0].offset != ALTRACE_COMPRESSED_HEADER_SIZE) || (in->blocks[count].offset != endblock)) {
+        return 0;
+    }
+
+    in->num_blocks = count;
+    return 1;
+}
+
+// no index (the app probably crashed), so walk the blocks that made it out.
+static void scan_blocks(TraceInput *in)
+{
+    uint64 offset = ALTRACE_COMPRESSED_HEADER_SIZE;
+    uint64 pos = 0;
+    uint32 rawlen, storedlen;
+    uint32 i = 0;
+
+    while (read_block_header(in, offset, &rawlen, &storedlen) && (rawlen != 0)) {
+        const uint64 next = offset + ALTRACE_BLOCK_HEADER_SIZE + (storedlen & ~ALTRACE_BLOCK_STORED_RAW);
+        if (next > in->container_size) {
+            break;  // didn't finish writing this one.
+        }
+        add_trace_input_block(in, i++, offset, pos);
+        offset = next;
+        pos += rawlen;
+    }
+
+    add_trace_input_block(in, i, offset, pos);
+    in->num_blocks = i;
+}
+
+static int open_trace_input(TraceInput *in, const char *filename)
+{
+    uint32 magic = 0;
+    struct stat statbuf;
+
+    in->fd = open(filename, O_RDONLY);
+    in->map = NULL;
+    in->map_len = 0;
+    in->segmented = 0;
+    in->segment_size = 0;
+    in->container_size = 0;
+    in->compressed = 0;
+    in->blocks = NULL;
+    in->num_blocks = 0;
+    in->cached_block = 0;
+    in->block_data = NULL;
+    in->block_data_len = 0;
+    in->stored_data = NULL;
+    in->stored_data_len = 0;
+    in->size = 0;
+    in->pos = 0;
+
+    if (in->fd == -1) {
+        return 0;
+    } else if (fstat(in->fd, &statbuf) == -1) {
+        close(in->fd);
+        in->fd = -1;
+        return 0;
+    }
+
+    if (S_ISREG(statbuf.st_mode) && (statbuf.st_size > 0) && (((uint64) statbuf.st_size) <= ((uint64) ((size_t) -1)))) {
+        void *ptr = mmap(NULL, (size_t) statbuf.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+        if (ptr != MAP_FAILED) {
+            in->map = (const uint8 *) ptr;
+            in->map_len = (size_t) statbuf.st_size;
+            #ifdef MADV_SEQUENTIAL
+            madvise(ptr, in->map_len, MADV_SEQUENTIAL);
+            #endif
+        }
+    }
+
+    if ((pread(in->fd, &magic, sizeof (magic), 0) == sizeof (magic)) && (swap32(magic) == ALTRACE_SEGMENT_MAGIC)) {
+        uint64 segsize = 0;
+        uint64 committed = 0;
+        uint32 i;
+
+        in->segmented = 1;
+        if (read_segment_header(in->fd, 0, 0, &segsize, &committed)) {
+            in->segment_size = segsize;
+            // everything up to the first segment that isn't full is good.
+            for (i = 0; read_segment_header(in->fd, i, segsize, &segsize, &committed); i++) {
+                in->container_size += committed;
+                if ((segsize != in->segment_size) || (committed < (segsize - ALTRACE_SEGMENT_HEADER_SIZE))) {
+                    break;
+                }
+            }
+        }
+    } else {
+        in->container_size = (uint64) statbuf.st_size;
+    }
+
+    if ((read_trace_container(in, &magic, sizeof (magic), 0) == sizeof (magic)) && (swap32(magic) == ALTRACE_COMPRESSED_MAGIC)) {
+        in->compressed = 1;
+        if (!load_block_index(in)) {
+            scan_blocks(in);
+        }
+        in->cached_block = in->num_blocks;  // nothing cached yet.
+        in->size = in->blocks[in->num_blocks].pos;
+    } else {
+        in->size = in->container_size;
+    }
+
+    return 1;
+}
+
+static void close_trace_input(TraceInput *in)
+{
+    if (in->map) {
+        munmap((void *) in->map, in->map_len);
+    }
+    in->map = NULL;
+    in->map_len = 0;
+    if (in->fd != -1) {
+        close(in->fd);
+    }
+    in->fd = -1;
+    free(in->blocks);
+    in->blocks = NULL;
+    free(in->block_data);
+    in->block_data = NULL;
+    free(in->stored_data);
+    in->stored_data = NULL;
+}
+
+// decompress block (idx) into in->block_data, unless it's already there.
+static int load_trace_block(TraceInput *in, const uint32 idx)
+{
+    const TraceBlock *block = &in->blocks[idx];
+    const uint64 span = block[1].offset - block->offset;
+    const uint64 rawlen = block[1].pos - block->pos;
+    uint32 hdrraw, hdrstored, storedlen;
+
+    if (in->cached_block == idx) {
+        return 1;
+    } else if ((span < ALTRACE_BLOCK_HEADER_SIZE) || (span > 0xFFFFFFFF) || (rawlen > 0xFFFFFFFF)) {
+        errno = EIO;
+        return 0;
+    }
+
+    if (in->stored_data_len < span) {
+        void *ptr = realloc(in->stored_data, (size_t) span);
+        if (!ptr) {
+            out_of_memory();
+        }
+        in->stored_data = (uint8 *) ptr;
+        in->stored_data_len = (size_t) span;
+    }
+
+    if (in->block_data_len < rawlen) {
+        void *ptr = realloc(in->block_data, (size_t) rawlen);
+        if (!ptr) {
+            out_of_memory();
+        }
+        in->block_data = (uint8 *) ptr;
+        in->block_data_len = (size_t) rawlen;
+    }
+
+    if (read_trace_container(in, in->stored_data, (size_t) span, block->offset) != (ssize_t) span) {
+        return 0;
+    }
+
+    memcpy(&hdrraw, in->stored_data, 4);
+    memcpy(&hdrstored, in->stored_data + 4, 4);
+    hdrraw = swap32(hdrraw);
+    hdrstored = swap32(hdrstored);
+    storedlen = hdrstored & ~ALTRACE_BLOCK_STORED_RAW;
+    if ((hdrraw != rawlen) || (storedlen != (span - ALTRACE_BLOCK_HEADER_SIZE))) {
+        errno = EIO;
+        return 0;
+    }
+
+    if (hdrstored & ALTRACE_BLOCK_STORED_RAW) {
+        if (storedlen != rawlen) {
+            errno = EIO;
+            return 0;
+        }
+        memcpy(in->block_data, in->stored_data + ALTRACE_BLOCK_HEADER_SIZE, (size_t) rawlen);
+    } else if (!lz4_decompress(in->stored_data + ALTRACE_BLOCK_HEADER_SIZE, storedlen, in->block_data, (size_t) rawlen)) {
+        errno = EIO;
+        return 0;
+    }
+
+    in->cached_block = idx;
+    return 1;
+}
+
+static uint32 find_trace_block(const TraceInput *in, const uint64 pos)
+{
+    uint32 lo = 0;
+    uint32 hi = in->num_blocks;
+    while ((hi - lo) > 1) {
+        const uint32 mid = lo + ((hi - lo) / 2);
+        if (in->blocks[mid].pos <= pos) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// a pointer to the next (len) bytes of the event stream, if they're already
+//  sitting in memory in one piece (the mmap'd file, or the decompressed
+//  block we have cached), or NULL if read_trace_input() has to copy them.
+//  This doesn't move the read position.
+static const uint8 *peek_trace_input(const TraceInput *in, const size_t len)
+{
+    if (len > (in->size - in->pos)) {
+        return NULL;
+    } else if (in->compressed) {
+        const uint32 idx = in->cached_block;
+        if ((idx < in->num_blocks) && (in->pos >= in->blocks[idx].pos) && ((in->pos + len) <= in->blocks[idx+1].pos)) {
+            return in->block_data + (size_t) (in->pos - in->blocks[idx].pos);
+        }
+    } else if (in->map) {
+        uint64 offset = in->pos;
+        if (in->segmented) {
+            const uint64 capacity = in->segment_size - ALTRACE_SEGMENT_HEADER_SIZE;
+            const uint64 segpos = offset % capacity;
+            if ((segpos + len) > capacity) {
+                return NULL;  // runs into the next segment.
+            }
+            offset = ((offset / capacity) * in->segment_size) + ALTRACE_SEGMENT_HEADER_SIZE + segpos;
+        }
+        if ((offset + len) <= in->map_len) {
+            return in->map + (size_t) offset;
+        }
+    }
+    return NULL;
+}
+
+// works like read(), but on the event stream.
+static ssize_t read_trace_input(TraceInput *in, void *_buf, size_t len)
+{
+    uint8 *buf = (uint8 *) _buf;
+    ssize_t retval = 0;
+
+    if (len > (in->size - in->pos)) {
+        len = (size_t) (in->size - in->pos);
+    }
+
+    if (!in->compressed) {
+        retval = read_trace_container(in, buf, len, in->pos);
+        if (retval > 0) {
+            in->pos += (uint64) retval;
+        }
+        return retval;
+    }
+
+    while (len > 0) {
+        uint32 idx = in->cached_block;
+        uint64 blockpos;
+        size_t cpy;
+
+        if ((idx >= in->num_blocks) || (in->pos < in->blocks[idx].pos) || (in->pos >= in->blocks[idx+1].pos)) {
+            idx = find_trace_block(in, in->pos);
+        }
+
+        if (!load_trace_block(in, idx)) {
+            return -1;
+        }
+
+        blockpos = in->pos - in->blocks[idx].pos;
+        cpy = (size_t) ((in->blocks[idx+1].pos - in->blocks[idx].pos) - blockpos);
+        if (cpy > len) {
+            cpy = len;
+        }
+
+        memcpy(buf, in->block_data + blockpos, cpy);
+        in->pos += (uint64) cpy;
+        buf += cpy;
+        len -= cpy;
+        retval += (ssize_t) cpy;
+    }
+
+    return retval;
+}
+
+int read_tracelog_data(const char *filename, const off_t offset, void *buf, const size_t len)
+{
+    TraceInput in;
+    int retval = 0;
+    if (open_trace_input(&in, filename)) {
+        in.pos = (uint64) offset;
+        if ((offset >= 0) && (in.pos <= in.size)) {
+            retval = (read_trace_input(&in, buf, len) == (ssize_t) len);
+        }
+        close_trace_input(&in);
+    }
+    return retval;
+}
+
+// read (len) bytes of the event stream into (buf), straight out of memory
+//  if we can. Returns zero (and sets io_failure) if that doesn't work out.
+static int read_trace_bytes(void *buf, const size_t len)
+{
+    const uint8 *ptr;
+    ssize_t br;
+
+    if (io_failure) {
+        return 0;
+    }
+
+    ptr = peek_trace_input(&input, len);
+    if (ptr) {
+        memcpy(buf, ptr, len);
+        input.pos += (uint64) len;
+        return 1;
+    }
+
+    br = read_trace_input(&input, buf, len);
+    if (br != ((ssize_t) len)) {
+        IO_READ_FAIL(br >= 0);
+        return 0;
+    }
+    return 1;
+}
+
+static uint32 readle32(void)
+{
+    uint32 retval = 0;
+    read_trace_bytes(&retval, sizeof (retval));
     return swap32(retval);
 }
 
 static uint64 readle64(void)
 {
     uint64 retval = 0;
-    if (!io_failure) {
-        const ssize_t br = read(logfd, &retval, sizeof (retval));
-        if (br != ((ssize_t) sizeof (retval))) {
-            IO_READ_FAIL(br >= 0);
-        }
-    }
+    read_trace_bytes(&retval, sizeof (retval));
     return swap64(retval);
 }
 
+static uint64 readvarint(void)
+{
+    uint64 retval = 0;
+    int shift = 0;
+    uint8 byte = 0;
+
+    do {
+        if (!read_trace_bytes(&byte, sizeof (byte))) {
+            return 0;
+        }
+        if (shift < 64) {
+            retval |= ((uint64) (byte & 0x7F)) << shift;
+        }
+        shift += 7;
+    } while (byte & 0x80);
+
+    return retval;
+}
+
 static int32 IO_INT32(void)
 {
     union { int32 si32; uint32 ui32; } cvt;
-    cvt.ui32 = readle32();
+    cvt.ui32 = (trace_format == ALTRACE_LOG_FILE_FORMAT_V1) ? readle32() : (uint32) readvarint();
     return cvt.si32;
 }
 
 static uint32 IO_UINT32(void)
 {
-    return readle32();
+    return (trace_format == ALTRACE_LOG_FILE_FORMAT_V1) ? readle32() : (uint32) readvarint();
 }
 
 static uint64 IO_UINT64(void)
 {
-    return readle64();
+    return (trace_format == ALTRACE_LOG_FILE_FORMAT_V1) ? readle64() : readvarint();
 }
 
 static ALCsizei IO_ALCSIZEI(void)
@@ -133,50 +1122,254 @@ static float IO_FLOAT(void)
     return cvt.f;
 }
 
-static double IO_DOUBLE(void)
-{
-    union { double d; uint64 ui64; } cvt;
-    cvt.ui64 = readle64();
-    return cvt.d;
+static double IO_DOUBLE(void)
+{
+    union { double d; uint64 ui64; } cvt;
+    cvt.ui64 = readle64();
+    return cvt.d;
+}
+
+// if (copy) is zero and the tracefile is mmap'd, this hands back a pointer
+//  into the file instead of copying, which is read-only and not
+//  null-terminated. Otherwise it's a null-terminated copy we can write to.
+static uint8 *IO_BLOB_DATA(const uint64 len, const int copy)
+{
+    const size_t slen = (size_t) len;
+    uint8 *ptr;
+    ssize_t br;
+
+    if (!copy && input.map && !input.compressed) {  // decompressed blocks get replaced, so only the mapping is safe to point into.
+        const uint8 *mapped = peek_trace_input(&input, slen);
+        if (mapped) {
+            input.pos += len;
+            return (uint8 *) mapped;
+        }
+    }
+
+    ptr = (uint8 *) get_ioblob(slen + 1);
+    br = read_trace_input(&input, ptr, slen);
+    if (br != ((ssize_t) slen)) {
+        IO_READ_FAIL(br >= 0);
+    }
+    ptr[slen] = '\0';
+    return ptr;
+}
+
+// where the bytes of each ALTRACE_BLOB_DEFINE blob are, indexed by blob id.
+typedef struct TraceBlob
+{
+    uint64 offset;
+    uint64 len;
+} TraceBlob;
+
+static TraceBlob *trace_blobs = NULL;
+static uint64 num_trace_blobs = 0;
+static uint64 trace_blobs_allocated = 0;
+
+// Blob ids, like callstack ids, come in the order the recorder first saw
+//  them, but definitions can land a little out of order. Anything further
+//  ahead than this is a corrupt tracefile, not a table to grow.
+#define MAX_BLOB_ID_GAP 4096
+
+static void add_trace_blob(const uint64 id, const uint64 offset, const uint64 len)
+{
+    if ((id >= num_trace_blobs) && ((id - num_trace_blobs) >= MAX_BLOB_ID_GAP)) {
+        fprintf(stderr, "%s: Bogus blob #%llu in log, only %llu so far.\n", GAppName, (unsigned long long) id, (unsigned long long) num_trace_blobs);
+        io_failure = 1;
+        return;
+    }
+
+    if (id >= trace_blobs_allocated) {
+        uint64 newalloc = trace_blobs_allocated ? (trace_blobs_allocated * 2) : 64;
+        uint64 i;
+        void *ptr;
+        if (newalloc <= id) {
+            newalloc = id + 1;
+        }
+        ptr = realloc(trace_blobs, newalloc * sizeof (TraceBlob));
+        if (!ptr) {
+            out_of_memory();
+        }
+        trace_blobs = (TraceBlob *) ptr;
+        for (i = trace_blobs_allocated; i < newalloc; i++) {  // skipped ids aren't defined (yet).
+            trace_blobs[i].offset = 0;
+            trace_blobs[i].len = ALTRACE_BLOB_NULL;
+        }
+        trace_blobs_allocated = newalloc;
+    }
+
+    trace_blobs[id].offset = offset;
+    trace_blobs[id].len = len;
+    if (id >= num_trace_blobs) {
+        num_trace_blobs = id + 1;
+    }
+}
+
+static void free_trace_blobs(void)
+{
+    free(trace_blobs);
+    trace_blobs = NULL;
+    num_trace_blobs = 0;
+    trace_blobs_allocated = 0;
+}
+
+static const uint8 *IO_BLOB(uint64 *_len);
+
+// audio that the recorder didn't store in full (see ALTRACE_BUFFER_DATA).
+//  We hand the visitor a buffer of the original size anyhow, so replaying
+//  the call still allocates what the app did: silence where we have nothing,
+//  the preview at the start, or each kept frame repeated to fill the gaps.
+static uint8 *IO_POLICY_BLOB(uint64 *_len)
+{
+    const PayloadPolicy policy = (PayloadPolicy) IO_UINT32();
+    const uint64 len = IO_UINT64();
+    uint64 storedlen = 0;
+    uint64 hash = 0;
+    uint64 factor = 0;
+    uint32 framesize = 0;
+    const uint8 *stored = NULL;
+    uint8 *ptr;
+
+    switch (policy) {
+        case ALTRACE_PAYLOAD_NONE:
+            break;
+        case ALTRACE_PAYLOAD_HASH:
+            hash = IO_UINT64();
+            break;
+        case ALTRACE_PAYLOAD_PREVIEW:
+            stored = IO_BLOB(&storedlen);
+            break;
+        case ALTRACE_PAYLOAD_DOWNSAMPLE:
+            factor = IO_UINT64();
+            framesize = IO_UINT32();
+            stored = IO_BLOB(&storedlen);
+            break;
+        default:
+            fprintf(stderr, "%s: Unknown payload policy %u in log.\n", GAppName, (uint) policy);
+            io_failure = 1;
+            break;
+    }
+
+    if (io_failure) {
+        return NULL;
+    } else if ((storedlen > len) || ((policy == ALTRACE_PAYLOAD_DOWNSAMPLE) && (!factor || !framesize))) {
+        fprintf(stderr, "%s: Bogus downsampled or preview payload in log.\n", GAppName);
+        io_failure = 1;
+        return NULL;
+    }
+
+    if (current_callerinfo) {
+        current_callerinfo->payload_policy = (int) policy;
+        current_callerinfo->payload_len = len;
+        current_callerinfo->payload_stored_len = storedlen;
+        current_callerinfo->payload_hash = hash;
+        current_callerinfo->payload_downsample = (uint32) factor;
+        if (!stored) {
+            current_callerinfo->bloboffset = 0;
+        }
+    }
+
+    ptr = (uint8 *) get_ioblob((size_t) len + 1);
+    memset(ptr, '\0', (size_t) len + 1);
+    if (policy == ALTRACE_PAYLOAD_PREVIEW) {
+        memcpy(ptr, stored, (size_t) storedlen);
+    } else if (policy == ALTRACE_PAYLOAD_DOWNSAMPLE) {
+        const uint64 frames = len / framesize;
+        const uint64 kept = storedlen / framesize;
+        uint64 i;
+        for (i = 0; i < frames; i++) {
+            const uint64 src = i / factor;
+            if (src >= kept) {
+                break;
+            }
+            memcpy(ptr + (i * framesize), stored + (src * framesize), framesize);
+        }
+    }
+
+    *_len = len;
+    return ptr;
 }
 
-static uint8 *IO_BLOB(uint64 *_len)
+static uint8 *IO_BLOB_INTERNAL(uint64 *_len, const int copy)
 {
-    const uint64 len = IO_UINT64();
-    const size_t slen = (size_t) len;
+    uint64 len = IO_UINT64();
+    uint64 offset;
     uint8 *ptr;
-    ssize_t br;
 
     if (io_failure) {
         return NULL;
     }
 
-    if (len == 0xFFFFFFFFFFFFFFFFull) {
+    if (len == ALTRACE_BLOB_NULL) {
         *_len = 0;
         return NULL;
+    } else if (len == ALTRACE_BLOB_POLICY) {
+        return IO_POLICY_BLOB(_len);
+    } else if (len == ALTRACE_BLOB_DEFINE) {
+        const uint64 id = IO_UINT64();
+        len = IO_UINT64();
+        if (io_failure) {
+            return NULL;
+        }
+        add_trace_blob(id, input.pos, len);
+    } else if (len == ALTRACE_BLOB_REF) {
+        const uint64 id = IO_UINT64();
+        if (io_failure) {
+            return NULL;
+        } else if ((id >= num_trace_blobs) || (trace_blobs[id].len == ALTRACE_BLOB_NULL)) {
+            fprintf(stderr, "%s: Log refers to blob #%llu, which it never defined.\n", GAppName, (unsigned long long) id);
+            io_failure = 1;
+            return NULL;
+        }
+
+        // the bytes are back where the blob was defined; go get them.
+        len = trace_blobs[id].len;
+        offset = input.pos;
+        input.pos = trace_blobs[id].offset;
+        ptr = IO_BLOB_DATA(len, copy);
+        input.pos = offset;
+        *_len = len;
+        if (current_callerinfo) {
+            current_callerinfo->bloboffset = (off_t) trace_blobs[id].offset;
+        }
+        return ptr;
     }
 
     *_len = len;
 
-    ptr = (uint8 *) get_ioblob(slen + 1);
-    br = read(logfd, ptr, slen);
-    if (br != ((ssize_t) slen)) {
-        IO_READ_FAIL(br >= 0);
+    if (current_callerinfo) {
+        current_callerinfo->bloboffset = (off_t) input.pos;
     }
-    ptr[slen] = '\0';
 
-    return ptr;
+    return IO_BLOB_DATA(len, copy);
+}
+
+// this might point right into the mmap'd tracefile, so it's read-only.
+static const uint8 *IO_BLOB(uint64 *_len)
+{
+    return IO_BLOB_INTERNAL(_len, 0);
+}
+
+// a null-terminated copy, for things that get written to or used as C strings.
+static uint8 *IO_BLOB_COPY(uint64 *_len)
+{
+    return IO_BLOB_INTERNAL(_len, 1);
 }
 
 static const char *IO_STRING(void)
 {
     uint64 len;
-    return (const char *) IO_BLOB(&len);
+    return (const char *) IO_BLOB_COPY(&len);
 }
 
 static EventEnum IO_EVENTENUM(void)
 {
-    return (EventEnum) IO_UINT32();
+    uint8 tag = 0;
+    if (trace_format == ALTRACE_LOG_FILE_FORMAT_V1) {
+        return (EventEnum) IO_UINT32();
+    }
+    read_trace_bytes(&tag, sizeof (tag));
+    return (EventEnum) tag;
 }
 
 static void *IO_PTR(void)
@@ -204,44 +1397,136 @@ static ALboolean IO_BOOLEAN(void)
     return (ALboolean) IO_UINT32();
 }
 
+// format 2 calls refer to their thread by index (see ALEE_NEW_THREAD), and
+//  their timestamps count from that thread's previous call.
+typedef struct TraceThread
+{
+    uint64 logthreadid;
+    uint64 last_timestamp;
+} TraceThread;
+
+static TraceThread *trace_threads = NULL;
+static uint32 num_trace_threads = 0;
+
+static void free_trace_threads(void)
+{
+    free(trace_threads);
+    trace_threads = NULL;
+    num_trace_threads = 0;
+}
+
+// the small numbers tools show for threads, in the order they showed up.
+static uint32 map_logthreadid(const uint64 logthreadid)
+{
+    uint32 threadid = get_mapped_threadid(logthreadid);
+    if (!threadid) {
+        threadid = ++next_mapped_threadid;
+        add_threadid_to_map(logthreadid, threadid);
+    }
+    return threadid;
+}
+
 static void IO_ENTRYINFO(CallerInfo *callerinfo)
 {
-    const uint32 wait_until = IO_UINT32();
-    const uint64 logthreadid = IO_UINT64();
-    const uint32 frames = IO_UINT32();
+    uint32 wait_until;
+    uint64 timestamp;
+    uint64 duration = 0;
+    uint64 cputime = 0;
+    int have_cputime = 0;
+    uint64 logthreadid;
+    uint32 frames;
+    void **interned = NULL;
     uint32 threadid;
     uint32 i;
 
+    if (trace_format == ALTRACE_LOG_FILE_FORMAT_V1) {
+        wait_until = IO_UINT32();
+        timestamp = ((uint64) wait_until) * 1000000;
+        logthreadid = IO_UINT64();
+        frames = IO_UINT32();
+    } else {
+        const uint32 idx = IO_UINT32();
+        const uint64 delta = IO_UINT64();
+        frames = IO_UINT32();
+        if (trace_format >= 3) {
+            duration = IO_UINT64();
+            have_cputime = (int) (duration & 1);
+            duration >>= 1;
+            if (have_cputime) {
+                cputime = IO_UINT64();
+            }
+        }
+
+        if (io_failure) {
+            return;
+        } else if (idx >= num_trace_threads) {
+            fprintf(stderr, "%s: Log refers to thread #%u, which it never defined.\n", GAppName, (uint) idx);
+            io_failure = 1;
+            return;
+        }
+
+        // format 2 counted in milliseconds, and the sum wrapped at 32 bits.
+        timestamp = trace_threads[idx].last_timestamp + delta;
+        if (trace_format == ALTRACE_LOG_FILE_FORMAT_V2) {
+            timestamp &= 0xFFFFFFFF;
+            trace_threads[idx].last_timestamp = timestamp;
+            timestamp *= 1000000;
+        } else {
+            trace_threads[idx].last_timestamp = timestamp;
+        }
+        wait_until = (uint32) (timestamp / 1000000);
+        logthreadid = trace_threads[idx].logthreadid;
+        frames = frames ? (ALTRACE_CALLSTACK_ID_FLAG | (frames - 1)) : 0;
+    }
+
     if (io_failure) {
         return;
     }
 
-    threadid = get_mapped_threadid(logthreadid);
-
-    if (!threadid) {
-        threadid = ++next_mapped_threadid;
-        add_threadid_to_map(logthreadid, threadid);
+    if (frames & ALTRACE_CALLSTACK_ID_FLAG) {
+        const uint32 id = frames & ~ALTRACE_CALLSTACK_ID_FLAG;
+        if (id >= num_trace_callstacks) {  // the recorder never drops definitions, so this is a corrupt log.
+            fprintf(stderr, "%s: Log refers to callstack #%u, which it never defined.\n", GAppName, (uint) id);
+            io_failure = 1;
+            return;
+        }
+        interned = trace_callstacks[id].callstack;
+        frames = trace_callstacks[id].frames;
     }
 
+    threadid = map_logthreadid(logthreadid);
+
     callerinfo->num_callstack_frames = (frames < MAX_CALLSTACKS) ? frames : MAX_CALLSTACKS;
     callerinfo->threadid = threadid;
     callerinfo->trace_scope = trace_scope;
     callerinfo->wait_until = wait_until;
+    callerinfo->timestamp = timestamp;
+    callerinfo->duration = duration;
+    callerinfo->cputime = cputime;
+    callerinfo->have_cputime = have_cputime;
+    callerinfo->bloboffset = 0;
+    callerinfo->payload_policy = ALTRACE_PAYLOAD_FULL;
+    callerinfo->payload_len = callerinfo->payload_stored_len = 0;
+    callerinfo->payload_hash = 0;
+    callerinfo->payload_downsample = 0;
     callerinfo->userdata = guserdata;
+    current_callerinfo = callerinfo;
+    last_wait_until = wait_until;
 
     for (i = 0; i < frames; i++) {
-        void *ptr = IO_PTR();
+        void *ptr = interned ? interned[i] : IO_PTR();
         if ((!io_failure) && (i < MAX_CALLSTACKS)) {
+            const char *sym = get_mapped_stackframe(ptr);
             callerinfo->callstack[i].frame = ptr;
-            callerinfo->callstack[i].sym = get_mapped_stackframe(ptr);
+            callerinfo->callstack[i].sym = sym ? sym : symbolize_frame(ptr);
         }
     }
 
-    callerinfo->fdoffset = lseek(logfd, 0, SEEK_CUR);
+    callerinfo->fdoffset = (off_t) input.pos;
 }
 
 #define IO_START(e) { CallerInfo callerinfo; IO_ENTRYINFO(&callerinfo); if (!io_failure) {
-#define IO_END() } }
+#define IO_END() } current_callerinfo = NULL; }
 
 
 static int init_altrace_playback(const char *filename, void *userdata)
@@ -249,12 +1534,14 @@ static int init_altrace_playback(const char *filename, void *userdata)
     int okay = 1;
 
     io_failure = 0;
+    trace_format = 0;
     next_mapped_threadid = 0;
     trace_scope = 0;
+    last_wait_until = 0;
+    current_callerinfo = NULL;
     guserdata = userdata;
 
-    logfd = open(filename, O_RDONLY);
-    if (logfd == -1) {
+    if (!open_trace_input(&input, filename)) {
         fprintf(stderr, "%s: Failed to open OpenAL log file '%s': %s\n", GAppName, filename, strerror(errno));
         okay = 0;
     }
@@ -262,12 +1549,15 @@ static int init_altrace_playback(const char *filename, void *userdata)
     fflush(stderr);
 
     if (okay) {
-        if (IO_UINT32() != ALTRACE_LOG_FILE_MAGIC) {
+        if (readle32() != ALTRACE_LOG_FILE_MAGIC) {
             fprintf(stderr, "%s: File '%s' does not appear to be an OpenAL log file.\n", GAppName, filename);
             okay = 0;
-        } else if (IO_UINT32() != ALTRACE_LOG_FILE_FORMAT) {
-            fprintf(stderr, "%s: File '%s' is an unsupported log file format version.\n", GAppName, filename);
-            okay = 0;
+        } else {
+            trace_format = readle32();
+            if ((trace_format < ALTRACE_LOG_FILE_FORMAT_V1) || (trace_format > ALTRACE_LOG_FILE_FORMAT)) {
+                fprintf(stderr, "%s: File '%s' is an unsupported log file format version.\n", GAppName, filename);
+                okay = 0;
+            }
         }
     }
 
@@ -280,25 +1570,26 @@ static int init_altrace_playback(const char *filename, void *userdata)
 
 static void quit_altrace_playback(void)
 {
-    const int io = logfd;
-
-    logfd = -1;
+    close_trace_input(&input);
     io_failure = 0;
     next_mapped_threadid = 0;
     trace_scope = 0;
+    last_wait_until = 0;
+    current_callerinfo = NULL;
     guserdata = NULL;
 
     fflush(stdout);
 
-    if ((io != -1) && (close(io) < 0)) {
-        fprintf(stderr, "%s: Failed to close OpenAL log file: %s\n", GAppName, strerror(errno));
-    }
-
     free_device_map();
     free_context_map();
     free_source_map();
     free_buffer_map();
     free_stackframe_map();
+    free_trace_callstacks();
+    free_trace_blobs();
+    free_trace_threads();
+    free_trace_modules();
+    free_module_symbols();
     free_threadid_map();
     free_devicelabel_map();
     free_contextlabel_map();
@@ -444,9 +1735,15 @@ const char *alenumString(const ALCenum x)
 const char *litString(const char *str)
 {
     if (str) {
-        const size_t slen = (strlen(str) + 1) * 2;
-        char *retval = (char *) get_ioblob(slen);
-        char *ptr = retval;
+        size_t slen = 3;  // two quotes and a null terminator.
+        const char *src;
+        char *retval;
+        char *ptr;
+        for (src = str; *src; src++) {
+            slen += (*src == '"') ? 2 : 1;
+        }
+        retval = (char *) get_ioblob(slen);
+        ptr = retval;
         *(ptr++) = '"';
         while (1) {
             const char ch = *(str++);
@@ -471,6 +1768,31 @@ const char *ptrString(const void *ptr)
     return ptr ? sprintf_alloc("%p", ptr) : "NULL";
 }
 
+const char *durationString(const uint64 ns)
+{
+    if (ns < 1000) {
+        return sprintf_alloc("%uns", (uint) ns);
+    } else if (ns < 1000000) {
+        return sprintf_alloc("%.3fus", ((double) ns) / 1000.0);
+    } else if (ns < 1000000000) {
+        return sprintf_alloc("%.3fms", ((double) ns) / 1000000.0);
+    }
+    return sprintf_alloc("%.3fs", ((double) ns) / 1000000000.0);
+}
+
+const char *payloadString(const int policy, const uint64 len, const uint64 storedlen, const uint64 hash, const uint32 downsample)
+{
+    switch ((PayloadPolicy) policy) {
+        case ALTRACE_PAYLOAD_FULL: return "recorded in full";
+        case ALTRACE_PAYLOAD_NONE: return sprintf_alloc("not recorded (%llu bytes)", (unsigned long long) len);
+        case ALTRACE_PAYLOAD_HASH: return sprintf_alloc("hash only (%llu bytes, hash 0x%016llx)", (unsigned long long) len, (unsigned long long) hash);
+        case ALTRACE_PAYLOAD_PREVIEW: return sprintf_alloc("first %llu of %llu bytes, rest silent", (unsigned long long) storedlen, (unsigned long long) len);
+        case ALTRACE_PAYLOAD_DOWNSAMPLE: return sprintf_alloc("downsampled 1/%u (%llu of %llu bytes)", (uint) downsample, (unsigned long long) storedlen, (unsigned long long) len);
+        default: break;
+    }
+    return "???";
+}
+
 const char *ctxString(ALCcontext *ctx)
 {
     char *label = ctx ? get_mapped_contextlabel(ctx) : NULL;
@@ -576,7 +1898,7 @@ static void decode_alcCaptureCloseDevice(void)
     ALCdevice *device = (ALCdevice *) IO_PTR();
     const ALCboolean retval = IO_ALCBOOLEAN();
     if (!io_failure) visit_alcCaptureCloseDevice(&callerinfo, retval, device);
-    add_devicelabel_to_map(device, NULL);
+    remove_devicelabel_from_map(device);
     IO_END();
 }
 
@@ -599,7 +1921,7 @@ static void decode_alcCloseDevice(void)
     ALCdevice *device = (ALCdevice *) IO_PTR();
     const ALCboolean retval = IO_ALCBOOLEAN();
     if (!io_failure) visit_alcCloseDevice(&callerinfo, retval, device);
-    add_devicelabel_to_map(device, NULL);
+    remove_devicelabel_from_map(device);
     IO_END();
 }
 
@@ -656,7 +1978,7 @@ static void decode_alcDestroyContext(void)
     IO_START(alcDestroyContext);
     ALCcontext *ctx = (ALCcontext *) IO_PTR();
     if (!io_failure) visit_alcDestroyContext(&callerinfo, ctx);
-    add_contextlabel_to_map(ctx, NULL);
+    remove_contextlabel_from_map(ctx);
     IO_END();
 }
 
@@ -719,7 +2041,7 @@ static void decode_alcCaptureSamples(void)
     void *origbuffer = IO_PTR();
     const ALCsizei samples = IO_ALCSIZEI();
     uint64 bloblen;
-    uint8 *blob = IO_BLOB(&bloblen);
+    uint8 *blob = IO_BLOB_COPY(&bloblen);  // the visitor might capture into this.
     if (!io_failure) visit_alcCaptureSamples(&callerinfo, device, origbuffer, blob, bloblen, samples);
     IO_END();
 }
@@ -1132,7 +2454,7 @@ static void decode_alDeleteSources(void)
     if (!io_failure) visit_alDeleteSources(&callerinfo, n, orignames, names);
 
     for (i = 0; i < n; i++) {
-        add_sourcelabel_to_map(names[i], NULL);
+        remove_sourcelabel_from_map(names[i]);
     }
 
     IO_END();
@@ -1502,7 +2824,7 @@ static void decode_alDeleteBuffers(void)
     if (!io_failure) visit_alDeleteBuffers(&callerinfo, n, orignames, names);
 
     for (i = 0; i < n; i++) {
-        add_bufferlabel_to_map(names[i], NULL);
+        remove_bufferlabel_from_map(names[i]);
     }
 
     IO_END();
@@ -1714,8 +3036,12 @@ static void decode_alTracePushScope(void)
 static void decode_alTracePopScope(void)
 {
     IO_START(alTracePopScope);
-    callerinfo.trace_scope--;
-    trace_scope--;
+    // logs that start partway through a run (capture triggers, flight
+    //  recorder dumps) can pop scopes they never saw pushed.
+    if (trace_scope > 0) {
+        callerinfo.trace_scope--;
+        trace_scope--;
+    }
     if (!io_failure) visit_alTracePopScope(&callerinfo);
     IO_END();
 }
@@ -1807,6 +3133,103 @@ static void decode_callstack_syms_event(void)
     }
 }
 
+// no visitor here either; IO_ENTRYINFO looks these up when a call refers to them.
+// The recorder numbers callstacks in the order it first sees them, but
+//  calls don't always finish (and get written) in the order they started,
+//  so a definition can come a little ahead of the ones before it. Anything
+//  further ahead than this is a corrupt tracefile, not a table to grow.
+#define MAX_CALLSTACK_ID_GAP 65536
+
+static void decode_new_callstack_event(void)
+{
+    const uint32 id = IO_UINT32();
+    const uint32 frames = IO_UINT32();
+    void **callstack;
+    uint32 i;
+
+    if (io_failure) {
+        return;
+    } else if (!(id & ALTRACE_CALLSTACK_ID_FLAG) && (id >= num_trace_callstacks) && ((id - num_trace_callstacks) >= MAX_CALLSTACK_ID_GAP)) {
+        fprintf(stderr, "%s: Bogus callstack #%u in log, only %u so far.\n", GAppName, (uint) id, (uint) num_trace_callstacks);
+        io_failure = 1;
+        return;
+    } else if (frames > MAX_CALLSTACKS) {
+        fprintf(stderr, "%s: Bogus callstack in log, %u frames deep.\n", GAppName, (uint) frames);
+        io_failure = 1;
+        return;
+    }
+
+    callstack = (void **) malloc((frames ? frames : 1) * sizeof (void *));
+    if (!callstack) {
+        out_of_memory();
+    }
+
+    for (i = 0; i < frames; i++) {
+        callstack[i] = IO_PTR();
+    }
+
+    if (io_failure || (id & ALTRACE_CALLSTACK_ID_FLAG)) {
+        free(callstack);
+        return;
+    }
+
+    if (id >= num_trace_callstacks) {
+        void *ptr = realloc(trace_callstacks, (id + 1) * sizeof (TraceCallstack));
+        if (!ptr) {
+            out_of_memory();
+        }
+        trace_callstacks = (TraceCallstack *) ptr;
+        memset(&trace_callstacks[num_trace_callstacks], '\0', ((id + 1) - num_trace_callstacks) * sizeof (TraceCallstack));
+        num_trace_callstacks = id + 1;
+    }
+
+    free(trace_callstacks[id].callstack);
+    trace_callstacks[id].frames = frames;
+    trace_callstacks[id].callstack = callstack;
+}
+
+// this one doesn't have a visitor either; it replaces the list of loaded
+//  modules we use to symbolize callstacks.
+#define MAX_TRACE_MODULES 65536
+
+static void decode_module_map_event(void)
+{
+    const uint32 num_modules = IO_UINT32();
+    uint32 i;
+
+    free_trace_modules();
+
+    if (io_failure) {
+        return;
+    } else if (num_modules > MAX_TRACE_MODULES) {
+        fprintf(stderr, "%s: Log has a module map with %u modules, which can't be right.\n", GAppName, (uint) num_modules);
+        io_failure = 1;
+        return;
+    }
+
+    trace_modules = (TraceModule *) calloc(num_modules ? num_modules : 1, sizeof (TraceModule));
+    if (!trace_modules) {
+        out_of_memory();
+    }
+
+    for (i = 0; i < num_modules; i++) {
+        TraceModule *mod = &trace_modules[num_trace_modules];
+        const char *path;
+        mod->bias = IO_PTR();
+        mod->start = IO_PTR();
+        mod->len = IO_UINT64();
+        path = IO_STRING();
+        if (io_failure) {
+            break;
+        } else if (path) {
+            mod->path = strdup(path);
+            if (!mod->path) {
+                out_of_memory();
+            }
+            num_trace_modules++;
+        }
+    }
+}
 
 static void decode_al_error_event(void)
 {
@@ -1926,9 +3349,282 @@ static void decode_buffer_state_changed_int(void)
     if (!io_failure) visit_buffer_state_changed_int(guserdata, name, param, newval);
 }
 
+// format 3 and later write these times in nanoseconds.
+static uint32 IO_TICKS(void)
+{
+    return (trace_format >= 3) ? (uint32) (IO_UINT64() / 1000000) : IO_UINT32();
+}
+
+static void decode_state_poll(void)
+{
+    const uint32 ticks = IO_TICKS();
+    ALCcontext *ctx = (ALCcontext *) IO_PTR();
+    if (!io_failure) {
+        last_wait_until = ticks;
+        visit_state_poll(guserdata, ctx, ticks);
+    }
+}
+
+// no visitor; IO_ENTRYINFO looks these up.
+// The recorder numbers threads from 1 again in each segment, but two
+//  threads' definitions can land in either order, so allow a little slack.
+#define MAX_THREAD_INDEX_GAP 4096
+
+static void decode_new_thread_event(void)
+{
+    const uint32 idx = IO_UINT32();
+    const uint64 logthreadid = IO_UINT64();
+
+    if (io_failure) {
+        return;
+    } else if ((idx >= num_trace_threads) && ((idx - num_trace_threads) >= MAX_THREAD_INDEX_GAP)) {
+        fprintf(stderr, "%s: Bogus thread #%u in log, only %u so far.\n", GAppName, (uint) idx, (uint) num_trace_threads);
+        io_failure = 1;
+        return;
+    }
+
+    if (idx >= num_trace_threads) {
+        void *ptr = realloc(trace_threads, (idx + 1) * sizeof (TraceThread));
+        if (!ptr) {
+            out_of_memory();
+        }
+        trace_threads = (TraceThread *) ptr;
+        memset(&trace_threads[num_trace_threads], '\0', ((idx + 1) - num_trace_threads) * sizeof (TraceThread));
+        num_trace_threads = idx + 1;
+    }
+
+    trace_threads[idx].logthreadid = logthreadid;
+    trace_threads[idx].last_timestamp = 0;
+}
+
+static void decode_overhead_summary(void)
+{
+    const uint32 numcategories = IO_UINT32();
+    const uint32 numentries = IO_UINT32();
+    OverheadSummary *entries;
+    uint32 i, j;
+
+    if (io_failure) {
+        return;
+    } else if (numentries > ALEE_MAX) {
+        fprintf(stderr, "%s: Log has an overhead summary for %u entry points, which can't be right.\n", GAppName, (uint) numentries);
+        io_failure = 1;
+        return;
+    }
+
+    entries = (OverheadSummary *) calloc(numentries ? numentries : 1, sizeof (OverheadSummary));
+    if (!entries) {
+        out_of_memory();
+    }
+
+    for (i = 0; i < numentries; i++) {
+        OverheadSummary *entry = &entries[i];
+        uint32 buckets;
+        entry->entryid = IO_EVENTENUM();
+        entry->calls = IO_UINT64();
+        for (j = 0; j < numcategories; j++) {
+            const uint64 ns = IO_UINT64();
+            if (j < ALTRACE_OVERHEAD_MAX) {
+                entry->ns[j] = ns;
+            }
+        }
+        buckets = IO_UINT32();
+        for (j = 0; !io_failure && (j < buckets); j++) {
+            const uint32 bucket = IO_UINT32();
+            const uint64 count = IO_UINT64();
+            if (bucket < ALTRACE_HISTOGRAM_BUCKETS) {
+                entry->histogram[bucket] = count;
+            }
+        }
+        if (io_failure) {
+            break;
+        }
+    }
+
+    if (!io_failure) {
+        visit_overhead_summary(guserdata, numentries, entries);
+    }
+    free(entries);
+}
+
+static void *contention_calloc(const uint32 count, const size_t len)
+{
+    void *retval = calloc(count ? count : 1, len);
+    if (!retval) {
+        out_of_memory();
+    }
+    return retval;
+}
+
+static void free_contention_summary(ContentionSummary *summary)
+{
+    uint32 i;
+    if (summary->threads) {
+        for (i = 0; i < summary->num_threads; i++) {
+            free(summary->threads[i].contexts);
+        }
+    }
+    if (summary->shared) {
+        for (i = 0; i < summary->num_shared; i++) {
+            free(summary->shared[i].threadids);
+        }
+    }
+    free(summary->threads);
+    free(summary->contexts);
+    free(summary->callsites);
+    free(summary->shared);
+}
+
+static void decode_contention_summary(void)
+{
+    ContentionSummary summary;
+    uint32 i, j;
+
+    memset(&summary, '\0', sizeof (summary));
+    summary.window_ns = IO_UINT64();
+
+    // each list is a count and then its items; a count this big means a bad log.
+    #define CONTENTION_LIST(count, list, type) \
+        if (!io_failure) { \
+            summary.count = IO_UINT32(); \
+            if (!io_failure && (summary.count > 0xFFFFFF)) { \
+                fprintf(stderr, "%s: Log has a contention summary with %u " #list ", which can't be right.\n", GAppName, (uint) summary.count); \
+                io_failure = 1; \
+            } \
+        } \
+        if (io_failure) { \
+            summary.count = 0; \
+        } \
+        summary.list = (type *) contention_calloc(summary.count, sizeof (type));
+
+    CONTENTION_LIST(num_threads, threads, ContentionThread);
+    for (i = 0; !io_failure && (i < summary.num_threads); i++) {
+        ContentionThread *thr = &summary.threads[i];
+        thr->threadid = map_logthreadid(IO_UINT64());
+        thr->calls = IO_UINT64();
+        thr->wait_ns = IO_UINT64();
+        thr->max_wait_ns = IO_UINT64();
+        thr->sources = IO_UINT32();
+        thr->buffers = IO_UINT32();
+        thr->num_contexts = IO_UINT32();
+        if (io_failure || (thr->num_contexts > 0xFFFF)) {
+            thr->num_contexts = 0;
+            io_failure = 1;
+        }
+        thr->contexts = (ContentionContextUse *) contention_calloc(thr->num_contexts, sizeof (ContentionContextUse));
+        for (j = 0; j < thr->num_contexts; j++) {
+            thr->contexts[j].ctx = (ALCcontext *) IO_PTR();
+            thr->contexts[j].calls = IO_UINT64();
+        }
+    }
+
+    CONTENTION_LIST(num_contexts, contexts, ContentionContext);
+    for (i = 0; !io_failure && (i < summary.num_contexts); i++) {
+        ContentionContext *cc = &summary.contexts[i];
+        cc->ctx = (ALCcontext *) IO_PTR();
+        cc->calls = IO_UINT64();
+        cc->handoffs = IO_UINT64();
+        cc->overlaps = IO_UINT64();
+    }
+
+    CONTENTION_LIST(num_callsites, callsites, ContentionCallsite);
+    for (i = 0; !io_failure && (i < summary.num_callsites); i++) {
+        ContentionCallsite *site = &summary.callsites[i];
+        site->entryid = IO_EVENTENUM();
+        site->callsite = IO_PTR();
+        site->calls = IO_UINT64();
+        site->wait_ns = IO_UINT64();
+        site->max_wait_ns = IO_UINT64();
+        site->symbol = io_failure ? NULL : symbolize_frame(site->callsite);
+    }
+
+    CONTENTION_LIST(num_shared, shared, ContentionShared);
+    for (i = 0; !io_failure && (i < summary.num_shared); i++) {
+        ContentionShared *obj = &summary.shared[i];
+        obj->is_buffer = IO_UINT32() ? AL_TRUE : AL_FALSE;
+        obj->name = IO_UINT32();
+        obj->calls = IO_UINT64();
+        obj->num_threads = IO_UINT32();
+        if (io_failure || (obj->num_threads > 0xFFFF)) {
+            obj->num_threads = 0;
+            io_failure = 1;
+        }
+        obj->threadids = (uint32 *) contention_calloc(obj->num_threads, sizeof (uint32));
+        for (j = 0; j < obj->num_threads; j++) {
+            obj->threadids[j] = map_logthreadid(IO_UINT64());
+        }
+    }
+
+    #undef CONTENTION_LIST
+
+    if (!io_failure) {
+        visit_contention_summary(guserdata, &summary);
+    }
+    free_contention_summary(&summary);
+}
+
+static void decode_capture_event(const ALboolean started)
+{
+    const uint32 ticks = IO_TICKS();
+    const char *reason = IO_STRING();
+    if (!io_failure) {
+        last_wait_until = ticks;
+        if (started) {
+            visit_capture_started(guserdata, ticks, reason);
+        } else {
+            visit_capture_stopped(guserdata, ticks, reason);
+        }
+    }
+}
+
+static void decode_latency_histograms(void)
+{
+    const uint32 subbits = IO_UINT32();
+    const uint32 numentries = IO_UINT32();
+    LatencyHistogram *entries;
+    uint32 i, j;
+
+    if (io_failure) {
+        return;
+    } else if (subbits != ALTRACE_HISTOGRAM_SUB_BITS) {
+        fprintf(stderr, "%s: Log has latency histograms with %u sub-bucket bits, but we only understand %u.\n", GAppName, (uint) subbits, (uint) ALTRACE_HISTOGRAM_SUB_BITS);
+        io_failure = 1;
+        return;
+    } else if (numentries > ALEE_MAX) {
+        fprintf(stderr, "%s: Log has latency histograms for %u entry points, which can't be right.\n", GAppName, (uint) numentries);
+        io_failure = 1;
+        return;
+    }
+
+    entries = (LatencyHistogram *) calloc(numentries ? numentries : 1, sizeof (LatencyHistogram));
+    if (!entries) {
+        out_of_memory();
+    }
+
+    for (i = 0; (i < numentries) && !io_failure; i++) {
+        LatencyHistogram *entry = &entries[i];
+        uint32 buckets;
+        entry->entryid = IO_EVENTENUM();
+        buckets = IO_UINT32();
+        for (j = 0; !io_failure && (j < buckets); j++) {
+            const uint32 bucket = IO_UINT32();
+            const uint64 count = IO_UINT64();
+            if (bucket < ALTRACE_HISTOGRAM_BUCKETS) {
+                entry->histogram[bucket] = count;
+                entry->calls += count;
+            }
+        }
+    }
+
+    if (!io_failure) {
+        visit_latency_histograms(guserdata, numentries, entries);
+    }
+    free(entries);
+}
+
 static void decode_eos(void)
 {
-    const uint32 ticks = IO_UINT32();
+    const uint32 ticks = IO_TICKS();
     if (!io_failure) visit_eos(guserdata, AL_TRUE, ticks);
 }
 
@@ -1939,28 +3635,14 @@ int process_tracelog(const char *fname, void *userdata)
 {
     int retval = 1;
     int eos = 0;
-    off_t fdoffset = 0;
-    off_t fdsize = 0;
 
     if (!init_altrace_playback(fname, userdata)) {
         return 0;
     }
 
-    fdoffset = lseek(logfd, 0, SEEK_CUR);
-    fdsize = lseek(logfd, 0, SEEK_END);
-    if ((lseek(logfd, fdoffset, SEEK_SET) == -1) || (fdoffset == -1) || (fdsize == -1)) {
-        fprintf(stderr, "%s: Failed to seek in file: %s\n", GAppName, strerror(errno));
-        io_failure = 1;
-    }
-
     while (!eos) {
-        if (!io_failure) {
-            fdoffset = lseek(logfd, 0, SEEK_CUR);
-            if (fdoffset == -1) {
-                fprintf(stderr, "%s: Failed to get current file offset: %s\n", GAppName, strerror(errno));
-                io_failure = 1;
-            }
-        }
+        // everything the last event decoded is done with; see get_ioblob().
+        reset_ioblobs();
 
         if (io_failure) {
             retval = 0;
@@ -1968,7 +3650,16 @@ int process_tracelog(const char *fname, void *userdata)
             break;
         }
 
-        if (!visit_progress(guserdata, fdoffset, fdsize)) {
+        // Running out of data right between two events means the app died
+        //  before it could write ALEE_EOS. Play back what we have.
+        if (input.pos == input.size) {
+            fprintf(stderr, "%s: Log file ends without an end-of-stream marker; the app probably crashed.\n", GAppName);
+            visit_eos(guserdata, AL_TRUE, last_wait_until);
+            eos = 1;
+            break;
+        }
+
+        if (!visit_progress(guserdata, (off_t) input.pos, (off_t) input.size)) {
             fprintf(stderr, "%s: Application cancelled file processing!\n", GAppName);
             visit_eos(guserdata, AL_FALSE, 0);
             retval = -1;
@@ -1984,6 +3675,42 @@ int process_tracelog(const char *fname, void *userdata)
                 decode_callstack_syms_event();
                 break;
 
+            case ALEE_MODULE_MAP:
+                decode_module_map_event();
+                break;
+
+            case ALEE_NEW_CALLSTACK:
+                decode_new_callstack_event();
+                break;
+
+            case ALEE_STATE_POLL:
+                decode_state_poll();
+                break;
+
+            case ALEE_NEW_THREAD:
+                decode_new_thread_event();
+                break;
+
+            case ALEE_CONTENTION_SUMMARY:
+                decode_contention_summary();
+                break;
+
+            case ALEE_OVERHEAD_SUMMARY:
+                decode_overhead_summary();
+                break;
+
+            case ALEE_LATENCY_HISTOGRAMS:
+                decode_latency_histograms();
+                break;
+
+            case ALEE_CAPTURE_STARTED:
+                decode_capture_event(AL_TRUE);
+                break;
+
+            case ALEE_CAPTURE_STOPPED:
+                decode_capture_event(AL_FALSE);
+                break;
+
             case ALEE_ALERROR_TRIGGERED:
                 decode_al_error_event();
                 break;
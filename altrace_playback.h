@@ -35,11 +35,101 @@ typedef struct CallerInfo
     int numargs;
     uint32 threadid;
     uint32 trace_scope;
-    uint32 wait_until;
-    off_t fdoffset;
+    uint32 wait_until;  // milliseconds since the recording started.
+    uint64 timestamp;  // the same in nanoseconds, if the tracefile has them.
+    uint64 duration;  // nanoseconds the real OpenAL call took, 0 if unknown.
+    uint64 cputime;  // CPU time the call used, if have_cputime (ALTRACE_CPU_TIME).
+    int have_cputime;
+    off_t fdoffset;  // position in the event stream, after the call's header.
+    off_t bloboffset;  // where the call's last blob payload is; see read_tracelog_data().
+    int payload_policy;  // a PayloadPolicy: how much audio alBufferData/alcCaptureSamples stored.
+    uint64 payload_len;  // the audio's real size, if it wasn't stored in full.
+    uint64 payload_stored_len;  // bytes actually in the tracefile (preview/downsample).
+    uint64 payload_hash;  // for ALTRACE_PAYLOAD_HASH.
+    uint32 payload_downsample;  // for ALTRACE_PAYLOAD_DOWNSAMPLE: kept one frame in this many.
     void *userdata;
 } CallerInfo;
 
+// One entry point's line from ALEE_OVERHEAD_SUMMARY (ALTRACE_OVERHEAD=1).
+//  ns[] is total nanoseconds per OverheadCategory, and the histogram is of
+//  each call's overhead; see histogram_percentile().
+typedef struct OverheadSummary
+{
+    EventEnum entryid;  // ALEE_STATE_POLL is the recorder's poller thread.
+    uint64 calls;
+    uint64 ns[ALTRACE_OVERHEAD_MAX];
+    uint64 histogram[ALTRACE_HISTOGRAM_BUCKETS];
+} OverheadSummary;
+
+// One entry point's real call durations from ALEE_LATENCY_HISTOGRAMS
+//  (ALTRACE_HISTOGRAMS=1); see histogram_percentile().
+typedef struct LatencyHistogram
+{
+    EventEnum entryid;
+    uint64 calls;
+    uint64 histogram[ALTRACE_HISTOGRAM_BUCKETS];
+} LatencyHistogram;
+
+// From ALEE_CONTENTION_SUMMARY (ALTRACE_CONTENTION=1). Thread IDs are the
+//  same ones CallerInfo::threadid uses, and times are nanoseconds.
+typedef struct ContentionContextUse
+{
+    ALCcontext *ctx;
+    uint64 calls;
+} ContentionContextUse;
+
+typedef struct ContentionThread
+{
+    uint32 threadid;
+    uint64 calls;
+    uint64 wait_ns;  // waiting for the recorder's API lock.
+    uint64 max_wait_ns;
+    uint32 sources;
+    uint32 buffers;
+    uint32 num_contexts;
+    ContentionContextUse *contexts;
+} ContentionThread;
+
+typedef struct ContentionContext
+{
+    ALCcontext *ctx;
+    uint64 calls;
+    uint64 handoffs;  // calls from another thread than the one before, within window_ns.
+    uint64 overlaps;  // handoffs while the other thread's call hadn't finished.
+} ContentionContext;
+
+typedef struct ContentionCallsite
+{
+    EventEnum entryid;
+    void *callsite;
+    const char *symbol;  // NULL if we couldn't find one.
+    uint64 calls;
+    uint64 wait_ns;
+    uint64 max_wait_ns;
+} ContentionCallsite;
+
+typedef struct ContentionShared
+{
+    ALboolean is_buffer;
+    ALuint name;
+    uint64 calls;
+    uint32 num_threads;
+    uint32 *threadids;
+} ContentionShared;
+
+typedef struct ContentionSummary
+{
+    uint64 window_ns;
+    uint32 num_threads;
+    ContentionThread *threads;
+    uint32 num_contexts;
+    ContentionContext *contexts;
+    uint32 num_callsites;
+    ContentionCallsite *callsites;
+    uint32 num_shared;  // sources and buffers more than one thread used.
+    ContentionShared *shared;
+} ContentionSummary;
+
 MAP_DECL(device, ALCdevice *, ALCdevice *);
 MAP_DECL(context, ALCcontext *, ALCcontext *);
 MAP_DECL(devicelabel, ALCdevice *, char *);
@@ -68,6 +158,19 @@ void visit_source_state_changed_uint(void *userdata, const ALuint name, const AL
 void visit_source_state_changed_float(void *userdata, const ALuint name, const ALenum param, const ALfloat newval);
 void visit_source_state_changed_float3(void *userdata, const ALuint name, const ALenum param, const ALfloat newval1, const ALfloat newval2, const ALfloat newval3);
 void visit_buffer_state_changed_int(void *userdata, const ALuint name, const ALenum param, const ALint newval);
+// The state changes after this were noticed by the recorder's poller thread
+//  at (wait_until), not by a call. (ctx) is the context the source changes
+//  belong to, or NULL for device changes.
+void visit_state_poll(void *userdata, ALCcontext *ctx, const uint32 wait_until);
+// The recorder started or stopped capturing at (wait_until), because of
+//  (reason). Calls the app made while capture was off aren't in the log;
+//  right after a start comes a trace scope of calls that rebuild the state
+//  everything was in at that moment.
+void visit_capture_started(void *userdata, const uint32 wait_until, const char *reason);
+void visit_capture_stopped(void *userdata, const uint32 wait_until, const char *reason);
+void visit_overhead_summary(void *userdata, const uint32 numentries, const OverheadSummary *entries);
+void visit_latency_histograms(void *userdata, const uint32 numentries, const LatencyHistogram *entries);
+void visit_contention_summary(void *userdata, const ContentionSummary *summary);
 void visit_eos(void *userdata, const ALboolean okay, const uint32 wait_until);
 int visit_progress(void *userdata, const off_t current, const off_t total);
 
@@ -77,6 +180,8 @@ const char *alcenumString(const ALCenum x);
 const char *alenumString(const ALCenum x);
 const char *litString(const char *str);
 const char *ptrString(const void *ptr);
+const char *durationString(const uint64 ns);
+const char *payloadString(const int policy, const uint64 len, const uint64 storedlen, const uint64 hash, const uint32 downsample);
 const char *ctxString(ALCcontext *ctx);
 const char *deviceString(ALCdevice *device);
 const char *sourceString(const ALuint name);
@@ -84,6 +189,12 @@ const char *bufferString(const ALuint name);
 
 int process_tracelog(const char *filename, void *userdata);
 
+// Read (len) bytes of a tracefile's event stream, starting at (offset),
+//  like CallerInfo::bloboffset. This deals with any container format, so
+//  don't fopen() the tracefile and seek to it yourself. Returns non-zero
+//  on success.
+int read_tracelog_data(const char *filename, const off_t offset, void *buf, const size_t len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -6,8 +6,22 @@
  *  This file written by Ryan C. Gordon.
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 1  // for dl_iterate_phdr() details in <link.h>
+#endif
+
 #include <execinfo.h>
 #include <float.h>
+#include <sys/mman.h>
+#include <limits.h>
+#include <stddef.h>
+#include <fnmatch.h>
+#include <signal.h>
+
+#ifndef __APPLE__
+#include <link.h>
+#define ALTRACE_HAVE_MODULE_MAP 1
+#endif
 
 const char *GAppName = "altrace_record";
 
@@ -32,6 +46,8 @@ AL_API void AL_APIENTRY alTraceBufferLabel(ALuint name, const ALchar *str);
 AL_API void AL_APIENTRY alTraceSourceLabel(ALuint name, const ALchar *str);
 AL_API void AL_APIENTRY alcTraceDeviceLabel(ALCdevice *device, const ALCchar *str);
 AL_API void AL_APIENTRY alcTraceContextLabel(ALCcontext *ctx, const ALCchar *str);
+AL_API void AL_APIENTRY alTraceStartCapture(void);
+AL_API void AL_APIENTRY alTraceStopCapture(void);
 
 
 static int logfd = -1;
@@ -46,23 +62,26 @@ typedef struct BufferWrapper
     ALint bits;
     ALint frequency;
     ALint size;   /* length of data in bytes. */
-    struct BufferWrapper *hash_prev;  /* previous item in same hash bucket. */
-    struct BufferWrapper *hash_next;  /* next item in same hash bucket. */
+    struct ContentionObject *contention;  /* ALTRACE_CONTENTION; outlives the buffer. */
 } BufferWrapper;
 
 typedef struct SourceWrapper
 {
+    /* the poller looks at these for every playing source, keep them together up front. */
     ALuint name;
     ALenum state;
-    ALenum type;
     ALuint buffer;
     ALint buffers_queued;
     ALint buffers_processed;
-    ALboolean source_relative;
-    ALboolean looping;
     ALint sec_offset;
     ALint sample_offset;
     ALint byte_offset;
+    struct SourceWrapper *playlist_next;
+    struct SourceWrapper *playlist_prev;
+
+    ALenum type;
+    ALboolean source_relative;
+    ALboolean looping;
     ALfloat gain;
     ALfloat min_gain;
     ALfloat max_gain;
@@ -76,12 +95,233 @@ typedef struct SourceWrapper
     ALfloat position[3];
     ALfloat velocity[3];
     ALfloat direction[3];
-    struct SourceWrapper *playlist_next;
-    struct SourceWrapper *playlist_prev;
-    struct SourceWrapper *hash_prev;  /* previous item in same hash bucket. */
-    struct SourceWrapper *hash_next;  /* next item in same hash bucket. */
+    struct ContentionObject *contention;  /* ALTRACE_CONTENTION; outlives the source. */
 } SourceWrapper;
 
+// Source and buffer wrappers are carved out of big chunks instead of
+//  malloc'ing each one, so a few thousand of them sit close together in
+//  memory. Deleted wrappers go on a free list for the next alGen*; chunks
+//  are never given back, same as the rest of our per-device state.
+#define WRAPPER_POOL_CHUNK 256
+
+typedef struct WrapperPool
+{
+    size_t itemsize;
+    void *freelist;  /* unused items, linked through their first pointer. */
+    void *chunks;  /* every chunk we allocated, linked through their first slot. */
+} WrapperPool;
+
+static WrapperPool source_pool = { sizeof (SourceWrapper), NULL, NULL };
+static WrapperPool buffer_pool = { sizeof (BufferWrapper), NULL, NULL };
+
+static void *pool_alloc(WrapperPool *pool)
+{
+    void *retval = pool->freelist;
+    if (!retval) {
+        const size_t itemsize = pool->itemsize;
+        uint8 *chunk = (uint8 *) malloc(itemsize * (WRAPPER_POOL_CHUNK + 1));
+        int i;
+        if (!chunk) {
+            out_of_memory();
+        }
+        *((void **) chunk) = pool->chunks;
+        pool->chunks = chunk;
+        // push them backwards, so we hand them out in address order.
+        for (i = WRAPPER_POOL_CHUNK; i > 0; i--) {
+            void *item = chunk + (itemsize * i);
+            *((void **) item) = pool->freelist;
+            pool->freelist = item;
+        }
+        retval = pool->freelist;
+    }
+    pool->freelist = *((void **) retval);
+    return retval;
+}
+
+static void pool_free(WrapperPool *pool, void *item)
+{
+    if (item) {
+        *((void **) item) = pool->freelist;
+        pool->freelist = item;
+    }
+}
+
+// Maps AL names to wrappers. Names are almost always small numbers handed
+//  out in order, so anything under HANDLE_DIRECT_LIMIT is just an index into
+//  a page of pointers, and pages are only allocated once something lands in
+//  them. Bigger names, which some implementations use, go into a little
+//  open addressing table instead.
+#define HANDLE_PAGE_BITS 8
+#define HANDLE_PAGE_SIZE (1 << HANDLE_PAGE_BITS)
+#define HANDLE_DIRECT_PAGES 256
+#define HANDLE_DIRECT_LIMIT ((uint32) (HANDLE_PAGE_SIZE * HANDLE_DIRECT_PAGES))
+
+typedef struct HandleSlot
+{
+    ALuint name;
+    void *item;  /* NULL if this slot is empty. */
+} HandleSlot;
+
+typedef struct HandleTable
+{
+    void **pages[HANDLE_DIRECT_PAGES];
+    HandleSlot *sparse;
+    uint32 sparse_capacity;  /* always a power of two. */
+    uint32 sparse_count;
+} HandleTable;
+
+static void *handle_table_get(const HandleTable *table, const ALuint name)
+{
+    if (name < HANDLE_DIRECT_LIMIT) {
+        void **page = table->pages[name >> HANDLE_PAGE_BITS];
+        return page ? page[name & (HANDLE_PAGE_SIZE - 1)] : NULL;
+    } else if (table->sparse_capacity) {
+        const uint32 mask = table->sparse_capacity - 1;
+        uint32 slot = hash_uint64(name) & mask;
+        while (table->sparse[slot].item) {
+            if (table->sparse[slot].name == name) {
+                return table->sparse[slot].item;
+            }
+            slot = (slot + 1) & mask;
+        }
+    }
+    return NULL;
+}
+
+static void handle_table_sparse_insert(HandleTable *table, const ALuint name, void *item)
+{
+    const uint32 mask = table->sparse_capacity - 1;
+    uint32 slot = hash_uint64(name) & mask;
+    while (table->sparse[slot].item && (table->sparse[slot].name != name)) {
+        slot = (slot + 1) & mask;
+    }
+    if (!table->sparse[slot].item) {
+        table->sparse_count++;
+    }
+    table->sparse[slot].name = name;
+    table->sparse[slot].item = item;
+}
+
+// (item) must not be NULL; use handle_table_remove() for that.
+static void handle_table_set(HandleTable *table, const ALuint name, void *item)
+{
+    if (name < HANDLE_DIRECT_LIMIT) {
+        void ***page = &table->pages[name >> HANDLE_PAGE_BITS];
+        if (!*page) {
+            *page = (void **) calloc(HANDLE_PAGE_SIZE, sizeof (void *));
+            if (!*page) {
+                out_of_memory();
+            }
+        }
+        (*page)[name & (HANDLE_PAGE_SIZE - 1)] = item;
+        return;
+    }
+
+    if (((table->sparse_count + 1) * 4) > (table->sparse_capacity * 3)) {
+        HandleSlot *oldslots = table->sparse;
+        const uint32 oldcapacity = table->sparse_capacity;
+        const uint32 newcapacity = oldcapacity ? (oldcapacity * 2) : 64;
+        uint32 i;
+        table->sparse = (HandleSlot *) calloc(newcapacity, sizeof (HandleSlot));
+        if (!table->sparse) {
+            out_of_memory();
+        }
+        table->sparse_capacity = newcapacity;
+        table->sparse_count = 0;
+        for (i = 0; i < oldcapacity; i++) {
+            if (oldslots[i].item) {
+                handle_table_sparse_insert(table, oldslots[i].name, oldslots[i].item);
+            }
+        }
+        free(oldslots);
+    }
+
+    handle_table_sparse_insert(table, name, item);
+}
+
+static void handle_table_remove(HandleTable *table, const ALuint name)
+{
+    if (name < HANDLE_DIRECT_LIMIT) {
+        void **page = table->pages[name >> HANDLE_PAGE_BITS];
+        if (page) {
+            page[name & (HANDLE_PAGE_SIZE - 1)] = NULL;
+        }
+    } else if (table->sparse_capacity) {
+        const uint32 mask = table->sparse_capacity - 1;
+        HandleSlot *slots = table->sparse;
+        uint32 slot = hash_uint64(name) & mask;
+        uint32 next = slot;
+        while (slots[slot].item && (slots[slot].name != name)) {
+            slot = (slot + 1) & mask;
+        }
+        if (!slots[slot].item) {
+            return;  // not here.
+        }
+
+        // shift later items in the same run back, so lookups never hit a hole before their item.
+        while (1) {
+            uint32 home;
+            next = (next + 1) & mask;
+            if (!slots[next].item) {
+                break;
+            }
+            home = hash_uint64(slots[next].name) & mask;
+            if ((slot <= next) ? ((slot < home) && (home <= next)) : ((slot < home) || (home <= next))) {
+                continue;  // it's still reachable from its home slot.
+            }
+            slots[slot] = slots[next];
+            slot = next;
+        }
+        slots[slot].name = 0;
+        slots[slot].item = NULL;
+        table->sparse_count--;
+    }
+}
+
+// Walk every item in the table; start (*pos) at zero, stops when this returns NULL.
+//  Items can be changed, but not added or removed, during the walk.
+static void *handle_table_iterate(const HandleTable *table, uint32 *pos)
+{
+    uint32 i = *pos;
+    void *retval = NULL;
+
+    while (!retval && (i < HANDLE_DIRECT_LIMIT)) {
+        void **page = table->pages[i >> HANDLE_PAGE_BITS];
+        if (!page) {
+            i = (i | (HANDLE_PAGE_SIZE - 1)) + 1;  // skip the whole page.
+        } else {
+            retval = page[i & (HANDLE_PAGE_SIZE - 1)];
+            i++;
+        }
+    }
+
+    while (!retval && ((i - HANDLE_DIRECT_LIMIT) < table->sparse_capacity)) {
+        retval = table->sparse[i - HANDLE_DIRECT_LIMIT].item;
+        i++;
+    }
+
+    *pos = i;
+    return retval;
+}
+
+// gives every item in the table back to (pool), and empties the table.
+static void handle_table_free(HandleTable *table, WrapperPool *pool)
+{
+    uint32 pos = 0;
+    void *item;
+    int i;
+
+    while ((item = handle_table_iterate(table, &pos)) != NULL) {
+        pool_free(pool, item);
+    }
+
+    for (i = 0; i < HANDLE_DIRECT_PAGES; i++) {
+        free(table->pages[i]);
+    }
+    free(table->sparse);
+    memset(table, '\0', sizeof (*table));
+}
+
 struct ContextWrapper;
 
 typedef struct DeviceWrapper
@@ -92,9 +332,15 @@ typedef struct DeviceWrapper
     ALCboolean connected;
     ALCboolean supports_disconnect_ext;
     ALCint capture_samples;
+    ALCboolean capture_started;
+    ALCuint capture_frequency;  /* what alcCaptureOpenDevice was given, for capture snapshots. */
+    ALCenum capture_format;
+    ALCsizei capture_buffersize;
     int samplesize;   /* size of a capture device sample in bytes */
     char *extension_string;
-    BufferWrapper *wrapped_buffer_hash[256];
+    HandleTable wrapped_buffers;
+    ALboolean checked_buffer_defaults;
+    uint32 buffer_default_mismatches;  /* BufferProperty bits that weren't what we expected on a new buffer. */
     struct ContextWrapper *contexts;
     struct DeviceWrapper *prev;
     struct DeviceWrapper *next;
@@ -107,7 +353,9 @@ typedef struct ContextWrapper
     char *extension_string;
     ALenum errorlatch;
     ALboolean checked_static_state;
-    SourceWrapper *wrapped_source_hash[256];
+    ALboolean checked_source_defaults;
+    uint32 source_default_mismatches;  /* SourceProperty bits that weren't what we expected on a new source. */
+    HandleTable wrapped_sources;
     ALenum distance_model;
     ALfloat doppler_factor;
     ALfloat doppler_velocity;
@@ -117,6 +365,8 @@ typedef struct ContextWrapper
     ALfloat listener_orientation[6];
     ALfloat listener_gain;
     SourceWrapper *playlist;
+    int unlocked_calls;  /* calls on this context in their real call without the API lock. */
+    struct ContentionContext *contention;  /* ALTRACE_CONTENTION; outlives the context. */
     struct ContextWrapper *next;
     struct ContextWrapper *prev;
 } ContextWrapper;
@@ -138,8 +388,9 @@ void out_of_memory(void)
 }
 
 // override _exit(), which terminates the process without running library
-//  destructors, so we can close our log file, etc.
-void _exit(int status)
+//  destructors, so we can close our log file, etc. This has to be exported,
+//  since we build with hidden symbol visibility.
+__attribute__((visibility("default"))) void _exit(int status)
 {
     quit_altrace_record();
     _Exit(status);  // just use _Exit(), which does the same thing but no one really uses.  :P
@@ -153,303 +404,3919 @@ NORETURN static void IO_WRITE_FAIL(void)
     _exit(42);
 }
 
-static void writele32(const uint32 x)
+static int write_fully(const int fd, const void *_data, size_t len)
 {
-    const uint32 y = swap32(x);
-    if (write(logfd, &y, sizeof (y)) != sizeof (y)) {
-        IO_WRITE_FAIL();
+    const uint8 *data = (const uint8 *) _data;
+    while (len > 0) {
+        const ssize_t rc = write(fd, data, len);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        data += rc;
+        len -= (size_t) rc;
     }
+    return 1;
 }
 
-static void writele64(const uint64 x)
+
+// Output backends. The output path hands them the raw event stream through
+//  write(), and calls commit() whenever everything written so far ends on
+//  a record boundary.
+typedef struct OutputBackend
 {
-    const uint64 y = swap64(x);
-    if (write(logfd, &y, sizeof (y)) != sizeof (y)) {
-        IO_WRITE_FAIL();
-    }
+    int (*open)(const char *filename);
+    int (*write)(const void *data, size_t len);
+    void (*commit)(void);
+    int (*close)(void);
+} OutputBackend;
+
+static const OutputBackend *output = NULL;
+
+static int fd_output_open(const char *filename)
+{
+    logfd = open(filename, O_WRONLY | O_TRUNC | O_CREAT, 0644);
+    return (logfd != -1);
 }
 
-static void IO_INT32(const int32 x)
+static int fd_output_write(const void *data, size_t len)
 {
-    union { int32 si32; uint32 ui32; } cvt;
-    cvt.si32 = x;
-    writele32(cvt.ui32);
+    return write_fully(logfd, data, len);
 }
 
-static void IO_UINT32(const uint32 x)
+static void fd_output_commit(void)
 {
-    writele32(x);
+    // no-op, write() already put it in the kernel's hands.
 }
 
-static void IO_UINT64(const uint64 x)
+static int fd_output_close(void)
 {
-    writele64(x);
+    const int rc = close(logfd);
+    logfd = -1;
+    return (rc == 0);
 }
 
-static void IO_ALCSIZEI(const ALCsizei x)
+static const OutputBackend fd_output = {
+    fd_output_open, fd_output_write, fd_output_commit, fd_output_close
+};
+
+
+// ALTRACE_OUTPUT=mmap writes the tracefile through a series of mmap'd
+//  segments (see ALTRACE_SEGMENT_MAGIC). Data is just a memcpy into the
+//  page cache, so it survives the process crashing or being SIGKILLed, and
+//  each segment's header says how much of it holds complete records.
+#define DEFAULT_SEGMENT_SIZE (16 * 1024 * 1024)
+
+static uint64 segment_size = DEFAULT_SEGMENT_SIZE;
+static uint8 *segment = NULL;
+static uint32 segment_index = 0;
+static uint64 segment_used = 0;  // bytes of event stream in this segment.
+static uint32 segment_first_uncommitted = 0;
+
+static void set_segment_header(uint8 *hdr, const uint32 idx, const uint64 committed)
 {
-    IO_UINT64((uint64) x);
+    const uint32 magic = swap32(ALTRACE_SEGMENT_MAGIC);
+    const uint32 sidx = swap32(idx);
+    const uint64 ssize = swap64(segment_size);
+    const uint64 scommitted = swap64(committed);
+    memset(hdr, '\0', ALTRACE_SEGMENT_HEADER_SIZE);
+    memcpy(hdr, &magic, 4);
+    memcpy(hdr + 4, &sidx, 4);
+    memcpy(hdr + 8, &ssize, 8);
+    memcpy(hdr + 16, &scommitted, 8);
 }
 
-static void IO_ALSIZEI(const ALsizei x)
+static int map_segment(const uint32 idx)
 {
-    IO_UINT64((uint64) x);
+    const off_t offset = (off_t) (idx * segment_size);
+    void *ptr;
+
+    if (ftruncate(logfd, offset + (off_t) segment_size) == -1) {
+        return 0;
+    }
+
+    ptr = mmap(NULL, (size_t) segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, logfd, offset);
+    if (ptr == MAP_FAILED) {
+        return 0;
+    }
+
+    if (segment) {
+        munmap(segment, (size_t) segment_size);
+    }
+
+    segment = (uint8 *) ptr;
+    segment_index = idx;
+    segment_used = 0;
+    set_segment_header(segment, idx, 0);
+    return 1;
 }
 
-static void IO_FLOAT(const float x)
+static int mmap_output_open(const char *filename)
 {
-    union { float f; uint32 ui32; } cvt;
-    cvt.f = x;
-    IO_UINT32(cvt.ui32);
+    const long pagesize = sysconf(_SC_PAGESIZE);
+    const uint64 po2 = (pagesize > 0) ? (uint64) pagesize : 4096;
+
+    // segments have to start on a page boundary.
+    segment_size = ((segment_size + (po2 - 1)) / po2) * po2;
+    if (segment_size < (ALTRACE_SEGMENT_HEADER_SIZE * 2)) {
+        segment_size = po2;
+    }
+
+    segment = NULL;
+    segment_first_uncommitted = 0;
+    logfd = open(filename, O_RDWR | O_TRUNC | O_CREAT, 0644);
+    if (logfd == -1) {
+        return 0;
+    } else if (!map_segment(0)) {
+        const int err = errno;
+        close(logfd);
+        logfd = -1;
+        errno = err;
+        return 0;
+    }
+    return 1;
 }
 
-static void IO_DOUBLE(const double x)
+static int mmap_output_write(const void *_data, size_t len)
 {
-    union { double d; uint64 ui64; } cvt;
-    cvt.d = x;
-    IO_UINT64(cvt.ui64);
+    const uint64 capacity = segment_size - ALTRACE_SEGMENT_HEADER_SIZE;
+    const uint8 *data = (const uint8 *) _data;
+    while (len > 0) {
+        uint64 cpy = capacity - segment_used;
+        if (cpy == 0) {
+            if (!map_segment(segment_index + 1)) {
+                return 0;
+            }
+            continue;
+        } else if (cpy > len) {
+            cpy = len;
+        }
+        memcpy(segment + ALTRACE_SEGMENT_HEADER_SIZE + segment_used, data, (size_t) cpy);
+        segment_used += cpy;
+        data += cpy;
+        len -= (size_t) cpy;
+    }
+    return 1;
 }
 
-static void IO_STRING(const char *str)
+static void mmap_output_commit(void)
 {
-    if (!str) {
-        IO_UINT64(0xFFFFFFFFFFFFFFFFull);
-    } else {
-        const size_t len = strlen(str);
-        IO_UINT64((uint64) len);
-        if (len > 0) {
-            if (write(logfd, str, len) != len) IO_WRITE_FAIL();
+    const uint64 capacity = segment_size - ALTRACE_SEGMENT_HEADER_SIZE;
+    uint8 hdr[ALTRACE_SEGMENT_HEADER_SIZE];
+    uint32 i;
+
+    // The current segment goes first: if we die before the earlier ones are
+    //  marked full, a reader just stops at the last commit in those.
+    set_segment_header(segment, segment_index, segment_used);
+
+    // Segments we've moved past are unmapped already, but this only happens
+    //  once per segment.
+    for (i = segment_first_uncommitted; i < segment_index; i++) {
+        set_segment_header(hdr, i, capacity);
+        if (pwrite(logfd, hdr, sizeof (hdr), (off_t) (i * segment_size)) != sizeof (hdr)) {
+            break;  // !!! FIXME: report this?
         }
     }
+    segment_first_uncommitted = i;
 }
 
-static void IO_BLOB(const uint8 *data, const uint64 len)
+static int mmap_output_close(void)
 {
-    if (!data) {
-        IO_UINT64(0xFFFFFFFFFFFFFFFFull);
+    const off_t end = (off_t) ((segment_index * segment_size) + ALTRACE_SEGMENT_HEADER_SIZE + segment_used);
+    int okay = 1;
+
+    if (segment) {
+        mmap_output_commit();
+        munmap(segment, (size_t) segment_size);
+        segment = NULL;
+    }
+
+    // drop the unused part of the last segment.
+    if (ftruncate(logfd, end) == -1) {
+        okay = 0;
+    }
+
+    if (close(logfd) == -1) {
+        okay = 0;
+    }
+    logfd = -1;
+    return okay;
+}
+
+static const OutputBackend mmap_output = {
+    mmap_output_open, mmap_output_write, mmap_output_commit, mmap_output_close
+};
+
+
+// ALTRACE_COMPRESS=1 sits in front of whichever backend we picked and hands
+//  it compressed blocks (see ALTRACE_COMPRESSED_MAGIC) instead of the raw
+//  event stream. Blocks are cut on a commit once they're full, so they
+//  usually end between records; a record that doesn't fit in what's left of
+//  the block is split across blocks instead of making it grow, which
+//  playback doesn't mind. A block that has been filling for
+//  COMPRESS_FLUSH_MS is cut early, by the next commit or by the writer or
+//  poller thread if the app has gone quiet (see compress_flush_if_stale());
+//  if the process dies, we lose what went into the current block since then.
+#define DEFAULT_COMPRESS_BLOCK_SIZE (128 * 1024)
+#define MIN_COMPRESS_BLOCK_SIZE (4 * 1024)
+#define MAX_COMPRESS_BLOCK_SIZE (1024 * 1024 * 1024)  // lengths have to stay clear of ALTRACE_BLOCK_STORED_RAW.
+#define COMPRESS_FLUSH_MS 250
+
+static const OutputBackend *compress_inner = NULL;
+static uint32 compress_block_size = DEFAULT_COMPRESS_BLOCK_SIZE;
+static uint8 *compress_raw = NULL;
+static size_t compress_raw_len = 0;
+static size_t compress_raw_allocated = 0;
+static uint8 *compress_buf = NULL;
+static size_t compress_buf_allocated = 0;
+static uint64 compress_container_pos = 0;
+static uint64 compress_stream_pos = 0;
+static uint64 *compress_index = NULL;  // container offset, stream offset pairs.
+static uint32 compress_blocks = 0;
+static uint32 compress_index_allocated = 0;
+static uint32 compress_last_flush = 0;
+
+static int compress_write_inner(const void *data, const size_t len)
+{
+    if (!compress_inner->write(data, len)) {
+        return 0;
+    }
+    compress_container_pos += len;
+    return 1;
+}
+
+static int compress_flush_block(void)
+{
+    const size_t needed = ALTRACE_BLOCK_HEADER_SIZE + lz4_compress_bound(compress_raw_len);
+    uint32 hdr[2];
+    size_t len;
+
+    compress_last_flush = now();
+    if (compress_raw_len == 0) {
+        return 1;
+    }
+
+    if (compress_buf_allocated < needed) {
+        void *ptr = realloc(compress_buf, needed);
+        if (!ptr) {
+            out_of_memory();
+        }
+        compress_buf = (uint8 *) ptr;
+        compress_buf_allocated = needed;
+    }
+
+    if (compress_blocks >= compress_index_allocated) {
+        const uint32 newalloc = compress_index_allocated ? (compress_index_allocated * 2) : 256;
+        void *ptr = realloc(compress_index, newalloc * sizeof (uint64) * 2);
+        if (!ptr) {
+            out_of_memory();
+        }
+        compress_index = (uint64 *) ptr;
+        compress_index_allocated = newalloc;
+    }
+
+    len = lz4_compress(compress_raw, compress_raw_len, compress_buf + ALTRACE_BLOCK_HEADER_SIZE, needed - ALTRACE_BLOCK_HEADER_SIZE);
+    if ((len == 0) || (len >= compress_raw_len)) {
+        // didn't help, store it as-is.
+        len = compress_raw_len;
+        memcpy(compress_buf + ALTRACE_BLOCK_HEADER_SIZE, compress_raw, len);
+        hdr[1] = swap32(((uint32) len) | ALTRACE_BLOCK_STORED_RAW);
     } else {
-        const size_t slen = (size_t) len;
-        IO_UINT64(len);
-        if (len > 0) {
-            if (write(logfd, data, slen) != slen) IO_WRITE_FAIL();
+        hdr[1] = swap32((uint32) len);
+    }
+    hdr[0] = swap32((uint32) compress_raw_len);
+    memcpy(compress_buf, hdr, sizeof (hdr));
+
+    compress_index[compress_blocks * 2] = compress_container_pos;
+    compress_index[(compress_blocks * 2) + 1] = compress_stream_pos;
+    compress_blocks++;
+
+    if (!compress_write_inner(compress_buf, ALTRACE_BLOCK_HEADER_SIZE + len)) {
+        return 0;
+    }
+
+    compress_stream_pos += compress_raw_len;
+    compress_raw_len = 0;
+    return 1;
+}
+
+static int compressed_output_open(const char *filename)
+{
+    uint32 hdr[4];
+
+    compress_raw_len = 0;
+    compress_container_pos = 0;
+    compress_stream_pos = 0;
+    compress_blocks = 0;
+    compress_last_flush = now();
+
+    if (!compress_inner->open(filename)) {
+        return 0;
+    }
+
+    hdr[0] = swap32(ALTRACE_COMPRESSED_MAGIC);
+    hdr[1] = swap32(ALTRACE_COMPRESSED_FORMAT);
+    hdr[2] = swap32(compress_block_size);
+    hdr[3] = 0;
+    if (!compress_write_inner(hdr, sizeof (hdr))) {
+        const int err = errno;
+        compress_inner->close();
+        errno = err;
+        return 0;
+    }
+    compress_inner->commit();
+    return 1;
+}
+
+static int compressed_output_write(const void *_data, size_t len)
+{
+    const uint8 *data = (const uint8 *) _data;
+
+    if (!compress_raw) {
+        compress_raw = (uint8 *) malloc(compress_block_size);
+        if (!compress_raw) {
+            out_of_memory();
+        }
+        compress_raw_allocated = compress_block_size;
+    }
+
+    while (len > 0) {
+        size_t cpy = compress_raw_allocated - compress_raw_len;
+        if (cpy == 0) {  // full, and this write still has more.
+            if (!compress_flush_block()) {
+                return 0;
+            }
+            continue;
+        } else if (cpy > len) {
+            cpy = len;
         }
+        memcpy(compress_raw + compress_raw_len, data, cpy);
+        compress_raw_len += cpy;
+        data += cpy;
+        len -= cpy;
     }
+
+    return 1;
 }
 
-static void IO_EVENTENUM(const EventEnum x)
+static void compressed_output_commit(void)
 {
-    IO_UINT32((uint32) x);
+    // the first block (just the file header) goes out right away, so even a
+    //  very short recording that crashes is recognizable as a tracefile.
+    if (compress_raw_len == 0) {
+        return;
+    } else if ((compress_blocks == 0) || (compress_raw_len >= compress_block_size) || ((now() - compress_last_flush) >= COMPRESS_FLUSH_MS)) {
+        if (!compress_flush_block()) {
+            IO_WRITE_FAIL();
+        }
+        compress_inner->commit();
+    }
 }
 
-static void IO_PTR(const void *ptr)
+static int compressed_output_close(void)
 {
-    IO_UINT64((uint64) (size_t) ptr);
+    int okay = compress_flush_block();
+    const uint64 endblock = compress_container_pos;
+    uint32 i;
+
+    if (okay) {
+        uint32 hdr[2];
+        hdr[0] = 0;
+        hdr[1] = swap32(compress_blocks);
+        okay = compress_write_inner(hdr, sizeof (hdr));
+    }
+
+    for (i = 0; okay && (i < compress_blocks * 2); i++) {
+        const uint64 val = swap64(compress_index[i]);
+        okay = compress_write_inner(&val, sizeof (val));
+    }
+
+    if (okay) {
+        uint64 val[2];
+        val[0] = swap64(endblock);
+        val[1] = swap64(compress_stream_pos);
+        okay = compress_write_inner(val, sizeof (val));
+    }
+
+    if (okay) {
+        uint8 footer[16];
+        const uint64 end = swap64(endblock);
+        const uint32 magic = swap32(ALTRACE_COMPRESSED_INDEX_MAGIC);
+        memset(footer, '\0', sizeof (footer));
+        memcpy(footer, &end, 8);
+        memcpy(footer + 8, &magic, 4);
+        okay = compress_write_inner(footer, sizeof (footer));
+    }
+
+    compress_inner->commit();
+    if (!compress_inner->close()) {
+        okay = 0;
+    }
+
+    free(compress_raw);
+    compress_raw = NULL;
+    compress_raw_allocated = 0;
+    free(compress_buf);
+    compress_buf = NULL;
+    compress_buf_allocated = 0;
+    free(compress_index);
+    compress_index = NULL;
+    compress_index_allocated = 0;
+    return okay;
+}
+
+static const OutputBackend compressed_output = {
+    compressed_output_open, compressed_output_write, compressed_output_commit, compressed_output_close
+};
+
+// Flight recorder segments and rolled tracefiles both cut the event stream
+//  into pieces that have to stand on their own; see start_new_segment().
+static int segmented_output = 0;
+static uint32 segment_generation = 0;  // bumped for every new segment.
+static const char *tracefile_procname = NULL;  // see choose_tracefile_name().
+
+// ALTRACE_FLIGHT_RECORDER and ALTRACE_FLIGHT_SECONDS keep the tracefile in
+//  memory instead of writing it, and only hold on to the last part of it.
+//  The event stream is split into segments; every segment after the first
+//  starts over with its own thread, callstack and blob definitions and a
+//  state snapshot (see flight_rotate()), so dropping the oldest one never
+//  leaves later ones referring to anything that's gone. When something goes
+//  wrong, flight_dump() writes the preamble and whatever segments are left
+//  through the output we would have used otherwise.
+#define FLIGHT_SEGMENTS 4
+
+typedef struct FlightSegment
+{
+    uint8 *data;
+    size_t len;
+    size_t allocated;
+    size_t snapshot_len;  // how much of this is the snapshot it starts with.
+    uint64 start_ns;
+} FlightSegment;
+
+static const OutputBackend *flight_inner = NULL;
+static int flight_recorder = 0;
+static uint64 flight_segment_size = 0;  // ALTRACE_FLIGHT_RECORDER / (FLIGHT_SEGMENTS - 1), 0 for no limit.
+static uint64 flight_window_ns = 0;  // ALTRACE_FLIGHT_SECONDS, 0 for no limit.
+static FlightSegment flight_preamble;  // file header and initial module map.
+static FlightSegment flight_segments[FLIGHT_SEGMENTS];
+static int flight_first = 0;  // oldest segment still around.
+static int flight_count = 0;
+static int flight_in_preamble = 1;
+static int flight_rotate_pending = 0;
+
+static FlightSegment *flight_current_segment(void)
+{
+    return &flight_segments[(flight_first + flight_count - 1) % FLIGHT_SEGMENTS];
+}
+
+static void flight_append(FlightSegment *seg, const void *data, const size_t len)
+{
+    if ((seg->len + len) > seg->allocated) {
+        size_t newalloc = seg->allocated ? seg->allocated : (64 * 1024);
+        void *ptr;
+        while (newalloc < (seg->len + len)) {
+            newalloc *= 2;
+        }
+        ptr = realloc(seg->data, newalloc);
+        if (!ptr) {
+            out_of_memory();
+        }
+        seg->data = (uint8 *) ptr;
+        seg->allocated = newalloc;
+    }
+    memcpy(seg->data + seg->len, data, len);
+    seg->len += len;
 }
 
-static void IO_ALCENUM(ALCenum e)
+static int flight_output_open(const char *filename)
 {
-    IO_UINT32((uint32) e);
+    // nothing touches the disk until there's something to dump.
+    memset(flight_segments, '\0', sizeof (flight_segments));
+    memset(&flight_preamble, '\0', sizeof (flight_preamble));
+    flight_first = 0;
+    flight_count = 1;
+    flight_in_preamble = 1;
+    flight_rotate_pending = 0;
+    return 1;
 }
 
-static void IO_ENUM(ALenum e)
+static int flight_output_write(const void *data, size_t len)
 {
-    IO_UINT32((uint32) e);
+    if (flight_in_preamble) {
+        flight_append(&flight_preamble, data, len);
+    } else {
+        FlightSegment *seg = flight_current_segment();
+        flight_append(seg, data, len);
+        // the snapshot doesn't count, or a big one would make us rotate after every call.
+        if (flight_segment_size && ((seg->len - seg->snapshot_len) >= flight_segment_size)) {
+            flight_rotate_pending = 1;
+        } else if (flight_window_ns && ((now_ns() - seg->start_ns) >= (flight_window_ns / (FLIGHT_SEGMENTS - 1)))) {
+            flight_rotate_pending = 1;
+        }
+    }
+    return 1;
 }
 
-static void IO_ALCBOOLEAN(ALCboolean b)
+static void flight_output_commit(void)
 {
-    IO_UINT32((uint32) b);
+    // no-op, it's all in memory.
 }
 
-static void IO_BOOLEAN(ALboolean b)
+static int flight_output_close(void)
 {
-    IO_UINT32((uint32) b);
+    int i;
+    for (i = 0; i < FLIGHT_SEGMENTS; i++) {
+        free(flight_segments[i].data);
+    }
+    free(flight_preamble.data);
+    memset(flight_segments, '\0', sizeof (flight_segments));
+    memset(&flight_preamble, '\0', sizeof (flight_preamble));
+    flight_count = 0;
+    return 1;
 }
 
+static const OutputBackend flight_output = {
+    flight_output_open, flight_output_write, flight_output_commit, flight_output_close
+};
 
-static void free_hash_item_stackframe(void *from, char *to) { free(to); }
-static uint8 hash_stackframe(void *from) {
-    // everything is going to end in a multiple of pointer size, so flatten down.
-    const size_t val = ((size_t) from) / (sizeof (void *));
-    return (uint8) (val & 0xFF);  // good enough, I guess.
+// what makes flight_dump() run. These are all handled after the call that
+//  asked for it is committed (see segment_requests_after_call()), so that
+//  call is in the dump. After an error dumps, more errors don't until the oldest
+//  segment is gone, so an app spewing errors doesn't spew tracefiles, too.
+#define FLIGHT_DUMP_MESSAGE "altrace: dump flight recording"
+
+static const char *flight_dump_request = NULL;
+static int flight_error_dump_armed = 1;
+static char flight_error_reason[64];
+
+// async-signal-safe, so the signal handlers can use it.
+static void request_flight_dump(const char *reason)
+{
+    __atomic_store_n(&flight_dump_request, reason, __ATOMIC_RELEASE);
 }
-HASH_MAP(stackframe, void *, char *)
 
-// backtrace_symbols() is pretty expensive, so we don't want to run it
-//  dozens of times per-frame. So we call it on individual frames when
-//  we haven't seen them before, assuming most of our calls come from a
-//  handful of places, and even there we can reuse most of the callstack
-//  frames anyhow.
-static char *get_callstack_sym(void *frame, int *_seen_before)
+// called once the file header is written; everything after it is segments.
+static void flight_end_preamble(void)
 {
-    char *retval = get_mapped_stackframe(frame);
-    if (retval) {
-        *_seen_before = 1;
-    } else {
-        char **syms = backtrace_symbols(&frame, 1);
-        char *sym = syms[0];
-        if (sym && (*sym == '0')) {  // skip '0\s+' on macOS; it's counting frames assuming there's more than one.
-            while (*(++sym) == ' ') { /* spin */ }
-        }
-        retval = sym ? strdup(sym) : NULL;
-        free(syms);
-        *_seen_before = 0;
-        if (retval) {
-            add_stackframe_to_map(frame, retval);
+    flight_in_preamble = 0;
+    flight_segments[flight_first].start_ns = now_ns();
+}
+
+// ALTRACE_ROLL_SIZE and ALTRACE_ROLL_MINUTES start a new tracefile every so
+//  often, and ALTRACE_ROLL_KEEP deletes the oldest ones. The writer thread
+//  notices when it's time (roll_wanted), the next call to finish starts a
+//  new segment and notes the sequence number of its first record
+//  (roll_at_seq), and the writer switches files right before it writes that
+//  record. The app never waits on opening, closing or deleting files, which
+//  is why rolling turns on ALTRACE_ASYNC.
+#define NO_ROLL_PENDING (~((uint64) 0))
+
+static const OutputBackend *roll_inner = NULL;
+static int rolling = 0;
+static uint64 roll_size = 0;  // ALTRACE_ROLL_SIZE, 0 for no limit.
+static uint64 roll_interval_ns = 0;  // ALTRACE_ROLL_MINUTES, 0 for no limit.
+static uint32 roll_keep = 0;  // ALTRACE_ROLL_KEEP, 0 to keep them all.
+static uint64 roll_bytes = 0;  // written to the current tracefile.
+static uint64 roll_started = 0;  // when the current tracefile was opened.
+static int roll_wanted = 0;
+static uint64 roll_at_seq = NO_ROLL_PENDING;
+static char **roll_files = NULL;  // the ones we haven't deleted, oldest first.
+static uint32 num_roll_files = 0;
+
+static char *choose_tracefile_name(const char *procname);
+static void roll_tracefile(void);
+
+static void roll_add_file(const char *filename)
+{
+    void *ptr = realloc(roll_files, (num_roll_files + 1) * sizeof (char *));
+    if (!ptr) {
+        out_of_memory();
+    }
+    roll_files = (char **) ptr;
+    roll_files[num_roll_files] = strdup(filename);
+    if (!roll_files[num_roll_files]) {
+        out_of_memory();
+    }
+    num_roll_files++;
+
+    if (roll_keep && (num_roll_files > roll_keep)) {
+        if (unlink(roll_files[0]) == -1) {
+            fprintf(stderr, "%s: Failed to delete old log file '%s': %s\n", GAppName, roll_files[0], strerror(errno));
+        }
+        free(roll_files[0]);
+        num_roll_files--;
+        memmove(roll_files, roll_files + 1, num_roll_files * sizeof (char *));
+    }
+}
+
+static int rolling_output_open(const char *filename)
+{
+    if (!roll_inner->open(filename)) {
+        return 0;
+    }
+    roll_add_file(filename);
+    roll_bytes = 0;
+    roll_started = now_ns();
+    return 1;
+}
+
+static int rolling_output_write(const void *data, size_t len)
+{
+    if (!roll_inner->write(data, len)) {
+        return 0;
+    }
+
+    roll_bytes += len;
+    if (__atomic_load_n(&roll_at_seq, __ATOMIC_ACQUIRE) == NO_ROLL_PENDING) {
+        if ((roll_size && (roll_bytes >= roll_size)) || (roll_interval_ns && ((now_ns() - roll_started) >= roll_interval_ns))) {
+            __atomic_store_n(&roll_wanted, 1, __ATOMIC_RELEASE);
+        }
+    }
+    return 1;
+}
+
+static void rolling_output_commit(void)
+{
+    roll_inner->commit();
+}
+
+static int rolling_output_close(void)
+{
+    uint32 i;
+    for (i = 0; i < num_roll_files; i++) {
+        free(roll_files[i]);
+    }
+    free(roll_files);
+    roll_files = NULL;
+    num_roll_files = 0;
+    return roll_inner->close();
+}
+
+static const OutputBackend rolling_output = {
+    rolling_output_open, rolling_output_write, rolling_output_commit, rolling_output_close
+};
+
+
+// The IO_* functions don't write to the log directly. Everything a traced
+//  call produces is encoded into a per-thread record buffer, and handed to
+//  the output path in one piece when the call is done (commit_record()).
+//
+// By default, that's one write() per call. If ALTRACE_ASYNC is set,
+//  committed records go into a ring buffer owned by the calling thread
+//  instead, and a background writer thread merges the rings back into call
+//  order (every record gets a global sequence number) and writes them out
+//  in large chunks, so the app doesn't pay for disk latency inside OpenAL.
+
+typedef enum
+{
+    BACKPRESSURE_BLOCK,  // wait for the writer thread to make room.
+    BACKPRESSURE_DROP,   // throw the record away and count it.
+    BACKPRESSURE_GROW    // move the thread to a bigger ring.
+} BackpressurePolicy;
+
+typedef struct RecordRing
+{
+    uint8 *buffer;
+    uint64 size;  // always a power of two.
+    uint64 head;  // total bytes produced. Only the owning thread changes this.
+    uint64 tail;  // total bytes consumed. Only the writer thread changes this.
+    int orphaned;  // owning thread is gone; writer frees this once drained.
+    struct RecordRing *grown;  // owning thread moved on to this ring.
+    struct RecordRing *next;  // writer thread's list of rings.
+} RecordRing;
+
+// Each record in a RecordRing starts with one of these.
+typedef struct RecordFrame
+{
+    uint64 seq;
+    uint32 len;
+    uint32 flags;
+} RecordFrame;
+
+// Huge records (alBufferData, etc) don't get copied into the ring; the
+//  frame is followed by a pointer to the malloc'd record instead.
+#define RECORDFRAME_INDIRECT (1 << 0)
+
+typedef struct ThreadState
+{
+    uint8 *record;
+    size_t record_len;
+    size_t record_allocated;
+    int record_nodrop;  // record defines things later records refer to.
+    size_t error_callstack_entry;  // see IO_ERROR_CALLSTACK().
+    size_t error_callstack_field;  // where its frame field is, from the entry.
+    uint32 thread_index;  // this thread's entry in the tracefile, 0 if none yet.
+    uint32 segment_generation;  // see start_new_segment().
+    uint64 timestamp_base;  // last timestamp this thread got into the tracefile.
+    uint64 record_timestamp;  // timestamp of the call in the current record.
+    size_t timing_slot;  // where the current call's duration goes, see IO_CALL_TIMING().
+    uint64 real_call_start;  // see REAL_CALL_START().
+    uint64 real_call_cpu_start;
+    uint64 real_call_ns;
+    uint64 real_call_cpu_ns;
+    int unlock_real_call;  // see REAL_CALL_START().
+    int real_call_unlocked;
+    struct ContextWrapper *real_call_context;  // the context real_call_unlocked counts against.
+    EventEnum call_entry;  // the entry point we're in right now.
+    uint64 overhead_call_start;  // see OVERHEAD_CALL_START().
+    uint64 overhead_ns[ALTRACE_OVERHEAD_MAX];
+    struct ContentionThread *contention;  // see contention_call_start().
+    struct ContentionContext *contention_context;
+    void *contention_callsite;
+    uint64 contention_wait_ns;
+    uint32 *latency[ALEE_MAX];  // see record_latency().
+    int latency_listed;
+    struct ThreadState *latency_next;
+    uintptr_t stack_lo;  // this thread's stack, for the frame pointer unwinder.
+    uintptr_t stack_hi;
+    RecordRing *ring;
+} ThreadState;
+
+#define DEFAULT_RING_SIZE (1024 * 1024)
+#define MIN_RING_SIZE (64 * 1024)
+#define WRITER_CHUNK_SIZE (256 * 1024)
+#define WRITER_IDLE_MS 5
+
+static int async_writer = 0;
+static BackpressurePolicy backpressure = BACKPRESSURE_BLOCK;
+static uint64 ring_size = DEFAULT_RING_SIZE;
+static uint64 next_record_seq = 0;
+static uint64 dropped_records = 0;
+static uint64 dropped_bytes = 0;
+static __thread ThreadState *thread_state = NULL;
+static __thread int filtered_call = 0;  // see FILTER_CALL().
+static pthread_key_t thread_state_key;
+static int thread_state_key_created = 0;
+static pthread_mutex_t ringlist_lock;
+static RecordRing *ringlist = NULL;
+static pthread_mutex_t writer_lock;
+static pthread_cond_t writer_cond;
+static pthread_t writer_thread;
+static int writer_thread_running = 0;
+static int writer_thread_quit = 0;
+
+// How often the poller thread checks for state changes (ALTRACE_POLL_HZ).
+//  If this is zero, we check after every call instead, like we used to.
+#define DEFAULT_POLL_HZ 100
+static int poll_hz = DEFAULT_POLL_HZ;
+static pthread_t poller_thread;
+static pthread_mutex_t poller_lock;
+static pthread_cond_t poller_cond;
+static int poller_thread_running = 0;
+static int poller_thread_quit = 0;
+static int poller_wake_pending = 0;  // see wake_poller_for_segment().
+
+static void merge_thread_latency(ThreadState *ts);
+
+static void free_thread_state(void *_ts)
+{
+    ThreadState *ts = (ThreadState *) _ts;
+    merge_thread_latency(ts);
+    if (ts->ring) {
+        __atomic_store_n(&ts->ring->orphaned, 1, __ATOMIC_RELEASE);
+    }
+    free(ts->record);
+    free(ts);
+    thread_state = NULL;
+}
+
+static ThreadState *get_thread_state(void)
+{
+    ThreadState *ts = thread_state;
+    if (!ts) {
+        ts = (ThreadState *) calloc(1, sizeof (ThreadState));
+        if (!ts) {
+            out_of_memory();
+        }
+        ts->error_callstack_entry = (size_t) -1;
+        if (thread_state_key_created) {
+            pthread_setspecific(thread_state_key, ts);
+        }
+        thread_state = ts;
+    }
+    return ts;
+}
+
+static void record_append(const void *data, const size_t len)
+{
+    ThreadState *ts = get_thread_state();
+    const size_t needed = ts->record_len + len;
+    if (needed > ts->record_allocated) {
+        size_t newalloc = ts->record_allocated ? ts->record_allocated : 4096;
+        void *ptr;
+        while (newalloc < needed) {
+            newalloc *= 2;
+        }
+        ptr = realloc(ts->record, newalloc);
+        if (!ptr) {
+            out_of_memory();
+        }
+        ts->record = (uint8 *) ptr;
+        ts->record_allocated = newalloc;
+    }
+    memcpy(ts->record + ts->record_len, data, len);
+    ts->record_len = needed;
+}
+
+// mark the current record as something that can't be dropped, even when
+//  ALTRACE_BACKPRESSURE=drop, because later records depend on it.
+static void record_nodrop(void)
+{
+    get_thread_state()->record_nodrop = 1;
+}
+
+// ALTRACE_OVERHEAD: each thread adds up where the time goes during the
+//  current call, then folds it into these when the call is done. Writers
+//  only ever add, so atomics are enough and nobody waits on anybody.
+typedef struct OverheadStats
+{
+    uint64 calls;
+    uint64 ns[ALTRACE_OVERHEAD_MAX];
+    uint64 histogram[ALTRACE_HISTOGRAM_BUCKETS];  // each call's overhead.
+} OverheadStats;
+
+static int profile_overhead = 0;  // ALTRACE_OVERHEAD
+static OverheadStats *overhead_stats = NULL;  // ALEE_MAX of them.
+
+static uint64 OVERHEAD_START(void)
+{
+    return profile_overhead ? now_ns() : 0;
+}
+
+static void OVERHEAD_ADD(const OverheadCategory category, const uint64 start)
+{
+    if (profile_overhead) {
+        get_thread_state()->overhead_ns[category] += now_ns() - start;
+    }
+}
+
+#define OVERHEAD_TIMED(category, stmt) { \
+    const uint64 overhead_start = OVERHEAD_START(); \
+    stmt; \
+    OVERHEAD_ADD(category, overhead_start); \
+}
+
+// a few entry points call into the real OpenAL before IO_START, and the
+//  clock starts there for them instead (see REAL_CALL_START()).
+static void OVERHEAD_CALL_START(void)
+{
+    if (profile_overhead) {
+        ThreadState *ts = get_thread_state();
+        if (!ts->overhead_call_start) {
+            ts->overhead_call_start = now_ns();
+        }
+    }
+}
+
+static void overhead_fold(const EventEnum entryid, uint64 *ns)
+{
+    OverheadStats *stats = &overhead_stats[entryid];
+    const uint64 tracer = (ns[ALTRACE_OVERHEAD_TOTAL] > ns[ALTRACE_OVERHEAD_REAL_CALL]) ? (ns[ALTRACE_OVERHEAD_TOTAL] - ns[ALTRACE_OVERHEAD_REAL_CALL]) : 0;
+    int i;
+
+    __atomic_add_fetch(&stats->calls, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < ALTRACE_OVERHEAD_MAX; i++) {
+        if (ns[i]) {
+            __atomic_add_fetch(&stats->ns[i], ns[i], __ATOMIC_RELAXED);
+            ns[i] = 0;
+        }
+    }
+    __atomic_add_fetch(&stats->histogram[histogram_bucket(tracer)], 1, __ATOMIC_RELAXED);
+}
+
+// ALTRACE_HISTOGRAMS: a histogram of real call durations for each entry
+//  point. Each thread counts its own calls without any locking or atomic
+//  read-modify-writes, and they get added up when the thread goes away or
+//  we shut down, whichever comes first.
+static int record_histograms = 0;  // ALTRACE_HISTOGRAMS
+static char *histogram_file = NULL;  // ALTRACE_HISTOGRAM_FILE
+static pthread_mutex_t latency_lock = PTHREAD_MUTEX_INITIALIZER;
+static ThreadState *latency_threads = NULL;  // threads with histograms to merge.
+static uint64 *latency_merged = NULL;  // ALEE_MAX * ALTRACE_HISTOGRAM_BUCKETS.
+
+static void record_latency(ThreadState *ts, const EventEnum entryid, const uint64 ns)
+{
+    uint32 *histogram = ts->latency[entryid];
+    uint32 *bucket;
+
+    if (!histogram) {
+        histogram = (uint32 *) calloc(ALTRACE_HISTOGRAM_BUCKETS, sizeof (uint32));
+        if (!histogram) {
+            out_of_memory();
+        }
+
+        pthread_mutex_lock(&latency_lock);
+        ts->latency[entryid] = histogram;
+        if (!ts->latency_listed) {
+            ts->latency_listed = 1;
+            ts->latency_next = latency_threads;
+            latency_threads = ts;
+        }
+        pthread_mutex_unlock(&latency_lock);
+    }
+
+    // only this thread writes here, but the merge might read at any time.
+    bucket = &histogram[histogram_bucket(ns)];
+    __atomic_store_n(bucket, __atomic_load_n(bucket, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+}
+
+// add a thread's counts to latency_merged and forget about it. If we already
+//  shut down, there's nowhere for them to go.
+static void merge_thread_latency(ThreadState *ts)
+{
+    ThreadState **prev;
+    int i, j;
+
+    pthread_mutex_lock(&latency_lock);
+    for (prev = &latency_threads; *prev; prev = &(*prev)->latency_next) {
+        if (*prev == ts) {
+            *prev = ts->latency_next;
+            break;
+        }
+    }
+    ts->latency_next = NULL;
+    ts->latency_listed = 0;
+
+    for (i = 0; i < ALEE_MAX; i++) {
+        uint32 *histogram = ts->latency[i];
+        if (!histogram) {
+            continue;
+        }
+        if (latency_merged) {
+            uint64 *merged = latency_merged + (i * ALTRACE_HISTOGRAM_BUCKETS);
+            for (j = 0; j < ALTRACE_HISTOGRAM_BUCKETS; j++) {
+                merged[j] += __atomic_load_n(&histogram[j], __ATOMIC_RELAXED);
+            }
+        }
+        ts->latency[i] = NULL;
+        free(histogram);
+    }
+    pthread_mutex_unlock(&latency_lock);
+}
+
+// threads that are still running at shutdown keep their histograms, but
+//  their counts go into latency_merged now. Call with latency_lock held.
+static void merge_all_latency(void)
+{
+    ThreadState *ts;
+    int i, j;
+
+    for (ts = latency_threads; ts; ts = ts->latency_next) {
+        ts->latency_listed = 0;
+        for (i = 0; i < ALEE_MAX; i++) {
+            const uint32 *histogram = ts->latency[i];
+            if (histogram) {
+                uint64 *merged = latency_merged + (i * ALTRACE_HISTOGRAM_BUCKETS);
+                for (j = 0; j < ALTRACE_HISTOGRAM_BUCKETS; j++) {
+                    merged[j] += __atomic_load_n(&histogram[j], __ATOMIC_RELAXED);
+                }
+            }
+        }
+    }
+    for (ts = latency_threads; ts; ) {
+        ThreadState *next = ts->latency_next;
+        ts->latency_next = NULL;
+        ts = next;
+    }
+    latency_threads = NULL;
+}
+
+// ALTRACE_CONTENTION: how threads share OpenAL. Each call adds up how long
+//  it waited for the API lock (going in, and coming back from a real call
+//  that let go of it), and that's totaled per thread and per call site. We
+//  also note which threads use each context, source and buffer, and count
+//  a handoff when a call on a context comes from a different thread than
+//  the one before it, within contention_window_ns or while that one is
+//  still in its real call: that's when threads end up fighting over the
+//  OpenAL implementation's own locks. None of this is freed until shutdown,
+//  so the summary still covers threads and objects that went away. Only
+//  touched with the API lock held.
+typedef struct ContentionContext
+{
+    ContextWrapper *ctx;  // only used as an ID; it might be gone.
+    uint64 calls;
+    uint64 handoffs;
+    uint64 overlaps;  // handoffs while the other thread was still in its real call.
+    uint64 last_end_ns;
+    struct ContentionThread *last_thread;
+    int active;  // calls on this context that haven't finished.
+    struct ContentionContext *next;
+} ContentionContext;
+
+typedef struct ContentionContextUse
+{
+    ContentionContext *context;
+    uint64 calls;
+    struct ContentionContextUse *next;
+} ContentionContextUse;
+
+typedef struct ContentionThread
+{
+    uint64 logthreadid;
+    uint32 index;  // what ContentionObject::threads calls this thread.
+    uint64 calls;
+    uint64 wait_ns;
+    uint64 max_wait_ns;
+    uint32 sources;  // these two are only counted at shutdown.
+    uint32 buffers;
+    ContentionContextUse *contexts;
+    struct ContentionThread *next;
+} ContentionThread;
+
+typedef struct ContentionCallsite
+{
+    void *callsite;
+    EventEnum entryid;
+    uint64 calls;
+    uint64 wait_ns;
+    uint64 max_wait_ns;
+    struct ContentionCallsite *next;
+} ContentionCallsite;
+
+typedef struct ContentionObject
+{
+    int is_buffer;
+    ALuint name;
+    uint64 calls;
+    uint32 *threads;  // ContentionThread::index of each thread that used it.
+    uint32 num_threads;
+    uint32 threads_allocated;
+    struct ContentionObject *next;
+} ContentionObject;
+
+#define DEFAULT_CONTENTION_WINDOW_US 1000
+
+static int contention = 0;  // ALTRACE_CONTENTION
+static uint64 contention_window_ns = 0;  // ALTRACE_CONTENTION_WINDOW_US
+static ContentionThread *contention_threads = NULL;
+static ContentionThread *contention_threads_tail = NULL;
+static uint32 num_contention_threads = 0;
+static ContentionContext *contention_contexts = NULL;
+static ContentionContext *contention_contexts_tail = NULL;
+static uint32 num_contention_contexts = 0;
+static ContentionCallsite **contention_callsites = NULL;
+static uint32 contention_callsite_buckets = 0;
+static uint32 num_contention_callsites = 0;
+static ContentionObject *contention_objects = NULL;
+
+static void *contention_alloc(const size_t len)
+{
+    void *retval = calloc(1, len);
+    if (!retval) {
+        out_of_memory();
+    }
+    return retval;
+}
+
+static ContentionThread *get_contention_thread(ThreadState *ts)
+{
+    if (!ts->contention) {
+        ContentionThread *thr = (ContentionThread *) contention_alloc(sizeof (ContentionThread));
+        thr->logthreadid = (uint64) pthread_self();
+        thr->index = num_contention_threads;
+        if (contention_threads_tail) {
+            contention_threads_tail->next = thr;
+        } else {
+            contention_threads = thr;
+        }
+        contention_threads_tail = thr;
+        num_contention_threads++;
+        ts->contention = thr;
+    }
+    return ts->contention;
+}
+
+static ContentionContext *get_contention_context(ContextWrapper *ctx)
+{
+    if (!ctx->contention) {
+        ContentionContext *cc = (ContentionContext *) contention_alloc(sizeof (ContentionContext));
+        cc->ctx = ctx;
+        if (contention_contexts_tail) {
+            contention_contexts_tail->next = cc;
+        } else {
+            contention_contexts = cc;
+        }
+        contention_contexts_tail = cc;
+        num_contention_contexts++;
+        ctx->contention = cc;
+    }
+    return ctx->contention;
+}
+
+static uint32 hash_contention_callsite(void *callsite, const EventEnum entryid)
+{
+    return (uint32) ((((uintptr_t) callsite) >> 2) * 0x9E3779B1) ^ (uint32) entryid;
+}
+
+static void grow_contention_callsites(void)
+{
+    const uint32 newbuckets = contention_callsite_buckets ? (contention_callsite_buckets * 2) : 256;
+    ContentionCallsite **newtable = (ContentionCallsite **) contention_alloc(newbuckets * sizeof (ContentionCallsite *));
+    uint32 i;
+
+    for (i = 0; i < contention_callsite_buckets; i++) {
+        ContentionCallsite *item = contention_callsites[i];
+        while (item) {
+            ContentionCallsite *next = item->next;
+            const uint32 bucket = hash_contention_callsite(item->callsite, item->entryid) & (newbuckets - 1);
+            item->next = newtable[bucket];
+            newtable[bucket] = item;
+            item = next;
+        }
+    }
+
+    free(contention_callsites);
+    contention_callsites = newtable;
+    contention_callsite_buckets = newbuckets;
+}
+
+static ContentionCallsite *get_contention_callsite(void *callsite, const EventEnum entryid)
+{
+    ContentionCallsite *item;
+    uint32 bucket;
+
+    if (contention_callsite_buckets) {
+        bucket = hash_contention_callsite(callsite, entryid) & (contention_callsite_buckets - 1);
+        for (item = contention_callsites[bucket]; item; item = item->next) {
+            if ((item->callsite == callsite) && (item->entryid == entryid)) {
+                return item;
+            }
+        }
+    }
+
+    if (num_contention_callsites >= (contention_callsite_buckets / 2)) {
+        grow_contention_callsites();
+    }
+
+    bucket = hash_contention_callsite(callsite, entryid) & (contention_callsite_buckets - 1);
+    item = (ContentionCallsite *) contention_alloc(sizeof (ContentionCallsite));
+    item->callsite = callsite;
+    item->entryid = entryid;
+    item->next = contention_callsites[bucket];
+    contention_callsites[bucket] = item;
+    num_contention_callsites++;
+    return item;
+}
+
+// IO_START calls this once it has the API lock.
+static void contention_call_start(void *callsite)
+{
+    ThreadState *ts = get_thread_state();
+    ContentionThread *thr = get_contention_thread(ts);
+    ContentionContext *cc = current_context ? get_contention_context(current_context) : NULL;
+    ContentionContextUse *use;
+
+    ts->contention_callsite = callsite;
+    ts->contention_context = cc;
+    if (!cc) {
+        return;
+    }
+
+    cc->calls++;
+    if (cc->last_thread && (cc->last_thread != thr)) {
+        if (cc->active) {
+            cc->handoffs++;
+            cc->overlaps++;
+        } else if ((now_ns() - cc->last_end_ns) < contention_window_ns) {
+            cc->handoffs++;
+        }
+    }
+    cc->last_thread = thr;
+    cc->active++;
+
+    for (use = thr->contexts; use; use = use->next) {
+        if (use->context == cc) {
+            break;
+        }
+    }
+    if (!use) {
+        use = (ContentionContextUse *) contention_alloc(sizeof (ContentionContextUse));
+        use->context = cc;
+        use->next = thr->contexts;
+        thr->contexts = use;
+    }
+    use->calls++;
+}
+
+// IO_END and IO_END_ALC call this before they let go of the API lock.
+static void contention_call_end(void)
+{
+    ThreadState *ts = get_thread_state();
+    ContentionThread *thr = ts->contention;
+    ContentionContext *cc = ts->contention_context;
+    ContentionCallsite *site = get_contention_callsite(ts->contention_callsite, ts->call_entry);
+    const uint64 waited = ts->contention_wait_ns;
+
+    thr->calls++;
+    thr->wait_ns += waited;
+    if (waited > thr->max_wait_ns) {
+        thr->max_wait_ns = waited;
+    }
+
+    site->calls++;
+    site->wait_ns += waited;
+    if (waited > site->max_wait_ns) {
+        site->max_wait_ns = waited;
+    }
+
+    if (cc) {
+        cc->active--;
+        cc->last_end_ns = now_ns();
+    }
+
+    ts->contention_context = NULL;
+    ts->contention_wait_ns = 0;
+}
+
+// the current call used this source or buffer.
+static void contention_object_use(ContentionObject **_obj, const int is_buffer, const ALuint name)
+{
+    ContentionObject *obj = *_obj;
+    if (!obj) {
+        obj = (ContentionObject *) contention_alloc(sizeof (ContentionObject));
+        obj->is_buffer = is_buffer;
+        obj->name = name;
+        obj->next = contention_objects;
+        contention_objects = obj;
+        *_obj = obj;
+    }
+    obj->calls++;
+
+    // most objects only ever see a thread or two, so a list is fine.
+    {
+        const uint32 index = get_contention_thread(get_thread_state())->index;
+        uint32 i;
+        for (i = 0; i < obj->num_threads; i++) {
+            if (obj->threads[i] == index) {
+                return;
+            }
+        }
+        if (obj->num_threads >= obj->threads_allocated) {
+            const uint32 newalloc = obj->threads_allocated ? (obj->threads_allocated * 2) : 2;
+            void *ptr = realloc(obj->threads, newalloc * sizeof (uint32));
+            if (!ptr) {
+                out_of_memory();
+            }
+            obj->threads = (uint32 *) ptr;
+            obj->threads_allocated = newalloc;
+        }
+        obj->threads[obj->num_threads++] = index;
+    }
+}
+
+static void free_contention_stats(void)
+{
+    uint32 i;
+
+    while (contention_threads) {
+        ContentionThread *next = contention_threads->next;
+        while (contention_threads->contexts) {
+            ContentionContextUse *nextuse = contention_threads->contexts->next;
+            free(contention_threads->contexts);
+            contention_threads->contexts = nextuse;
+        }
+        free(contention_threads);
+        contention_threads = next;
+    }
+    contention_threads_tail = NULL;
+    num_contention_threads = 0;
+
+    while (contention_contexts) {
+        ContentionContext *next = contention_contexts->next;
+        free(contention_contexts);
+        contention_contexts = next;
+    }
+    contention_contexts_tail = NULL;
+    num_contention_contexts = 0;
+
+    for (i = 0; i < contention_callsite_buckets; i++) {
+        while (contention_callsites[i]) {
+            ContentionCallsite *next = contention_callsites[i]->next;
+            free(contention_callsites[i]);
+            contention_callsites[i] = next;
+        }
+    }
+    free(contention_callsites);
+    contention_callsites = NULL;
+    contention_callsite_buckets = 0;
+    num_contention_callsites = 0;
+
+    while (contention_objects) {
+        ContentionObject *next = contention_objects->next;
+        free(contention_objects->threads);
+        free(contention_objects);
+        contention_objects = next;
+    }
+}
+
+static void OVERHEAD_CALL_END(void)
+{
+    if (profile_overhead) {
+        ThreadState *ts = get_thread_state();
+        ts->overhead_ns[ALTRACE_OVERHEAD_TOTAL] = now_ns() - ts->overhead_call_start;
+        ts->overhead_call_start = 0;
+        overhead_fold(ts->call_entry, ts->overhead_ns);
+    }
+}
+
+static void wake_writer_thread(void)
+{
+    pthread_cond_signal(&writer_cond);
+}
+
+static RecordRing *create_ring(uint64 size)
+{
+    RecordRing *ring = (RecordRing *) calloc(1, sizeof (RecordRing));
+    uint64 po2 = MIN_RING_SIZE;
+    while (po2 < size) {
+        po2 *= 2;
+    }
+    if (ring) {
+        ring->buffer = (uint8 *) malloc((size_t) po2);
+        ring->size = po2;
+    }
+    if (!ring || !ring->buffer) {
+        out_of_memory();
+    }
+    return ring;
+}
+
+static void free_ring(RecordRing *ring)
+{
+    free(ring->buffer);
+    free(ring);
+}
+
+static void ring_copy_in(RecordRing *ring, const uint64 pos, const void *_data, const size_t len)
+{
+    const uint8 *data = (const uint8 *) _data;
+    const size_t offset = (size_t) (pos & (ring->size - 1));
+    const size_t avail = (size_t) (ring->size - offset);
+    if (len <= avail) {
+        memcpy(ring->buffer + offset, data, len);
+    } else {
+        memcpy(ring->buffer + offset, data, avail);
+        memcpy(ring->buffer, data + avail, len - avail);
+    }
+}
+
+static void ring_copy_out(const RecordRing *ring, const uint64 pos, void *_data, const size_t len)
+{
+    uint8 *data = (uint8 *) _data;
+    const size_t offset = (size_t) (pos & (ring->size - 1));
+    const size_t avail = (size_t) (ring->size - offset);
+    if (len <= avail) {
+        memcpy(data, ring->buffer + offset, len);
+    } else {
+        memcpy(data, ring->buffer + offset, avail);
+        memcpy(data + avail, ring->buffer, len - avail);
+    }
+}
+
+// returns zero if the record was thrown away.
+static int ring_push_record(ThreadState *ts)
+{
+    const size_t len = ts->record_len;
+    const int indirect = (len > (ring_size / 4));
+    const uint64 needed = sizeof (RecordFrame) + (indirect ? sizeof (void *) : len);
+    RecordRing *ring = ts->ring;
+    RecordFrame frame;
+
+    if (!ring) {
+        ring = ts->ring = create_ring(ring_size);
+        pthread_mutex_lock(&ringlist_lock);
+        ring->next = ringlist;
+        ringlist = ring;
+        pthread_mutex_unlock(&ringlist_lock);
+    }
+
+    while ((ring->size - (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))) < needed) {
+        if (__atomic_load_n(&writer_thread_quit, __ATOMIC_ACQUIRE)) {
+            return 0;  // shutting down, nothing is draining the ring anymore.
+        } else if ((backpressure == BACKPRESSURE_DROP) && !ts->record_nodrop) {
+            __atomic_add_fetch(&dropped_records, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&dropped_bytes, len, __ATOMIC_RELAXED);
+            return 0;
+        } else if (backpressure == BACKPRESSURE_GROW) {
+            // the writer finds the new ring through ->grown once the old one
+            //  drains, so it keeps this thread's records in order.
+            RecordRing *grown = create_ring((ring->size * 2) + needed);
+            __atomic_store_n(&ring->grown, grown, __ATOMIC_RELEASE);
+            ring = ts->ring = grown;
+        } else {
+            wake_writer_thread();
+            usleep(100);
+        }
+    }
+
+    frame.seq = __atomic_fetch_add(&next_record_seq, 1, __ATOMIC_RELAXED);
+    frame.len = (uint32) len;
+    frame.flags = indirect ? RECORDFRAME_INDIRECT : 0;
+    ring_copy_in(ring, ring->head, &frame, sizeof (frame));
+    if (indirect) {
+        // hand the whole buffer to the writer thread, start a new one.
+        ring_copy_in(ring, ring->head + sizeof (frame), &ts->record, sizeof (void *));
+        ts->record = NULL;
+        ts->record_allocated = 0;
+    } else {
+        ring_copy_in(ring, ring->head + sizeof (frame), ts->record, len);
+    }
+    __atomic_store_n(&ring->head, ring->head + needed, __ATOMIC_RELEASE);
+
+    if ((ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) > (ring->size / 2)) {
+        wake_writer_thread();
+    }
+    return 1;
+}
+
+static void commit_record(void)
+{
+    ThreadState *ts = get_thread_state();
+    if ((ts->record_len > 0) && output) {
+        int written = 1;
+        if (async_writer) {
+            written = ring_push_record(ts);
+        } else if (!output->write(ts->record, ts->record_len)) {
+            IO_WRITE_FAIL();
+        } else {
+            output->commit();
+        }
+
+        // timestamps are relative to the last one playback actually sees.
+        if (written) {
+            ts->timestamp_base = ts->record_timestamp;
+        }
+    }
+    ts->record_timestamp = ts->timestamp_base;
+    ts->record_len = 0;
+    ts->record_nodrop = 0;
+    ts->error_callstack_entry = (size_t) -1;
+}
+
+// ALTRACE_COMPRESS only cuts blocks when something is written, so whoever
+//  owns the output (the writer thread, or the poller thread under the API
+//  lock) calls this while things are quiet, or a block could sit in memory
+//  until the app makes another call.
+static void compress_flush_if_stale(void)
+{
+    if ((output == &compressed_output) || (rolling && (roll_inner == &compressed_output))) {
+        if ((compress_raw_len > 0) && ((now() - compress_last_flush) >= COMPRESS_FLUSH_MS)) {
+            if (!compress_flush_block()) {
+                IO_WRITE_FAIL();
+            }
+            compress_inner->commit();
+        }
+    }
+}
+
+static void writer_flush_chunk(uint8 *chunk, size_t *chunklen)
+{
+    if (*chunklen > 0) {
+        if (!output->write(chunk, *chunklen)) {
+            IO_WRITE_FAIL();
+        }
+        output->commit();
+        *chunklen = 0;
+    }
+}
+
+// move every record from (ring) that's next in sequence into (chunk).
+static int writer_drain_ring(RecordRing *ring, uint64 *expected, uint8 *chunk, size_t *chunklen)
+{
+    int progress = 0;
+    while (1) {
+        const uint64 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64 tail = ring->tail;
+        RecordFrame frame;
+
+        if (tail == head) {
+            break;
+        }
+
+        ring_copy_out(ring, tail, &frame, sizeof (frame));
+        if (frame.seq != *expected) {
+            break;  // some other thread has the next record.
+        }
+
+        if (frame.seq == __atomic_load_n(&roll_at_seq, __ATOMIC_ACQUIRE)) {
+            writer_flush_chunk(chunk, chunklen);
+            roll_tracefile();
+            __atomic_store_n(&roll_at_seq, NO_ROLL_PENDING, __ATOMIC_RELEASE);
+        }
+
+        tail += sizeof (frame);
+        // chunks always end between records, so every flush can commit.
+        if ((frame.flags & RECORDFRAME_INDIRECT) || ((*chunklen + frame.len) > WRITER_CHUNK_SIZE)) {
+            writer_flush_chunk(chunk, chunklen);
+        }
+
+        if (frame.flags & RECORDFRAME_INDIRECT) {
+            uint8 *record = NULL;
+            ring_copy_out(ring, tail, &record, sizeof (void *));
+            tail += sizeof (void *);
+            if (!output->write(record, frame.len)) {
+                IO_WRITE_FAIL();
+            }
+            output->commit();
+            free(record);
+        } else if (frame.len > WRITER_CHUNK_SIZE) {
+            // too big to stage; write it straight out of the ring.
+            size_t remaining = frame.len;
+            while (remaining > 0) {
+                const size_t offset = (size_t) (tail & (ring->size - 1));
+                size_t cpy = (size_t) (ring->size - offset);
+                if (cpy > remaining) {
+                    cpy = remaining;
+                }
+                if (!output->write(ring->buffer + offset, cpy)) {
+                    IO_WRITE_FAIL();
+                }
+                tail += cpy;
+                remaining -= cpy;
+            }
+            output->commit();
+        } else {
+            ring_copy_out(ring, tail, chunk + *chunklen, frame.len);
+            *chunklen += frame.len;
+            tail += frame.len;
+        }
+
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        (*expected)++;
+        progress = 1;
+    }
+    return progress;
+}
+
+static void *writer_thread_main(void *arg)
+{
+    uint8 *chunk = (uint8 *) malloc(WRITER_CHUNK_SIZE);
+    size_t chunklen = 0;
+    uint64 expected = 0;
+    int quitting = 0;
+
+    if (!chunk) {
+        out_of_memory();
+    }
+
+    while (1) {
+        int progress = 0;
+        RecordRing **prev;
+        RecordRing *ring;
+
+        pthread_mutex_lock(&ringlist_lock);
+        prev = &ringlist;
+        while ((ring = *prev) != NULL) {
+            RecordRing *grown;
+            if (writer_drain_ring(ring, &expected, chunk, &chunklen)) {
+                progress = 1;
+            }
+
+            // retire rings that were outgrown or whose thread went away,
+            //  once they're empty. Check ->grown before ->head, since the
+            //  thread doesn't touch the old ring after setting ->grown.
+            grown = __atomic_load_n(&ring->grown, __ATOMIC_ACQUIRE);
+            if (ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+                if (grown) {
+                    grown->next = ring->next;
+                    *prev = grown;
+                    free_ring(ring);
+                    progress = 1;  // check the new ring right away.
+                    continue;
+                } else if (__atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE)) {
+                    *prev = ring->next;
+                    free_ring(ring);
+                    continue;
+                }
+            }
+            prev = &ring->next;
+        }
+        pthread_mutex_unlock(&ringlist_lock);
+
+        if (!progress) {
+            writer_flush_chunk(chunk, &chunklen);
+            if (quitting) {
+                break;  // one last pass found nothing, we're done.
+            } else if (__atomic_load_n(&writer_thread_quit, __ATOMIC_ACQUIRE)) {
+                quitting = 1;
+            } else {
+                struct timespec ts;
+                compress_flush_if_stale();
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_nsec += WRITER_IDLE_MS * 1000000;
+                if (ts.tv_nsec >= 1000000000) {
+                    ts.tv_sec++;
+                    ts.tv_nsec -= 1000000000;
+                }
+                pthread_mutex_lock(&writer_lock);
+                pthread_cond_timedwait(&writer_cond, &writer_lock, &ts);
+                pthread_mutex_unlock(&writer_lock);
+            }
+        }
+    }
+
+    free(chunk);
+    return NULL;
+}
+
+// a fork()'d child shares our file descriptor but not our writer thread;
+//  don't let it touch the parent's tracefile (or try to join a thread that
+//  doesn't exist when it calls _exit()).
+static void forked_child(void)
+{
+    output = NULL;
+    if (logfd != -1) {
+        close(logfd);
+        logfd = -1;
+    }
+    writer_thread_running = 0;
+    ringlist = NULL;
+    poller_thread_running = 0;
+}
+
+static int start_writer_thread(void)
+{
+    int rc;
+    pthread_mutex_init(&ringlist_lock, NULL);
+    pthread_mutex_init(&writer_lock, NULL);
+    pthread_cond_init(&writer_cond, NULL);
+    rc = pthread_create(&writer_thread, NULL, writer_thread_main, NULL);
+    if (rc != 0) {
+        fprintf(stderr, "%s: Failed to create writer thread: %s\n", GAppName, strerror(rc));
+        return 0;
+    }
+    writer_thread_running = 1;
+    return 1;
+}
+
+static void stop_writer_thread(void)
+{
+    RecordRing *ring;
+    RecordRing *next;
+
+    if (!writer_thread_running) {
+        return;
+    }
+
+    __atomic_store_n(&writer_thread_quit, 1, __ATOMIC_RELEASE);
+
+    if (pthread_equal(pthread_self(), writer_thread)) {
+        return;  // writer thread itself failed; whatever is queued is lost.
+    }
+
+    wake_writer_thread();
+    pthread_join(writer_thread, NULL);
+    writer_thread_running = 0;
+
+    for (ring = ringlist; ring; ring = next) {
+        next = ring->next;
+        // rings still in use by live threads stay allocated; they're just
+        //  never drained again.
+        if (__atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE)) {
+            free_ring(ring);
+        }
+    }
+    ringlist = NULL;
+
+    if (dropped_records > 0) {
+        fprintf(stderr, "%s: Dropped %llu records (%llu bytes) because the ring buffer was full.\n",
+                GAppName, (unsigned long long) dropped_records, (unsigned long long) dropped_bytes);
+    }
+}
+
+// a call that FILTER_CALL() turned away doesn't encode anything, so the
+//  lowest-level writers all check for that.
+static void writele32(const uint32 x)
+{
+    const uint32 y = swap32(x);
+    if (!filtered_call) {
+        record_append(&y, sizeof (y));
+    }
+}
+
+static void writele64(const uint64 x)
+{
+    const uint64 y = swap64(x);
+    if (!filtered_call) {
+        record_append(&y, sizeof (y));
+    }
+}
+
+// Integers are LEB128 varints (see ALTRACE_LOG_FILE_FORMAT). Signed values
+//  are written as their unsigned bit pattern, so a 32-bit field reads back
+//  the same whichever integer type the other side uses for it.
+#define MAX_VARINT_LEN 10
+
+static size_t encode_varint(uint8 *buf, uint64 x)
+{
+    size_t len = 0;
+    while (x >= 0x80) {
+        buf[len++] = (uint8) (x | 0x80);
+        x >>= 7;
+    }
+    buf[len++] = (uint8) x;
+    return len;
+}
+
+// like encode_varint(), but always (len) bytes, so it can be patched later.
+//  Values that don't fit are clamped.
+static void encode_varint_padded(uint8 *buf, uint64 x, const size_t len)
+{
+    const uint64 max = (((uint64) 1) << (len * 7)) - 1;
+    size_t i;
+    if (x > max) {
+        x = max;
+    }
+    for (i = 0; i < (len - 1); i++) {
+        buf[i] = (uint8) ((x & 0x7F) | 0x80);
+        x >>= 7;
+    }
+    buf[len - 1] = (uint8) x;
+}
+
+static void writevarint(const uint64 x)
+{
+    uint8 buf[MAX_VARINT_LEN];
+    if (!filtered_call) {
+        record_append(buf, encode_varint(buf, x));
+    }
+}
+
+static void IO_INT32(const int32 x)
+{
+    union { int32 si32; uint32 ui32; } cvt;
+    cvt.si32 = x;
+    writevarint(cvt.ui32);
+}
+
+static void IO_UINT32(const uint32 x)
+{
+    writevarint(x);
+}
+
+static void IO_UINT64(const uint64 x)
+{
+    writevarint(x);
+}
+
+static void IO_ALCSIZEI(const ALCsizei x)
+{
+    IO_UINT64((uint64) x);
+}
+
+static void IO_ALSIZEI(const ALsizei x)
+{
+    IO_UINT64((uint64) x);
+}
+
+static void IO_FLOAT(const float x)
+{
+    union { float f; uint32 ui32; } cvt;
+    cvt.f = x;
+    writele32(cvt.ui32);
+}
+
+static void IO_DOUBLE(const double x)
+{
+    union { double d; uint64 ui64; } cvt;
+    cvt.d = x;
+    writele64(cvt.ui64);
+}
+
+static void IO_STRING(const char *str)
+{
+    if (filtered_call) {
+        return;
+    } else if (!str) {
+        IO_UINT64(0xFFFFFFFFFFFFFFFFull);
+    } else {
+        const size_t len = strlen(str);
+        IO_UINT64((uint64) len);
+        if (len > 0) {
+            record_append(str, len);
+        }
+    }
+}
+
+// Apps upload the same audio over and over (pooled buffers, restarting
+//  after a lost context, etc), so blobs bigger than this are stored once,
+//  keyed by a hash of their contents, and repeats refer back to them. We
+//  keep a copy of each blob's bytes so a hash collision can't make playback
+//  use the wrong data; once those copies add up to ALTRACE_BLOB_DEDUP_MEMORY,
+//  new blobs are just written out in full every time.
+#define BLOB_DEDUP_MIN_SIZE 64
+#define DEFAULT_BLOB_DEDUP_MEMORY (64 * 1024 * 1024)
+
+typedef struct BlobEntry
+{
+    uint64 hash;
+    uint64 len;
+    uint64 id;
+    struct BlobEntry *next;
+    // copy of the blob's bytes follows.
+} BlobEntry;
+
+static int blob_dedup = 1;  // ALTRACE_BLOB_DEDUP
+static uint64 blob_dedup_memory = DEFAULT_BLOB_DEDUP_MEMORY;  // ALTRACE_BLOB_DEDUP_MEMORY
+static uint64 blob_memory_used = 0;
+static BlobEntry **blob_table = NULL;
+static uint32 blob_table_buckets = 0;
+static uint64 num_blobs = 0;
+
+// MurmurHash64A, by Austin Appleby (public domain). This only needs to be
+//  stable within one process, so we don't care about byte order.
+static uint64 hash_blob(const uint8 *data, const size_t len)
+{
+    const uint64 m = 0xc6a4a7935bd1e995ull;
+    const int r = 47;
+    const uint8 *end = data + (len & ~((size_t) 7));
+    uint64 h = 0x8445D61A4E774912ull ^ (len * m);
+
+    while (data != end) {
+        uint64 k;
+        memcpy(&k, data, sizeof (k));
+        data += sizeof (k);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    switch (len & 7) {
+        case 7: h ^= ((uint64) data[6]) << 48;  /* fallthrough */
+        case 6: h ^= ((uint64) data[5]) << 40;  /* fallthrough */
+        case 5: h ^= ((uint64) data[4]) << 32;  /* fallthrough */
+        case 4: h ^= ((uint64) data[3]) << 24;  /* fallthrough */
+        case 3: h ^= ((uint64) data[2]) << 16;  /* fallthrough */
+        case 2: h ^= ((uint64) data[1]) << 8;  /* fallthrough */
+        case 1: h ^= ((uint64) data[0]); h *= m;
+        default: break;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+static void grow_blob_table(void)
+{
+    const uint32 newbuckets = blob_table_buckets ? (blob_table_buckets * 2) : 256;
+    BlobEntry **newtable = (BlobEntry **) calloc(newbuckets, sizeof (BlobEntry *));
+    uint32 i;
+
+    if (!newtable) {
+        out_of_memory();
+    }
+
+    for (i = 0; i < blob_table_buckets; i++) {
+        BlobEntry *item = blob_table[i];
+        while (item) {
+            BlobEntry *next = item->next;
+            const uint32 bucket = (uint32) (item->hash & (newbuckets - 1));
+            item->next = newtable[bucket];
+            newtable[bucket] = item;
+            item = next;
+        }
+    }
+
+    free(blob_table);
+    blob_table = newtable;
+    blob_table_buckets = newbuckets;
+}
+
+// returns the blob's ID, and sets *_is_new if this is the first time we've
+//  seen these bytes. Returns ALTRACE_BLOB_NULL if we're out of room to
+//  remember more blobs, in which case the caller should write it in full.
+static uint64 intern_blob(const uint8 *data, const uint64 len, int *_is_new)
+{
+    const uint64 hash = hash_blob(data, (size_t) len);
+    BlobEntry *item;
+
+    if (blob_table_buckets) {
+        for (item = blob_table[hash & (blob_table_buckets - 1)]; item; item = item->next) {
+            if ((item->hash == hash) && (item->len == len) && (memcmp(item + 1, data, (size_t) len) == 0)) {
+                *_is_new = 0;
+                return item->id;
+            }
+        }
+    }
+
+    if ((blob_memory_used + len) > blob_dedup_memory) {
+        return ALTRACE_BLOB_NULL;
+    }
+
+    if (num_blobs >= (blob_table_buckets / 2)) {
+        grow_blob_table();
+    }
+
+    item = (BlobEntry *) malloc(sizeof (BlobEntry) + (size_t) len);
+    if (!item) {
+        out_of_memory();
+    }
+    memcpy(item + 1, data, (size_t) len);
+    blob_memory_used += len;
+    item->hash = hash;
+    item->len = len;
+    item->id = num_blobs++;
+    item->next = blob_table[hash & (blob_table_buckets - 1)];
+    blob_table[hash & (blob_table_buckets - 1)] = item;
+    *_is_new = 1;
+    return item->id;
+}
+
+static void free_blob_table(void)
+{
+    uint32 i;
+    for (i = 0; i < blob_table_buckets; i++) {
+        BlobEntry *item = blob_table[i];
+        while (item) {
+            BlobEntry *next = item->next;
+            free(item);
+            item = next;
+        }
+    }
+    free(blob_table);
+    blob_table = NULL;
+    blob_table_buckets = 0;
+    num_blobs = 0;
+    blob_memory_used = 0;
+}
+
+static void IO_BLOB(const uint8 *data, const uint64 len)
+{
+    uint64 id = 0;
+    int is_new = 0;
+
+    if (filtered_call) {
+        return;
+    } else if (!data) {
+        IO_UINT64(ALTRACE_BLOB_NULL);
+    } else if (blob_dedup && (len >= BLOB_DEDUP_MIN_SIZE) && ((id = intern_blob(data, len, &is_new)) != ALTRACE_BLOB_NULL)) {
+        if (is_new) {
+            record_nodrop();  // later calls might refer to these bytes.
+            IO_UINT64(ALTRACE_BLOB_DEFINE);
+            IO_UINT64(id);
+            IO_UINT64(len);
+            record_append(data, (size_t) len);
+        } else {
+            IO_UINT64(ALTRACE_BLOB_REF);
+            IO_UINT64(id);
+        }
+    } else {
+        const size_t slen = (size_t) len;
+        IO_UINT64(len);
+        if (len > 0) {
+            record_append(data, slen);
+        }
+    }
+}
+
+// ALTRACE_BUFFER_DATA and ALTRACE_CAPTURE_DATA: how much of the audio that
+//  goes through alBufferData and alcCaptureSamples makes it into the
+//  tracefile. (amount) is the preview size in bytes or the downsampling
+//  factor in sample frames.
+typedef struct PayloadConfig
+{
+    PayloadPolicy policy;
+    uint64 amount;
+} PayloadConfig;
+
+#define DEFAULT_PAYLOAD_PREVIEW_SIZE 4096
+#define DEFAULT_PAYLOAD_DOWNSAMPLE 16
+
+static PayloadConfig buffer_payload = { ALTRACE_PAYLOAD_FULL, 0 };
+static PayloadConfig capture_payload = { ALTRACE_PAYLOAD_FULL, 0 };
+
+// bytes per sample frame, or zero if we don't know the format.
+static uint32 format_frame_size(const ALenum format)
+{
+    switch (format) {
+        case AL_FORMAT_MONO8: return 1;
+        case AL_FORMAT_MONO16: return 2;
+        case AL_FORMAT_STEREO8: return 2;
+        case AL_FORMAT_STEREO16: return 4;
+        case AL_FORMAT_MONO_FLOAT32: return 4;
+        case AL_FORMAT_STEREO_FLOAT32: return 8;
+        default: break;
+    }
+    return 0;
+}
+
+static void IO_PAYLOAD(const PayloadConfig *config, const uint8 *data, const uint64 len, uint32 framesize)
+{
+    if (filtered_call) {
+        return;
+    } else if (!data || (config->policy == ALTRACE_PAYLOAD_FULL)) {
+        IO_BLOB(data, len);
+        return;
+    }
+
+    IO_UINT64(ALTRACE_BLOB_POLICY);
+    IO_UINT32((uint32) config->policy);
+    IO_UINT64(len);
+
+    switch (config->policy) {
+        case ALTRACE_PAYLOAD_HASH:
+            IO_UINT64(hash_blob(data, (size_t) len));
+            break;
+
+        case ALTRACE_PAYLOAD_PREVIEW:
+            IO_BLOB(data, (len < config->amount) ? len : config->amount);
+            break;
+
+        case ALTRACE_PAYLOAD_DOWNSAMPLE: {
+            const uint64 factor = config->amount;
+            uint64 frames, kept, i;
+            uint8 *buf;
+            if (!framesize) {
+                framesize = 1;
+            }
+            frames = len / framesize;
+            kept = (frames + (factor - 1)) / factor;
+            buf = (uint8 *) malloc((size_t) (kept ? (kept * framesize) : 1));
+            if (!buf) {
+                out_of_memory();
+            }
+            for (i = 0; i < kept; i++) {
+                memcpy(buf + (i * framesize), data + ((i * factor) * framesize), framesize);
+            }
+            IO_UINT64(factor);
+            IO_UINT32(framesize);
+            IO_BLOB(buf, kept * framesize);
+            free(buf);
+            break;
+        }
+
+        default: break;  // ALTRACE_PAYLOAD_NONE
+    }
+}
+
+static void IO_EVENTENUM(const EventEnum x)
+{
+    const uint8 tag = (uint8) x;
+    if (!filtered_call) {
+        record_append(&tag, sizeof (tag));
+    }
+}
+
+static void IO_PTR(const void *ptr)
+{
+    IO_UINT64((uint64) (size_t) ptr);
+}
+
+static void IO_ALCENUM(ALCenum e)
+{
+    IO_UINT32((uint32) e);
+}
+
+static void IO_ENUM(ALenum e)
+{
+    IO_UINT32((uint32) e);
+}
+
+static void IO_ALCBOOLEAN(ALCboolean b)
+{
+    IO_UINT32((uint32) b);
+}
+
+static void IO_BOOLEAN(ALboolean b)
+{
+    IO_UINT32((uint32) b);
+}
+
+
+static void free_hash_item_stackframe(void *from, char *to) { free(to); }
+#define hash_stackframe hash_pointer
+HASH_MAP(stackframe, void *, char *)
+
+// backtrace_symbols() is pretty expensive, so we don't want to run it
+//  dozens of times per-frame. So we call it on individual frames when
+//  we haven't seen them before, assuming most of our calls come from a
+//  handful of places, and even there we can reuse most of the callstack
+//  frames anyhow.
+static char *get_callstack_sym(void *frame, int *_seen_before)
+{
+    char *retval = get_mapped_stackframe(frame);
+    if (retval) {
+        *_seen_before = 1;
+    } else {
+        char **syms = backtrace_symbols(&frame, 1);
+        char *sym = syms[0];
+        if (sym && (*sym == '0')) {  // skip '0\s+' on macOS; it's counting frames assuming there's more than one.
+            while (*(++sym) == ' ') { /* spin */ }
+        }
+        retval = sym ? strdup(sym) : NULL;
+        free(syms);
+        *_seen_before = 0;
+        if (retval) {
+            add_stackframe_to_map(frame, retval);
+        }
+    }
+    return retval;
+}
+
+#if ALTRACE_HAVE_MODULE_MAP
+// Instead of symbolizing callstacks while the app waits on us, we record
+//  where each loaded ELF object's code lives, and the playback side looks
+//  up symbols from the files on disk later. We only rescan the loaded
+//  objects when a frame turns up outside everything we know about, and
+//  only write a new ALEE_MODULE_MAP if the set actually changed.
+typedef struct ModuleInfo
+{
+    uintptr_t start;
+    uintptr_t end;
+    uintptr_t bias;
+    char *path;
+} ModuleInfo;
+
+static ModuleInfo *modules = NULL;
+static int num_modules = 0;
+static unsigned long long module_adds = 0;
+static unsigned long long module_subs = 0;
+static int module_counters_valid = 0;
+static int modules_scanned = 0;
+
+// frames we rescanned for and still couldn't place (JIT code, etc), so
+//  they don't force a rescan every time they show up.
+static void free_hash_item_unknownframe(void *from, int to) {}
+#define hash_unknownframe hash_pointer
+HASH_MAP(unknownframe, void *, int)
+
+static void free_modules(ModuleInfo *mods, const int count)
+{
+    int i;
+    for (i = 0; i < count; i++) {
+        free(mods[i].path);
+    }
+    free(mods);
+}
+
+static int cmp_modules(const void *_a, const void *_b)
+{
+    const ModuleInfo *a = (const ModuleInfo *) _a;
+    const ModuleInfo *b = (const ModuleInfo *) _b;
+    return (a->start < b->start) ? -1 : (a->start > b->start) ? 1 : 0;
+}
+
+typedef struct ModuleScan
+{
+    ModuleInfo *modules;
+    int num_modules;
+    int counters_valid;
+    unsigned long long adds;
+    unsigned long long subs;
+} ModuleScan;
+
+static int scan_module_callback(struct dl_phdr_info *info, size_t size, void *_data)
+{
+    ModuleScan *data = (ModuleScan *) _data;
+    const char *path = info->dlpi_name;
+    char exepath[PATH_MAX];
+    int i;
+
+    if (size >= (offsetof(struct dl_phdr_info, dlpi_subs) + sizeof (info->dlpi_subs))) {
+        data->counters_valid = 1;
+        data->adds = info->dlpi_adds;
+        data->subs = info->dlpi_subs;
+    }
+
+    if (!path || !*path) {  // the main executable doesn't report a name.
+        const ssize_t len = readlink("/proc/self/exe", exepath, sizeof (exepath) - 1);
+        if (len <= 0) {
+            return 0;  // oh well, skip it.
+        }
+        exepath[len] = '\0';
+        path = exepath;
+    }
+
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if ((phdr->p_type == PT_LOAD) && (phdr->p_flags & PF_X)) {
+            ModuleInfo *mod;
+            void *ptr = realloc(data->modules, (data->num_modules + 1) * sizeof (ModuleInfo));
+            if (!ptr) {
+                out_of_memory();
+            }
+            data->modules = (ModuleInfo *) ptr;
+            mod = &data->modules[data->num_modules];
+            mod->bias = (uintptr_t) info->dlpi_addr;
+            mod->start = mod->bias + (uintptr_t) phdr->p_vaddr;
+            mod->end = mod->start + (uintptr_t) phdr->p_memsz;
+            mod->path = strdup(path);
+            if (!mod->path) {
+                out_of_memory();
+            }
+            data->num_modules++;
+        }
+    }
+    return 0;
+}
+
+// returns non-zero if the list of loaded modules changed.
+static int scan_modules(void)
+{
+    ModuleScan data;
+
+    memset(&data, '\0', sizeof (data));
+    dl_iterate_phdr(scan_module_callback, &data);
+
+    if (modules_scanned && data.counters_valid && module_counters_valid &&
+        (data.adds == module_adds) && (data.subs == module_subs)) {
+        free_modules(data.modules, data.num_modules);
+        return 0;  // nothing was loaded or unloaded.
+    }
+
+    qsort(data.modules, data.num_modules, sizeof (ModuleInfo), cmp_modules);
+    free_modules(modules, num_modules);
+    modules = data.modules;
+    num_modules = data.num_modules;
+    module_adds = data.adds;
+    module_subs = data.subs;
+    module_counters_valid = data.counters_valid;
+    modules_scanned = 1;
+    free_unknownframe_map();  // these might be in a new module now.
+    return 1;
+}
+
+static int frame_in_known_module(void *frame)
+{
+    const uintptr_t addr = (uintptr_t) frame;
+    int lo = 0;
+    int hi = num_modules - 1;
+    while (lo <= hi) {
+        const int mid = lo + ((hi - lo) / 2);
+        const ModuleInfo *mod = &modules[mid];
+        if (addr < mod->start) {
+            hi = mid - 1;
+        } else if (addr >= mod->end) {
+            lo = mid + 1;
+        } else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void IO_MODULE_MAP(void)
+{
+    int i;
+    record_nodrop();
+    IO_EVENTENUM(ALEE_MODULE_MAP);
+    IO_UINT32((uint32) num_modules);
+    for (i = 0; i < num_modules; i++) {
+        IO_PTR((void *) modules[i].bias);
+        IO_PTR((void *) modules[i].start);
+        IO_UINT64((uint64) (modules[i].end - modules[i].start));
+        IO_STRING(modules[i].path);
+    }
+}
+
+static void check_module_map(void **callstack, const int frames)
+{
+    int i;
+    for (i = 0; i < frames; i++) {
+        void *ptr = callstack[i];
+        if (!frame_in_known_module(ptr) && !get_mapped_unknownframe(ptr)) {
+            if (scan_modules()) {
+                IO_MODULE_MAP();
+            }
+            if (!frame_in_known_module(ptr)) {
+                add_unknownframe_to_map(ptr, 1);
+            }
+        }
+    }
+}
+
+static void free_module_map(void)
+{
+    free_modules(modules, num_modules);
+    modules = NULL;
+    num_modules = 0;
+    modules_scanned = 0;
+    free_unknownframe_map();
+}
+#endif
+
+// Most calls come from a handful of places, so each distinct callstack gets
+//  written once with ALEE_NEW_CALLSTACK, and calls just refer to its ID.
+typedef struct InternedCallstack
+{
+    uint32 hash;
+    uint32 id;
+    int frames;
+    void **callstack;
+    struct InternedCallstack *next;
+} InternedCallstack;
+
+static InternedCallstack **interned_callstacks = NULL;
+static uint32 interned_callstack_buckets = 0;
+static uint32 num_interned_callstacks = 0;
+
+static uint32 hash_callstack(void **callstack, const int frames)
+{
+    uint32 hash = 5381;  // djb-xor over the pointers.
+    int i;
+    for (i = 0; i < frames; i++) {
+        uint64 val = (uint64) (size_t) callstack[i];
+        hash = ((hash << 5) + hash) ^ (uint32) (val & 0xFFFFFFFF);
+        hash = ((hash << 5) + hash) ^ (uint32) (val >> 32);
+    }
+    return hash;
+}
+
+static void grow_interned_callstacks(void)
+{
+    const uint32 newbuckets = interned_callstack_buckets ? (interned_callstack_buckets * 2) : 256;
+    InternedCallstack **newtable = (InternedCallstack **) calloc(newbuckets, sizeof (InternedCallstack *));
+    uint32 i;
+
+    if (!newtable) {
+        out_of_memory();
+    }
+
+    for (i = 0; i < interned_callstack_buckets; i++) {
+        InternedCallstack *item = interned_callstacks[i];
+        while (item) {
+            InternedCallstack *next = item->next;
+            const uint32 bucket = item->hash & (newbuckets - 1);
+            item->next = newtable[bucket];
+            newtable[bucket] = item;
+            item = next;
+        }
+    }
+
+    free(interned_callstacks);
+    interned_callstacks = newtable;
+    interned_callstack_buckets = newbuckets;
+}
+
+// returns the callstack's ID, and sets *_is_new if this is the first time
+//  we've seen it.
+static uint32 intern_callstack(void **callstack, const int frames, int *_is_new)
+{
+    const uint32 hash = hash_callstack(callstack, frames);
+    InternedCallstack *item;
+
+    if (interned_callstack_buckets) {
+        for (item = interned_callstacks[hash & (interned_callstack_buckets - 1)]; item; item = item->next) {
+            if ((item->hash == hash) && (item->frames == frames) && (memcmp(item->callstack, callstack, frames * sizeof (void *)) == 0)) {
+                *_is_new = 0;
+                return item->id;
+            }
+        }
+    }
+
+    if (num_interned_callstacks >= (interned_callstack_buckets / 2)) {
+        grow_interned_callstacks();
+    }
+
+    item = (InternedCallstack *) malloc(sizeof (InternedCallstack) + (frames * sizeof (void *)));
+    if (!item) {
+        out_of_memory();
+    }
+
+    item->hash = hash;
+    item->id = num_interned_callstacks++;
+    item->frames = frames;
+    item->callstack = (void **) (item + 1);
+    memcpy(item->callstack, callstack, frames * sizeof (void *));
+    item->next = interned_callstacks[hash & (interned_callstack_buckets - 1)];
+    interned_callstacks[hash & (interned_callstack_buckets - 1)] = item;
+    *_is_new = 1;
+    return item->id;
+}
+
+static void free_interned_callstacks(void)
+{
+    uint32 i;
+    for (i = 0; i < interned_callstack_buckets; i++) {
+        InternedCallstack *item = interned_callstacks[i];
+        while (item) {
+            InternedCallstack *next = item->next;
+            free(item);
+            item = next;
+        }
+    }
+    free(interned_callstacks);
+    interned_callstacks = NULL;
+    interned_callstack_buckets = 0;
+    num_interned_callstacks = 0;
+}
+
+// ALTRACE_SYMBOLIZE=1 goes back to calling backtrace_symbols() as calls
+//  happen. That's the only option where we can't write a module map.
+static int symbolize_inline = 1;
+
+// Unwinders fill in (callstack) with return addresses, starting with the
+//  one in their caller, like backtrace() does, and return the frame count.
+typedef int (*UnwinderFn)(void **callstack, const int maxframes);
+
+__attribute__((noinline)) static int unwind_backtrace(void **callstack, const int maxframes)
+{
+    void *frames[MAX_CALLSTACKS + 17];
+    const int max = (maxframes < MAX_CALLSTACKS + 16) ? maxframes : (MAX_CALLSTACKS + 16);
+    const int total = backtrace(frames, max + 1);
+    if (total <= 1) {
+        return 0;
+    }
+    memcpy(callstack, frames + 1, (total - 1) * sizeof (void *));  // drop our own frame.
+    return total - 1;
+}
+
+static int unwind_none(void **callstack, const int maxframes)
+{
+    return 0;
+}
+
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+#define ALTRACE_HAVE_FRAMEPOINTER_UNWINDER 1
+// This only works if the app was built with -fno-omit-frame-pointer (we
+//  are). Every frame starts with the caller's frame pointer and then the
+//  return address. We never follow a frame pointer outside this thread's
+//  stack, so code built without frame pointers just gives a short stack
+//  instead of crashing.
+static int get_thread_stack_bounds(uintptr_t *_lo, uintptr_t *_hi)
+{
+    ThreadState *ts = get_thread_state();
+    if (!ts->stack_hi) {
+        #if defined(__APPLE__)
+        pthread_t self = pthread_self();
+        ts->stack_hi = (uintptr_t) pthread_get_stackaddr_np(self);
+        ts->stack_lo = ts->stack_hi - (uintptr_t) pthread_get_stacksize_np(self);
+        #else
+        pthread_attr_t attr;
+        void *addr = NULL;
+        size_t size = 0;
+        if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+            return 0;
+        }
+        pthread_attr_getstack(&attr, &addr, &size);
+        pthread_attr_destroy(&attr);
+        ts->stack_lo = (uintptr_t) addr;
+        ts->stack_hi = ts->stack_lo + (uintptr_t) size;
+        #endif
+    }
+    *_lo = ts->stack_lo;
+    *_hi = ts->stack_hi;
+    return (*_hi > *_lo);
+}
+
+__attribute__((noinline)) static int unwind_framepointer(void **callstack, const int maxframes)
+{
+    uintptr_t lo, hi;
+    void **fp = (void **) __builtin_frame_address(0);
+    int frames = 0;
+
+    if (!get_thread_stack_bounds(&lo, &hi)) {
+        return 0;
+    }
+
+    while (frames < maxframes) {
+        void **next;
+        if (((uintptr_t) fp < lo) || (((uintptr_t) fp + (2 * sizeof (void *))) > hi) || (((uintptr_t) fp) & (sizeof (void *) - 1))) {
+            break;  // not a frame on this stack.
+        } else if (fp[1] == NULL) {
+            break;
+        }
+        callstack[frames++] = fp[1];
+        next = (void **) fp[0];
+        if (next <= fp) {
+            break;  // stacks grow down, so this would loop or go wild.
+        }
+        fp = next;
+    }
+    return frames;
+}
+#endif
+
+static UnwinderFn unwinder = unwind_backtrace;
+
+// Callstack sampling. If none of these are set, every call gets a callstack.
+//  Otherwise, a call gets one if any of them wants it.
+static uint32 callstack_every = 0;  // ALTRACE_CALLSTACK_EVERY
+static uint32 callstack_first = 0;  // ALTRACE_CALLSTACK_FIRST
+static int callstack_on_error = 0;  // ALTRACE_CALLSTACK_ON_ERROR
+static uint32 callstack_call_count = 0;
+static uint32 callstack_entry_counts[ALEE_MAX];
+
+static int want_callstack(const EventEnum entryid)
+{
+    int retval = 0;
+
+    if (!callstack_every && !callstack_first && !callstack_on_error) {
+        return 1;
+    }
+
+    if (callstack_every) {
+        if (++callstack_call_count >= callstack_every) {
+            callstack_call_count = 0;
+            retval = 1;
+        }
+    }
+
+    if (callstack_first && (callstack_entry_counts[entryid] < callstack_first)) {
+        callstack_entry_counts[entryid]++;
+        retval = 1;
+    }
+
+    return retval;
+}
+
+// Writes whatever events playback needs before a call can refer to this
+//  callstack, and returns the value for the call's frame count field.
+static uint32 IO_CALLSTACK_DEFINITIONS(void **callstack, int frames)
+{
+    char *new_strings[MAX_CALLSTACKS];
+    void *new_strings_ptrs[MAX_CALLSTACKS];
+    int num_new_strings = 0;
+    int is_new_callstack = 0;
+    const uint64 overhead_start = OVERHEAD_START();
+    uint32 callstack_id;
+    int i;
+
+    if (!symbolize_inline) {
+        #if ALTRACE_HAVE_MODULE_MAP
+        check_module_map(callstack, frames);
+        #endif
+    } else {
+        for (i = 0; i < frames; i++) {
+            int seen_before = 0;
+            void *ptr = callstack[i];
+            char *str = get_callstack_sym(ptr, &seen_before);
+            if ((str == NULL) && !seen_before) {
+                break;
+            }
+
+            if (!seen_before) {
+                new_strings[num_new_strings] = str;
+                new_strings_ptrs[num_new_strings] = ptr;
+                num_new_strings++;
+            }
+        }
+        frames = i;  /* in case we stopped early. */
+    }
+
+    OVERHEAD_ADD(ALTRACE_OVERHEAD_SYMBOLIZE, overhead_start);
+
+    if (num_new_strings > 0) {
+        record_nodrop();
+        IO_EVENTENUM(ALEE_NEW_CALLSTACK_SYMS);
+        IO_UINT32((uint32) num_new_strings);
+        for (i = 0; i < num_new_strings; i++) {
+            IO_PTR(new_strings_ptrs[i]);
+            IO_STRING(new_strings[i]);
+        }
+    }
+
+    callstack_id = intern_callstack(callstack, frames, &is_new_callstack);
+    if (is_new_callstack) {
+        record_nodrop();
+        IO_EVENTENUM(ALEE_NEW_CALLSTACK);
+        IO_UINT32(callstack_id);
+        IO_UINT32((uint32) frames);
+        for (i = 0; i < frames; i++) {
+            IO_PTR(callstack[i]);
+        }
+    }
+
+    return ALTRACE_CALLSTACK_ID_FLAG | callstack_id;
+}
+
+static const char *entrypoint_name(const EventEnum entryid)
+{
+    switch (entryid) {
+        #define ENTRYPOINT(ret,name,params,args,numargs,visitparams,visitargs) case ALEE_##name: return #name;
+        #include "altrace_entrypoints.h"
+        default: break;
+    }
+    return "(unknown)";
+}
+
+// Record-time filtering (ALTRACE_FILTER_*). Calls we turn away still go
+//  through to the real OpenAL and we still keep track of the objects they
+//  create or destroy, but nothing about them goes into the tracefile, not
+//  even state changes they cause, and they skip IO_ENTRYINFO and all the
+//  encoding. Later polls still notice async state (source playback, etc).
+//  Turning away calls that create things playback needs to know about
+//  (alcOpenDevice, alGenSources...) leaves a tracefile that can't --run.
+typedef struct FilterCallsite
+{
+    void *callsite;  // return address into the app's code.
+    EventEnum entryid;
+    int module_okay;
+    uint64 last_recorded;  // nanoseconds, for ALTRACE_FILTER_INTERVAL_MS.
+} FilterCallsite;
+
+#define FILTER_CALLSITES 4096  // must be a power of two.
+
+static int filtering = 0;  // non-zero if any of this is in use.
+static int capturing = 1;  // zero while capture is off; see process_capture_request().
+static uint8 filter_entry[ALEE_MAX];  // non-zero to turn away this entry point.
+static char **filter_modules = NULL;  // ALTRACE_FILTER_MODULES
+static int num_filter_modules = 0;
+static char **filter_deny_modules = NULL;  // ALTRACE_FILTER_DENY_MODULES
+static int num_filter_deny_modules = 0;
+static uint64 filter_interval_ns = 0;  // ALTRACE_FILTER_INTERVAL_MS
+static FilterCallsite *filter_callsites = NULL;
+static int callstack_depth = MAX_CALLSTACKS;  // ALTRACE_CALLSTACK_DEPTH
+
+static int filter_module_matches(const char *path, char **list, const int count)
+{
+    int i;
+    for (i = 0; i < count; i++) {
+        if (strstr(path, list[i]) != NULL) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int filter_module_okay(void *callsite)
+{
+    Dl_info info;
+    const char *path = (dladdr(callsite, &info) && info.dli_fname) ? info.dli_fname : "";
+    if (num_filter_modules && !filter_module_matches(path, filter_modules, num_filter_modules)) {
+        return 0;
+    }
+    return !filter_module_matches(path, filter_deny_modules, num_filter_deny_modules);
+}
+
+// Callsites are cached in a fixed-size table; if two collide, the newer
+//  one takes over the slot, which only means the other gets its module
+//  looked up again and might get recorded a little sooner than the
+//  interval says. Only called with the API lock held.
+static int filter_callsite(const EventEnum entryid, void *callsite)
+{
+    const uintptr_t hash = (((uintptr_t) callsite) >> 2) * 0x9E3779B1;
+    FilterCallsite *site = &filter_callsites[(hash >> 8) & (FILTER_CALLSITES - 1)];
+
+    if ((site->callsite != callsite) || (site->entryid != entryid)) {
+        site->callsite = callsite;
+        site->entryid = entryid;
+        site->module_okay = filter_module_okay(callsite);
+        site->last_recorded = 0;
+    }
+
+    if (!site->module_okay) {
+        return 1;
+    }
+
+    if (filter_interval_ns) {
+        const uint64 ns = now_ns();
+        if (site->last_recorded && ((ns - site->last_recorded) < filter_interval_ns)) {
+            return 1;
+        }
+        site->last_recorded = ns;
+    }
+
+    return 0;
+}
+
+// Decides if this call goes in the tracefile. Returns non-zero to turn it
+//  away, in which case nothing gets encoded until FILTER_END().
+static int FILTER_CALL(const EventEnum entryid, void *callsite)
+{
+    get_thread_state()->call_entry = entryid;
+    if (!capturing) {
+        filtered_call = 1;
+    } else if (filtering) {
+        filtered_call = filter_entry[entryid] || (filter_callsites && filter_callsite(entryid, callsite));
+    }
+    return filtered_call;
+}
+
+static void FILTER_END(void)
+{
+    filtered_call = 0;
+}
+
+static int parse_filter_list(const char *str, char ***_list, int *_count)
+{
+    char *dup = str ? strdup(str) : NULL;
+    char **list = NULL;
+    int count = 0;
+    char *saveptr = NULL;
+    char *tok;
+
+    if (!str) {
+        return 1;
+    } else if (!dup) {
+        out_of_memory();
+    }
+
+    for (tok = strtok_r(dup, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)) {
+        void *ptr;
+        while (*tok == ' ') {
+            tok++;
+        }
+        if (!*tok) {
+            continue;
+        }
+        ptr = realloc(list, (count + 1) * sizeof (char *));
+        if (!ptr) {
+            out_of_memory();
+        }
+        list = (char **) ptr;
+        list[count] = strdup(tok);
+        if (!list[count]) {
+            out_of_memory();
+        }
+        count++;
+    }
+
+    free(dup);
+    *_list = list;
+    *_count = count;
+    return 1;
+}
+
+static void free_filter_list(char **list, const int count)
+{
+    int i;
+    for (i = 0; i < count; i++) {
+        free(list[i]);
+    }
+    free(list);
+}
+
+// entry point names can be fnmatch() patterns, like "alListener*".
+static int apply_filter_entries(const char *envname, const uint8 filterval)
+{
+    char **list = NULL;
+    int count = 0;
+    int i, j;
+
+    parse_filter_list(getenv(envname), &list, &count);
+    for (i = 0; i < count; i++) {
+        int matched = 0;
+        for (j = 0; j < ALEE_MAX; j++) {
+            const char *name = entrypoint_name((EventEnum) j);
+            if ((*name != '(') && (fnmatch(list[i], name, 0) == 0)) {
+                filter_entry[j] = filterval;
+                matched = 1;
+            }
+        }
+        if (!matched) {
+            fprintf(stderr, "%s: %s: '%s' doesn't match any entry point\n", GAppName, envname, list[i]);
+        }
+    }
+    free_filter_list(list, count);
+    return count;
+}
+
+static int init_filter_config(void)
+{
+    const char *env = getenv("ALTRACE_FILTER_ALLOW");
+
+    memset(filter_entry, '\0', sizeof (filter_entry));
+    if (env && *env) {
+        memset(filter_entry, 1, sizeof (filter_entry));
+        apply_filter_entries("ALTRACE_FILTER_ALLOW", 0);
+        filtering = 1;
+    }
+    if (apply_filter_entries("ALTRACE_FILTER_DENY", 1)) {
+        filtering = 1;
+    }
+
+    parse_filter_list(getenv("ALTRACE_FILTER_MODULES"), &filter_modules, &num_filter_modules);
+    parse_filter_list(getenv("ALTRACE_FILTER_DENY_MODULES"), &filter_deny_modules, &num_filter_deny_modules);
+
+    env = getenv("ALTRACE_FILTER_INTERVAL_MS");
+    filter_interval_ns = env ? (((uint64) strtoull(env, NULL, 10)) * 1000000) : 0;
+
+    if (num_filter_modules || num_filter_deny_modules || filter_interval_ns) {
+        filter_callsites = (FilterCallsite *) calloc(FILTER_CALLSITES, sizeof (FilterCallsite));
+        if (!filter_callsites) {
+            out_of_memory();
+        }
+        filtering = 1;
+    }
+
+    env = getenv("ALTRACE_CALLSTACK_DEPTH");
+    if (env) {
+        callstack_depth = atoi(env);
+        if ((callstack_depth < 0) || (callstack_depth > MAX_CALLSTACKS)) {
+            fprintf(stderr, "%s: ALTRACE_CALLSTACK_DEPTH must be between 0 and %d\n", GAppName, MAX_CALLSTACKS);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void free_filter_config(void)
+{
+    free_filter_list(filter_modules, num_filter_modules);
+    filter_modules = NULL;
+    num_filter_modules = 0;
+    free_filter_list(filter_deny_modules, num_filter_deny_modules);
+    filter_deny_modules = NULL;
+    num_filter_deny_modules = 0;
+    free(filter_callsites);
+    filter_callsites = NULL;
+    filtering = 0;
+}
+
+static uint32 next_thread_index = 0;
+static int record_cpu_time = 0;  // ALTRACE_CPU_TIME
+static uint64 cpu_clock_overhead = 0;  // what a thread_cpu_ns() pair costs us.
+
+// Calls' durations are only known once they return, so the entry info
+//  leaves room for them: the duration in nanoseconds, shifted left one bit,
+//  with the low bit set if the thread's CPU time for the call follows.
+#define CALL_TIMING_FIELD_SIZE 8  // 56 bits, that's a long time.
+#define CALL_TIMING_COMPACT_MAX 1024
+
+// Threads get defined before their first call, and again at the start of
+//  every flight recorder segment or rolled tracefile (the one before might
+//  not be around). Indexes start over in each segment, so the ones in any
+//  file stay small and dense no matter how many threads came and went.
+//  Playback starts the thread's timestamps over from zero when it sees this.
+static void IO_THREAD_DEFINITION(ThreadState *ts)
+{
+    if (!ts->thread_index || (ts->segment_generation != segment_generation)) {
+        ts->thread_index = __atomic_add_fetch(&next_thread_index, 1, __ATOMIC_RELAXED);
+        ts->segment_generation = segment_generation;
+        ts->timestamp_base = 0;
+        record_nodrop();
+        IO_EVENTENUM(ALEE_NEW_THREAD);
+        IO_UINT32(ts->thread_index);
+        IO_UINT64((uint64) pthread_self());
+    }
+}
+
+__attribute__((noinline)) static void IO_ENTRYINFO(const EventEnum entryid)
+{
+    const uint64 currentns = now_ns();
+    ThreadState *ts = get_thread_state();
+    uint32 callstack_field = 0;
+    size_t entry;
+
+    ts->error_callstack_entry = (size_t) -1;
+
+    IO_THREAD_DEFINITION(ts);
+
+    if (callstack_depth && want_callstack(entryid)) {
+        void* callstack[MAX_CALLSTACKS + 2];
+        const int maxframes = (callstack_depth < MAX_CALLSTACKS) ? (callstack_depth + 2) : MAX_CALLSTACKS;
+        int frames;
+        OVERHEAD_TIMED(ALTRACE_OVERHEAD_UNWIND, frames = unwinder(callstack, maxframes));
+        frames -= 2;  // skip IO_ENTRYINFO and entry point.
+        if (frames < 0) {
+            frames = 0;
+        }
+        callstack_field = IO_CALLSTACK_DEFINITIONS(callstack + 2, frames);
+    }
+
+    entry = ts->record_len;
+    ts->record_timestamp = currentns;
+    IO_EVENTENUM(entryid);
+    IO_UINT32(ts->thread_index);
+    IO_UINT64(currentns - ts->timestamp_base);
+
+    // the frame field is 0 for no callstack, or the callstack's id plus one.
+    callstack_field = callstack_field ? ((callstack_field & ~ALTRACE_CALLSTACK_ID_FLAG) + 1) : 0;
+    if (!callstack_field && callstack_on_error) {
+        // filled in later if the call fails, so leave room for any id.
+        uint8 buf[5];
+        encode_varint_padded(buf, 0, sizeof (buf));
+        ts->error_callstack_entry = entry;
+        ts->error_callstack_field = ts->record_len - entry;
+        record_append(buf, sizeof (buf));
+    } else {
+        IO_UINT32(callstack_field);
+    }
+
+    {
+        uint8 buf[CALL_TIMING_FIELD_SIZE * 2];
+        const size_t len = record_cpu_time ? sizeof (buf) : CALL_TIMING_FIELD_SIZE;
+        memset(buf, '\0', sizeof (buf));
+        ts->timing_slot = ts->record_len;
+        record_append(buf, len);  // IO_CALL_TIMING() fills this in.
+    }
+}
+
+// Entry points that don't create or destroy anything (the ones that use
+//  IO_PASSTHROUGH) let go of the API lock for their real call.
+//  Everything else we do still happens under the lock, and records go out
+//  in the order their calls finished. Anything that needs OpenAL to itself,
+//  or needs every call's record to be out (state snapshots, new segments,
+//  swapping the current context to check sources), calls
+//  wait_for_unlocked_calls() first.
+//  OpenAL keeps one error code (and one set of state) per context, and we
+//  ask for it at the end of every call, so two calls on the same context
+//  can't overlap or one would report the other's errors and state changes.
+//  A call waits in IO_START until nobody else is in an unlocked call on the
+//  current context. There's only one current context for the whole process,
+//  so calls from different threads still run one at a time; the only ones
+//  that overlap are calls on a context the app has since switched away from.
+static int unlocked_calls = 0;  // calls that are in their real call without the lock.
+static int unlocked_calls_paused = 0;  // non-zero: new calls keep the lock for now.
+static int unlocked_call_waiters = 0;  // calls in wait_for_context_calls().
+static pthread_cond_t unlocked_calls_cond;
+
+static void APILOCK(void);
+static void APIUNLOCK(void);
+
+// APILOCK() for an entry point, which counts the wait for ALTRACE_OVERHEAD
+//  and ALTRACE_CONTENTION.
+static void APILOCK_FOR_CALL(void)
+{
+    if (!profile_overhead && !contention) {
+        APILOCK();
+    } else {
+        ThreadState *ts = get_thread_state();
+        const uint64 start = now_ns();
+        uint64 waited;
+        APILOCK();
+        waited = now_ns() - start;
+        if (profile_overhead) {
+            ts->overhead_ns[ALTRACE_OVERHEAD_LOCK_WAIT] += waited;
+        }
+        if (contention) {
+            ts->contention_wait_ns += waited;
+        }
+    }
+}
+
+// Only called with the API lock held. It's held again when this returns,
+//  but not while it waits.
+static void wait_for_unlocked_calls(void)
+{
+    if (unlocked_calls > 0) {
+        unlocked_calls_paused++;  // so this can't wait forever.
+        while (unlocked_calls > 0) {
+            pthread_cond_wait(&unlocked_calls_cond, apilock);
+        }
+        unlocked_calls_paused--;
+    }
+}
+
+// Only called with the API lock held, from IO_START. It's held again when
+//  this returns, but not while it waits. The wait counts as lock wait.
+static void wait_for_context_calls(void)
+{
+    if (current_context && (current_context->unlocked_calls > 0)) {
+        const int timed = profile_overhead || contention;
+        const uint64 start = timed ? now_ns() : 0;
+        unlocked_call_waiters++;
+        do {
+            pthread_cond_wait(&unlocked_calls_cond, apilock);
+        } while (current_context && (current_context->unlocked_calls > 0));
+        unlocked_call_waiters--;
+        if (timed) {
+            ThreadState *ts = get_thread_state();
+            const uint64 waited = now_ns() - start;
+            if (profile_overhead) {
+                ts->overhead_ns[ALTRACE_OVERHEAD_LOCK_WAIT] += waited;
+            }
+            if (contention) {
+                ts->contention_wait_ns += waited;
+            }
+        }
+    }
+}
+
+// Entry points put these right around their call into the real OpenAL, so
+//  a call's duration doesn't include any of our own work. Some make more
+//  than one real call, so this adds up until IO_CALL_TIMING().
+static void REAL_CALL_START(void)
+{
+    ThreadState *ts = get_thread_state();
+    if (ts->unlock_real_call && !unlocked_calls_paused) {
+        ts->real_call_unlocked = 1;
+        ts->real_call_context = current_context;
+        if (current_context) {
+            current_context->unlocked_calls++;
+        }
+        unlocked_calls++;
+        APIUNLOCK();
+    }
+    if (record_cpu_time) {
+        ts->real_call_cpu_start = thread_cpu_ns();
+    }
+    ts->real_call_start = now_ns();
+    if (profile_overhead && !ts->overhead_call_start) {
+        ts->overhead_call_start = ts->real_call_start;
+    }
+}
+
+static void REAL_CALL_END(void)
+{
+    const uint64 end = now_ns();
+    ThreadState *ts = get_thread_state();
+    ts->real_call_ns += end - ts->real_call_start;
+    if (record_cpu_time) {
+        const uint64 cpu = thread_cpu_ns() - ts->real_call_cpu_start;
+        ts->real_call_cpu_ns += (cpu > cpu_clock_overhead) ? (cpu - cpu_clock_overhead) : 0;
+    }
+    if (ts->real_call_unlocked) {
+        ContextWrapper *ctx = ts->real_call_context;
+        ts->real_call_unlocked = 0;
+        ts->real_call_context = NULL;
+        APILOCK_FOR_CALL();
+        unlocked_calls--;
+        if (ctx) {
+            ctx->unlocked_calls--;
+        }
+        if ((unlocked_calls_paused && (unlocked_calls == 0)) || (unlocked_call_waiters && ctx && (ctx->unlocked_calls == 0))) {
+            pthread_cond_broadcast(&unlocked_calls_cond);
+        }
+    }
+}
+
+// reading the thread's CPU clock is a syscall on some systems, which is
+//  charged to the call it's timing, so measure that and take it back out.
+static void calibrate_cpu_clock(void)
+{
+    uint64 best = ~((uint64) 0);
+    int i;
+    for (i = 0; i < 64; i++) {
+        const uint64 start = thread_cpu_ns();
+        const uint64 elapsed = thread_cpu_ns() - start;
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+    cpu_clock_overhead = best;
+}
+
+// fill in the space IO_ENTRYINFO left for the call's timing. If not much
+//  was written after it, squeeze the padding back out, too.
+static void IO_CALL_TIMING(void)
+{
+    ThreadState *ts = get_thread_state();
+    const size_t slot = ts->timing_slot;
+    const size_t slotlen = record_cpu_time ? (CALL_TIMING_FIELD_SIZE * 2) : CALL_TIMING_FIELD_SIZE;
+    const size_t tail = ts->record_len - (slot + slotlen);
+    const uint64 duration = (ts->real_call_ns << 1) | (record_cpu_time ? 1 : 0);
+    const uint64 cputime = ts->real_call_cpu_ns;
+    uint8 *ptr = ts->record + slot;
+
+    ts->overhead_ns[ALTRACE_OVERHEAD_REAL_CALL] = ts->real_call_ns;
+    if (record_histograms) {
+        record_latency(ts, ts->call_entry, ts->real_call_ns);
+    }
+    ts->real_call_ns = 0;
+    ts->real_call_cpu_ns = 0;
+
+    if (filtered_call) {
+        return;  // IO_ENTRYINFO didn't run, there's no slot.
+    }
+
+    if (tail <= CALL_TIMING_COMPACT_MAX) {
+        uint8 buf[MAX_VARINT_LEN * 2];
+        size_t len = encode_varint(buf, duration);
+        if (record_cpu_time) {
+            len += encode_varint(buf + len, cputime);
+        }
+        if (len < slotlen) {
+            memmove(ptr + len, ptr + slotlen, tail);
+            memcpy(ptr, buf, len);
+            ts->record_len -= slotlen - len;
+            return;
+        }
+    }
+
+    encode_varint_padded(ptr, duration, CALL_TIMING_FIELD_SIZE);
+    if (record_cpu_time) {
+        encode_varint_padded(ptr + CALL_TIMING_FIELD_SIZE, cputime, CALL_TIMING_FIELD_SIZE);
+    }
+}
+
+// ALTRACE_CALLSTACK_ON_ERROR: this call raised an error but we didn't get
+//  its callstack at the start, so get it now and patch it into the call's
+//  entry, which is still sitting in this thread's record buffer.
+static void IO_ERROR_CALLSTACK(void)
+{
+    ThreadState *ts = get_thread_state();
+    const size_t entry = ts->error_callstack_entry;
+    void *callstack[MAX_CALLSTACKS + 16];
+    Dl_info self, info;
+    size_t defstart, deflen;
+    uint32 callstack_field;
+    int frames, first;
+
+    if (entry == (size_t) -1) {
+        return;  // we have it already, or don't want it.
+    }
+    ts->error_callstack_entry = (size_t) -1;
+
+    // we're some unknown number of frames into the entry point now, so
+    //  skip everything that's in this library instead of a fixed count.
+    OVERHEAD_TIMED(ALTRACE_OVERHEAD_UNWIND, frames = unwinder(callstack, MAX_CALLSTACKS + 16));
+    if (!dladdr((void *) IO_ERROR_CALLSTACK, &self)) {
+        return;
+    }
+    for (first = 0; first < frames; first++) {
+        if (!dladdr(callstack[first], &info) || (info.dli_fbase != self.dli_fbase)) {
+            break;
+        }
+    }
+    frames -= first;
+    if (frames > callstack_depth) {
+        frames = callstack_depth;
+    }
+
+    // definitions go on the end of the record; move them in front of the entry.
+    defstart = ts->record_len;
+    callstack_field = IO_CALLSTACK_DEFINITIONS(callstack + first, frames);
+    deflen = ts->record_len - defstart;
+    if (deflen > 0) {
+        uint8 *tmp = (uint8 *) malloc(deflen);
+        if (!tmp) {
+            out_of_memory();
+        }
+        memcpy(tmp, ts->record + defstart, deflen);
+        memmove(ts->record + entry + deflen, ts->record + entry, defstart - entry);
+        memcpy(ts->record + entry, tmp, deflen);
+        free(tmp);
+    }
+
+    // overwrite the padded frame field; this id fits in its five bytes.
+    callstack_field = (callstack_field & ~ALTRACE_CALLSTACK_ID_FLAG) + 1;
+    encode_varint_padded(ts->record + entry + deflen + ts->error_callstack_field, callstack_field, 5);
+}
+
+static void APILOCK(void)
+{
+    const int rc = pthread_mutex_lock(apilock);
+    if (rc != 0) {
+        fprintf(stderr, "%s: Failed to grab API lock: %s\n", GAppName, strerror(rc));
+        quit_altrace_record();
+        _exit(42);
+    }
+}
+
+static void APIUNLOCK(void)
+{
+    const int rc = pthread_mutex_unlock(apilock);
+    if (rc != 0) {
+        fprintf(stderr, "%s: Failed to release API lock: %s\n", GAppName, strerror(rc));
+        quit_altrace_record();
+        _exit(42);
+    }
+}
+
+static void request_flight_error_dump(const char *what, const int err)
+{
+    if (flight_recorder && flight_error_dump_armed && !filtered_call) {
+        flight_error_dump_armed = 0;
+        snprintf(flight_error_reason, sizeof (flight_error_reason), "%s 0x%X", what, (unsigned int) err);
+        request_flight_dump(flight_error_reason);
+    }
+}
+
+static ALenum check_al_error_events(void)
+{
+    if (!current_context) return AL_NO_ERROR;  // !!! FIXME: OpenAL-Soft returns AL_INVALID_OPERATION if no context is current.
+    const ALenum alerr = REAL_alGetError();
+    if (alerr != AL_NO_ERROR) {
+        ALenum *errorlatch = current_context ? &current_context->errorlatch : &null_context_errorlatch;
+        IO_ERROR_CALLSTACK();
+        IO_EVENTENUM(ALEE_ALERROR_TRIGGERED);
+        IO_ENUM(alerr);
+        if (*errorlatch == AL_NO_ERROR) {
+            *errorlatch = alerr;
+        }
+        request_flight_error_dump("AL error", alerr);
+    }
+    return alerr;
+}
+
+static ALCenum check_alc_error_events(DeviceWrapper *device)
+{
+    ALCenum alcerr = ALC_NO_ERROR;
+    if (device) {
+        alcerr = REAL_alcGetError(device->device);
+        if (alcerr != ALC_NO_ERROR) {
+            IO_ERROR_CALLSTACK();
+            IO_EVENTENUM(ALEE_ALCERROR_TRIGGERED);
+            IO_PTR(device);
+            IO_ALCENUM(alcerr);
+            if (device->errorlatch == ALC_NO_ERROR) {
+                device->errorlatch = alcerr;
+            }
+            request_flight_error_dump("ALC error", alcerr);
+        }
+    }
+    return alcerr;
+}
+
+static void check_al_async_states(void);
+static void check_capture_samples(DeviceWrapper *device);
+static int start_poller_thread(void);
+static void stop_poller_thread(void);
+
+// Capture triggers (ALTRACE_CAPTURE, etc). While capture is off, entry
+//  points that don't create or destroy anything go straight to the real
+//  OpenAL through IO_PASSTHROUGH: no lock, no callstack, nothing written.
+//  While it's on, they make their real call without the lock instead (see
+//  REAL_CALL_START()).
+//  The rest still keep our wrappers up to date, so capture can start with
+//  a snapshot of everything that's alive (see write_state_snapshot()).
+//  Triggers can come from a signal handler or another thread, so they only
+//  post a request; the next call (or poll) to take the API lock acts on it.
+typedef enum
+{
+    CAPTURE_REQUEST_NONE,
+    CAPTURE_REQUEST_START,
+    CAPTURE_REQUEST_STOP
+} CaptureRequest;
+
+static int capture_passthrough = 0;  // non-zero: IO_PASSTHROUGH skips everything.
+static int capture_request = CAPTURE_REQUEST_NONE;
+static const char *capture_request_reason = NULL;
+static int capture_signals = 1;  // ALTRACE_CAPTURE_SIGNALS
+static uint64 capture_delay_ms = 0;  // ALTRACE_CAPTURE_DELAY_MS
+static uint64 capture_duration_ms = 0;  // ALTRACE_CAPTURE_DURATION_MS
+static pthread_t capture_timer_thread;
+static pthread_mutex_t capture_timer_lock;
+static pthread_cond_t capture_timer_cond;
+static int capture_timer_running = 0;
+static int capture_timer_quit = 0;
+
+#define IO_PASSTHROUGH(call) \
+    if (__atomic_load_n(&capture_passthrough, __ATOMIC_RELAXED)) { \
+        return REAL_##call; \
+    } \
+    get_thread_state()->unlock_real_call = 1;
+
+#define IO_PASSTHROUGH_VOID(call) \
+    if (__atomic_load_n(&capture_passthrough, __ATOMIC_RELAXED)) { \
+        REAL_##call; \
+        return; \
+    } \
+    get_thread_state()->unlock_real_call = 1;
+
+// async-signal-safe, so the signal handlers can use it.
+static void request_capture(const CaptureRequest request, const char *reason)
+{
+    __atomic_store_n(&capture_request_reason, reason, __ATOMIC_RELAXED);
+    __atomic_store_n(&capture_request, (int) request, __ATOMIC_RELEASE);
+    if (request == CAPTURE_REQUEST_START) {
+        // make the next call take the lock, so it notices.
+        __atomic_store_n(&capture_passthrough, 0, __ATOMIC_RELEASE);
+    }
+}
+
+static void write_state_snapshot(const char *scope);
+
+static void IO_CAPTURE_EVENT(const EventEnum event, const char *reason)
+{
+    record_nodrop();
+    IO_EVENTENUM(event);
+    IO_UINT64(now_ns());
+    IO_STRING(reason);
+    commit_record();
+}
+
+// Only called with the API lock held.
+static void process_capture_request(void)
+{
+    const CaptureRequest request = (CaptureRequest) __atomic_exchange_n(&capture_request, CAPTURE_REQUEST_NONE, __ATOMIC_ACQUIRE);
+    const char *reason = __atomic_load_n(&capture_request_reason, __ATOMIC_RELAXED);
+
+    if ((request == CAPTURE_REQUEST_START) && !capturing) {
+        wait_for_unlocked_calls();  // so nobody changes anything behind the snapshot's back.
+        fprintf(stderr, "%s: Capture started (%s)\n", GAppName, reason);
+        capturing = 1;
+        IO_CAPTURE_EVENT(ALEE_CAPTURE_STARTED, reason);
+        write_state_snapshot("altrace: state when capture started");
+    } else if ((request == CAPTURE_REQUEST_STOP) && capturing) {
+        fprintf(stderr, "%s: Capture stopped (%s)\n", GAppName, reason);
+        IO_CAPTURE_EVENT(ALEE_CAPTURE_STOPPED, reason);
+        capturing = 0;
+    }
+
+    __atomic_store_n(&capture_passthrough, !capturing, __ATOMIC_RELEASE);
+
+    // if another request came in meanwhile, don't let passthrough hide it.
+    if (__atomic_load_n(&capture_request, __ATOMIC_ACQUIRE) != CAPTURE_REQUEST_NONE) {
+        __atomic_store_n(&capture_passthrough, 0, __ATOMIC_RELEASE);
+    }
+}
+
+static void capture_signal_handler(int sig)
+{
+    if (flight_recorder) {
+        request_flight_dump("SIGUSR1");  // that's the only one we take in this mode.
+    } else if (sig == SIGUSR1) {
+        request_capture(CAPTURE_REQUEST_START, "SIGUSR1");
+    } else if (sig == SIGUSR2) {
+        request_capture(CAPTURE_REQUEST_STOP, "SIGUSR2");
+    }
+}
+
+static void install_capture_signal(const int sig, const char *signame)
+{
+    struct sigaction sa;
+
+    // don't take a signal away from an app that's already using it.
+    if ((sigaction(sig, NULL, &sa) != 0) || (sa.sa_handler != SIG_DFL)) {
+        fprintf(stderr, "%s: %s is already in use, not using it to start or stop capture\n", GAppName, signame);
+        return;
+    }
+
+    memset(&sa, '\0', sizeof (sa));
+    sa.sa_handler = capture_signal_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(sig, &sa, NULL) != 0) {
+        fprintf(stderr, "%s: Failed to install %s handler: %s\n", GAppName, signame, strerror(errno));
+    }
+}
+
+static int init_capture_config(void)
+{
+    const char *env = getenv("ALTRACE_CAPTURE");
+    capturing = env ? (atoi(env) != 0) : 1;
+
+    env = getenv("ALTRACE_CAPTURE_DELAY_MS");
+    capture_delay_ms = env ? (uint64) strtoull(env, NULL, 10) : 0;
+    if (capture_delay_ms) {
+        capturing = 0;
+    }
+
+    env = getenv("ALTRACE_CAPTURE_DURATION_MS");
+    capture_duration_ms = env ? (uint64) strtoull(env, NULL, 10) : 0;
+
+    env = getenv("ALTRACE_CAPTURE_SIGNALS");
+    capture_signals = env ? (atoi(env) != 0) : 1;
+    if (capture_signals) {
+        install_capture_signal(SIGUSR1, "SIGUSR1");
+        if (!flight_recorder) {
+            install_capture_signal(SIGUSR2, "SIGUSR2");
+        }
+    }
+
+    capture_passthrough = !capturing;
+    if (!capturing) {
+        fprintf(stderr, "%s: Capture is off until something starts it\n", GAppName);
+    }
+
+    return 1;
+}
+
+// returns non-zero if it was told to quit before (ms) passed.
+static int capture_timer_wait(const uint64 ms)
+{
+    struct timespec ts;
+    int quit;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += (time_t) (ms / 1000);
+    ts.tv_nsec += (long) ((ms % 1000) * 1000000);
+    while (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&capture_timer_lock);
+    while (!capture_timer_quit) {
+        if (pthread_cond_timedwait(&capture_timer_cond, &capture_timer_lock, &ts) == ETIMEDOUT) {
+            break;
+        }
+    }
+    quit = capture_timer_quit;
+    pthread_mutex_unlock(&capture_timer_lock);
+    return quit;
+}
+
+static void *capture_timer_thread_main(void *arg)
+{
+    if (capture_delay_ms) {
+        if (capture_timer_wait(capture_delay_ms)) {
+            return NULL;
+        }
+        request_capture(CAPTURE_REQUEST_START, "ALTRACE_CAPTURE_DELAY_MS");
+    }
+
+    if (capture_duration_ms) {
+        if (capture_timer_wait(capture_duration_ms)) {
+            return NULL;
+        }
+        request_capture(CAPTURE_REQUEST_STOP, "ALTRACE_CAPTURE_DURATION_MS");
+    }
+
+    return NULL;
+}
+
+static int start_capture_timer_thread(void)
+{
+    int rc;
+
+    if (!capture_delay_ms && !capture_duration_ms) {
+        return 1;
+    }
+
+    pthread_mutex_init(&capture_timer_lock, NULL);
+    pthread_cond_init(&capture_timer_cond, NULL);
+    rc = pthread_create(&capture_timer_thread, NULL, capture_timer_thread_main, NULL);
+    if (rc != 0) {
+        fprintf(stderr, "%s: Failed to create capture timer thread: %s\n", GAppName, strerror(rc));
+        return 0;
+    }
+    capture_timer_running = 1;
+    return 1;
+}
+
+static void stop_capture_timer_thread(void)
+{
+    if (!capture_timer_running) {
+        return;
+    }
+
+    pthread_mutex_lock(&capture_timer_lock);
+    capture_timer_quit = 1;
+    pthread_cond_signal(&capture_timer_cond);
+    pthread_mutex_unlock(&capture_timer_lock);
+    pthread_join(capture_timer_thread, NULL);
+    capture_timer_running = 0;
+    pthread_cond_destroy(&capture_timer_cond);
+    pthread_mutex_destroy(&capture_timer_lock);
+}
+
+#define IO_START(e) \
+    { \
+        OVERHEAD_CALL_START(); \
+        APILOCK_FOR_CALL(); \
+        if (unlocked_calls > 0) { \
+            wait_for_context_calls(); \
+        } \
+        if (__atomic_load_n(&capture_request, __ATOMIC_RELAXED) != CAPTURE_REQUEST_NONE) { \
+            process_capture_request(); \
+        } \
+        if (contention) { \
+            contention_call_start(__builtin_return_address(0)); \
+        } \
+        if (!FILTER_CALL(ALEE_##e, __builtin_return_address(0))) { \
+            IO_ENTRYINFO(ALEE_##e); \
+        }
+
+#define IO_END() \
+        IO_CALL_TIMING(); \
+        check_al_error_events(); \
+        FILTER_END(); \
+        OVERHEAD_TIMED(ALTRACE_OVERHEAD_POLL, check_al_async_states()); \
+        OVERHEAD_TIMED(ALTRACE_OVERHEAD_IO, commit_record()); \
+        if (segmented_output) { \
+            segment_requests_after_call(); \
+        } \
+        if (contention) { \
+            contention_call_end(); \
+        } \
+        get_thread_state()->unlock_real_call = 0; \
+        APIUNLOCK(); \
+        OVERHEAD_CALL_END(); \
+    }
+
+#define IO_END_ALC(dev) \
+        IO_CALL_TIMING(); \
+        check_alc_error_events(dev); \
+        FILTER_END(); \
+        OVERHEAD_TIMED(ALTRACE_OVERHEAD_POLL, check_al_async_states()); \
+        OVERHEAD_TIMED(ALTRACE_OVERHEAD_IO, commit_record()); \
+        if (segmented_output) { \
+            segment_requests_after_call(); \
+        } \
+        if (contention) { \
+            contention_call_end(); \
+        } \
+        get_thread_state()->unlock_real_call = 0; \
+        APIUNLOCK(); \
+        OVERHEAD_CALL_END(); \
+    }
+
+static const char *get_procname(const int argc, char **argv)
+{
+    const char *procname = "MyOpenALProgram";
+    if (argv && argv[0]) {
+        const char *ptr = strrchr(argv[0], '/');
+        procname = ptr ? (ptr + 1) : argv[0];
+    }
+    return procname;
+}
+
+// caller free()s the return value. This doesn't use sprintf_alloc(), since
+//  that's scratch memory that the caller couldn't free().
+static char *choose_tracefile_name(const char *procname)
+{
+    const size_t len = strlen(procname) + 32;
+    char *retval = (char *) malloc(len);
+    int i = 1;
+
+    if (retval) {
+        snprintf(retval, len, "%s.altrace", procname);
+    }
+
+    while (retval != NULL) {
+        FILE *f = fopen(retval, "rb");
+        if (!f) {
+            break;
         }
+
+        fclose(f);
+        snprintf(retval, len, "%s.%d.altrace", procname, i);
+        i++;
+    }
+    return retval;
+}
+
+static uint64 parse_size(const char *str, const uint64 defval)
+{
+    char *endp = NULL;
+    uint64 retval;
+
+    if (!str || !*str) {
+        return defval;
+    }
+
+    retval = (uint64) strtoull(str, &endp, 10);
+    switch (*endp) {
+        case 'k': case 'K': retval *= 1024; break;
+        case 'm': case 'M': retval *= 1024 * 1024; break;
+        case 'g': case 'G': retval *= 1024 * 1024 * 1024; break;
+        default: break;
+    }
+    return retval ? retval : defval;
+}
+
+static int parse_payload_config(const char *envname, PayloadConfig *config)
+{
+    const char *env = getenv(envname);
+    const char *colon = env ? strchr(env, ':') : NULL;
+    const size_t len = colon ? (size_t) (colon - env) : (env ? strlen(env) : 0);
+    uint64 defamount = 0;
+
+    if (!env || (strcmp(env, "full") == 0)) {
+        config->policy = ALTRACE_PAYLOAD_FULL;
+    } else if (strcmp(env, "none") == 0) {
+        config->policy = ALTRACE_PAYLOAD_NONE;
+    } else if (strcmp(env, "hash") == 0) {
+        config->policy = ALTRACE_PAYLOAD_HASH;
+    } else if ((len == 7) && (strncmp(env, "preview", len) == 0)) {
+        config->policy = ALTRACE_PAYLOAD_PREVIEW;
+        defamount = DEFAULT_PAYLOAD_PREVIEW_SIZE;
+    } else if ((len == 10) && (strncmp(env, "downsample", len) == 0)) {
+        config->policy = ALTRACE_PAYLOAD_DOWNSAMPLE;
+        defamount = DEFAULT_PAYLOAD_DOWNSAMPLE;
+    } else {
+        fprintf(stderr, "%s: %s must be 'full', 'none', 'hash', 'preview[:bytes]', or 'downsample[:frames]'\n", GAppName, envname);
+        return 0;
     }
-    return retval;
+
+    config->amount = defamount ? parse_size(colon ? colon + 1 : NULL, defamount) : 0;
+    return 1;
 }
 
-__attribute__((noinline)) static void IO_ENTRYINFO(const EventEnum entryid)
+// Flight recorder segments and rolled tracefiles have to make sense without
+//  anything that came before them, so they start over with everything later
+//  records might refer to, and a snapshot of the current state. Only called
+//  with the API lock held, between calls.
+static void start_new_segment(const char *scope)
 {
-    const uint32 currentms = now();
-    void* callstack[MAX_CALLSTACKS + 2];
-    char *new_strings[MAX_CALLSTACKS];
-    void *new_strings_ptrs[MAX_CALLSTACKS];
-    int frames = backtrace(callstack, MAX_CALLSTACKS);
-    int num_new_strings = 0;
+    wait_for_unlocked_calls();  // their records might refer to the old segment.
+    segment_generation++;
+    __atomic_store_n(&next_thread_index, 0, __ATOMIC_RELAXED);
+    free_interned_callstacks();
+    free_blob_table();
+    free_stackframe_map();
+    #if ALTRACE_HAVE_MODULE_MAP
+    if (!symbolize_inline) {
+        IO_MODULE_MAP();
+        commit_record();
+    }
+    #endif
+
+    if (capturing) {
+        write_state_snapshot(scope);
+    }
+}
+
+// Only called with the API lock held, between calls.
+static void flight_dump(const char *reason)
+{
+    char *filename = choose_tracefile_name(tracefile_procname);
+    const FlightSegment *oldest = &flight_segments[flight_first];
+    const uint64 seconds_ns = now_ns() - oldest->start_ns;
+    int okay;
     int i;
 
-    frames -= 2;  // skip IO_ENTRYINFO and entry point.
-    if (frames < 0) {
-        frames = 0;
+    if (!filename) {
+        out_of_memory();
     }
 
-    for (i = 0; i < frames; i++) {
-        int seen_before = 0;
-        void *ptr = callstack[i + 2];
-        char *str = get_callstack_sym(ptr, &seen_before);
-        if ((str == NULL) && !seen_before) {
-            break;
+    okay = flight_inner->open(filename);
+    if (okay) {
+        uint8 eos[1 + MAX_VARINT_LEN];
+        okay = flight_inner->write(flight_preamble.data, flight_preamble.len);
+        for (i = 0; okay && (i < flight_count); i++) {
+            const FlightSegment *seg = &flight_segments[(flight_first + i) % FLIGHT_SEGMENTS];
+            okay = flight_inner->write(seg->data, seg->len);
         }
 
-        if (!seen_before) {
-            new_strings[num_new_strings] = str;
-            new_strings_ptrs[num_new_strings] = ptr;
-            num_new_strings++;
+        eos[0] = (uint8) ALEE_EOS;
+        okay = okay && flight_inner->write(eos, 1 + encode_varint(eos + 1, now_ns()));
+        if (okay) {
+            flight_inner->commit();
+        }
+        if (!flight_inner->close()) {
+            okay = 0;
         }
     }
-    frames = i;  /* in case we stopped early. */
 
-    if (num_new_strings > 0) {
-        IO_EVENTENUM(ALEE_NEW_CALLSTACK_SYMS);
-        IO_UINT32((uint32) num_new_strings);
-        for (i = 0; i < num_new_strings; i++) {
-            IO_PTR(new_strings_ptrs[i]);
-            IO_STRING(new_strings[i]);
-        }
+    if (okay) {
+        fprintf(stderr, "%s: Dumped the last %.2f seconds of OpenAL calls to '%s' (%s)\n", GAppName, ((double) seconds_ns) / 1000000000.0, filename, reason);
+    } else {
+        fprintf(stderr, "%s: Failed to dump OpenAL calls to '%s' (%s): %s\n", GAppName, filename, reason, strerror(errno));
     }
+    fflush(stderr);
+    free(filename);
+}
 
-    IO_EVENTENUM(entryid);
-    IO_UINT32(currentms);
-    IO_UINT64((uint64) pthread_self());
+// Only called with the API lock held, between calls, so the current
+//  thread's record is empty and nothing else is writing.
+static void flight_rotate(void)
+{
+    const uint64 ticks = now_ns();
+    FlightSegment *seg;
 
-    IO_UINT32((uint32) frames);
-    for (i = 0; i < frames; i++) {
-        IO_PTR(callstack[i + 2]);
+    flight_rotate_pending = 0;
+
+    // keep everything newer than the window, and at most FLIGHT_SEGMENTS - 1 full segments.
+    while ((flight_count > 1) && ((flight_count == FLIGHT_SEGMENTS) ||
+            (flight_window_ns && ((ticks - flight_segments[(flight_first + 1) % FLIGHT_SEGMENTS].start_ns) > flight_window_ns)))) {
+        flight_segments[flight_first].len = 0;  // keep the allocation for later.
+        flight_first = (flight_first + 1) % FLIGHT_SEGMENTS;
+        flight_count--;
     }
+
+    seg = &flight_segments[(flight_first + flight_count) % FLIGHT_SEGMENTS];
+    flight_count++;
+    seg->len = 0;
+    seg->snapshot_len = 0;
+    seg->start_ns = ticks;
+
+    start_new_segment("altrace: state when this part of the flight recording started");
+
+    seg->snapshot_len = seg->len;
+    flight_rotate_pending = 0;  // writing the snapshot doesn't count.
+    flight_error_dump_armed = 1;
 }
 
-static void APILOCK(void)
+// Only called from the writer thread, right before the first record of
+//  the segment that goes in the new tracefile.
+static void roll_tracefile(void)
 {
-    const int rc = pthread_mutex_lock(apilock);
-    if (rc != 0) {
-        fprintf(stderr, "%s: Failed to grab API lock: %s\n", GAppName, strerror(rc));
-        quit_altrace_record();
-        _exit(42);
+    char *filename = choose_tracefile_name(tracefile_procname);
+    uint8 eos[1 + MAX_VARINT_LEN];
+    uint32 hdr[2];
+
+    if (!filename) {
+        out_of_memory();
+    }
+
+    eos[0] = (uint8) ALEE_EOS;
+    if (!roll_inner->write(eos, 1 + encode_varint(eos + 1, now_ns()))) {
+        IO_WRITE_FAIL();
+    }
+    roll_inner->commit();
+    if (!roll_inner->close()) {
+        fprintf(stderr, "%s: Failed to close OpenAL log file: %s\n", GAppName, strerror(errno));
+    }
+
+    if (!rolling_output_open(filename)) {
+        IO_WRITE_FAIL();
+    }
+
+    hdr[0] = swap32(ALTRACE_LOG_FILE_MAGIC);
+    hdr[1] = swap32(ALTRACE_LOG_FILE_FORMAT);
+    if (!roll_inner->write(hdr, sizeof (hdr))) {
+        IO_WRITE_FAIL();
     }
+
+    fprintf(stderr, "%s: Continuing OpenAL session in log file '%s'\n", GAppName, filename);
+    free(filename);
 }
 
-static void APIUNLOCK(void)
+static int segment_request_pending(void)
 {
-    const int rc = pthread_mutex_unlock(apilock);
-    if (rc != 0) {
-        fprintf(stderr, "%s: Failed to release API lock: %s\n", GAppName, strerror(rc));
-        quit_altrace_record();
-        _exit(42);
+    if (flight_recorder) {
+        return flight_rotate_pending || (__atomic_load_n(&flight_dump_request, __ATOMIC_ACQUIRE) != NULL);
     }
+    return rolling && __atomic_load_n(&roll_wanted, __ATOMIC_ACQUIRE) && (__atomic_load_n(&roll_at_seq, __ATOMIC_ACQUIRE) == NO_ROLL_PENDING);
 }
 
-static ALenum check_al_error_events(void)
+// Only called with the API lock held, after a call's record is committed
+//  (or by the poller thread, between polls).
+static void process_segment_requests(void)
 {
-    if (!current_context) return AL_NO_ERROR;  // !!! FIXME: OpenAL-Soft returns AL_INVALID_OPERATION if no context is current.
-    const ALenum alerr = REAL_alGetError();
-    if (alerr != AL_NO_ERROR) {
-        ALenum *errorlatch = current_context ? &current_context->errorlatch : &null_context_errorlatch;
-        IO_EVENTENUM(ALEE_ALERROR_TRIGGERED);
-        IO_ENUM(alerr);
-        if (*errorlatch == AL_NO_ERROR) {
-            *errorlatch = alerr;
+    if (flight_recorder) {
+        const char *reason = __atomic_exchange_n(&flight_dump_request, NULL, __ATOMIC_ACQUIRE);
+        if (reason) {
+            flight_dump(reason);
         }
+        if (flight_rotate_pending) {
+            flight_rotate();
+        }
+    } else if (rolling && __atomic_load_n(&roll_wanted, __ATOMIC_ACQUIRE) && (__atomic_load_n(&roll_at_seq, __ATOMIC_ACQUIRE) == NO_ROLL_PENDING)) {
+        __atomic_store_n(&roll_wanted, 0, __ATOMIC_RELEASE);
+        wait_for_unlocked_calls();  // their records belong in the old tracefile.
+        // every record committed from here on goes in the new tracefile.
+        __atomic_store_n(&roll_at_seq, __atomic_load_n(&next_record_seq, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+        start_new_segment("altrace: state when this tracefile started");
     }
-    return alerr;
 }
 
-static ALCenum check_alc_error_events(DeviceWrapper *device)
-{
-    ALCenum alcerr = ALC_NO_ERROR;
-    if (device) {
-        alcerr = REAL_alcGetError(device->device);
-        if (alcerr != ALC_NO_ERROR) {
-            IO_EVENTENUM(ALEE_ALCERROR_TRIGGERED);
-            IO_PTR(device);
-            IO_ALCENUM(alcerr);
-            if (device->errorlatch == ALC_NO_ERROR) {
-                device->errorlatch = alcerr;
-            }
-        }
+// A new segment means a state snapshot, and a flight dump means writing a
+//  tracefile, which could stall the app's thread (maybe its audio thread)
+//  for a long time. If the poller thread is running, it does them instead,
+//  as soon as we wake it up; calls that finish meanwhile go in the old
+//  segment, which is fine. Without it, the call that notices does them.
+//  Only called with the API lock held, after a call's record is committed.
+static void segment_requests_after_call(void)
+{
+    if (!poller_thread_running) {
+        process_segment_requests();
+    } else if (segment_request_pending() && !__atomic_exchange_n(&poller_wake_pending, 1, __ATOMIC_ACQ_REL)) {
+        pthread_mutex_lock(&poller_lock);
+        pthread_cond_signal(&poller_cond);
+        pthread_mutex_unlock(&poller_lock);
     }
-    return alcerr;
 }
 
-static void check_al_async_states(void);
+static int init_output_config(void)
+{
+    const char *env = getenv("ALTRACE_ASYNC");
+    async_writer = (env && (atoi(env) != 0));
 
-#define IO_START(e) \
-    { \
-        APILOCK(); \
-        IO_ENTRYINFO(ALEE_##e)
+    ring_size = parse_size(getenv("ALTRACE_BUFFER_SIZE"), DEFAULT_RING_SIZE);
 
-#define IO_END() \
-        check_al_error_events(); \
-        check_al_async_states(); \
-        APIUNLOCK(); \
+    if (!parse_payload_config("ALTRACE_BUFFER_DATA", &buffer_payload) ||
+        !parse_payload_config("ALTRACE_CAPTURE_DATA", &capture_payload)) {
+        return 0;
     }
 
-#define IO_END_ALC(dev) \
-        check_alc_error_events(dev); \
-        check_al_async_states(); \
-        APIUNLOCK(); \
+    env = getenv("ALTRACE_BLOB_DEDUP");
+    blob_dedup = env ? (atoi(env) != 0) : 1;
+    blob_dedup_memory = parse_size(getenv("ALTRACE_BLOB_DEDUP_MEMORY"), DEFAULT_BLOB_DEDUP_MEMORY);
+
+    env = getenv("ALTRACE_POLL_HZ");
+    poll_hz = env ? atoi(env) : DEFAULT_POLL_HZ;
+
+    env = getenv("ALTRACE_UNWINDER");
+    if (!env || (strcmp(env, "backtrace") == 0)) {
+        unwinder = unwind_backtrace;
+    } else if (strcmp(env, "none") == 0) {
+        unwinder = unwind_none;
+    } else if (strcmp(env, "framepointer") == 0) {
+        #if ALTRACE_HAVE_FRAMEPOINTER_UNWINDER
+        unwinder = unwind_framepointer;
+        #else
+        fprintf(stderr, "%s: ALTRACE_UNWINDER=framepointer isn't supported on this CPU, using backtrace\n", GAppName);
+        unwinder = unwind_backtrace;
+        #endif
+    } else {
+        fprintf(stderr, "%s: ALTRACE_UNWINDER must be 'backtrace', 'framepointer', or 'none'\n", GAppName);
+        return 0;
     }
 
-static const char *get_procname(const int argc, char **argv)
-{
-    const char *procname = "MyOpenALProgram";
-    if (argv && argv[0]) {
-        const char *ptr = strrchr(argv[0], '/');
-        procname = ptr ? (ptr + 1) : argv[0];
+    env = getenv("ALTRACE_CALLSTACK_EVERY");
+    callstack_every = env ? (uint32) strtoul(env, NULL, 10) : 0;
+    env = getenv("ALTRACE_CALLSTACK_FIRST");
+    callstack_first = env ? (uint32) strtoul(env, NULL, 10) : 0;
+    env = getenv("ALTRACE_CALLSTACK_ON_ERROR");
+    callstack_on_error = (env && (atoi(env) != 0));
+
+    env = getenv("ALTRACE_OVERHEAD");
+    profile_overhead = (env && (atoi(env) != 0));
+    if (profile_overhead) {
+        // this is big, but untouched pages are free, and most entry points never get called.
+        overhead_stats = (OverheadStats *) calloc(ALEE_MAX, sizeof (OverheadStats));
+        if (!overhead_stats) {
+            out_of_memory();
+        }
     }
-    return procname;
-}
 
-static char *choose_tracefile_name(const int argc, char **argv)
-{
-    const char *procname = get_procname(argc, argv);
-    char *retval = sprintf_alloc("%s.altrace", procname);
-    int i = 1;
+    env = getenv("ALTRACE_CONTENTION");
+    contention = (env && (atoi(env) != 0));
+    env = getenv("ALTRACE_CONTENTION_WINDOW_US");
+    contention_window_ns = ((uint64) (env ? strtoull(env, NULL, 10) : DEFAULT_CONTENTION_WINDOW_US)) * 1000;
+
+    env = getenv("ALTRACE_HISTOGRAMS");
+    record_histograms = (env && (atoi(env) != 0));
+    env = getenv("ALTRACE_HISTOGRAM_FILE");
+    if (env && *env) {
+        histogram_file = strdup(env);
+        if (!histogram_file) {
+            out_of_memory();
+        }
+        record_histograms = 1;
+    }
+    if (record_histograms) {
+        latency_merged = (uint64 *) calloc(ALEE_MAX * ALTRACE_HISTOGRAM_BUCKETS, sizeof (uint64));
+        if (!latency_merged) {
+            out_of_memory();
+        }
+    }
 
-    while (retval != NULL) {
-        FILE *f = fopen(retval, "rb");
-        if (!f) {
-            break;
+    env = getenv("ALTRACE_CPU_TIME");
+    record_cpu_time = (env && (atoi(env) != 0));
+    if (record_cpu_time) {
+        calibrate_cpu_clock();
+    }
+
+    #if ALTRACE_HAVE_MODULE_MAP
+    env = getenv("ALTRACE_SYMBOLIZE");
+    symbolize_inline = (env && (atoi(env) != 0));
+    #endif
+
+    env = getenv("ALTRACE_OUTPUT");
+    if (!env || (strcmp(env, "write") == 0)) {
+        output = &fd_output;
+    } else if (strcmp(env, "mmap") == 0) {
+        output = &mmap_output;
+        segment_size = parse_size(getenv("ALTRACE_SEGMENT_SIZE"), DEFAULT_SEGMENT_SIZE);
+    } else {
+        fprintf(stderr, "%s: ALTRACE_OUTPUT must be 'write' or 'mmap'\n", GAppName);
+        return 0;
+    }
+
+    env = getenv("ALTRACE_COMPRESS");
+    if (env && (atoi(env) != 0)) {
+        const uint64 blocksize = parse_size(getenv("ALTRACE_COMPRESS_BLOCK_SIZE"), DEFAULT_COMPRESS_BLOCK_SIZE);
+        compress_inner = output;
+        output = &compressed_output;
+        if (blocksize < MIN_COMPRESS_BLOCK_SIZE) {
+            fprintf(stderr, "%s: ALTRACE_COMPRESS_BLOCK_SIZE is too small, using %u\n", GAppName, (unsigned int) MIN_COMPRESS_BLOCK_SIZE);
+            compress_block_size = MIN_COMPRESS_BLOCK_SIZE;
+        } else if (blocksize > MAX_COMPRESS_BLOCK_SIZE) {
+            fprintf(stderr, "%s: ALTRACE_COMPRESS_BLOCK_SIZE is too big, using %u\n", GAppName, (unsigned int) MAX_COMPRESS_BLOCK_SIZE);
+            compress_block_size = MAX_COMPRESS_BLOCK_SIZE;
+        } else {
+            compress_block_size = (uint32) blocksize;
         }
+    }
 
-        fclose(f);
-        free(retval);
-        retval = sprintf_alloc("%s.%d.altrace", procname, i);
-        i++;
+    flight_segment_size = parse_size(getenv("ALTRACE_FLIGHT_RECORDER"), 0) / (FLIGHT_SEGMENTS - 1);
+    env = getenv("ALTRACE_FLIGHT_SECONDS");
+    flight_window_ns = env ? (uint64) (strtod(env, NULL) * 1000000000.0) : 0;
+    if (flight_segment_size || flight_window_ns) {
+        flight_recorder = 1;
+        segmented_output = 1;
+        flight_inner = output;
+        output = &flight_output;
+        if (async_writer) {
+            // segments have to end between two calls, in call order.
+            fprintf(stderr, "%s: ALTRACE_ASYNC doesn't work with the flight recorder, turning it off\n", GAppName);
+            async_writer = 0;
+        }
     }
-    return retval;
+
+    roll_size = parse_size(getenv("ALTRACE_ROLL_SIZE"), 0);
+    env = getenv("ALTRACE_ROLL_MINUTES");
+    roll_interval_ns = env ? (uint64) (strtod(env, NULL) * 60.0 * 1000000000.0) : 0;
+    env = getenv("ALTRACE_ROLL_KEEP");
+    roll_keep = env ? (uint32) strtoul(env, NULL, 10) : 0;
+    if (roll_size || roll_interval_ns) {
+        if (flight_recorder) {
+            fprintf(stderr, "%s: ALTRACE_ROLL_* doesn't work with the flight recorder, ignoring it\n", GAppName);
+        } else {
+            rolling = 1;
+            segmented_output = 1;
+            roll_inner = output;
+            output = &rolling_output;
+            async_writer = 1;  // the writer thread switches files; see roll_tracefile().
+        }
+    }
+
+    env = getenv("ALTRACE_BACKPRESSURE");
+    if (!env || (strcmp(env, "block") == 0)) {
+        backpressure = BACKPRESSURE_BLOCK;
+    } else if (strcmp(env, "drop") == 0) {
+        backpressure = BACKPRESSURE_DROP;
+    } else if (strcmp(env, "grow") == 0) {
+        backpressure = BACKPRESSURE_GROW;
+    } else {
+        fprintf(stderr, "%s: ALTRACE_BACKPRESSURE must be 'block', 'drop', or 'grow'\n", GAppName);
+        return 0;
+    }
+
+    if (pthread_key_create(&thread_state_key, free_thread_state) != 0) {
+        fprintf(stderr, "%s: Failed to create thread-local storage\n", GAppName);
+        return 0;
+    }
+    thread_state_key_created = 1;
+
+    pthread_atfork(NULL, NULL, forked_child);
+
+    return 1;
 }
 
 static void init_altrace_record(int argc, char **argv) __attribute__((constructor));
@@ -469,6 +4336,18 @@ static void init_altrace_record(int argc, char **argv)
         _exit(42);
     }
 
+    if (!init_output_config()) {
+        okay = 0;
+    }
+
+    if (okay && !init_filter_config()) {
+        okay = 0;
+    }
+
+    if (okay && !init_capture_config()) {
+        okay = 0;
+    }
+
     if (okay) {
         const int rc = pthread_mutex_init(&_apilock, NULL);
         if (rc != 0) {
@@ -476,20 +4355,29 @@ static void init_altrace_record(int argc, char **argv)
             okay = 0;
         }
         apilock = &_apilock;
+        pthread_cond_init(&unlocked_calls_cond, NULL);
     }
 
     if (okay) {
-        char *filename = choose_tracefile_name(argc, argv);
-        logfd = filename ? open(filename, O_WRONLY | O_TRUNC | O_CREAT, 0644) : -1;
-        if (logfd == -1) {
+        char *filename;
+        tracefile_procname = get_procname(argc, argv);
+        filename = choose_tracefile_name(tracefile_procname);
+        if (!filename || !output->open(filename)) {
             fprintf(stderr, "%s: Failed to open OpenAL log file '%s': %s\n", GAppName, filename, filename ? strerror(errno) : "Out of memory");
+            output = NULL;
             okay = 0;
+        } else if (flight_recorder) {
+            fprintf(stderr, "%s: Keeping the last part of the OpenAL session in memory, dumps go to files like '%s'\n\n\n", GAppName, filename);
         } else {
             fprintf(stderr, "%s: Recording OpenAL session to log file '%s'\n\n\n", GAppName, filename);
         }
         free(filename);
     }
 
+    if (okay && async_writer) {
+        okay = start_writer_thread();
+    }
+
     fflush(stderr);
 
     if (!okay) {
@@ -497,33 +4385,323 @@ static void init_altrace_record(int argc, char **argv)
         _exit(42);
     }
 
-    IO_UINT32(ALTRACE_LOG_FILE_MAGIC);
-    IO_UINT32(ALTRACE_LOG_FILE_FORMAT);
+    writele32(ALTRACE_LOG_FILE_MAGIC);
+    writele32(ALTRACE_LOG_FILE_FORMAT);
+
+    #if ALTRACE_HAVE_MODULE_MAP
+    if (!symbolize_inline) {
+        scan_modules();
+        IO_MODULE_MAP();
+    }
+    #endif
+
+    commit_record();
+
+    if (flight_recorder) {
+        flight_end_preamble();
+    }
+
+    if (!start_poller_thread() || !start_capture_timer_thread()) {
+        quit_altrace_record();
+        _exit(42);
+    }
+}
+
+static void IO_OVERHEAD_SUMMARY(void)
+{
+    uint32 entries = 0;
+    int i, j;
+
+    for (i = 0; i < ALEE_MAX; i++) {
+        if (overhead_stats[i].calls) {
+            entries++;
+        }
+    }
+
+    IO_EVENTENUM(ALEE_OVERHEAD_SUMMARY);
+    IO_UINT32(ALTRACE_OVERHEAD_MAX);
+    IO_UINT32(entries);
+    for (i = 0; i < ALEE_MAX; i++) {
+        const OverheadStats *stats = &overhead_stats[i];
+        uint32 buckets = 0;
+        if (!stats->calls) {
+            continue;
+        }
+
+        IO_EVENTENUM((EventEnum) i);
+        IO_UINT64(stats->calls);
+        for (j = 0; j < ALTRACE_OVERHEAD_MAX; j++) {
+            IO_UINT64(stats->ns[j]);
+        }
+
+        for (j = 0; j < ALTRACE_HISTOGRAM_BUCKETS; j++) {
+            if (stats->histogram[j]) {
+                buckets++;
+            }
+        }
+        IO_UINT32(buckets);
+        for (j = 0; j < ALTRACE_HISTOGRAM_BUCKETS; j++) {
+            if (stats->histogram[j]) {
+                IO_UINT32((uint32) j);
+                IO_UINT64(stats->histogram[j]);
+            }
+        }
+    }
+}
+
+// Only called at shutdown, when nothing else is touching the stats.
+static void IO_CONTENTION_SUMMARY(void)
+{
+    ContentionThread **bythread = (ContentionThread **) contention_alloc((num_contention_threads + 1) * sizeof (ContentionThread *));
+    ContentionThread *thr;
+    const ContentionContext *cc;
+    const ContentionObject *obj;
+    uint32 shared = 0;
+    uint32 i;
+
+    for (thr = contention_threads; thr; thr = thr->next) {
+        bythread[thr->index] = thr;
+    }
+
+    // which threads used how many sources and buffers, and which were shared.
+    for (obj = contention_objects; obj; obj = obj->next) {
+        for (i = 0; i < obj->num_threads; i++) {
+            if (obj->is_buffer) {
+                bythread[obj->threads[i]]->buffers++;
+            } else {
+                bythread[obj->threads[i]]->sources++;
+            }
+        }
+        if (obj->num_threads > 1) {
+            shared++;
+        }
+    }
+
+    IO_EVENTENUM(ALEE_CONTENTION_SUMMARY);
+    IO_UINT64(contention_window_ns);
+
+    IO_UINT32(num_contention_threads);
+    for (thr = contention_threads; thr; thr = thr->next) {
+        const ContentionContextUse *use;
+        uint32 uses = 0;
+        for (use = thr->contexts; use; use = use->next) {
+            uses++;
+        }
+        IO_UINT64(thr->logthreadid);
+        IO_UINT64(thr->calls);
+        IO_UINT64(thr->wait_ns);
+        IO_UINT64(thr->max_wait_ns);
+        IO_UINT32(thr->sources);
+        IO_UINT32(thr->buffers);
+        IO_UINT32(uses);
+        for (use = thr->contexts; use; use = use->next) {
+            IO_PTR(use->context->ctx);
+            IO_UINT64(use->calls);
+        }
+    }
+
+    IO_UINT32(num_contention_contexts);
+    for (cc = contention_contexts; cc; cc = cc->next) {
+        IO_PTR(cc->ctx);
+        IO_UINT64(cc->calls);
+        IO_UINT64(cc->handoffs);
+        IO_UINT64(cc->overlaps);
+    }
+
+    IO_UINT32(num_contention_callsites);
+    for (i = 0; i < contention_callsite_buckets; i++) {
+        const ContentionCallsite *site;
+        for (site = contention_callsites[i]; site; site = site->next) {
+            IO_EVENTENUM(site->entryid);
+            IO_PTR(site->callsite);
+            IO_UINT64(site->calls);
+            IO_UINT64(site->wait_ns);
+            IO_UINT64(site->max_wait_ns);
+        }
+    }
+
+    IO_UINT32(shared);
+    for (obj = contention_objects; obj; obj = obj->next) {
+        if (obj->num_threads <= 1) {
+            continue;  // only one thread used it.
+        }
+        IO_UINT32(obj->is_buffer ? 1 : 0);
+        IO_UINT32(obj->name);
+        IO_UINT64(obj->calls);
+        IO_UINT32(obj->num_threads);
+        for (i = 0; i < obj->num_threads; i++) {
+            IO_UINT64(bythread[obj->threads[i]]->logthreadid);
+        }
+    }
+
+    free(bythread);
+}
+
+// call with latency_lock held, after merge_all_latency().
+static void IO_LATENCY_HISTOGRAMS(void)
+{
+    uint32 entries = 0;
+    int i, j;
+
+    for (i = 0; i < ALEE_MAX; i++) {
+        const uint64 *histogram = latency_merged + (i * ALTRACE_HISTOGRAM_BUCKETS);
+        for (j = 0; j < ALTRACE_HISTOGRAM_BUCKETS; j++) {
+            if (histogram[j]) {
+                entries++;
+                break;
+            }
+        }
+    }
+
+    IO_EVENTENUM(ALEE_LATENCY_HISTOGRAMS);
+    IO_UINT32(ALTRACE_HISTOGRAM_SUB_BITS);
+    IO_UINT32(entries);
+    for (i = 0; i < ALEE_MAX; i++) {
+        const uint64 *histogram = latency_merged + (i * ALTRACE_HISTOGRAM_BUCKETS);
+        uint32 buckets = 0;
+        for (j = 0; j < ALTRACE_HISTOGRAM_BUCKETS; j++) {
+            if (histogram[j]) {
+                buckets++;
+            }
+        }
+        if (!buckets) {
+            continue;
+        }
+
+        IO_EVENTENUM((EventEnum) i);
+        IO_UINT32(buckets);
+        for (j = 0; j < ALTRACE_HISTOGRAM_BUCKETS; j++) {
+            if (histogram[j]) {
+                IO_UINT32((uint32) j);
+                IO_UINT64(histogram[j]);
+            }
+        }
+    }
+}
+
+// ALTRACE_HISTOGRAM_FILE gets appended to, so one file can collect lots of
+//  sessions. Each entry point gets a line with its call count and some
+//  percentiles, then a line for each used bucket: the smallest duration
+//  that goes in it and how many calls did. All times are nanoseconds.
+static void write_histogram_file(void)
+{
+    FILE *io = fopen(histogram_file, "a");
+    int i, j;
+
+    if (!io) {
+        fprintf(stderr, "%s: Failed to open histogram file '%s': %s\n", GAppName, histogram_file, strerror(errno));
+        return;
+    }
+
+    fprintf(io, "# session pid=%d time=%llu\n", (int) getpid(), (unsigned long long) time(NULL));
+    fprintf(io, "# entrypoint calls p50 p90 p99 p99.9 max\n");
+    for (i = 0; i < ALEE_MAX; i++) {
+        const uint64 *histogram = latency_merged + (i * ALTRACE_HISTOGRAM_BUCKETS);
+        uint64 calls = 0;
+        for (j = 0; j < ALTRACE_HISTOGRAM_BUCKETS; j++) {
+            calls += histogram[j];
+        }
+        if (!calls) {
+            continue;
+        }
+
+        fprintf(io, "%s %llu %llu %llu %llu %llu %llu\n", entrypoint_name((EventEnum) i),
+                (unsigned long long) calls,
+                (unsigned long long) histogram_percentile(histogram, 50.0),
+                (unsigned long long) histogram_percentile(histogram, 90.0),
+                (unsigned long long) histogram_percentile(histogram, 99.0),
+                (unsigned long long) histogram_percentile(histogram, 99.9),
+                (unsigned long long) histogram_percentile(histogram, 100.0));
+        for (j = 0; j < ALTRACE_HISTOGRAM_BUCKETS; j++) {
+            if (histogram[j]) {
+                fprintf(io, "    %llu %llu\n", (unsigned long long) histogram_bucket_min((uint32) j), (unsigned long long) histogram[j]);
+            }
+        }
+    }
+
+    if (fclose(io) == EOF) {
+        fprintf(stderr, "%s: Failed to write histogram file '%s': %s\n", GAppName, histogram_file, strerror(errno));
+    }
 }
 
 static void quit_altrace_record(void)
 {
-    const int io = logfd;
+    const OutputBackend *out;
     pthread_mutex_t *mutex = apilock;
 
-    logfd = -1;
+    // no more capture triggers or state polling, then get everything still sitting in ring
+    //  buffers to disk.
+    stop_capture_timer_thread();
+    stop_poller_thread();
+    stop_writer_thread();
+
+    out = output;
+    output = NULL;
     apilock = NULL;
 
     fprintf(stderr, "%s: Shutting down...\n", GAppName);
     fflush(stderr);
 
-    if (io != -1) {
-        const uint32 eos = swap32((uint32) ALEE_EOS);
-        const uint32 ticks = swap32(now());
-        if ((write(io, &eos, 4) != 4) || (write(io, &ticks, 4) != 4)) {
+    if (out && profile_overhead) {
+        ThreadState *ts = get_thread_state();
+        ts->record_len = 0;
+        IO_OVERHEAD_SUMMARY();
+        if (!out->write(ts->record, ts->record_len)) {
+            fprintf(stderr, "%s: Failed to write overhead summary to OpenAL log file: %s\n", GAppName, strerror(errno));
+        }
+        ts->record_len = 0;
+    }
+
+    if (contention) {
+        contention = 0;
+        if (out) {
+            ThreadState *ts = get_thread_state();
+            ts->record_len = 0;
+            IO_CONTENTION_SUMMARY();
+            if (!out->write(ts->record, ts->record_len)) {
+                fprintf(stderr, "%s: Failed to write contention summary to OpenAL log file: %s\n", GAppName, strerror(errno));
+            }
+            ts->record_len = 0;
+        }
+        free_contention_stats();
+    }
+
+    if (record_histograms) {
+        ThreadState *ts = get_thread_state();
+        record_histograms = 0;
+        pthread_mutex_lock(&latency_lock);
+        merge_all_latency();
+        if (out) {
+            ts->record_len = 0;
+            IO_LATENCY_HISTOGRAMS();
+            if (!out->write(ts->record, ts->record_len)) {
+                fprintf(stderr, "%s: Failed to write latency histograms to OpenAL log file: %s\n", GAppName, strerror(errno));
+            }
+            ts->record_len = 0;
+        }
+        if (histogram_file) {
+            write_histogram_file();
+        }
+        free(latency_merged);
+        latency_merged = NULL;
+        pthread_mutex_unlock(&latency_lock);
+    }
+
+    if (out) {
+        uint8 eos[1 + MAX_VARINT_LEN];
+        eos[0] = (uint8) ALEE_EOS;
+        if (!out->write(eos, 1 + encode_varint(eos + 1, now_ns()))) {
             fprintf(stderr, "%s: Failed to write EOS to OpenAL log file: %s\n", GAppName, strerror(errno));
+        } else {
+            out->commit();
         }
-        if (close(io) < 0) {
+        if (!out->close()) {
             fprintf(stderr, "%s: Failed to close OpenAL log file: %s\n", GAppName, strerror(errno));
         }
     }
 
     if (mutex) {
+        pthread_cond_destroy(&unlocked_calls_cond);
         pthread_mutex_destroy(mutex);
     }
 
@@ -532,6 +4710,18 @@ static void quit_altrace_record(void)
 
     close_real_openal();
     free_stackframe_map();
+    free_interned_callstacks();
+    free_blob_table();
+    #if ALTRACE_HAVE_MODULE_MAP
+    free_module_map();
+    #endif
+
+    profile_overhead = 0;
+    free(overhead_stats);
+    overhead_stats = NULL;
+    free(histogram_file);
+    histogram_file = NULL;
+    free_filter_config();
 
     fflush(stderr);
 }
@@ -542,7 +4732,9 @@ ALCcontext *alcGetCurrentContext(void)
 {
     ALCcontext *retval;
     IO_START(alcGetCurrentContext);
+    REAL_CALL_START();
     retval = REAL_alcGetCurrentContext();
+    REAL_CALL_END();
     (void) retval; // !!! FIXME: assert this hasn't gone out of sync with current_context...
     IO_PTR(current_context);
     IO_END_ALC(NULL);
@@ -555,7 +4747,9 @@ ALCdevice *alcGetContextsDevice(ALCcontext *_ctx)
     ALCdevice *retval;
     IO_START(alcGetContextsDevice);
     IO_PTR(ctx);
+    REAL_CALL_START();
     retval = REAL_alcGetContextsDevice(ctx->ctx);
+    REAL_CALL_END();
     (void) retval; // !!! FIXME: assert this hasn't gone out of sync with current_context...
     IO_PTR(ctx->device);
     IO_END_ALC(ctx->device);
@@ -573,7 +4767,9 @@ ALCboolean alcIsExtensionPresent(ALCdevice *_device, const ALCchar *extname)
         retval = ALC_TRUE;
 } else if (strcasecmp(extname, "ALC_EXT_EFX") == 0) { retval = ALC_FALSE;  // !!! FIXME
     } else {
+        REAL_CALL_START();
         retval = REAL_alcIsExtensionPresent(device->device, extname);
+        REAL_CALL_END();
     }
     IO_ALCBOOLEAN(retval);
     IO_END_ALC(device);
@@ -609,7 +4805,9 @@ ALCenum alcGetEnumValue(ALCdevice *_device, const ALCchar *enumname)
     IO_START(alcGetEnumValue);
     IO_PTR(_device);
     IO_STRING(enumname);
+    REAL_CALL_START();
     retval = REAL_alcGetEnumValue(device->device, enumname);
+    REAL_CALL_END();
     IO_ALCENUM(retval);
     IO_END_ALC(device);
     return retval;
@@ -622,7 +4820,9 @@ const ALCchar *alcGetString(ALCdevice *_device, ALCenum param)
     IO_START(alcGetString);
     IO_PTR(_device);
     IO_ALCENUM(param);
+    REAL_CALL_START();
     retval = REAL_alcGetString(device->device, param);
+    REAL_CALL_END();
 
     if ((param == ALC_EXTENSIONS) && retval) {
         const char *addstr = "ALC_EXT_trace_info";
@@ -654,7 +4854,9 @@ ALCdevice *alcCaptureOpenDevice(const ALCchar *devicename, ALCuint frequency, AL
     IO_UINT32(frequency);
     IO_ALCENUM(format);
     IO_ALSIZEI(buffersize);
+    REAL_CALL_START();
     retval = REAL_alcCaptureOpenDevice(devicename, frequency, format, buffersize);
+    REAL_CALL_END();
     IO_PTR(retval ? device : NULL);
 
     if (!retval) {
@@ -667,16 +4869,10 @@ ALCdevice *alcCaptureOpenDevice(const ALCchar *devicename, ALCuint frequency, AL
         device->iscapture = ALC_TRUE;
         device->connected = ALC_TRUE;
         device->supports_disconnect_ext = REAL_alcIsExtensionPresent(device->device, "ALC_EXT_disconnect");
-        if (format == AL_FORMAT_MONO8) {
-            device->samplesize = 1;
-        } else if (format == AL_FORMAT_MONO16) {
-            device->samplesize = 2;
-        } else if (format == AL_FORMAT_STEREO8) {
-            device->samplesize = 2;
-        } else if (format == AL_FORMAT_STEREO16) {
-            device->samplesize = 4;
-            // !!! FIXME: float32
-        }
+        device->samplesize = (int) format_frame_size(format);
+        device->capture_frequency = frequency;
+        device->capture_format = format;
+        device->capture_buffersize = buffersize;
 
         device->next = null_device.next;
         device->prev = &null_device;
@@ -693,6 +4889,7 @@ ALCdevice *alcCaptureOpenDevice(const ALCchar *devicename, ALCuint frequency, AL
         IO_STRING(alcstr);
         alcstr = REAL_alcGetString(device->device, ALC_EXTENSIONS);
         IO_STRING(alcstr);
+        check_capture_samples(device);
     }
 
     IO_END_ALC(device);
@@ -705,7 +4902,9 @@ ALCboolean alcCaptureCloseDevice(ALCdevice *_device)
     ALCboolean retval;
     IO_START(alcCaptureCloseDevice);
     IO_PTR(_device);
+    REAL_CALL_START();
     retval = REAL_alcCaptureCloseDevice(device->device);
+    REAL_CALL_END();
     IO_ALCBOOLEAN(retval);
 
     if (retval == ALC_TRUE) {
@@ -717,6 +4916,7 @@ ALCboolean alcCaptureCloseDevice(ALCdevice *_device)
                 device->prev->next = device->next;
             }
         }
+        handle_table_free(&device->wrapped_buffers, &buffer_pool);
         free(device->extension_string);
         free(device);
     }
@@ -736,7 +4936,9 @@ ALCdevice *alcOpenDevice(const ALCchar *devicename)
 
     IO_START(alcOpenDevice);
     IO_STRING(devicename);
+    REAL_CALL_START();
     retval = REAL_alcOpenDevice(devicename);
+    REAL_CALL_END();
     IO_PTR(retval ? device : NULL);
 
     if (!retval) {
@@ -777,7 +4979,9 @@ ALCboolean alcCloseDevice(ALCdevice *_device)
     ALCboolean retval;
     IO_START(alcCloseDevice);
     IO_PTR(_device);
+    REAL_CALL_START();
     retval = REAL_alcCloseDevice(device->device);
+    REAL_CALL_END();
     IO_ALCBOOLEAN(retval);
 
     if (retval == ALC_TRUE) {
@@ -789,6 +4993,7 @@ ALCboolean alcCloseDevice(ALCdevice *_device)
                 device->prev->next = device->next;
             }
         }
+        handle_table_free(&device->wrapped_buffers, &buffer_pool);
         free(device->extension_string);
         free(device);
     }
@@ -873,6 +5078,21 @@ static void check_context_state(void)
     }
 }
 
+// what a new context looks like, before anyone changes anything.
+static void init_context_state(ContextWrapper *ctx)
+{
+    ctx->distance_model = AL_INVERSE_DISTANCE_CLAMPED;
+    ctx->doppler_factor = 1.0f;
+    ctx->doppler_velocity = 1.0f;
+    ctx->speed_of_sound = 343.3f;
+    memset(ctx->listener_position, '\0', sizeof (ctx->listener_position));
+    memset(ctx->listener_velocity, '\0', sizeof (ctx->listener_velocity));
+    memset(ctx->listener_orientation, '\0', sizeof (ctx->listener_orientation));
+    ctx->listener_orientation[2] = -1.0f;
+    ctx->listener_orientation[4] = 1.0f;
+    ctx->listener_gain = 1.0f;
+}
+
 ALCcontext *alcCreateContext(ALCdevice *_device, const ALCint* attrlist)
 {
     DeviceWrapper *device = _device ? (DeviceWrapper *) _device : &null_device;
@@ -898,7 +5118,9 @@ ALCcontext *alcCreateContext(ALCdevice *_device, const ALCint* attrlist)
             IO_INT32(attrlist[i]);
         }
     }
+    REAL_CALL_START();
     retval = REAL_alcCreateContext(device->device, attrlist);
+    REAL_CALL_END();
     IO_PTR(retval ? ctx : NULL);
 
     if (retval == NULL) {
@@ -906,13 +5128,7 @@ ALCcontext *alcCreateContext(ALCdevice *_device, const ALCint* attrlist)
     } else {
         ctx->ctx = retval;
         ctx->device = device;
-        ctx->distance_model = AL_INVERSE_DISTANCE_CLAMPED;
-        ctx->doppler_factor = 1.0f;
-        ctx->doppler_velocity = 1.0f;
-        ctx->speed_of_sound = 343.3f;
-        ctx->listener_gain = 1.0f;
-        ctx->listener_orientation[2] = -1.0f;
-        ctx->listener_orientation[4] = 1.0f;
+        init_context_state(ctx);
 
         ctx->prev = NULL;
         ctx->next = device->contexts;
@@ -967,7 +5183,9 @@ ALCboolean alcMakeContextCurrent(ALCcontext *_ctx)
     ALCboolean retval;
     IO_START(alcMakeContextCurrent);
     IO_PTR(ctx);
+    REAL_CALL_START();
     retval = REAL_alcMakeContextCurrent(ctx ? ctx->ctx : NULL);
+    REAL_CALL_END();
     IO_ALCBOOLEAN(retval);
     if (retval) {
         current_context = ctx;
@@ -985,7 +5203,9 @@ void alcProcessContext(ALCcontext *_ctx)
     ContextWrapper *ctx = (ContextWrapper *) _ctx;
     IO_START(alcProcessContext);
     IO_PTR(ctx);
+    REAL_CALL_START();
     REAL_alcProcessContext(ctx ? ctx->ctx : NULL);
+    REAL_CALL_END();
     IO_END_ALC(ctx ? ctx->device : NULL);
 }
 
@@ -994,7 +5214,9 @@ void alcSuspendContext(ALCcontext *_ctx)
     ContextWrapper *ctx = (ContextWrapper *) _ctx;
     IO_START(alcSuspendContext);
     IO_PTR(ctx);
+    REAL_CALL_START();
     REAL_alcSuspendContext(ctx ? ctx->ctx : NULL);
+    REAL_CALL_END();
     IO_END_ALC(ctx ? ctx->device : NULL);
 }
 
@@ -1004,7 +5226,9 @@ void alcDestroyContext(ALCcontext *_ctx)
     DeviceWrapper *device = NULL;
     IO_START(alcDestroyContext);
     IO_PTR(ctx);
+    REAL_CALL_START();
     REAL_alcDestroyContext(ctx ? ctx->ctx : NULL);
+    REAL_CALL_END();
 // !!! FIXME: see if this triggered an error and don't clean up if so.
     if (ctx) {
         device = ctx->device;
@@ -1018,6 +5242,7 @@ void alcDestroyContext(ALCcontext *_ctx)
             device->contexts = ctx->next;
         }
 
+        handle_table_free(&ctx->wrapped_sources, &source_pool);
         free(ctx->extension_string);
         free(ctx);
     }
@@ -1051,7 +5276,9 @@ void alcGetIntegerv(ALCdevice *_device, ALCenum param, ALCsizei size, ALCint *va
         memset(values, '\0', size * sizeof (ALCint));
     }
 
+    REAL_CALL_START();
     REAL_alcGetIntegerv(device->device, param, size, values);
+    REAL_CALL_END();
 
     if (values) {
         for (i = 0; i < size; i++) {
@@ -1067,7 +5294,11 @@ void alcCaptureStart(ALCdevice *_device)
     DeviceWrapper *device = _device ? (DeviceWrapper *) _device : &null_device;
     IO_START(alcCaptureStart);
     IO_PTR(_device);
+    REAL_CALL_START();
     REAL_alcCaptureStart(device->device);
+    REAL_CALL_END();
+    device->capture_started = ALC_TRUE;
+    check_capture_samples(device);
     IO_END_ALC(device);
 }
 
@@ -1076,7 +5307,11 @@ void alcCaptureStop(ALCdevice *_device)
     DeviceWrapper *device = _device ? (DeviceWrapper *) _device : &null_device;
     IO_START(alcCaptureStop);
     IO_PTR(_device);
+    REAL_CALL_START();
     REAL_alcCaptureStop(device->device);
+    REAL_CALL_END();
+    device->capture_started = ALC_FALSE;
+    check_capture_samples(device);
     IO_END_ALC(device);
 }
 
@@ -1087,72 +5322,97 @@ void alcCaptureSamples(ALCdevice *_device, ALCvoid *buffer, ALCsizei samples)
     IO_PTR(_device);
     IO_PTR(buffer);
     IO_ALCSIZEI(samples);
-    if (samples && device->samplesize) {
+    // we don't look at the samples at all if they aren't recorded.
+    if (samples && device->samplesize && (capture_payload.policy != ALTRACE_PAYLOAD_NONE)) {
         memset(buffer, '\0', samples * device->samplesize);
     }
+    REAL_CALL_START();
     REAL_alcCaptureSamples(device->device, buffer, samples);
-    IO_BLOB(buffer, samples * device->samplesize);
+    REAL_CALL_END();
+    IO_PAYLOAD(&capture_payload, (const uint8 *) buffer, samples * device->samplesize, device->samplesize);
+    check_capture_samples(device);
     IO_END_ALC(device);
 }
 
 void alDopplerFactor(ALfloat value)
 {
+    IO_PASSTHROUGH_VOID(alDopplerFactor(value));
     IO_START(alDopplerFactor);
     IO_FLOAT(value);
+    REAL_CALL_START();
     REAL_alDopplerFactor(value);
+    REAL_CALL_END();
     if (current_context) { check_context_state_float(AL_DOPPLER_FACTOR, &current_context->doppler_factor); }
     IO_END();
 }
 
 void alDopplerVelocity(ALfloat value)
 {
+    IO_PASSTHROUGH_VOID(alDopplerVelocity(value));
     IO_START(alDopplerVelocity);
     IO_FLOAT(value);
+    REAL_CALL_START();
     REAL_alDopplerVelocity(value);
+    REAL_CALL_END();
     if (current_context) { check_context_state_float(AL_DOPPLER_VELOCITY, &current_context->doppler_velocity); }
     IO_END();
 }
 
 void alSpeedOfSound(ALfloat value)
 {
+    IO_PASSTHROUGH_VOID(alSpeedOfSound(value));
     IO_START(alSpeedOfSound);
     IO_FLOAT(value);
+    REAL_CALL_START();
     REAL_alSpeedOfSound(value);
+    REAL_CALL_END();
     if (current_context) { check_context_state_float(AL_SPEED_OF_SOUND, &current_context->speed_of_sound); }
     IO_END();
 }
 
 void alDistanceModel(ALenum model)
 {
+    IO_PASSTHROUGH_VOID(alDistanceModel(model));
     IO_START(alDistanceModel);
     IO_ENUM(model);
+    REAL_CALL_START();
     REAL_alDistanceModel(model);
+    REAL_CALL_END();
     if (current_context) { check_context_state_enum(AL_DISTANCE_MODEL, &current_context->distance_model); }
     IO_END();
 }
 
 void alEnable(ALenum capability)
 {
+    IO_PASSTHROUGH_VOID(alEnable(capability));
     IO_START(alEnable);
     IO_ENUM(capability);
+    REAL_CALL_START();
     REAL_alEnable(capability);
+    REAL_CALL_END();
     IO_END();
 }
 
 void alDisable(ALenum capability)
 {
+    IO_PASSTHROUGH_VOID(alDisable(capability));
     IO_START(alDisable);
     IO_ENUM(capability);
+    REAL_CALL_START();
     REAL_alDisable(capability);
+    REAL_CALL_END();
     IO_END();
 }
 
 ALboolean alIsEnabled(ALenum capability)
 {
     ALboolean retval;
+    IO_PASSTHROUGH(alIsEnabled(capability));
     IO_START(alIsEnabled);
     IO_ENUM(capability);
+    REAL_CALL_START();
     retval = REAL_alIsEnabled(capability);
+    REAL_CALL_END();
     IO_BOOLEAN(retval);
     IO_END();
     return retval;
@@ -1163,7 +5423,9 @@ const ALchar *alGetString(const ALenum param)
     const ALchar *retval;
     IO_START(alGetString);
     IO_ENUM(param);
+    REAL_CALL_START();
     retval = REAL_alGetString(param);
+    REAL_CALL_END();
 
     if (param == AL_EXTENSIONS) {
         if (retval && current_context) {
@@ -1187,6 +5449,7 @@ void alGetBooleanv(ALenum param, ALboolean *values)
 {
     uint32 numvals = 0;
     uint32 i;
+    IO_PASSTHROUGH_VOID(alGetBooleanv(param, values));
     IO_START(alGetBooleanv);
     IO_ENUM(param);
     IO_PTR(values);
@@ -1196,7 +5459,9 @@ void alGetBooleanv(ALenum param, ALboolean *values)
     if (numvals) {
         memset(values, '\0', numvals * sizeof (ALboolean));
     }
+    REAL_CALL_START();
     REAL_alGetBooleanv(param, values);
+    REAL_CALL_END();
     IO_UINT32(numvals);
     for (i = 0; i < numvals; i++) {
         IO_BOOLEAN(values[i]);
@@ -1208,6 +5473,7 @@ void alGetIntegerv(ALenum param, ALint *values)
 {
     uint32 numvals = 0;
     uint32 i;
+    IO_PASSTHROUGH_VOID(alGetIntegerv(param, values));
     IO_START(alGetIntegerv);
     IO_ENUM(param);
     IO_PTR(values);
@@ -1220,7 +5486,9 @@ void alGetIntegerv(ALenum param, ALint *values)
     if (numvals) {
         memset(values, '\0', numvals * sizeof (ALint));
     }
+    REAL_CALL_START();
     REAL_alGetIntegerv(param, values);
+    REAL_CALL_END();
     IO_UINT32(numvals);
     for (i = 0; i < numvals; i++) {
         IO_INT32(values[i]);
@@ -1232,6 +5500,7 @@ void alGetFloatv(ALenum param, ALfloat *values)
 {
     uint32 numvals = 0;
     uint32 i;
+    IO_PASSTHROUGH_VOID(alGetFloatv(param, values));
     IO_START(alGetFloatv);
     IO_ENUM(param);
     IO_PTR(values);
@@ -1246,7 +5515,9 @@ void alGetFloatv(ALenum param, ALfloat *values)
     if (numvals) {
         memset(values, '\0', numvals * sizeof (ALfloat));
     }
+    REAL_CALL_START();
     REAL_alGetFloatv(param, values);
+    REAL_CALL_END();
     IO_UINT32(numvals);
     for (i = 0; i < numvals; i++) {
         IO_FLOAT(values[i]);
@@ -1258,6 +5529,7 @@ void alGetDoublev(ALenum param, ALdouble *values)
 {
     uint32 numvals = 0;
     uint32 i;
+    IO_PASSTHROUGH_VOID(alGetDoublev(param, values));
     IO_START(alGetDoublev);
     IO_ENUM(param);
     IO_PTR(values);
@@ -1266,7 +5538,9 @@ void alGetDoublev(ALenum param, ALdouble *values)
     if (numvals) {
         memset(values, '\0', numvals * sizeof (ALdouble));
     }
+    REAL_CALL_START();
     REAL_alGetDoublev(param, values);
+    REAL_CALL_END();
     IO_UINT32(numvals);
     for (i = 0; i < numvals; i++) {
         IO_DOUBLE(values[i]);
@@ -1277,9 +5551,12 @@ void alGetDoublev(ALenum param, ALdouble *values)
 ALboolean alGetBoolean(ALenum param)
 {
     ALboolean retval;
+    IO_PASSTHROUGH(alGetBoolean(param));
     IO_START(alGetBoolean);
     IO_ENUM(param);
+    REAL_CALL_START();
     retval = REAL_alGetBoolean(param);
+    REAL_CALL_END();
     IO_BOOLEAN(retval);
     IO_END();
     return retval;
@@ -1288,9 +5565,12 @@ ALboolean alGetBoolean(ALenum param)
 ALint alGetInteger(ALenum param)
 {
     ALint retval;
+    IO_PASSTHROUGH(alGetInteger(param));
     IO_START(alGetInteger);
     IO_ENUM(param);
+    REAL_CALL_START();
     retval = REAL_alGetInteger(param);
+    REAL_CALL_END();
     IO_INT32(retval);
     IO_END();
     return retval;
@@ -1299,9 +5579,12 @@ ALint alGetInteger(ALenum param)
 ALfloat alGetFloat(ALenum param)
 {
     ALfloat retval;
+    IO_PASSTHROUGH(alGetFloat(param));
     IO_START(alGetFloat);
     IO_ENUM(param);
+    REAL_CALL_START();
     retval = REAL_alGetFloat(param);
+    REAL_CALL_END();
     IO_FLOAT(retval);
     IO_END();
     return retval;
@@ -1310,9 +5593,12 @@ ALfloat alGetFloat(ALenum param)
 ALdouble alGetDouble(ALenum param)
 {
     ALdouble retval;
+    IO_PASSTHROUGH(alGetDouble(param));
     IO_START(alGetDouble);
     IO_ENUM(param);
+    REAL_CALL_START();
     retval = REAL_alGetDouble(param);
+    REAL_CALL_END();
     IO_DOUBLE(retval);
     IO_END();
     return retval;
@@ -1326,7 +5612,9 @@ ALboolean alIsExtensionPresent(const ALchar *extname)
     if (strcasecmp(extname, "AL_EXT_trace_info") == 0) {
         retval = AL_TRUE;
     } else {
+        REAL_CALL_START();
         retval = REAL_alIsExtensionPresent(extname);
+        REAL_CALL_END();
     }
     IO_BOOLEAN(retval);
     IO_END();
@@ -1338,6 +5626,11 @@ ALenum alGetError(void)
     ALenum retval;
     IO_START(alGetError);
 
+    // calls that went straight through didn't collect their errors.
+    if (!capturing) {
+        check_al_error_events();
+    }
+
     if (current_context == NULL) {
         retval = null_context_errorlatch;
         null_context_errorlatch = AL_NO_ERROR;
@@ -1364,6 +5657,9 @@ void *alGetProcAddress(const ALchar *funcname)
     }
     #define ENTRYPOINT(ret,fn,params,args,numargs,visitparams,visitargs) else if (strcmp(funcname, #fn) == 0) { retval = (void *) fn; }
     #include "altrace_entrypoints.h"
+    // these never show up in a tracefile as calls, so they aren't in there.
+    else if (strcmp(funcname, "alTraceStartCapture") == 0) { retval = (void *) alTraceStartCapture; }
+    else if (strcmp(funcname, "alTraceStopCapture") == 0) { retval = (void *) alTraceStopCapture; }
 
     IO_PTR(retval);
     IO_END();
@@ -1373,9 +5669,12 @@ void *alGetProcAddress(const ALchar *funcname)
 ALenum alGetEnumValue(const ALchar *enumname)
 {
     ALenum retval;
+    IO_PASSTHROUGH(alGetEnumValue(enumname));
     IO_START(alGetEnumValue);
     IO_STRING(enumname);
+    REAL_CALL_START();
     retval = REAL_alGetEnumValue(enumname);
+    REAL_CALL_END();
     IO_ENUM(retval);
     IO_END();
     return retval;
@@ -1385,6 +5684,7 @@ void alListenerfv(ALenum param, const ALfloat *values)
 {
     uint32 numvals = 1;
     uint32 i;
+    IO_PASSTHROUGH_VOID(alListenerfv(param, values));
     IO_START(alListenerfv);
     IO_ENUM(param);
     IO_PTR(values);
@@ -1404,7 +5704,9 @@ void alListenerfv(ALenum param, const ALfloat *values)
         IO_FLOAT(values[i]);
     }
 
+    REAL_CALL_START();
     REAL_alListenerfv(param, values);
+    REAL_CALL_END();
 
     check_listener_state();
 
@@ -1413,22 +5715,28 @@ void alListenerfv(ALenum param, const ALfloat *values)
 
 void alListenerf(ALenum param, ALfloat value)
 {
+    IO_PASSTHROUGH_VOID(alListenerf(param, value));
     IO_START(alListenerf);
     IO_ENUM(param);
     IO_FLOAT(value);
+    REAL_CALL_START();
     REAL_alListenerf(param, value);
+    REAL_CALL_END();
     check_listener_state();
     IO_END();
 }
 
 void alListener3f(ALenum param, ALfloat value1, ALfloat value2, ALfloat value3)
 {
+    IO_PASSTHROUGH_VOID(alListener3f(param, value1, value2, value3));
     IO_START(alListener3f);
     IO_ENUM(param);
     IO_FLOAT(value1);
     IO_FLOAT(value2);
     IO_FLOAT(value3);
+    REAL_CALL_START();
     REAL_alListener3f(param, value1, value2, value3);
+    REAL_CALL_END();
     check_listener_state();
     IO_END();
 }
@@ -1437,6 +5745,7 @@ void alListeneriv(ALenum param, const ALint *values)
 {
     uint32 numvals = 1;
     uint32 i;
+    IO_PASSTHROUGH_VOID(alListeneriv(param, values));
     IO_START(alListeneriv);
     IO_ENUM(param);
     IO_PTR(values);
@@ -1453,7 +5762,9 @@ void alListeneriv(ALenum param, const ALint *values)
         IO_INT32(values[i]);
     }
 
+    REAL_CALL_START();
     REAL_alListeneriv(param, values);
+    REAL_CALL_END();
 
     check_listener_state();
 
@@ -1462,22 +5773,28 @@ void alListeneriv(ALenum param, const ALint *values)
 
 void alListeneri(ALenum param, ALint value)
 {
+    IO_PASSTHROUGH_VOID(alListeneri(param, value));
     IO_START(alListeneri);
     IO_ENUM(param);
     IO_INT32(value);
+    REAL_CALL_START();
     REAL_alListeneri(param, value);
+    REAL_CALL_END();
     check_listener_state();
     IO_END();
 }
 
 void alListener3i(ALenum param, ALint value1, ALint value2, ALint value3)
 {
+    IO_PASSTHROUGH_VOID(alListener3i(param, value1, value2, value3));
     IO_START(alListener3i);
     IO_ENUM(param);
     IO_INT32(value1);
     IO_INT32(value2);
     IO_INT32(value3);
+    REAL_CALL_START();
     REAL_alListener3i(param, value1, value2, value3);
+    REAL_CALL_END();
     check_listener_state();
     IO_END();
 }
@@ -1486,6 +5803,7 @@ void alGetListenerfv(ALenum param, ALfloat *values)
 {
     uint32 numvals = 1;
     uint32 i;
+    IO_PASSTHROUGH_VOID(alGetListenerfv(param, values));
     IO_START(alGetListenerfv);
     IO_ENUM(param);
     IO_PTR(values);
@@ -1502,7 +5820,9 @@ void alGetListenerfv(ALenum param, ALfloat *values)
         memset(values, '\0', numvals * sizeof (ALfloat));
     }
 
+    REAL_CALL_START();
     REAL_alGetListenerfv(param, values);
+    REAL_CALL_END();
 
     IO_UINT32(numvals);
     for (i = 0; i < numvals; i++) {
@@ -1514,22 +5834,28 @@ void alGetListenerfv(ALenum param, ALfloat *values)
 
 void alGetListenerf(ALenum param, ALfloat *value)
 {
+    IO_PASSTHROUGH_VOID(alGetListenerf(param, value));
     IO_START(alGetListenerf);
     IO_ENUM(param);
     IO_PTR(value);
+    REAL_CALL_START();
     REAL_alGetListenerf(param, value);
+    REAL_CALL_END();
     IO_FLOAT(value ? *value : 0.0f);
     IO_END();
 }
 
 void alGetListener3f(ALenum param, ALfloat *value1, ALfloat *value2, ALfloat *value3)
 {
+    IO_PASSTHROUGH_VOID(alGetListener3f(param, value1, value2, value3));
     IO_START(alGetListener3f);
     IO_ENUM(param);
     IO_PTR(value1);
     IO_PTR(value2);
     IO_PTR(value3);
+    REAL_CALL_START();
     REAL_alGetListener3f(param, value1, value2, value3);
+    REAL_CALL_END();
     IO_FLOAT(value1 ? *value1 : 0.0f);
     IO_FLOAT(value2 ? *value2 : 0.0f);
     IO_FLOAT(value3 ? *value3 : 0.0f);
@@ -1540,6 +5866,7 @@ void alGetListeneriv(ALenum param, ALint *values)
 {
     uint32 numvals = 1;
     uint32 i;
+    IO_PASSTHROUGH_VOID(alGetListeneriv(param, values));
     IO_START(alGetListeneriv);
     IO_ENUM(param);
     IO_PTR(values);
@@ -1556,7 +5883,9 @@ void alGetListeneriv(ALenum param, ALint *values)
         memset(values, '\0', numvals * sizeof (ALdouble));
     }
 
+    REAL_CALL_START();
     REAL_alGetListeneriv(param, values);
+    REAL_CALL_END();
 
     IO_UINT32(numvals);
     for (i = 0; i < numvals; i++) {
@@ -1568,50 +5897,57 @@ void alGetListeneriv(ALenum param, ALint *values)
 
 void alGetListeneri(ALenum param, ALint *value)
 {
+    IO_PASSTHROUGH_VOID(alGetListeneri(param, value));
     IO_START(alGetListeneri);
     IO_ENUM(param);
     IO_PTR(value);
+    REAL_CALL_START();
     REAL_alGetListeneri(param, value);
+    REAL_CALL_END();
     IO_INT32(value ? *value : 0);
     IO_END();
 }
 
 void alGetListener3i(ALenum param, ALint *value1, ALint *value2, ALint *value3)
 {
+    IO_PASSTHROUGH_VOID(alGetListener3i(param, value1, value2, value3));
     IO_START(alGetListener3i);
     IO_ENUM(param);
     IO_PTR(value1);
     IO_PTR(value2);
     IO_PTR(value3);
+    REAL_CALL_START();
     REAL_alGetListener3i(param, value1, value2, value3);
+    REAL_CALL_END();
     IO_INT32(value1 ? *value1 : 0);
     IO_INT32(value2 ? *value2 : 0);
     IO_INT32(value3 ? *value3 : 0);
     IO_END();
 }
 
-static uint8 hash_alname(const ALuint name)
-{
-    /* since these are usually small numbers that increment from 0, they distribute pretty well on their own. */
-    return (uint8) (name & 0xFF);
-}
-
 static SourceWrapper *source_wrapped_lookup(const ALuint name)
 {
-    SourceWrapper *retval = NULL;
     ContextWrapper *ctx = current_context;
-    if (ctx && name) {
-        const uint8 hash = hash_alname(name);
-        for (retval = ctx->wrapped_source_hash[hash]; retval; retval = retval->hash_next) {
-            if (retval->name == name) {
-                break;
+    return (ctx && name) ? (SourceWrapper *) handle_table_get(&ctx->wrapped_sources, name) : NULL;
+}
+
+// ALTRACE_CONTENTION: the current call used these sources.
+static void note_sources_used(const ALsizei n, const ALuint *names)
+{
+    if (contention && names) {
+        ALsizei i;
+        for (i = 0; i < n; i++) {
+            SourceWrapper *src = source_wrapped_lookup(names[i]);
+            if (src) {
+                contention_object_use(&src->contention, 0, names[i]);
             }
         }
     }
-    return retval;
 }
 
-static void check_source_state_bool(SourceWrapper *src, const ALenum param, ALboolean *current)
+static void note_buffers_used(const ALsizei n, const ALuint *names);
+
+static int check_source_state_bool(SourceWrapper *src, const ALenum param, ALboolean *current)
 {
     ALint ival = 0;
     ALboolean newval;
@@ -1623,10 +5959,12 @@ static void check_source_state_bool(SourceWrapper *src, const ALenum param, ALbo
         IO_ENUM(param);
         IO_BOOLEAN(newval);
         *current = newval;
+        return 1;
     }
+    return 0;
 }
 
-static void check_source_state_enum(SourceWrapper *src, const ALenum param, ALenum *current)
+static int check_source_state_enum(SourceWrapper *src, const ALenum param, ALenum *current)
 {
     ALint ival = 0;
     ALenum newval;
@@ -1638,10 +5976,12 @@ static void check_source_state_enum(SourceWrapper *src, const ALenum param, ALen
         IO_ENUM(param);
         IO_ENUM(newval);
         *current = newval;
+        return 1;
     }
+    return 0;
 }
 
-static void check_source_state_int(SourceWrapper *src, const ALenum param, ALint *current)
+static int check_source_state_int(SourceWrapper *src, const ALenum param, ALint *current)
 {
     ALint ival = 0;
     REAL_alGetSourcei(src->name, param, &ival);
@@ -1651,10 +5991,12 @@ static void check_source_state_int(SourceWrapper *src, const ALenum param, ALint
         IO_ENUM(param);
         IO_INT32(ival);
         *current = ival;
+        return 1;
     }
+    return 0;
 }
 
-static void check_source_state_uint(SourceWrapper *src, const ALenum param, ALuint *current)
+static int check_source_state_uint(SourceWrapper *src, const ALenum param, ALuint *current)
 {
     ALint ival = 0;
     ALuint newval;
@@ -1666,10 +6008,12 @@ static void check_source_state_uint(SourceWrapper *src, const ALenum param, ALui
         IO_ENUM(param);
         IO_UINT32(newval);
         *current = newval;
+        return 1;
     }
+    return 0;
 }
 
-static void check_source_state_float(SourceWrapper *src, const ALenum param, ALfloat *current)
+static int check_source_state_float(SourceWrapper *src, const ALenum param, ALfloat *current)
 {
     ALfloat fval = 0;
     REAL_alGetSourcef(src->name, param, &fval);
@@ -1679,10 +6023,12 @@ static void check_source_state_float(SourceWrapper *src, const ALenum param, ALf
         IO_ENUM(param);
         IO_FLOAT(fval);
         *current = fval;
+        return 1;
     }
+    return 0;
 }
 
-static void check_source_state_float3(SourceWrapper *src, const ALenum param, ALfloat *current)
+static int check_source_state_float3(SourceWrapper *src, const ALenum param, ALfloat *current)
 {
     const size_t size = sizeof (ALfloat) * 3;
     ALfloat fval[3] = { 0.0f, 0.0f, 0.0f };
@@ -1695,75 +6041,187 @@ static void check_source_state_float3(SourceWrapper *src, const ALenum param, AL
         IO_FLOAT(fval[1]);
         IO_FLOAT(fval[2]);
         memcpy(current, fval, size);
+        return 1;
+    }
+    return 0;
+}
+
+// One bit per source property we track, so calls only have to check the
+//  properties they can actually change.
+typedef enum SourceProperty
+{
+    SRCPROP_STATE = (1 << 0),
+    SRCPROP_TYPE = (1 << 1),
+    SRCPROP_BUFFER = (1 << 2),
+    SRCPROP_BUFFERS_QUEUED = (1 << 3),
+    SRCPROP_BUFFERS_PROCESSED = (1 << 4),
+    SRCPROP_SOURCE_RELATIVE = (1 << 5),
+    SRCPROP_LOOPING = (1 << 6),
+    SRCPROP_SEC_OFFSET = (1 << 7),
+    SRCPROP_SAMPLE_OFFSET = (1 << 8),
+    SRCPROP_BYTE_OFFSET = (1 << 9),
+    SRCPROP_GAIN = (1 << 10),
+    SRCPROP_MIN_GAIN = (1 << 11),
+    SRCPROP_MAX_GAIN = (1 << 12),
+    SRCPROP_REFERENCE_DISTANCE = (1 << 13),
+    SRCPROP_ROLLOFF_FACTOR = (1 << 14),
+    SRCPROP_MAX_DISTANCE = (1 << 15),
+    SRCPROP_PITCH = (1 << 16),
+    SRCPROP_CONE_INNER_ANGLE = (1 << 17),
+    SRCPROP_CONE_OUTER_ANGLE = (1 << 18),
+    SRCPROP_CONE_OUTER_GAIN = (1 << 19),
+    SRCPROP_POSITION = (1 << 20),
+    SRCPROP_VELOCITY = (1 << 21),
+    SRCPROP_DIRECTION = (1 << 22),
+    SRCPROP_ALL = (1 << 23) - 1
+} SourceProperty;
+
+#define SRCPROP_OFFSETS (SRCPROP_SEC_OFFSET | SRCPROP_SAMPLE_OFFSET | SRCPROP_BYTE_OFFSET)
+
+/* what the mixer changes on its own, and what play/pause/stop/rewind change. */
+#define SRCPROP_PLAYBACK (SRCPROP_STATE | SRCPROP_BUFFER | SRCPROP_BUFFERS_PROCESSED | SRCPROP_OFFSETS)
+
+/* what queueing or unqueueing buffers changes. */
+#define SRCPROP_QUEUE (SRCPROP_TYPE | SRCPROP_BUFFER | SRCPROP_BUFFERS_QUEUED | SRCPROP_BUFFERS_PROCESSED | SRCPROP_OFFSETS)
+
+/* what can change when a source setter changes (param). */
+static uint32 source_param_properties(const ALenum param)
+{
+    switch (param) {
+        case AL_SOURCE_RELATIVE: return SRCPROP_SOURCE_RELATIVE;
+        case AL_LOOPING: return SRCPROP_LOOPING;
+        case AL_GAIN: return SRCPROP_GAIN;
+        case AL_MIN_GAIN: return SRCPROP_MIN_GAIN;
+        case AL_MAX_GAIN: return SRCPROP_MAX_GAIN;
+        case AL_REFERENCE_DISTANCE: return SRCPROP_REFERENCE_DISTANCE;
+        case AL_ROLLOFF_FACTOR: return SRCPROP_ROLLOFF_FACTOR;
+        case AL_MAX_DISTANCE: return SRCPROP_MAX_DISTANCE;
+        case AL_PITCH: return SRCPROP_PITCH;
+        case AL_CONE_INNER_ANGLE: return SRCPROP_CONE_INNER_ANGLE;
+        case AL_CONE_OUTER_ANGLE: return SRCPROP_CONE_OUTER_ANGLE;
+        case AL_CONE_OUTER_GAIN: return SRCPROP_CONE_OUTER_GAIN;
+        case AL_POSITION: return SRCPROP_POSITION;
+        case AL_VELOCITY: return SRCPROP_VELOCITY;
+        case AL_DIRECTION: return SRCPROP_DIRECTION;
+
+        /* setting a buffer replaces the queue, and makes the source static (or undetermined, for buffer 0). */
+        case AL_BUFFER: return SRCPROP_QUEUE;
+
+        /* seeking moves all the offsets, and can move through a queue. The
+           spec says a bogus offset on a playing source is an error, but
+           don't trust that it didn't stop anyhow. */
+        case AL_SEC_OFFSET:
+        case AL_SAMPLE_OFFSET:
+        case AL_BYTE_OFFSET:
+            return SRCPROP_OFFSETS | SRCPROP_BUFFER | SRCPROP_BUFFERS_PROCESSED | SRCPROP_STATE;
+
+        default: break;
     }
+
+    return SRCPROP_ALL;  /* an extension or something; check everything. */
 }
 
-static void check_source_state(SourceWrapper *src)
+/* returns the SourceProperty bits that changed. */
+static uint32 check_source_state(SourceWrapper *src, const uint32 props)
 {
     const ALuint name = src ? src->name : 0;
+    uint32 changed = 0;
     if (name) {
-        check_source_state_enum(src, AL_SOURCE_STATE, &src->state);
-        check_source_state_enum(src, AL_SOURCE_TYPE, &src->type);
-        check_source_state_uint(src, AL_BUFFER, &src->buffer);
-        check_source_state_int(src, AL_BUFFERS_QUEUED, &src->buffers_queued);
-        check_source_state_int(src, AL_BUFFERS_PROCESSED, &src->buffers_processed);
-        check_source_state_bool(src, AL_SOURCE_RELATIVE, &src->source_relative);
-        check_source_state_bool(src, AL_LOOPING, &src->looping);
-        check_source_state_int(src, AL_SEC_OFFSET, &src->sec_offset);
-        check_source_state_int(src, AL_SAMPLE_OFFSET, &src->sample_offset);
-        check_source_state_int(src, AL_BYTE_OFFSET, &src->byte_offset);
-
-        check_source_state_float(src, AL_GAIN, &src->gain);
-        check_source_state_float(src, AL_MIN_GAIN, &src->min_gain);
-        check_source_state_float(src, AL_MAX_GAIN, &src->max_gain);
-        check_source_state_float(src, AL_REFERENCE_DISTANCE, &src->reference_distance);
-        check_source_state_float(src, AL_ROLLOFF_FACTOR, &src->rolloff_factor);
-        check_source_state_float(src, AL_MAX_DISTANCE, &src->max_distance);
-        check_source_state_float(src, AL_PITCH, &src->pitch);
-        check_source_state_float(src, AL_CONE_INNER_ANGLE, &src->cone_inner_angle);
-        check_source_state_float(src, AL_CONE_OUTER_ANGLE, &src->cone_outer_angle);
-        check_source_state_float(src, AL_CONE_OUTER_GAIN, &src->cone_outer_gain);
-
-        check_source_state_float3(src, AL_POSITION, src->position);
-        check_source_state_float3(src, AL_VELOCITY, src->velocity);
-        check_source_state_float3(src, AL_DIRECTION, src->direction);
+        #define CHECK_SOURCE_STATE(prop, typ, param, field) \
+            if ((props & prop) && check_source_state_##typ(src, param, field)) { changed |= prop; }
+        CHECK_SOURCE_STATE(SRCPROP_STATE, enum, AL_SOURCE_STATE, &src->state);
+        CHECK_SOURCE_STATE(SRCPROP_TYPE, enum, AL_SOURCE_TYPE, &src->type);
+        CHECK_SOURCE_STATE(SRCPROP_BUFFER, uint, AL_BUFFER, &src->buffer);
+        CHECK_SOURCE_STATE(SRCPROP_BUFFERS_QUEUED, int, AL_BUFFERS_QUEUED, &src->buffers_queued);
+        CHECK_SOURCE_STATE(SRCPROP_BUFFERS_PROCESSED, int, AL_BUFFERS_PROCESSED, &src->buffers_processed);
+        CHECK_SOURCE_STATE(SRCPROP_SOURCE_RELATIVE, bool, AL_SOURCE_RELATIVE, &src->source_relative);
+        CHECK_SOURCE_STATE(SRCPROP_LOOPING, bool, AL_LOOPING, &src->looping);
+        CHECK_SOURCE_STATE(SRCPROP_SEC_OFFSET, int, AL_SEC_OFFSET, &src->sec_offset);
+        CHECK_SOURCE_STATE(SRCPROP_SAMPLE_OFFSET, int, AL_SAMPLE_OFFSET, &src->sample_offset);
+        CHECK_SOURCE_STATE(SRCPROP_BYTE_OFFSET, int, AL_BYTE_OFFSET, &src->byte_offset);
+
+        CHECK_SOURCE_STATE(SRCPROP_GAIN, float, AL_GAIN, &src->gain);
+        CHECK_SOURCE_STATE(SRCPROP_MIN_GAIN, float, AL_MIN_GAIN, &src->min_gain);
+        CHECK_SOURCE_STATE(SRCPROP_MAX_GAIN, float, AL_MAX_GAIN, &src->max_gain);
+        CHECK_SOURCE_STATE(SRCPROP_REFERENCE_DISTANCE, float, AL_REFERENCE_DISTANCE, &src->reference_distance);
+        CHECK_SOURCE_STATE(SRCPROP_ROLLOFF_FACTOR, float, AL_ROLLOFF_FACTOR, &src->rolloff_factor);
+        CHECK_SOURCE_STATE(SRCPROP_MAX_DISTANCE, float, AL_MAX_DISTANCE, &src->max_distance);
+        CHECK_SOURCE_STATE(SRCPROP_PITCH, float, AL_PITCH, &src->pitch);
+        CHECK_SOURCE_STATE(SRCPROP_CONE_INNER_ANGLE, float, AL_CONE_INNER_ANGLE, &src->cone_inner_angle);
+        CHECK_SOURCE_STATE(SRCPROP_CONE_OUTER_ANGLE, float, AL_CONE_OUTER_ANGLE, &src->cone_outer_angle);
+        CHECK_SOURCE_STATE(SRCPROP_CONE_OUTER_GAIN, float, AL_CONE_OUTER_GAIN, &src->cone_outer_gain);
+
+        CHECK_SOURCE_STATE(SRCPROP_POSITION, float3, AL_POSITION, src->position);
+        CHECK_SOURCE_STATE(SRCPROP_VELOCITY, float3, AL_VELOCITY, src->velocity);
+        CHECK_SOURCE_STATE(SRCPROP_DIRECTION, float3, AL_DIRECTION, src->direction);
+        #undef CHECK_SOURCE_STATE
     }
+    return changed;
 }
 
-static void check_source_state_from_name(const ALuint name)
+static void check_source_state_from_name(const ALuint name, const uint32 props)
 {
-    check_source_state(source_wrapped_lookup(name));
+    check_source_state(source_wrapped_lookup(name), props);
 }
 
-static void init_source_state(SourceWrapper *src, const ALuint name)
+// what a new source looks like; this leaves its name and list links alone.
+static void reset_source_state(SourceWrapper *src)
 {
-    memset(src, '\0', sizeof (*src));
-    src->name = name;
     src->state = AL_INITIAL;
     src->type = AL_UNDETERMINED;
+    src->buffer = 0;
+    src->buffers_queued = 0;
+    src->buffers_processed = 0;
+    src->source_relative = AL_FALSE;
+    src->looping = AL_FALSE;
+    src->sec_offset = 0;
+    src->sample_offset = 0;
+    src->byte_offset = 0;
     src->gain = 1.0f;
+    src->min_gain = 0.0f;
     src->max_gain = 1.0f;
     src->reference_distance = 1.0f;
-    src->max_distance = FLT_MAX;
     src->rolloff_factor = 1.0f;
+    src->max_distance = FLT_MAX;
     src->pitch = 1.0f;
     src->cone_inner_angle = 360.0f;
     src->cone_outer_angle = 360.0f;
+    src->cone_outer_gain = 0.0f;
+    memset(src->position, '\0', sizeof (src->position));
+    memset(src->velocity, '\0', sizeof (src->velocity));
+    memset(src->direction, '\0', sizeof (src->direction));
+}
 
-    /* check everything for newly-generated sources. The theory being that
-       we can catch defaults in the AL that aren't what we expected. */
-    check_source_state(src);
+static void init_source_state(ContextWrapper *ctx, SourceWrapper *src, const ALuint name)
+{
+    memset(src, '\0', sizeof (*src));
+    src->name = name;
+    reset_source_state(src);
+
+    /* check everything for the first source generated on a context. The
+       theory being that we can catch defaults in the AL that aren't what we
+       expected. After that, every new source should look like the first
+       one, so only recheck what didn't match last time. */
+    if (!ctx->checked_source_defaults) {
+        ctx->source_default_mismatches = check_source_state(src, SRCPROP_ALL);
+        ctx->checked_source_defaults = AL_TRUE;
+    } else if (ctx->source_default_mismatches) {
+        check_source_state(src, ctx->source_default_mismatches);
+    }
 }
 
 void alGenSources(ALsizei n, ALuint *names)
 {
-    ContextWrapper *ctx = current_context;
+    ContextWrapper *ctx;
     ALsizei i;
 
+    IO_START(alGenSources);
+    ctx = current_context;
     memset(names, 0, n * sizeof (ALuint));
+    REAL_CALL_START();
     REAL_alGenSources(n, names);
+    REAL_CALL_END();
 
-    IO_START(alGenSources);
     IO_ALSIZEI(n);
     IO_PTR(names);
     for (i = 0; i < n; i++) {
@@ -1774,18 +6232,9 @@ void alGenSources(ALsizei n, ALuint *names)
         for (i = 0; i < n; i++) {
             const ALuint name = names[i];
             if (name != 0) {
-                const uint8 hash = hash_alname(name);
-                SourceWrapper *src = (SourceWrapper *) malloc(sizeof (SourceWrapper));
-                if (!src) {
-                    out_of_memory();
-                }
-            
-                init_source_state(src, name);
-                src->hash_next = ctx->wrapped_source_hash[hash];
-                if (ctx->wrapped_source_hash[hash]) {
-                    ctx->wrapped_source_hash[hash]->hash_prev = src;
-                }
-                ctx->wrapped_source_hash[hash] = src;
+                SourceWrapper *src = (SourceWrapper *) pool_alloc(&source_pool);
+                init_source_state(ctx, src, name);
+                handle_table_set(&ctx->wrapped_sources, name, src);
             }
         }
     }
@@ -1804,7 +6253,9 @@ void alDeleteSources(ALsizei n, const ALuint *names)
     for (i = 0; i < n; i++) {
         IO_UINT32(names[i]);
     }
+    REAL_CALL_START();
     REAL_alDeleteSources(n, names);
+    REAL_CALL_END();
 
     // objects are only deleted if there are no errors.
     if (check_al_error_events() == AL_NO_ERROR) {
@@ -1822,16 +6273,8 @@ void alDeleteSources(ALsizei n, const ALuint *names)
                         ctx->playlist = src->playlist_next;
                     }
 
-                    if (src->hash_prev) {
-                        src->hash_prev->hash_next = src->hash_next;
-                    } else {
-                        ctx->wrapped_source_hash[hash_alname(name)] = src->hash_next;
-                    }
-                    if (src->hash_next) {
-                        src->hash_next->hash_prev = src->hash_prev;
-                    }
-
-                    free(src);
+                    handle_table_remove(&ctx->wrapped_sources, name);
+                    pool_free(&source_pool, src);
                 }
             }
         }
@@ -1843,9 +6286,13 @@ void alDeleteSources(ALsizei n, const ALuint *names)
 ALboolean alIsSource(ALuint name)
 {
     ALboolean retval;
+    IO_PASSTHROUGH(alIsSource(name));
     IO_START(alIsSource);
+    note_sources_used(1, &name);
     IO_UINT32(name);
+    REAL_CALL_START();
     retval = REAL_alIsSource(name);
+    REAL_CALL_END();
     IO_BOOLEAN(retval);
     IO_END();
     return retval;
@@ -1855,7 +6302,9 @@ void alSourcefv(ALuint name, ALenum param, const ALfloat *values)
 {
     uint32 numvals = 1;
     uint32 i;
+    IO_PASSTHROUGH_VOID(alSourcefv(name, param, values));
     IO_START(alSourcefv);
+    note_sources_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_PTR(values);
@@ -1882,32 +6331,42 @@ void alSourcefv(ALuint name, ALenum param, const ALfloat *values)
         IO_FLOAT(values[i]);
     }
 
+    REAL_CALL_START();
     REAL_alSourcefv(name, param, values);
-    check_source_state_from_name(name);
+    REAL_CALL_END();
+    check_source_state_from_name(name, source_param_properties(param));
     IO_END();
 }
 
 void alSourcef(ALuint name, ALenum param, ALfloat value)
 {
+    IO_PASSTHROUGH_VOID(alSourcef(name, param, value));
     IO_START(alSourcef);
+    note_sources_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_FLOAT(value);
+    REAL_CALL_START();
     REAL_alSourcef(name, param, value);
-    check_source_state_from_name(name);
+    REAL_CALL_END();
+    check_source_state_from_name(name, source_param_properties(param));
     IO_END();
 }
 
 void alSource3f(ALuint name, ALenum param, ALfloat value1, ALfloat value2, ALfloat value3)
 {
+    IO_PASSTHROUGH_VOID(alSource3f(name, param, value1, value2, value3));
     IO_START(alSource3f);
+    note_sources_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_FLOAT(value1);
     IO_FLOAT(value2);
     IO_FLOAT(value3);
+    REAL_CALL_START();
     REAL_alSource3f(name, param, value1, value2, value3);
-    check_source_state_from_name(name);
+    REAL_CALL_END();
+    check_source_state_from_name(name, source_param_properties(param));
     IO_END();
 }
 
@@ -1915,7 +6374,9 @@ void alSourceiv(ALuint name, ALenum param, const ALint *values)
 {
     uint32 numvals = 1;
     uint32 i;
+    IO_PASSTHROUGH_VOID(alSourceiv(name, param, values));
     IO_START(alSourceiv);
+    note_sources_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_PTR(values);
@@ -1941,32 +6402,42 @@ void alSourceiv(ALuint name, ALenum param, const ALint *values)
         IO_INT32(values[i]);
     }
 
+    REAL_CALL_START();
     REAL_alSourceiv(name, param, values);
-    check_source_state_from_name(name);
+    REAL_CALL_END();
+    check_source_state_from_name(name, source_param_properties(param));
     IO_END();
 }
 
 void alSourcei(ALuint name, ALenum param, ALint value)
 {
+    IO_PASSTHROUGH_VOID(alSourcei(name, param, value));
     IO_START(alSourcei);
+    note_sources_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_INT32(value);
+    REAL_CALL_START();
     REAL_alSourcei(name, param, value);
-    check_source_state_from_name(name);
+    REAL_CALL_END();
+    check_source_state_from_name(name, source_param_properties(param));
     IO_END();
 }
 
 void alSource3i(ALuint name, ALenum param, ALint value1, ALint value2, ALint value3)
 {
+    IO_PASSTHROUGH_VOID(alSource3i(name, param, value1, value2, value3));
     IO_START(alSource3i);
+    note_sources_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_INT32(value1);
     IO_INT32(value2);
     IO_INT32(value3);
+    REAL_CALL_START();
     REAL_alSource3i(name, param, value1, value2, value3);
-    check_source_state_from_name(name);
+    REAL_CALL_END();
+    check_source_state_from_name(name, source_param_properties(param));
     IO_END();
 }
 
@@ -1974,7 +6445,9 @@ void alGetSourcefv(ALuint name, ALenum param, ALfloat *values)
 {
     uint32 numvals = 1;
     uint32 i;
+    IO_PASSTHROUGH_VOID(alGetSourcefv(name, param, values));
     IO_START(alGetSourcefv);
+    note_sources_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_PTR(values);
@@ -2004,7 +6477,9 @@ void alGetSourcefv(ALuint name, ALenum param, ALfloat *values)
         memset(values, '\0', numvals * sizeof (ALfloat));
     }
 
+    REAL_CALL_START();
     REAL_alGetSourcefv(name, param, values);
+    REAL_CALL_END();
 
     IO_UINT32(numvals);
     for (i = 0; i < numvals; i++) {
@@ -2016,24 +6491,32 @@ void alGetSourcefv(ALuint name, ALenum param, ALfloat *values)
 
 void alGetSourcef(ALuint name, ALenum param, ALfloat *value)
 {
+    IO_PASSTHROUGH_VOID(alGetSourcef(name, param, value));
     IO_START(alGetSourcef);
+    note_sources_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_PTR(value);
+    REAL_CALL_START();
     REAL_alGetSourcef(name, param, value);
+    REAL_CALL_END();
     IO_FLOAT(value ? *value : 0.0f);
     IO_END();
 }
 
 void alGetSource3f(ALuint name, ALenum param, ALfloat *value1, ALfloat *value2, ALfloat *value3)
 {
+    IO_PASSTHROUGH_VOID(alGetSource3f(name, param, value1, value2, value3));
     IO_START(alGetSource3f);
+    note_sources_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_PTR(value1);
     IO_PTR(value2);
     IO_PTR(value3);
+    REAL_CALL_START();
     REAL_alGetSource3f(name, param, value1, value2, value3);
+    REAL_CALL_END();
     IO_FLOAT(value1 ? *value1 : 0.0f);
     IO_FLOAT(value2 ? *value2 : 0.0f);
     IO_FLOAT(value3 ? *value3 : 0.0f);
@@ -2044,7 +6527,9 @@ void alGetSourceiv(ALuint name, ALenum param, ALint *values)
 {
     uint32 numvals = 1;
     uint32 i;
+    IO_PASSTHROUGH_VOID(alGetSourceiv(name, param, values));
     IO_START(alGetSourceiv);
+    note_sources_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_PTR(values);
@@ -2073,7 +6558,9 @@ void alGetSourceiv(ALuint name, ALenum param, ALint *values)
         memset(values, '\0', numvals * sizeof (ALint));
     }
 
+    REAL_CALL_START();
     REAL_alGetSourceiv(name, param, values);
+    REAL_CALL_END();
 
     IO_UINT32(numvals);
     for (i = 0; i < numvals; i++) {
@@ -2085,24 +6572,32 @@ void alGetSourceiv(ALuint name, ALenum param, ALint *values)
 
 void alGetSourcei(ALuint name, ALenum param, ALint *value)
 {
+    IO_PASSTHROUGH_VOID(alGetSourcei(name, param, value));
     IO_START(alGetSourcei);
+    note_sources_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_PTR(value);
+    REAL_CALL_START();
     REAL_alGetSourcei(name, param, value);
+    REAL_CALL_END();
     IO_INT32(value ? *value : 0);
     IO_END();
 }
 
 void alGetSource3i(ALuint name, ALenum param, ALint *value1, ALint *value2, ALint *value3)
 {
+    IO_PASSTHROUGH_VOID(alGetSource3i(name, param, value1, value2, value3));
     IO_START(alGetSource3i);
+    note_sources_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_PTR(value1);
     IO_PTR(value2);
     IO_PTR(value3);
+    REAL_CALL_START();
     REAL_alGetSource3i(name, param, value1, value2, value3);
+    REAL_CALL_END();
     IO_INT32(value1 ? *value1 : 0);
     IO_INT32(value2 ? *value2 : 0);
     IO_INT32(value3 ? *value3 : 0);
@@ -2125,15 +6620,20 @@ static void add_source_to_playlist(const ALuint name)
 
 void alSourcePlay(ALuint name)
 {
+    IO_PASSTHROUGH_VOID(alSourcePlay(name));
     IO_START(alSourcePlay);
+    note_sources_used(1, &name);
     IO_UINT32(name);
+    REAL_CALL_START();
     REAL_alSourcePlay(name);
+    REAL_CALL_END();
 
+    // this call changes the state right now, so note it here instead of
+    //  waiting for the next state poll. After this, the source is in the
+    //  playlist, so the poller will notice when it stops.
+    check_source_state_from_name(name, SRCPROP_PLAYBACK);
     add_source_to_playlist(name);
 
-    // Don't call, check_source_state_from_name(name), it's in the
-    //  playlist now and will be checked.
-
     IO_END();
 }
 
@@ -2141,19 +6641,22 @@ void alSourcePlayv(ALsizei n, const ALuint *names)
 {
     ALsizei i;
 
+    IO_PASSTHROUGH_VOID(alSourcePlayv(n, names));
     IO_START(alSourcePlayv);
+    note_sources_used(n, names);
     IO_ALSIZEI(n);
     IO_PTR(names);
     for (i = 0; i < n; i++) {
         IO_UINT32(names[i]);
     }
 
+    REAL_CALL_START();
     REAL_alSourcePlayv(n, names);
+    REAL_CALL_END();
 
     for (i = 0; i < n; i++) {
+        check_source_state_from_name(names[i], SRCPROP_PLAYBACK);  // see alSourcePlay().
         add_source_to_playlist(names[i]);
-        // Don't call, check_source_state_from_name(names[i]), it's in the
-        //  playlist now and will be checked.
     }
 
     IO_END();
@@ -2161,10 +6664,14 @@ void alSourcePlayv(ALsizei n, const ALuint *names)
 
 void alSourcePause(ALuint name)
 {
+    IO_PASSTHROUGH_VOID(alSourcePause(name));
     IO_START(alSourcePause);
+    note_sources_used(1, &name);
     IO_UINT32(name);
+    REAL_CALL_START();
     REAL_alSourcePause(name);
-    check_source_state_from_name(name);
+    REAL_CALL_END();
+    check_source_state_from_name(name, SRCPROP_PLAYBACK);
     IO_END();
 }
 
@@ -2172,17 +6679,21 @@ void alSourcePausev(ALsizei n, const ALuint *names)
 {
     ALsizei i;
 
+    IO_PASSTHROUGH_VOID(alSourcePausev(n, names));
     IO_START(alSourcePausev);
+    note_sources_used(n, names);
     IO_ALSIZEI(n);
     IO_PTR(names);
     for (i = 0; i < n; i++) {
         IO_UINT32(names[i]);
     }
 
+    REAL_CALL_START();
     REAL_alSourcePausev(n, names);
+    REAL_CALL_END();
 
     for (i = 0; i < n; i++) {
-        check_source_state_from_name(names[i]);
+        check_source_state_from_name(names[i], SRCPROP_PLAYBACK);
     }
 
     IO_END();
@@ -2190,10 +6701,14 @@ void alSourcePausev(ALsizei n, const ALuint *names)
 
 void alSourceRewind(ALuint name)
 {
+    IO_PASSTHROUGH_VOID(alSourceRewind(name));
     IO_START(alSourceRewind);
+    note_sources_used(1, &name);
     IO_UINT32(name);
+    REAL_CALL_START();
     REAL_alSourceRewind(name);
-    check_source_state_from_name(name);
+    REAL_CALL_END();
+    check_source_state_from_name(name, SRCPROP_PLAYBACK);
     IO_END();
 }
 
@@ -2201,17 +6716,21 @@ void alSourceRewindv(ALsizei n, const ALuint *names)
 {
     ALsizei i;
 
+    IO_PASSTHROUGH_VOID(alSourceRewindv(n, names));
     IO_START(alSourceRewindv);
+    note_sources_used(n, names);
     IO_ALSIZEI(n);
     IO_PTR(names);
     for (i = 0; i < n; i++) {
         IO_UINT32(names[i]);
     }
 
+    REAL_CALL_START();
     REAL_alSourceRewindv(n, names);
+    REAL_CALL_END();
 
     for (i = 0; i < n; i++) {
-        check_source_state_from_name(names[i]);
+        check_source_state_from_name(names[i], SRCPROP_PLAYBACK);
     }
 
     IO_END();
@@ -2219,10 +6738,14 @@ void alSourceRewindv(ALsizei n, const ALuint *names)
 
 void alSourceStop(ALuint name)
 {
+    IO_PASSTHROUGH_VOID(alSourceStop(name));
     IO_START(alSourceStop);
+    note_sources_used(1, &name);
     IO_UINT32(name);
+    REAL_CALL_START();
     REAL_alSourceStop(name);
-    check_source_state_from_name(name);
+    REAL_CALL_END();
+    check_source_state_from_name(name, SRCPROP_PLAYBACK);
 
     IO_END();
 }
@@ -2231,17 +6754,21 @@ void alSourceStopv(ALsizei n, const ALuint *names)
 {
     ALsizei i;
 
+    IO_PASSTHROUGH_VOID(alSourceStopv(n, names));
     IO_START(alSourceStopv);
+    note_sources_used(n, names);
     IO_ALSIZEI(n);
     IO_PTR(names);
     for (i = 0; i < n; i++) {
         IO_UINT32(names[i]);
     }
 
+    REAL_CALL_START();
     REAL_alSourceStopv(n, names);
+    REAL_CALL_END();
 
     for (i = 0; i < n; i++) {
-        check_source_state_from_name(names[i]);
+        check_source_state_from_name(names[i], SRCPROP_PLAYBACK);
     }
 
     IO_END();
@@ -2250,7 +6777,10 @@ void alSourceStopv(ALsizei n, const ALuint *names)
 void alSourceQueueBuffers(ALuint name, ALsizei nb, const ALuint *bufnames)
 {
     ALsizei i;
+    IO_PASSTHROUGH_VOID(alSourceQueueBuffers(name, nb, bufnames));
     IO_START(alSourceQueueBuffers);
+    note_sources_used(1, &name);
+    note_buffers_used(nb, bufnames);
     IO_UINT32(name);
     IO_ALSIZEI(nb);
     IO_PTR(bufnames);
@@ -2258,9 +6788,11 @@ void alSourceQueueBuffers(ALuint name, ALsizei nb, const ALuint *bufnames)
         IO_UINT32(bufnames[i]);
     }
 
+    REAL_CALL_START();
     REAL_alSourceQueueBuffers(name, nb, bufnames);
+    REAL_CALL_END();
 
-    check_source_state_from_name(name);
+    check_source_state_from_name(name, SRCPROP_QUEUE);
 
     IO_END();
 }
@@ -2268,17 +6800,21 @@ void alSourceQueueBuffers(ALuint name, ALsizei nb, const ALuint *bufnames)
 void alSourceUnqueueBuffers(ALuint name, ALsizei nb, ALuint *bufnames)
 {
     ALsizei i;
+    IO_PASSTHROUGH_VOID(alSourceUnqueueBuffers(name, nb, bufnames));
     IO_START(alSourceUnqueueBuffers);
+    note_sources_used(1, &name);
     IO_UINT32(name);
     IO_ALSIZEI(nb);
     IO_PTR(bufnames);
     memset(bufnames, 0, nb * sizeof (ALuint));
+    REAL_CALL_START();
     REAL_alSourceUnqueueBuffers(name, nb, bufnames);
+    REAL_CALL_END();
     for (i = 0; i < nb; i++) {
         IO_UINT32(bufnames[i]);
     }
 
-    check_source_state_from_name(name);
+    check_source_state_from_name(name, SRCPROP_QUEUE);
 
     IO_END();
 }
@@ -2286,22 +6822,25 @@ void alSourceUnqueueBuffers(ALuint name, ALsizei nb, ALuint *bufnames)
 
 static BufferWrapper *buffer_wrapped_lookup(const ALuint name)
 {
-    BufferWrapper *retval = NULL;
     DeviceWrapper *device = current_context ? current_context->device : NULL;
-    if (device && name) {
-        const uint8 hash = hash_alname(name);
-        for (retval = device->wrapped_buffer_hash[hash]; retval; retval = retval->hash_next) {
-            if (retval->name == name) {
-                break;
+    return (device && name) ? (BufferWrapper *) handle_table_get(&device->wrapped_buffers, name) : NULL;
+}
+
+// ALTRACE_CONTENTION: the current call used these buffers.
+static void note_buffers_used(const ALsizei n, const ALuint *names)
+{
+    if (contention && names) {
+        ALsizei i;
+        for (i = 0; i < n; i++) {
+            BufferWrapper *buf = buffer_wrapped_lookup(names[i]);
+            if (buf) {
+                contention_object_use(&buf->contention, 1, names[i]);
             }
         }
     }
-    return retval;
-
-
 }
 
-static void check_buffer_state_int(BufferWrapper *buf, const ALenum param, ALint *current)
+static int check_buffer_state_int(BufferWrapper *buf, const ALenum param, ALint *current)
 {
     ALint ival = 0;
     REAL_alGetBufferi(buf->name, param, &ival);
@@ -2311,46 +6850,71 @@ static void check_buffer_state_int(BufferWrapper *buf, const ALenum param, ALint
         IO_ENUM(param);
         IO_INT32(ival);
         *current = ival;
+        return 1;
     }
+    return 0;
 }
 
-static void check_buffer_state(BufferWrapper *buf)
+/* like SourceProperty, for buffers. */
+typedef enum BufferProperty
+{
+    BUFPROP_FREQUENCY = (1 << 0),
+    BUFPROP_SIZE = (1 << 1),
+    BUFPROP_BITS = (1 << 2),
+    BUFPROP_CHANNELS = (1 << 3),
+    BUFPROP_ALL = (1 << 4) - 1
+} BufferProperty;
+
+/* returns the BufferProperty bits that changed. */
+static uint32 check_buffer_state(BufferWrapper *buf, const uint32 props)
 {
     const ALuint name = buf ? buf->name : 0;
+    uint32 changed = 0;
     if (name) {
-        check_buffer_state_int(buf, AL_FREQUENCY, &buf->frequency);
-        check_buffer_state_int(buf, AL_SIZE, &buf->size);
-        check_buffer_state_int(buf, AL_BITS, &buf->bits);
-        check_buffer_state_int(buf, AL_CHANNELS, &buf->channels);
+        if ((props & BUFPROP_FREQUENCY) && check_buffer_state_int(buf, AL_FREQUENCY, &buf->frequency)) { changed |= BUFPROP_FREQUENCY; }
+        if ((props & BUFPROP_SIZE) && check_buffer_state_int(buf, AL_SIZE, &buf->size)) { changed |= BUFPROP_SIZE; }
+        if ((props & BUFPROP_BITS) && check_buffer_state_int(buf, AL_BITS, &buf->bits)) { changed |= BUFPROP_BITS; }
+        if ((props & BUFPROP_CHANNELS) && check_buffer_state_int(buf, AL_CHANNELS, &buf->channels)) { changed |= BUFPROP_CHANNELS; }
     }
+    return changed;
 }
 
 static void check_buffer_state_from_name(const ALuint name)
 {
-    check_buffer_state(buffer_wrapped_lookup(name));
+    /* there are only four of these, and alBufferData changes all of them. */
+    check_buffer_state(buffer_wrapped_lookup(name), BUFPROP_ALL);
 }
 
-static void init_buffer_state(BufferWrapper *buf, const ALuint name)
+static void init_buffer_state(DeviceWrapper *device, BufferWrapper *buf, const ALuint name)
 {
     memset(buf, '\0', sizeof (*buf));
     buf->name = name;
     buf->channels = 1;
     buf->bits = 16;
 
-    /* check everything for newly-generated buffers. The theory being that
-       we can catch defaults in the AL that aren't what we expected. */
-    check_buffer_state(buf);
+    /* check everything for the first buffer generated on a device. The
+       theory being that we can catch defaults in the AL that aren't what we
+       expected. See init_source_state(). */
+    if (!device->checked_buffer_defaults) {
+        device->buffer_default_mismatches = check_buffer_state(buf, BUFPROP_ALL);
+        device->checked_buffer_defaults = AL_TRUE;
+    } else if (device->buffer_default_mismatches) {
+        check_buffer_state(buf, device->buffer_default_mismatches);
+    }
 }
 
 void alGenBuffers(ALsizei n, ALuint *names)
 {
-    DeviceWrapper *device = current_context ? current_context->device : NULL;
+    DeviceWrapper *device;
     ALsizei i;
 
+    IO_START(alGenBuffers);
+    device = current_context ? current_context->device : NULL;
     memset(names, 0, n * sizeof (ALuint));
+    REAL_CALL_START();
     REAL_alGenBuffers(n, names);
+    REAL_CALL_END();
 
-    IO_START(alGenBuffers);
     IO_ALSIZEI(n);
     IO_PTR(names);
     for (i = 0; i < n; i++) {
@@ -2361,18 +6925,9 @@ void alGenBuffers(ALsizei n, ALuint *names)
         for (i = 0; i < n; i++) {
             const ALuint name = names[i];
             if (name != 0) {
-                const uint8 hash = hash_alname(name);
-                BufferWrapper *buf = (BufferWrapper *) malloc(sizeof (BufferWrapper));
-                if (!buf) {
-                    out_of_memory();
-                }
-            
-                init_buffer_state(buf, name);
-                buf->hash_next = device->wrapped_buffer_hash[hash];
-                if (device->wrapped_buffer_hash[hash]) {
-                    device->wrapped_buffer_hash[hash]->hash_prev = buf;
-                }
-                device->wrapped_buffer_hash[hash] = buf;
+                BufferWrapper *buf = (BufferWrapper *) pool_alloc(&buffer_pool);
+                init_buffer_state(device, buf, name);
+                handle_table_set(&device->wrapped_buffers, name, buf);
             }
         }
     }
@@ -2392,7 +6947,9 @@ void alDeleteBuffers(ALsizei n, const ALuint *names)
         IO_UINT32(names[i]);
     }
 
+    REAL_CALL_START();
     REAL_alDeleteBuffers(n, names);
+    REAL_CALL_END();
 
     // objects are only deleted if there are no errors.
     if (check_al_error_events() == AL_NO_ERROR) {
@@ -2401,15 +6958,8 @@ void alDeleteBuffers(ALsizei n, const ALuint *names)
                 const ALuint name = names[i];
                 BufferWrapper *buf = buffer_wrapped_lookup(name);
                 if (buf) {
-                    if (buf->hash_prev) {
-                        buf->hash_prev->hash_next = buf->hash_next;
-                    } else {
-                        device->wrapped_buffer_hash[hash_alname(name)] = buf->hash_next;
-                    }
-                    if (buf->hash_next) {
-                        buf->hash_next->hash_prev = buf->hash_prev;
-                    }
-                    free(buf);
+                    handle_table_remove(&device->wrapped_buffers, name);
+                    pool_free(&buffer_pool, buf);
                 }
             }
         }
@@ -2421,9 +6971,13 @@ void alDeleteBuffers(ALsizei n, const ALuint *names)
 ALboolean alIsBuffer(ALuint name)
 {
     ALboolean retval;
+    IO_PASSTHROUGH(alIsBuffer(name));
     IO_START(alIsBuffer);
+    note_buffers_used(1, &name);
     IO_UINT32(name);
+    REAL_CALL_START();
     retval = REAL_alIsBuffer(name);
+    REAL_CALL_END();
     IO_BOOLEAN(retval);
     IO_END();
     return retval;
@@ -2431,13 +6985,17 @@ ALboolean alIsBuffer(ALuint name)
 
 void alBufferData(ALuint name, ALenum alfmt, const ALvoid *data, ALsizei size, ALsizei freq)
 {
+    IO_PASSTHROUGH_VOID(alBufferData(name, alfmt, data, size, freq));
     IO_START(alBufferData);
+    note_buffers_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(alfmt);
     IO_ALSIZEI(freq);
     IO_PTR(data);
-    IO_BLOB(data, size);
+    IO_PAYLOAD(&buffer_payload, (const uint8 *) data, size, format_frame_size(alfmt));
+    REAL_CALL_START();
     REAL_alBufferData(name, alfmt, data, size, freq);
+    REAL_CALL_END();
     check_buffer_state_from_name(name);
     IO_END();
 }
@@ -2446,7 +7004,9 @@ void alBufferfv(ALuint name, ALenum param, const ALfloat *values)
 {
     uint32 numvals = 1;
     uint32 i;
+    IO_PASSTHROUGH_VOID(alBufferfv(name, param, values));
     IO_START(alBufferfv);
+    note_buffers_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_PTR(values);
@@ -2455,31 +7015,41 @@ void alBufferfv(ALuint name, ALenum param, const ALfloat *values)
     for (i = 0; i < numvals; i++) {
         IO_FLOAT(values[i]);
     }
+    REAL_CALL_START();
     REAL_alBufferfv(name, param, values);
+    REAL_CALL_END();
     check_buffer_state_from_name(name);
     IO_END();
 }
 
 void alBufferf(ALuint name, ALenum param, ALfloat value)
 {
+    IO_PASSTHROUGH_VOID(alBufferf(name, param, value));
     IO_START(alBufferf);
+    note_buffers_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_FLOAT(value);
+    REAL_CALL_START();
     REAL_alBufferf(name, param, value);
+    REAL_CALL_END();
     check_buffer_state_from_name(name);
     IO_END();
 }
 
 void alBuffer3f(ALuint name, ALenum param, ALfloat value1, ALfloat value2, ALfloat value3)
 {
+    IO_PASSTHROUGH_VOID(alBuffer3f(name, param, value1, value2, value3));
     IO_START(alBuffer3f);
+    note_buffers_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_FLOAT(value1);
     IO_FLOAT(value2);
     IO_FLOAT(value3);
+    REAL_CALL_START();
     REAL_alBuffer3f(name, param, value1, value2, value3);
+    REAL_CALL_END();
     check_buffer_state_from_name(name);
     IO_END();
 }
@@ -2488,7 +7058,9 @@ void alBufferiv(ALuint name, ALenum param, const ALint *values)
 {
     uint32 numvals = 1;
     uint32 i;
+    IO_PASSTHROUGH_VOID(alBufferiv(name, param, values));
     IO_START(alBufferiv);
+    note_buffers_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_PTR(values);
@@ -2497,31 +7069,41 @@ void alBufferiv(ALuint name, ALenum param, const ALint *values)
     for (i = 0; i < numvals; i++) {
         IO_INT32(values[i]);
     }
+    REAL_CALL_START();
     REAL_alBufferiv(name, param, values);
+    REAL_CALL_END();
     check_buffer_state_from_name(name);
     IO_END();
 }
 
 void alBufferi(ALuint name, ALenum param, ALint value)
 {
+    IO_PASSTHROUGH_VOID(alBufferi(name, param, value));
     IO_START(alBufferi);
+    note_buffers_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_INT32(value);
+    REAL_CALL_START();
     REAL_alBufferi(name, param, value);
+    REAL_CALL_END();
     check_buffer_state_from_name(name);
     IO_END();
 }
 
 void alBuffer3i(ALuint name, ALenum param, ALint value1, ALint value2, ALint value3)
 {
+    IO_PASSTHROUGH_VOID(alBuffer3i(name, param, value1, value2, value3));
     IO_START(alBuffer3i);
+    note_buffers_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_INT32(value1);
     IO_INT32(value2);
     IO_INT32(value3);
+    REAL_CALL_START();
     REAL_alBuffer3i(name, param, value1, value2, value3);
+    REAL_CALL_END();
     IO_END();
 }
 
@@ -2529,7 +7111,9 @@ void alGetBufferfv(ALuint name, ALenum param, ALfloat *values)
 {
     uint32 numvals = 1;
     uint32 i;
+    IO_PASSTHROUGH_VOID(alGetBufferfv(name, param, values));
     IO_START(alGetBufferfv);
+    note_buffers_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_PTR(values);
@@ -2541,7 +7125,9 @@ void alGetBufferfv(ALuint name, ALenum param, ALfloat *values)
         memset(values, '\0', numvals * sizeof (ALfloat));
     }
 
+    REAL_CALL_START();
     REAL_alGetBufferfv(name, param, values);
+    REAL_CALL_END();
 
     IO_UINT32(numvals);
     for (i = 0; i < numvals; i++) {
@@ -2553,24 +7139,32 @@ void alGetBufferfv(ALuint name, ALenum param, ALfloat *values)
 
 void alGetBufferf(ALuint name, ALenum param, ALfloat *value)
 {
+    IO_PASSTHROUGH_VOID(alGetBufferf(name, param, value));
     IO_START(alGetBufferf);
+    note_buffers_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_PTR(value);
+    REAL_CALL_START();
     REAL_alGetBufferf(name, param, value);
+    REAL_CALL_END();
     IO_FLOAT(value ? *value : 0.0f);
     IO_END();
 }
 
 void alGetBuffer3f(ALuint name, ALenum param, ALfloat *value1, ALfloat *value2, ALfloat *value3)
 {
+    IO_PASSTHROUGH_VOID(alGetBuffer3f(name, param, value1, value2, value3));
     IO_START(alGetBuffer3f);
+    note_buffers_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_PTR(value1);
     IO_PTR(value2);
     IO_PTR(value3);
+    REAL_CALL_START();
     REAL_alGetBuffer3f(name, param, value1, value2, value3);
+    REAL_CALL_END();
     IO_FLOAT(value1 ? *value1 : 0.0f);
     IO_FLOAT(value2 ? *value2 : 0.0f);
     IO_FLOAT(value3 ? *value3 : 0.0f);
@@ -2579,24 +7173,32 @@ void alGetBuffer3f(ALuint name, ALenum param, ALfloat *value1, ALfloat *value2,
 
 void alGetBufferi(ALuint name, ALenum param, ALint *value)
 {
+    IO_PASSTHROUGH_VOID(alGetBufferi(name, param, value));
     IO_START(alGetBufferi);
+    note_buffers_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_PTR(value);
+    REAL_CALL_START();
     REAL_alGetBufferi(name, param, value);
+    REAL_CALL_END();
     IO_INT32(value ? *value : 0);
     IO_END();
 }
 
 void alGetBuffer3i(ALuint name, ALenum param, ALint *value1, ALint *value2, ALint *value3)
 {
+    IO_PASSTHROUGH_VOID(alGetBuffer3i(name, param, value1, value2, value3));
     IO_START(alGetBuffer3i);
+    note_buffers_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_PTR(value1);
     IO_PTR(value2);
     IO_PTR(value3);
+    REAL_CALL_START();
     REAL_alGetBuffer3i(name, param, value1, value2, value3);
+    REAL_CALL_END();
     IO_INT32(value1 ? *value1 : 0);
     IO_INT32(value2 ? *value2 : 0);
     IO_INT32(value3 ? *value3 : 0);
@@ -2607,7 +7209,9 @@ void alGetBufferiv(ALuint name, ALenum param, ALint *values)
 {
     uint32 numvals = 1;
     uint32 i;
+    IO_PASSTHROUGH_VOID(alGetBufferiv(name, param, values));
     IO_START(alGetBufferiv);
+    note_buffers_used(1, &name);
     IO_UINT32(name);
     IO_ENUM(param);
     IO_PTR(values);
@@ -2625,7 +7229,9 @@ void alGetBufferiv(ALuint name, ALenum param, ALint *values)
         memset(values, '\0', numvals * sizeof (ALint));
     }
 
+    REAL_CALL_START();
     REAL_alGetBufferiv(name, param, values);
+    REAL_CALL_END();
 
     IO_UINT32(numvals);
     for (i = 0; i < numvals; i++) {
@@ -2652,6 +7258,9 @@ void alTraceMessage(const ALchar *str)
 {
     IO_START(alTraceMessage);
     IO_STRING(str);
+    if (flight_recorder && str && (strcmp(str, FLIGHT_DUMP_MESSAGE) == 0)) {
+        request_flight_dump("alTraceMessage");
+    }
     IO_END();
 }
 
@@ -2687,6 +7296,24 @@ void alcTraceContextLabel(ALCcontext *_ctx, const ALCchar *str)
     IO_END();
 }
 
+// these don't show up in the tracefile as calls, just as the capture
+//  events they cause, and they work even while capture is off.
+void alTraceStartCapture(void)
+{
+    request_capture(CAPTURE_REQUEST_START, "alTraceStartCapture");
+    APILOCK();
+    process_capture_request();
+    APIUNLOCK();
+}
+
+void alTraceStopCapture(void)
+{
+    request_capture(CAPTURE_REQUEST_STOP, "alTraceStopCapture");
+    APILOCK();
+    process_capture_request();
+    APIUNLOCK();
+}
+
 static void check_device_state_bool(DeviceWrapper *device, const ALCenum param, ALCboolean *current)
 {
     ALCint ival = 0;
@@ -2715,14 +7342,519 @@ static void check_device_state_int(DeviceWrapper *device, const ALCenum param, A
     }
 }
 
+// calls on capture devices change how many samples are waiting, so note
+//  that with the call instead of waiting for the next state poll.
+static void check_capture_samples(DeviceWrapper *device)
+{
+    if (poller_thread_running && device->iscapture) {
+        check_device_state_int(device, ALC_CAPTURE_SAMPLES, &device->capture_samples);
+    }
+}
+
+
+// Sources only get checked while the right context is current. The poller
+//  thread uses ALC_EXT_thread_local_context when it can, so it doesn't
+//  disturb anything, otherwise we briefly swap the process-wide current
+//  context, which is safe because everything goes through the API lock
+//  (and calls that let go of it for their real call are waited out).
+//  Either way, the checks share the context's error state with the app.
+static ALCboolean (*set_thread_context)(ALCcontext *ctx) = NULL;
+static ContextWrapper *checking_context = NULL;
+
+static void make_context_current_for_checks(ContextWrapper *ctx)
+{
+    if (set_thread_context) {
+        set_thread_context(ctx ? ctx->ctx : NULL);
+    } else if (ctx != checking_context) {
+        wait_for_unlocked_calls();  // they'd be talking to the wrong context.
+        REAL_alcMakeContextCurrent(ctx ? ctx->ctx : NULL);
+    }
+    checking_context = ctx;
+}
+
+static void check_context_sources(ContextWrapper *ctx)
+{
+    SourceWrapper *src;
+    SourceWrapper *next;
+
+    if (!ctx->playlist) {
+        return;
+    }
+
+    // a call that let go of the API lock might be about to raise an error on
+    //  this context; our alGetError() below would take it away from that call.
+    wait_for_unlocked_calls();
+
+    make_context_current_for_checks(ctx);
+
+    for (src = ctx->playlist; src != NULL; src = next) {
+        next = src->playlist_next;
+        check_source_state(src, SRCPROP_PLAYBACK);
+        if (src->state != AL_PLAYING) {
+            /* source has stopped for whatever reason, take it out of the playlist. */
+            if (next) {
+                next->playlist_prev = src->playlist_prev;
+            }
+            if (src->playlist_prev) {
+                src->playlist_prev->playlist_next = next;
+            } else {
+                ctx->playlist = next;
+            }
+            src->playlist_prev = NULL;
+            src->playlist_next = NULL;
+        }
+    }
+
+    // don't leave errors we caused for the app to find. Nothing else is in
+    //  OpenAL right now, and every call collects its own errors before it
+    //  lets go of the API lock, so the only errors here are ours.
+    REAL_alGetError();
+}
+
+static void restore_current_context(void)
+{
+    if (set_thread_context) {
+        set_thread_context(NULL);
+    } else if (checking_context != current_context) {
+        REAL_alcMakeContextCurrent(current_context ? current_context->ctx : NULL);
+    }
+    checking_context = current_context;
+}
+
+// State snapshots. When capture starts, the tracefile has nothing about
+//  what the app did while it was off (and a flight recorder segment can't
+//  count on the ones before it still being around), and most of our
+//  wrappers' state is stale. So we write every live device, context, buffer
+//  and source as the calls that would have made them what they are now, with
+//  no callstacks or durations, inside a trace scope. Each of these calls is
+//  followed by the state changes it would have caused, the same way a real
+//  one is: we get the current values from OpenAL, reset our copy to what
+//  playback believes at that point, and let the usual checks notice.
+//  Playback, --run, and the state views need nothing special for this.
+static void IO_SNAPSHOT_CALL(const EventEnum entryid)
+{
+    const uint64 currentns = now_ns();
+    ThreadState *ts = get_thread_state();
+
+    IO_THREAD_DEFINITION(ts);
+    record_nodrop();
+    ts->record_timestamp = currentns;
+    IO_EVENTENUM(entryid);
+    IO_UINT32(ts->thread_index);
+    IO_UINT64(currentns - ts->timestamp_base);
+    IO_UINT32(0);  // no callstack.
+    IO_UINT64(0);  // no duration or CPU time.
+}
+
+static void IO_SNAPSHOT_CALL_END(void)
+{
+    commit_record();
+}
+
+static ALenum buffer_format(const ALint channels, const ALint bits)
+{
+    if (channels == 1) {
+        return (bits == 8) ? AL_FORMAT_MONO8 : (bits == 16) ? AL_FORMAT_MONO16 : (bits == 32) ? AL_FORMAT_MONO_FLOAT32 : AL_NONE;
+    } else if (channels == 2) {
+        return (bits == 8) ? AL_FORMAT_STEREO8 : (bits == 16) ? AL_FORMAT_STEREO16 : (bits == 32) ? AL_FORMAT_STEREO_FLOAT32 : AL_NONE;
+    }
+    return AL_NONE;
+}
+
+static void snapshot_device(DeviceWrapper *device)
+{
+    const ALCenum specifier = device->iscapture ? ALC_CAPTURE_DEVICE_SPECIFIER : ALC_DEVICE_SPECIFIER;
+    const ALCchar *devname = REAL_alcGetString(device->device, specifier);
+    ALCint alci = 0;
+
+    if (device->iscapture) {
+        IO_SNAPSHOT_CALL(ALEE_alcCaptureOpenDevice);
+        IO_STRING(devname);
+        IO_UINT32(device->capture_frequency);
+        IO_ALCENUM(device->capture_format);
+        IO_ALSIZEI(device->capture_buffersize);
+    } else {
+        IO_SNAPSHOT_CALL(ALEE_alcOpenDevice);
+        IO_STRING(devname);
+    }
+    IO_PTR(device);
+    REAL_alcGetIntegerv(device->device, ALC_MAJOR_VERSION, 1, &alci);
+    IO_INT32(alci);
+    REAL_alcGetIntegerv(device->device, ALC_MINOR_VERSION, 1, &alci);
+    IO_INT32(alci);
+    IO_STRING(devname);
+    IO_STRING(REAL_alcGetString(device->device, ALC_EXTENSIONS));
+
+    // as far as playback knows, the device was just opened.
+    device->connected = ALC_TRUE;
+    device->capture_samples = 0;
+    if (device->supports_disconnect_ext) {
+        check_device_state_bool(device, ALC_CONNECTED, &device->connected);
+    }
+    IO_SNAPSHOT_CALL_END();
+
+    if (device->iscapture && device->capture_started) {
+        IO_SNAPSHOT_CALL(ALEE_alcCaptureStart);
+        IO_PTR(device);
+        check_device_state_int(device, ALC_CAPTURE_SAMPLES, &device->capture_samples);
+        IO_SNAPSHOT_CALL_END();
+    }
+}
+
+// (static_state) writes the context's strings again, for playback's first look at it.
+static void snapshot_make_context_current(ContextWrapper *ctx, const int static_state)
+{
+    IO_SNAPSHOT_CALL(ALEE_alcMakeContextCurrent);
+    IO_PTR(ctx);
+    IO_ALCBOOLEAN(ALC_TRUE);
+    if (ctx && static_state) {
+        ctx->checked_static_state = AL_FALSE;
+        check_context_static_state(ctx);
+    }
+    IO_SNAPSHOT_CALL_END();
+}
+
+static void snapshot_listener_floatv(const ALenum param, const int numfloats, const ALfloat *values, ALfloat *current)
+{
+    int i;
+    if (memcmp(values, current, sizeof (ALfloat) * numfloats) != 0) {
+        IO_SNAPSHOT_CALL(ALEE_alListenerfv);
+        IO_ENUM(param);
+        IO_PTR(values);
+        IO_UINT32((uint32) numfloats);
+        for (i = 0; i < numfloats; i++) {
+            IO_FLOAT(values[i]);
+        }
+        check_listener_state_floatv(param, numfloats, current);
+        IO_SNAPSHOT_CALL_END();
+    }
+}
+
+// (ctx) must be current_context.
+static void snapshot_context_state(ContextWrapper *ctx)
+{
+    ContextWrapper real;
+
+    filtered_call = 1;
+    check_context_state();
+    filtered_call = 0;
+    real = *ctx;
+    init_context_state(ctx);
+
+    if (real.distance_model != ctx->distance_model) {
+        IO_SNAPSHOT_CALL(ALEE_alDistanceModel);
+        IO_ENUM(real.distance_model);
+        check_context_state_enum(AL_DISTANCE_MODEL, &ctx->distance_model);
+        IO_SNAPSHOT_CALL_END();
+    }
+
+    #define SNAPSHOT_CONTEXT_FLOAT(entry, param, field) \
+        if (real.field != ctx->field) { \
+            IO_SNAPSHOT_CALL(ALEE_##entry); \
+            IO_FLOAT(real.field); \
+            check_context_state_float(param, &ctx->field); \
+            IO_SNAPSHOT_CALL_END(); \
+        }
+    SNAPSHOT_CONTEXT_FLOAT(alDopplerFactor, AL_DOPPLER_FACTOR, doppler_factor);
+    SNAPSHOT_CONTEXT_FLOAT(alDopplerVelocity, AL_DOPPLER_VELOCITY, doppler_velocity);
+    SNAPSHOT_CONTEXT_FLOAT(alSpeedOfSound, AL_SPEED_OF_SOUND, speed_of_sound);
+    #undef SNAPSHOT_CONTEXT_FLOAT
+
+    snapshot_listener_floatv(AL_POSITION, 3, real.listener_position, ctx->listener_position);
+    snapshot_listener_floatv(AL_VELOCITY, 3, real.listener_velocity, ctx->listener_velocity);
+    snapshot_listener_floatv(AL_ORIENTATION, 6, real.listener_orientation, ctx->listener_orientation);
+    snapshot_listener_floatv(AL_GAIN, 1, &real.listener_gain, &ctx->listener_gain);
+}
+
+// (device) must own current_context, since that's how buffers are found.
+static void snapshot_buffers(DeviceWrapper *device)
+{
+    ALuint *names = NULL;
+    ALsizei total = 0;
+    ALsizei i;
+    BufferWrapper *buf;
+    uint32 pos;
+
+    pos = 0;
+    while ((buf = (BufferWrapper *) handle_table_iterate(&device->wrapped_buffers, &pos)) != NULL) {
+        total++;
+    }
+
+    if (!total) {
+        return;
+    }
+
+    names = (ALuint *) malloc(sizeof (ALuint) * total);
+    if (!names) {
+        out_of_memory();
+    }
+
+    i = 0;
+    pos = 0;
+    while ((buf = (BufferWrapper *) handle_table_iterate(&device->wrapped_buffers, &pos)) != NULL) {
+        names[i++] = buf->name;
+    }
+
+    IO_SNAPSHOT_CALL(ALEE_alGenBuffers);
+    IO_ALSIZEI(total);
+    IO_PTR(names);
+    for (i = 0; i < total; i++) {
+        IO_UINT32(names[i]);
+    }
+    IO_SNAPSHOT_CALL_END();
+
+    pos = 0;
+    while ((buf = (BufferWrapper *) handle_table_iterate(&device->wrapped_buffers, &pos)) != NULL) {
+        BufferWrapper real;
+        filtered_call = 1;
+        check_buffer_state(buf, BUFPROP_ALL);
+        filtered_call = 0;
+        real = *buf;
+
+        buf->channels = 1;
+        buf->bits = 16;
+        buf->frequency = 0;
+        buf->size = 0;
+
+        // we never kept the audio itself, so this is silence of the right size.
+        IO_SNAPSHOT_CALL(ALEE_alBufferData);
+        IO_UINT32(buf->name);
+        IO_ENUM(buffer_format(real.channels, real.bits));
+        IO_ALSIZEI(real.frequency);
+        IO_PTR(NULL);
+        IO_UINT64(ALTRACE_BLOB_POLICY);
+        IO_UINT32((uint32) ALTRACE_PAYLOAD_NONE);
+        IO_UINT64((uint64) real.size);
+        check_buffer_state(buf, BUFPROP_ALL);
+        IO_SNAPSHOT_CALL_END();
+    }
+
+    free(names);
+}
+
+// (ctx) must be current_context.
+static void snapshot_source(ContextWrapper *ctx, SourceWrapper *src)
+{
+    const ALuint name = src->name;
+    SourceWrapper real;
+
+    filtered_call = 1;
+    check_source_state(src, SRCPROP_ALL);
+    filtered_call = 0;
+    real = *src;
+    reset_source_state(src);
+
+    #define SNAPSHOT_SOURCE_INT(param, field) \
+        if (real.field != src->field) { \
+            IO_SNAPSHOT_CALL(ALEE_alSourcei); \
+            IO_UINT32(name); \
+            IO_ENUM(param); \
+            IO_INT32((ALint) real.field); \
+            check_source_state(src, source_param_properties(param)); \
+            IO_SNAPSHOT_CALL_END(); \
+        }
+    #define SNAPSHOT_SOURCE_FLOAT(param, field) \
+        if (real.field != src->field) { \
+            IO_SNAPSHOT_CALL(ALEE_alSourcef); \
+            IO_UINT32(name); \
+            IO_ENUM(param); \
+            IO_FLOAT(real.field); \
+            check_source_state(src, source_param_properties(param)); \
+            IO_SNAPSHOT_CALL_END(); \
+        }
+    #define SNAPSHOT_SOURCE_FLOAT3(param, field) \
+        if (memcmp(real.field, src->field, sizeof (src->field)) != 0) { \
+            IO_SNAPSHOT_CALL(ALEE_alSource3f); \
+            IO_UINT32(name); \
+            IO_ENUM(param); \
+            IO_FLOAT(real.field[0]); \
+            IO_FLOAT(real.field[1]); \
+            IO_FLOAT(real.field[2]); \
+            check_source_state(src, source_param_properties(param)); \
+            IO_SNAPSHOT_CALL_END(); \
+        }
+
+    SNAPSHOT_SOURCE_INT(AL_SOURCE_RELATIVE, source_relative);
+    SNAPSHOT_SOURCE_INT(AL_LOOPING, looping);
+    SNAPSHOT_SOURCE_FLOAT(AL_GAIN, gain);
+    SNAPSHOT_SOURCE_FLOAT(AL_MIN_GAIN, min_gain);
+    SNAPSHOT_SOURCE_FLOAT(AL_MAX_GAIN, max_gain);
+    SNAPSHOT_SOURCE_FLOAT(AL_REFERENCE_DISTANCE, reference_distance);
+    SNAPSHOT_SOURCE_FLOAT(AL_ROLLOFF_FACTOR, rolloff_factor);
+    SNAPSHOT_SOURCE_FLOAT(AL_MAX_DISTANCE, max_distance);
+    SNAPSHOT_SOURCE_FLOAT(AL_PITCH, pitch);
+    SNAPSHOT_SOURCE_FLOAT(AL_CONE_INNER_ANGLE, cone_inner_angle);
+    SNAPSHOT_SOURCE_FLOAT(AL_CONE_OUTER_ANGLE, cone_outer_angle);
+    SNAPSHOT_SOURCE_FLOAT(AL_CONE_OUTER_GAIN, cone_outer_gain);
+    SNAPSHOT_SOURCE_FLOAT3(AL_POSITION, position);
+    SNAPSHOT_SOURCE_FLOAT3(AL_VELOCITY, velocity);
+    SNAPSHOT_SOURCE_FLOAT3(AL_DIRECTION, direction);
+
+    // !!! FIXME: OpenAL can't tell us what's in a source's buffer queue, so
+    // !!! FIXME:  streaming sources come back empty; the state changes
+    // !!! FIXME:  below still show how many buffers it had.
+    if (real.type == AL_STATIC) {
+        SNAPSHOT_SOURCE_INT(AL_BUFFER, buffer);
+    }
+
+    if (real.state != AL_INITIAL) {
+        IO_SNAPSHOT_CALL(ALEE_alSourcePlay);
+        IO_UINT32(name);
+        IO_SNAPSHOT_CALL_END();
+        if (real.state == AL_PAUSED) {
+            IO_SNAPSHOT_CALL(ALEE_alSourcePause);
+            IO_UINT32(name);
+            IO_SNAPSHOT_CALL_END();
+        } else if (real.state == AL_STOPPED) {
+            IO_SNAPSHOT_CALL(ALEE_alSourceStop);
+            IO_UINT32(name);
+            IO_SNAPSHOT_CALL_END();
+        } else if (real.sample_offset) {
+            SNAPSHOT_SOURCE_INT(AL_SAMPLE_OFFSET, sample_offset);
+        }
+    }
+
+    #undef SNAPSHOT_SOURCE_INT
+    #undef SNAPSHOT_SOURCE_FLOAT
+    #undef SNAPSHOT_SOURCE_FLOAT3
+
+    // whatever the calls above couldn't reproduce.
+    check_source_state(src, SRCPROP_ALL);
+    commit_record();
+
+    if (src->state == AL_PLAYING) {
+        add_source_to_playlist(name);
+    }
+}
+
+// (ctx) must be current_context.
+static void snapshot_sources(ContextWrapper *ctx)
+{
+    ALuint *names = NULL;
+    ALsizei total = 0;
+    ALsizei i;
+    SourceWrapper *src;
+    uint32 pos;
+
+    // the poller didn't look at anything while capture was off.
+    while (ctx->playlist) {
+        src = ctx->playlist;
+        ctx->playlist = src->playlist_next;
+        src->playlist_prev = src->playlist_next = NULL;
+    }
+
+    pos = 0;
+    while ((src = (SourceWrapper *) handle_table_iterate(&ctx->wrapped_sources, &pos)) != NULL) {
+        total++;
+    }
+
+    if (!total) {
+        return;
+    }
+
+    names = (ALuint *) malloc(sizeof (ALuint) * total);
+    if (!names) {
+        out_of_memory();
+    }
+
+    i = 0;
+    pos = 0;
+    while ((src = (SourceWrapper *) handle_table_iterate(&ctx->wrapped_sources, &pos)) != NULL) {
+        names[i++] = src->name;
+    }
+
+    IO_SNAPSHOT_CALL(ALEE_alGenSources);
+    IO_ALSIZEI(total);
+    IO_PTR(names);
+    for (i = 0; i < total; i++) {
+        IO_UINT32(names[i]);
+    }
+    IO_SNAPSHOT_CALL_END();
+
+    pos = 0;
+    while ((src = (SourceWrapper *) handle_table_iterate(&ctx->wrapped_sources, &pos)) != NULL) {
+        snapshot_source(ctx, src);
+    }
+
+    free(names);
+}
+
+// Only called with the API lock held, between calls.
+static void write_state_snapshot(const char *scope)
+{
+    ContextWrapper *app_context = current_context;
+    DeviceWrapper *device;
+
+    // errors from calls that went straight through belong to the app.
+    filtered_call = 1;
+    check_al_error_events();
+    filtered_call = 0;
+
+    IO_SNAPSHOT_CALL(ALEE_alTracePushScope);
+    IO_STRING(scope);
+    IO_SNAPSHOT_CALL_END();
+
+    checking_context = current_context;
+
+    for (device = null_device.next; device != NULL; device = device->next) {
+        ContextWrapper *ctx;
+
+        snapshot_device(device);
+
+        // !!! FIXME: we don't keep the attributes contexts were created with.
+        for (ctx = device->contexts; ctx != NULL; ctx = ctx->next) {
+            IO_SNAPSHOT_CALL(ALEE_alcCreateContext);
+            IO_PTR(device);
+            IO_PTR(NULL);
+            IO_UINT32(0);
+            IO_PTR(ctx);
+            IO_SNAPSHOT_CALL_END();
+        }
+
+        for (ctx = device->contexts; ctx != NULL; ctx = ctx->next) {
+            make_context_current_for_checks(ctx);
+            current_context = ctx;
+            snapshot_make_context_current(ctx, 1);
+            if (ctx == device->contexts) {
+                snapshot_buffers(device);  // buffers belong to the device, any context will do.
+            }
+            snapshot_context_state(ctx);
+            snapshot_sources(ctx);
+            REAL_alGetError();  // don't leave errors we caused for the app to find.
+        }
+    }
+
+    current_context = app_context;
+    restore_current_context();
+    snapshot_make_context_current(app_context, 0);
+
+    IO_SNAPSHOT_CALL(ALEE_alTracePopScope);
+    IO_SNAPSHOT_CALL_END();
+}
 
 /* this call checks for state changes that can happen outside of an entry
    point: sources that are playing change state in the mixer, devices can
-   disconnect, captured samples accumulate, etc. */
-static void check_al_async_states(void)
+   disconnect, captured samples accumulate, etc. Events go under an
+   ALEE_STATE_POLL marker for their context, so playback knows when they
+   happened; markers that nothing follows get taken back out. */
+static void poll_al_async_states(const int timestamped)
 {
+    ThreadState *ts = get_thread_state();
+    const uint64 ticks = now_ns();
     DeviceWrapper *device;
+    size_t marker;  // where the last ALEE_STATE_POLL marker ends.
+
+    checking_context = current_context;
+
     for (device = null_device.next; device != NULL; device = device->next) {
+        const size_t devicemarker = ts->record_len;
+        if (timestamped) {
+            IO_EVENTENUM(ALEE_STATE_POLL);
+            IO_UINT64(ticks);
+            IO_PTR(NULL);
+        }
+        marker = ts->record_len;
+
         if (device->supports_disconnect_ext) {
             check_device_state_bool(device, ALC_CONNECTED, &device->connected);
         }
@@ -2730,31 +7862,143 @@ static void check_al_async_states(void)
         if (device->iscapture) {
             check_device_state_int(device, ALC_CAPTURE_SAMPLES, &device->capture_samples);
         } else {
-            #pragma warning FIXME have to make these contexts current
             ContextWrapper *ctx;
+            if (timestamped && (ts->record_len == marker)) {
+                ts->record_len = devicemarker;
+            }
+
             for (ctx = device->contexts; ctx != NULL; ctx = ctx->next) {
-                SourceWrapper *src;
-                SourceWrapper *next;
-                for (src = ctx->playlist; src != NULL; src = next) {
-                    next = src->playlist_next;
-                    check_source_state(src);
-                    if (src->state != AL_PLAYING) {
-                        /* source has stopped for whatever reason, take it out of the playlist. */
-                        if (next) {
-                            next->playlist_prev = src->playlist_prev;
-                        }
-                        if (src->playlist_prev) {
-                            src->playlist_prev->playlist_next = next;
-                        } else {
-                            ctx->playlist = next;
-                        }
-                        src->playlist_prev = NULL;
-                        src->playlist_next = NULL;
-                    }
+                if (!ctx->playlist) {
+                    continue;
+                }
+                const size_t ctxmarker = ts->record_len;
+                if (timestamped) {
+                    IO_EVENTENUM(ALEE_STATE_POLL);
+                    IO_UINT64(ticks);
+                    IO_PTR(ctx);
+                }
+                marker = ts->record_len;
+                check_context_sources(ctx);
+                if (timestamped && (ts->record_len == marker)) {
+                    ts->record_len = ctxmarker;
                 }
             }
+            continue;
+        }
+
+        if (timestamped && (ts->record_len == marker)) {
+            ts->record_len = devicemarker;
+        }
+    }
+
+    restore_current_context();
+}
+
+static void check_al_async_states(void)
+{
+    if (!poller_thread_running && capturing) {
+        poll_al_async_states(0);
+    }
+}
+
+static void *poller_thread_main(void *arg)
+{
+    const long interval_ns = 1000000000L / poll_hz;
+
+    while (!__atomic_load_n(&poller_thread_quit, __ATOMIC_ACQUIRE)) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += interval_ns;
+        while (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+
+        pthread_mutex_lock(&poller_lock);
+        if (!__atomic_load_n(&poller_thread_quit, __ATOMIC_ACQUIRE) && !__atomic_load_n(&poller_wake_pending, __ATOMIC_ACQUIRE)) {
+            pthread_cond_timedwait(&poller_cond, &poller_lock, &ts);
+        }
+        pthread_mutex_unlock(&poller_lock);
+
+        if (__atomic_load_n(&poller_thread_quit, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        // the overhead summary lists the poller's work as ALEE_STATE_POLL.
+        get_thread_state()->call_entry = ALEE_STATE_POLL;
+        OVERHEAD_CALL_START();
+        OVERHEAD_TIMED(ALTRACE_OVERHEAD_LOCK_WAIT, APILOCK());
+        if (__atomic_load_n(&capture_request, __ATOMIC_RELAXED) != CAPTURE_REQUEST_NONE) {
+            process_capture_request();
         }
+        if (capturing) {
+            OVERHEAD_TIMED(ALTRACE_OVERHEAD_POLL, poll_al_async_states(1));
+        }
+        OVERHEAD_TIMED(ALTRACE_OVERHEAD_IO, commit_record());
+        if (!async_writer && output) {
+            compress_flush_if_stale();  // the writer thread does this otherwise.
+        }
+        if (segmented_output) {
+            __atomic_store_n(&poller_wake_pending, 0, __ATOMIC_RELEASE);
+            process_segment_requests();
+        }
+        APIUNLOCK();
+        OVERHEAD_CALL_END();
+    }
+
+    return NULL;
+}
+
+static int start_poller_thread(void)
+{
+    int rc;
+
+    if (poll_hz <= 0) {
+        return 1;  // check after every call instead.
+    }
+
+    if (REAL_alcIsExtensionPresent(NULL, "ALC_EXT_thread_local_context")) {
+        set_thread_context = (ALCboolean (*)(ALCcontext *)) REAL_alcGetProcAddress(NULL, "alcSetThreadContext");
+    }
+
+    pthread_mutex_init(&poller_lock, NULL);
+    pthread_cond_init(&poller_cond, NULL);
+    rc = pthread_create(&poller_thread, NULL, poller_thread_main, NULL);
+    if (rc != 0) {
+        fprintf(stderr, "%s: Failed to create state poller thread: %s\n", GAppName, strerror(rc));
+        return 0;
+    }
+    poller_thread_running = 1;
+    return 1;
+}
+
+static void stop_poller_thread(void)
+{
+    if (!poller_thread_running) {
+        return;
+    }
+
+    __atomic_store_n(&poller_thread_quit, 1, __ATOMIC_RELEASE);
+
+    if (pthread_equal(pthread_self(), poller_thread)) {
+        return;  // poller thread itself failed.
+    }
+
+    pthread_mutex_lock(&poller_lock);
+    pthread_cond_signal(&poller_cond);
+    pthread_mutex_unlock(&poller_lock);
+    pthread_join(poller_thread, NULL);
+    poller_thread_running = 0;
+
+    // the poller might not have gotten to a dump asked for right before exit.
+    if (flight_recorder && __atomic_load_n(&flight_dump_request, __ATOMIC_ACQUIRE)) {
+        APILOCK();
+        process_segment_requests();
+        APIUNLOCK();
     }
+
+    pthread_cond_destroy(&poller_cond);
+    pthread_mutex_destroy(&poller_lock);
 }
 
 // end of altrace_record.c ...
@@ -45,6 +45,17 @@ static const char *cache_string(const char *str)
     return str ? stringcache(appstringcache, str) : NULL;
 }
 
+// sprintf_alloc(), litString(), etc, hand out scratch memory that
+//  process_tracelog() takes back after every event. UI code that uses them
+//  outside of that calls this first, so that memory doesn't grow forever.
+static bool decoding_tracelog = false;
+static void reset_ui_scratch_memory(void)
+{
+    if (!decoding_tracelog) {
+        reset_ioblobs();
+    }
+}
+
 
 static const wxString oom_msg(wxT("Out of memory!"));
 static const wxString oom_title(wxT("Fatal error!"));
@@ -237,6 +248,7 @@ struct ApiCallInfo
         , callstack(new CallstackFrame[num_callstack_frames])
         , threadid(callerinfo->threadid)
         , timestamp(callerinfo->wait_until)
+        , duration(callerinfo->duration)
         , state(NULL)
         , generated_al_error(AL_FALSE)
         , generated_alc_error(AL_FALSE)
@@ -274,6 +286,7 @@ struct ApiCallInfo
     const CallstackFrame *callstack;
     const uint32 threadid;
     const uint32 timestamp;
+    const uint64 duration;
     StateTrie *state;
     ALboolean generated_al_error;
     ALboolean generated_alc_error;
@@ -946,6 +959,7 @@ public:
 
     uint32 getLatestCallTime() const { return latestCallTime; }
     uint32 getLargestThreadNum() const { return largestThreadNum; }
+    void findSlowCalls();
 
     virtual int GetNumberRows() { return numrows; }
     virtual int GetNumberCols() { return 3; }
@@ -953,39 +967,42 @@ public:
     virtual void SetValue(int row, int col, const wxString &value) { assert(!"Shouldn't call this"); }
 
     virtual bool CanGetValueAs(int row, int col, const wxString &typeName) {
-        return typeName == ((col == 2) ? wxGRID_VALUE_STRING : wxGRID_VALUE_NUMBER);
+        return typeName == ((col != 0) ? wxGRID_VALUE_STRING : wxGRID_VALUE_NUMBER);
     }
 
     virtual wxString GetTypeName(int row, int col) {
-        return (col == 2) ? wxGRID_VALUE_STRING : wxGRID_VALUE_NUMBER;
+        return (col != 0) ? wxGRID_VALUE_STRING : wxGRID_VALUE_NUMBER;
     }
 
     virtual long GetValueAsLong(int row, int col) {
-        assert(col >= 0);
-        assert(col < 2);
+        assert(col == 0);
         assert(row >= 0);
         assert(row < numrows);
         const ApiCallInfo *info = infoarray[row];
-        if (col == 0) {
-            return (long) info->threadid;
-        } else if (col == 1) {
-            return (long) info->timestamp;
-        }
-        return 0;
+        return (long) info->threadid;
     }
 
     virtual wxString GetValue(int row, int col) {
-        assert(col == 2);
+        assert(col >= 1);
+        assert(col < 3);
+        reset_ui_scratch_memory();
         assert(row >= 0);
         assert(row < numrows);
         const ApiCallInfo *info = infoarray[row];
+        if (col == 1) {
+            return timeString(info->timestamp, info->duration);
+        }
         return info->callstr;
     }
 
+    static wxString timeString(const uint32 timestamp, const uint64 duration) {
+        return wxString::Format(wxT("%u (%s)"), (uint) timestamp, durationString(duration));
+    }
+
     virtual wxString GetColLabelValue(int col) {
         switch (col) {
             case 0: return wxT("thread");
-            case 1: return wxT("time");
+            case 1: return wxT("time (took)");
             case 2: return wxT("call");
             default: break;
         }
@@ -1000,6 +1017,7 @@ private:
     int numrows;
     uint32 latestCallTime;
     uint32 largestThreadNum;
+    uint64 slowCallThreshold;  // calls that took at least this long get highlighted.
 
     // !!! FIXME: don't name these with explicit colors.
     wxGridCellAttr *attrEvenRed;
@@ -1008,6 +1026,8 @@ private:
     wxGridCellAttr *attrOddBlack;
     wxGridCellAttr *attrEvenDarkRed;
     wxGridCellAttr *attrOddDarkRed;
+    wxGridCellAttr *attrEvenSlow;
+    wxGridCellAttr *attrOddSlow;
 
     void generateCellAttributes();
     void decrefCellAttributes();
@@ -1018,6 +1038,7 @@ ALTraceGridTable::ALTraceGridTable()
     , numrows(0)
     , latestCallTime(0)
     , largestThreadNum(0)
+    , slowCallThreshold(0)
 {
     generateCellAttributes();
 }
@@ -1042,6 +1063,8 @@ void ALTraceGridTable::decrefCellAttributes()
     attrOddBlack->DecRef();
     attrEvenDarkRed->DecRef();
     attrOddDarkRed->DecRef();
+    attrEvenSlow->DecRef();
+    attrOddSlow->DecRef();
 }
 
 void ALTraceGridTable::generateCellAttributes()
@@ -1084,6 +1107,12 @@ void ALTraceGridTable::generateCellAttributes()
     attrOddBlack = oddattr->Clone();
     attrOddBlack->SetTextColour(textcolor);
 
+    // !!! FIXME: these backgrounds are probably awful in dark mode.
+    attrEvenSlow = attrEvenBlack->Clone();
+    attrEvenSlow->SetBackgroundColour(wxColour(255, 236, 200));
+    attrOddSlow = attrOddBlack->Clone();
+    attrOddSlow->SetBackgroundColour(wxColour(250, 228, 188));
+
     oddattr->DecRef();
     evenattr->DecRef();
 }
@@ -1099,11 +1128,14 @@ wxGridCellAttr *ALTraceGridTable::GetAttr(int row, int col, wxGridCellAttr::wxAt
     assert(row < numrows);
     const ApiCallInfo *info = infoarray[row];
     wxGridCellAttr *attr = NULL;
+    const bool slow = (slowCallThreshold > 0) && (info->duration >= slowCallThreshold);
     if (row & 0x1) {  // odd
         if (info->reported_failure)  {
             attr = attrOddRed;
         } else if (info->inefficient_state_change) {
             attr = attrOddDarkRed;
+        } else if (slow) {
+            attr = attrOddSlow;
         } else {
             attr = attrOddBlack;
         }
@@ -1112,6 +1144,8 @@ wxGridCellAttr *ALTraceGridTable::GetAttr(int row, int col, wxGridCellAttr::wxAt
             attr = attrEvenRed;
         } else if (info->inefficient_state_change) {
             attr = attrEvenDarkRed;
+        } else if (slow) {
+            attr = attrEvenSlow;
         } else {
             attr = attrEvenBlack;
         }
@@ -1120,6 +1154,36 @@ wxGridCellAttr *ALTraceGridTable::GetAttr(int row, int col, wxGridCellAttr::wxAt
     return attr;
 }
 
+static int cmp_durations(const void *_a, const void *_b)
+{
+    const uint64 a = *((const uint64 *) _a);
+    const uint64 b = *((const uint64 *) _b);
+    return (a < b) ? -1 : ((a > b) ? 1 : 0);
+}
+
+// Highlight the slowest 1% of calls, as long as they took at least
+//  SLOW_CALL_MIN_NS; in a trace where everything is fast, nothing stands out.
+#define SLOW_CALL_MIN_NS (1000 * 1000)
+void ALTraceGridTable::findSlowCalls()
+{
+    slowCallThreshold = 0;
+    if (numrows == 0) {
+        return;
+    }
+
+    uint64 *durations = new uint64[numrows];
+    for (int i = 0; i < numrows; i++) {
+        durations[i] = infoarray[i]->duration;
+    }
+    qsort(durations, numrows, sizeof (uint64), cmp_durations);
+    slowCallThreshold = durations[(numrows * 99) / 100];
+    delete[] durations;
+
+    if (slowCallThreshold < SLOW_CALL_MIN_NS) {
+        slowCallThreshold = SLOW_CALL_MIN_NS;
+    }
+}
+
 void ALTraceGridTable::onSysColourChanged(wxSysColourChangedEvent& event)
 {
     decrefCellAttributes();
@@ -1495,6 +1559,7 @@ static wxString htmlizeArgument(const ApiCallInfo *info, const ApiArgInfo *arg)
 
 void ALTraceCallInfoPage::updateCallInfoPage(const ApiCallInfo *info)
 {
+    reset_ui_scratch_memory();
     wxString html(wxString::Format(wxT("<html><body bgcolor='%s'><font color='%s'>"), getHtmlBackgroundColor(), getHtmlForegroundColor()));
     html << wxT("<p><h1>Function call</h1></p><p>\n");
     html << wxT("<font bgcolor='#000000' size='+1'><table width='100%' bgcolor='#000000'><tr><td colspan='2'>");
@@ -1592,6 +1657,7 @@ void ALTraceCallInfoPage::updateCallInfoPage(const ApiCallInfo *info)
 
 void ALTraceDeviceInfoPage::updateItemListImpl()
 {
+    reset_ui_scratch_memory();
     const StateTrie *trie = apiinfo->state;
     const uint64 *val = trie->getGlobalState("numdevices");
     const uint64 numdevs = val ? *val : 0;
@@ -1628,6 +1694,7 @@ void ALTraceDeviceInfoPage::updateItemListImpl()
 
 void ALTraceDeviceInfoPage::updateDetails(const wxUIntPtr data)
 {
+    reset_ui_scratch_memory();
     const StateTrie *trie = apiinfo->state;
     ALCdevice *dev = (ALCdevice *) data;
     const uint64 *val;
@@ -1745,6 +1812,34 @@ void ALTraceDeviceInfoPage::updateDetails(const wxUIntPtr data)
             // !!! FIXME: check current_player_id here and don't do file i/o if already matching.
             val = trie->getDeviceState(dev, "numcaptures");
             const uint64 numcaptures = val ? *val : 0;
+            uint32 downsample = 0;
+            if (numcaptures) {
+                // every capture in a session shares a policy, so report the
+                //  latest one's, with the sizes totalled over all of them.
+                const uint ilast = (uint) (numcaptures - 1);
+                uint64 totalsize = 0;
+                uint64 totalstored = 0;
+                for (uint64 i = 0; i < numcaptures; i++) {
+                    snprintf(buf, sizeof (buf), "capturesize/%u", (uint) i);
+                    val = trie->getDeviceState(dev, buf);
+                    totalsize += val ? *val : 0;
+                    snprintf(buf, sizeof (buf), "capturedatalen/%u", (uint) i);
+                    val = trie->getDeviceState(dev, buf);
+                    totalstored += val ? *val : 0;
+                }
+                snprintf(buf, sizeof (buf), "capturepolicy/%u", ilast);
+                val = trie->getDeviceState(dev, buf);
+                const int capturepolicy = val ? (int) *val : ALTRACE_PAYLOAD_FULL;
+                snprintf(buf, sizeof (buf), "capturedownsample/%u", ilast);
+                val = trie->getDeviceState(dev, buf);
+                downsample = (val && (capturepolicy == ALTRACE_PAYLOAD_DOWNSAMPLE)) ? (uint32) *val : 0;
+                snprintf(buf, sizeof (buf), "capturehash/%u", ilast);
+                val = trie->getDeviceState(dev, buf);
+                html << wxT("<li><strong>Capture data recorded</strong>: ");
+                html << payloadString(capturepolicy, totalsize, totalstored, val ? *val : 0, downsample);
+                html << wxT("</li>");
+            }
+
             if (!numcaptures) {
                 frame->clearAudio();
             } else {
@@ -1757,36 +1852,30 @@ void ALTraceDeviceInfoPage::updateDetails(const wxUIntPtr data)
                 uint8 *pcm = new uint8[bufferlen];
                 uint8 *pcmptr = pcm;
                 const wxCharBuffer utf8path = frame->getTracefilePath().ToUTF8();
-                FILE *f = fopen(utf8path.data(), "rb");  // !!! FIXME: don't use fopen.
                 uint64 pcmoffset = 0;
                 bool okay = false;
-                if (f) {
-                    for (uint64 i = 0; i < numcaptures; i++) {
-                        okay = false;
-                        snprintf(buf, sizeof (buf), "capturedatalen/%u", (uint) i);
+                for (uint64 i = 0; i < numcaptures; i++) {
+                    okay = false;
+                    snprintf(buf, sizeof (buf), "capturedatalen/%u", (uint) i);
+                    val = trie->getDeviceState(dev, buf);
+                    const uint64 len = val ? *val : 0;
+                    if (len) {
+                        snprintf(buf, sizeof (buf), "capturedata/%u", (uint) i);
                         val = trie->getDeviceState(dev, buf);
-                        const uint64 len = val ? *val : 0;
-                        if (len) {
-                            snprintf(buf, sizeof (buf), "capturedata/%u", (uint) i);
-                            val = trie->getDeviceState(dev, buf);
-                            pcmoffset = val ? *val : 0;
-                            if (fseek(f, (long) pcmoffset, SEEK_SET) != -1) {
-                                if (fread(pcmptr, len, 1, f) == 1) {
-                                    pcmptr += len;
-                                    okay = true;
-                                }
-                            }
-                            if (!okay) {
-                                break;
-                            }
+                        pcmoffset = val ? *val : 0;
+                        if (read_tracelog_data(utf8path.data(), (off_t) pcmoffset, pcmptr, (size_t) len)) {
+                            pcmptr += len;
+                            okay = true;
+                        }
+                        if (!okay) {
+                            break;
                         }
                     }
-                    fclose(f);
                 }
                 if (!okay) {
                     frame->clearAudio();
                 } else {
-                    frame->setAudio(pcmoffset, alfmt, pcm, bufferlen, pcmfreq);
+                    frame->setAudio(pcmoffset, alfmt, pcm, bufferlen, (unsigned int) (downsample ? (pcmfreq / downsample) : pcmfreq));
                 }
                 delete[] pcm;
             }
@@ -1849,6 +1938,7 @@ void ALTraceDeviceInfoPage::updateDetails(const wxUIntPtr data)
 
 void ALTraceContextInfoPage::updateItemListImpl()
 {
+    reset_ui_scratch_memory();
     const StateTrie *trie = apiinfo->state;
     ALCcontext *current = trie->getCurrentContext();
     const uint64 *val = trie->getGlobalState("numdevices");
@@ -1889,6 +1979,7 @@ void ALTraceContextInfoPage::updateItemListImpl()
 
 void ALTraceContextInfoPage::updateDetails(const wxUIntPtr data)
 {
+    reset_ui_scratch_memory();
     const StateTrie *trie = apiinfo->state;
     ALCcontext *ctx = (ALCcontext *) data;
     union { uint64 ui64; float f; } cvt;
@@ -2118,6 +2209,7 @@ void ALTraceContextInfoPage::updateDetails(const wxUIntPtr data)
 
 void ALTraceSourceInfoPage::updateItemListImpl()
 {
+    reset_ui_scratch_memory();
     const StateTrie *trie = apiinfo->state;
     const uint64 *val = trie->getGlobalState("numdevices");
     const uint64 numdevs = val ? *val : 0;
@@ -2191,6 +2283,7 @@ void ALTraceSourceInfoPage::updateItemListImpl()
 
 void ALTraceSourceInfoPage::updateDetails(const wxUIntPtr data)
 {
+    reset_ui_scratch_memory();
     const StateTrie *trie = apiinfo->state;
     const uint32 devidx = (uint32) ((data >> 48) & 0xFFFF);
     const uint32 ctxidx = (uint32) ((data >> 32) & 0xFFFF);
@@ -2424,6 +2517,7 @@ void ALTraceSourceInfoPage::updateDetails(const wxUIntPtr data)
 
 void ALTraceBufferInfoPage::updateItemListImpl()
 {
+    reset_ui_scratch_memory();
     const StateTrie *trie = apiinfo->state;
     const uint64 *val = trie->getGlobalState("numdevices");
     const uint64 numdevs = val ? *val : 0;
@@ -2487,6 +2581,7 @@ void ALTraceBufferInfoPage::clearDetails()
 
 void ALTraceBufferInfoPage::updateDetails(const wxUIntPtr data)
 {
+    reset_ui_scratch_memory();
     const StateTrie *trie = apiinfo->state;
     const uint32 devidx = (uint32) (data >> 32);
     const uint32 name = (uint32) (data & 0xFFFFFFFF);
@@ -2566,6 +2661,20 @@ void ALTraceBufferInfoPage::updateDetails(const wxUIntPtr data)
         const size_t pcmlen = (const size_t) (val ? *val : 0);
         val = trie->getBufferState(dev, name, "data");
         const uint64 pcmoffset = val ? *val : 0;
+        val = trie->getBufferState(dev, name, "datapolicy");
+        const int datapolicy = val ? (int) *val : ALTRACE_PAYLOAD_FULL;
+        val = trie->getBufferState(dev, name, "datadownsample");
+        const uint32 downsample = val ? (uint32) *val : 0;
+
+        if (datapolicy != ALTRACE_PAYLOAD_FULL) {
+            val = trie->getBufferState(dev, name, "datasize");
+            const uint64 datasize = val ? *val : 0;
+            val = trie->getBufferState(dev, name, "datahash");
+            html << wxT("<li><strong>Data recorded</strong>: ");
+            html << payloadString(datapolicy, datasize, (uint64) pcmlen, val ? *val : 0, downsample);
+            html << wxT("</li>");
+        }
+
         if (frame->getCurrentPlayerId() != pcmoffset) {  // only read from disk if this is different.
             uint8 *pcm = NULL;
             bool okay = false;
@@ -2574,18 +2683,12 @@ void ALTraceBufferInfoPage::updateDetails(const wxUIntPtr data)
             }
             if (pcm) {
                 const wxCharBuffer utf8path = frame->getTracefilePath().ToUTF8();
-                FILE *f = fopen(utf8path.data(), "rb");  // !!! FIXME: don't use fopen.
-                if (f) {
-                    if (fseek(f, (long) pcmoffset, SEEK_SET) != -1) {
-                        if (fread(pcm, pcmlen, 1, f) == 1) {
-                            okay = true;
-                        }
-                    }
-                    fclose(f);
-                }
+                okay = read_tracelog_data(utf8path.data(), (off_t) pcmoffset, pcm, pcmlen) != 0;
 
                 if (okay) {
-                    frame->setAudio(pcmoffset, alfmt, pcm, pcmlen, pcmfreq);
+                    // a downsampled buffer plays at the rate it was kept at; a preview is just shorter.
+                    const uint64 freq = ((datapolicy == ALTRACE_PAYLOAD_DOWNSAMPLE) && downsample) ? (pcmfreq / downsample) : pcmfreq;
+                    frame->setAudio(pcmoffset, alfmt, pcm, pcmlen, (unsigned int) freq);
                 }
 
                 delete[] pcm;
@@ -3308,10 +3411,20 @@ static void make_state_alcCaptureSamples(CallerInfo *callerinfo, ALCdevice *devi
             char buf[64];
             val = trie->getDeviceState(device, "numcaptures");
             const uint64 numcaptures = val ? *val : 0;
+            const bool full = (callerinfo->payload_policy == ALTRACE_PAYLOAD_FULL);
+            // capturedatalen is what's actually in the tracefile at capturedata.
             snprintf(buf, sizeof (buf), "capturedatalen/%u", (uint) numcaptures);
-            trie->addDeviceStateRevision(device, buf, (uint64) bufferlen);
+            trie->addDeviceStateRevision(device, buf, (uint64) (full ? bufferlen : callerinfo->payload_stored_len));
             snprintf(buf, sizeof (buf), "capturedata/%u", (uint) numcaptures);
-            trie->addDeviceStateRevision(device, buf, (uint64) (callerinfo->fdoffset + 32));
+            trie->addDeviceStateRevision(device, buf, (uint64) callerinfo->bloboffset);
+            snprintf(buf, sizeof (buf), "capturepolicy/%u", (uint) numcaptures);
+            trie->addDeviceStateRevision(device, buf, (uint64) callerinfo->payload_policy);
+            snprintf(buf, sizeof (buf), "capturedownsample/%u", (uint) numcaptures);
+            trie->addDeviceStateRevision(device, buf, (uint64) callerinfo->payload_downsample);
+            snprintf(buf, sizeof (buf), "capturehash/%u", (uint) numcaptures);
+            trie->addDeviceStateRevision(device, buf, callerinfo->payload_hash);
+            snprintf(buf, sizeof (buf), "capturesize/%u", (uint) numcaptures);
+            trie->addDeviceStateRevision(device, buf, (uint64) bufferlen);
             trie->addDeviceStateRevision(device, "numcaptures", numcaptures + 1);
         }
     } else {
@@ -3998,8 +4111,14 @@ static void make_state_alBufferData(CallerInfo *callerinfo, ALuint name, ALenum
         ALCcontext *ctx = trie->getCurrentContext(&dev);
         if (ctx && dev) {
             trie->addBufferStateRevision(dev, name, "format", (uint64) alfmt);
-            trie->addBufferStateRevision(dev, name, "data", (uint64) (origdata ? (callerinfo->fdoffset + 32) : 0));
-            trie->addBufferStateRevision(dev, name, "datalen", (uint64) (origdata ? size : 0));
+            const bool full = (callerinfo->payload_policy == ALTRACE_PAYLOAD_FULL);
+            // datalen is what's actually in the tracefile at data; datasize is what the app handed us.
+            trie->addBufferStateRevision(dev, name, "data", (uint64) (origdata ? callerinfo->bloboffset : 0));
+            trie->addBufferStateRevision(dev, name, "datalen", (uint64) (!origdata ? 0 : full ? size : callerinfo->payload_stored_len));
+            trie->addBufferStateRevision(dev, name, "datasize", (uint64) size);
+            trie->addBufferStateRevision(dev, name, "datapolicy", (uint64) callerinfo->payload_policy);
+            trie->addBufferStateRevision(dev, name, "datahash", callerinfo->payload_hash);
+            trie->addBufferStateRevision(dev, name, "datadownsample", (uint64) callerinfo->payload_downsample);
         }
     }
 }
@@ -4395,6 +4514,38 @@ void visit_buffer_state_changed_int(void *userdata, const ALuint name, const ALe
     }
 }
 
+// !!! FIXME: the source state changes after this belong to (ctx), but we
+// !!! FIXME:  still file them under whatever context is current.
+void visit_state_poll(void *userdata, ALCcontext *ctx, const uint32 wait_until)
+{
+}
+
+// the snapshot calls the recorder writes after a start keep the state trie
+//  right, so there's nothing to do with these yet.
+void visit_capture_started(void *userdata, const uint32 wait_until, const char *reason)
+{
+    // !!! FIXME: mark the gaps in the call list.
+}
+
+void visit_capture_stopped(void *userdata, const uint32 wait_until, const char *reason)
+{
+}
+
+void visit_overhead_summary(void *userdata, const uint32 numentries, const OverheadSummary *entries)
+{
+    // !!! FIXME: show this somewhere. altrace_cli prints it for now.
+}
+
+void visit_latency_histograms(void *userdata, const uint32 numentries, const LatencyHistogram *entries)
+{
+    // !!! FIXME: show this somewhere. altrace_cli prints it for now.
+}
+
+void visit_contention_summary(void *userdata, const ContentionSummary *summary)
+{
+    // !!! FIXME: show this somewhere. altrace_cli prints it for now.
+}
+
 void visit_eos(void *userdata, const ALboolean okay, const uint32 wait_until)
 {
     VisitArgs *visitargs = ((VisitArgs *) userdata);
@@ -4440,7 +4591,9 @@ bool ALTraceFrame::openFile(const wxString &path)
     const wxCharBuffer utf8path = path.ToUTF8();
 
     ALTraceGridUpdateLocker gridlock(apiCallGrid);
+    decoding_tracelog = true;
     int rc = process_tracelog(utf8path.data(), &args);
+    decoding_tracelog = false;
 
     delete progressdlg;
 
@@ -4455,6 +4608,7 @@ bool ALTraceFrame::openFile(const wxString &path)
     }
 
     // success!
+    apiCallGridTable->findSlowCalls();
     apiCallGrid->SetTable(apiCallGridTable, false, wxGrid::wxGridSelectRows);
 
     // AutoSizeColumns() is slowish on large datasets because it has to
@@ -4468,8 +4622,7 @@ bool ALTraceFrame::openFile(const wxString &path)
 
     // For numeric fields, just give yourself room for one digit
     //  more than its biggest number, and use the bigger between that and the
-    //  label width. Pad it out by 10 pixels to be safe. Make both the numeric
-    //  columns the same size.
+    //  label width. Pad it out by 10 pixels to be safe.
     int w, finalsize = 0;
     wxString str;
 
@@ -4477,19 +4630,19 @@ bool ALTraceFrame::openFile(const wxString &path)
     w = dc.GetTextExtent(str).x;
     if (finalsize < w) finalsize = w;
 
-    str = wxString::Format(wxT("%u"), (uint) (apiCallGridTable->getLatestCallTime() * 10));
-    w = dc.GetTextExtent(str).x;
-    if (finalsize < w) finalsize = w;
-
     w = apiCallGrid->GetColSize(0);
     if (finalsize < w) finalsize = w;
 
-    w = apiCallGrid->GetColSize(1);
-    if (finalsize < w) finalsize = w;
-
     finalsize += 10;
 
     apiCallGrid->SetColSize(0, finalsize);
+
+    // the time column also has the call's duration, which is never wider than this.
+    str = ALTraceGridTable::timeString(apiCallGridTable->getLatestCallTime() * 10, 999999);
+    finalsize = dc.GetTextExtent(str).x;
+    w = apiCallGrid->GetColSize(1);
+    if (finalsize < w) finalsize = w;
+    finalsize += 10;
     apiCallGrid->SetColSize(1, finalsize);
 
     // Just calculate the extent of the longest string (which usually works out